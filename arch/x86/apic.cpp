@@ -1,6 +1,7 @@
 #include "arch/x86/apic.h"
 #include "lib/debug.h"
 #include "arch/x86/interrupt.h"
+#include "arch/x86/smp.h"
 
 #include <lib/ioport.h>
 
@@ -115,6 +116,26 @@ void apic_send_sipi(uint32_t physical_address, uint32_t target) {
     }
 }
 
+void apic_send_ipi(uint32_t vector, uint32_t target) {
+    icr_low icr;
+    icr.raw = 0;
+    icr.vector = vector;
+    icr.delivery_mode = APIC_ICR_DELIVERY_FIXED;
+    icr.dest_mode = APIC_ICR_PHYSICAL_MODE;
+    icr.level = APIC_ICR_LEVEL_ASSERT;
+
+    // 写ICR1和ICR0之间不能被本CPU上发IPI的中断处理打断
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    // 上一个IPI还没发出去时ICR不能改
+    while (apic_read(LAPIC_ICR0) & APIC_ICR_PENDING_MASK) {
+        asm volatile("pause");
+    }
+    apic_write(LAPIC_ICR1, target << APIC_ICR_DEST_SHIFT);
+    apic_write(LAPIC_ICR0, icr.raw);
+    asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
 void APICController::init_timer() {
     // 设置APIC Timer为周期模式
     apic_write(LAPIC_LVT_TIMER, APIC_TIMER_PERIODIC | APIC_TIMER_VECTOR);
@@ -151,6 +172,56 @@ void apic_init_timer(uint32_t frequency) {
     apic_write(LAPIC_DIVIDE_CONFIG, APIC_TIMER_DIVIDE_16);
 }
 
+// 切到一次性或TSC-deadline模式之前的周期计数值
+static uint32_t timer_period[MAX_CPUS];
+
+// 周期模式下保存周期，已经停掉时保留原来保存的值
+static void save_timer_period() {
+    if (apic_read(LAPIC_LVT_TIMER) & APIC_TIMER_PERIODIC) {
+        timer_period[apic_get_id()] = apic_read(LAPIC_INITIAL_COUNT);
+    }
+}
+
+uint32_t apic_timer_period() {
+    save_timer_period();
+    return timer_period[apic_get_id()];
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "a"((uint32_t)value), "d"((uint32_t)(value >> 32)), "c"(msr));
+}
+
+void cpuid(uint32_t function, uint32_t& eax, uint32_t& ebx, uint32_t& ecx, uint32_t& edx);
+
+bool apic_timer_has_tsc_deadline() {
+    static int supported = -1;
+    if (supported < 0) {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(1, eax, ebx, ecx, edx);
+        supported = (ecx >> 24) & 1;
+    }
+    return supported;
+}
+
+void apic_timer_set_deadline(uint64_t tsc) {
+    save_timer_period();
+    if ((apic_read(LAPIC_LVT_TIMER) & (APIC_TIMER_PERIODIC | APIC_TIMER_TSC_DEADLINE)) != APIC_TIMER_TSC_DEADLINE) {
+        apic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR | APIC_TIMER_TSC_DEADLINE);
+        // LVT写入要在写deadline之前生效，否则deadline会被当成旧模式下的写入忽略
+        asm volatile("mfence" ::: "memory");
+    }
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+}
+
+void apic_timer_set_oneshot(uint32_t count) {
+    save_timer_period();
+    if (apic_read(LAPIC_LVT_TIMER) & (APIC_TIMER_PERIODIC | APIC_TIMER_TSC_DEADLINE)) {
+        apic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR | APIC_TIMER_ONESHOT);
+    }
+    // 写初始计数重新开始倒数，没到期的计数被覆盖
+    apic_write(LAPIC_INITIAL_COUNT, count ? count : 1);
+}
+
 // 获取CPU数量
 #include <cstdint>
 
@@ -239,6 +310,8 @@ void APICController::init() {
     apic_init();
     ioapic_init();
     init_timer();
+    // tick由每个CPU的本地APIC定时器产生，PIT的IRQ0只会额外唤醒BSP
+    disable_irq(0);
 }
 
 void APICController::send_eoi() {
@@ -1,39 +1,61 @@
 #include "arch/x86/cpu.h"
 #include "arch/x86/apic.h"
+#include "arch/x86/fpu.h"
 #include "arch/x86/gdt.h"
 #include "arch/x86/idt.h"
+#include "arch/x86/percpu.h"
 #include "lib/debug.h"
+#include "lib/string.h"
 
 #include <kernel/kernel.h>
+
+// 链接脚本里.percpu段的范围，和.bss里给其他CPU预留的副本
+extern "C" char __percpu_start[];
+extern "C" char __percpu_end[];
+extern "C" char __percpu_copies[];
+
 namespace arch {
 
-unsigned int get_cpu_id() {
-    return apic_get_id();
+uint32_t per_cpu_offset[MAX_CPUS];
+DEFINE_PER_CPU(uint32_t, cpu_number);
+DEFINE_PER_CPU(uint32_t, this_cpu_off);
+
+void setup_per_cpu_areas() {
+    // 段尾按缓存行对齐，每份副本的大小都是缓存行的整数倍
+    uint32_t size = __percpu_end - __percpu_start;
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        char* area = __percpu_start;
+        if (cpu != 0) {
+            area = __percpu_copies + (cpu - 1) * size;
+            memcpy(area, __percpu_start, size);
+        }
+        uint32_t offset = area - __percpu_start;
+        per_cpu_offset[cpu] = offset;
+        per_cpu(cpu_number, cpu) = cpu;
+        per_cpu(this_cpu_off, cpu) = offset;
+        GDT::setEntry(GDT_PERCPU_BASE + cpu, offset, 0xFFFFFFFF,
+            GDT_PRESENT | GDT_DPL_0 | GDT_TYPE_DATA, 0xCF);
+    }
+    log_info("per-cpu area: %d bytes per cpu at 0x%x\n", size, __percpu_start);
+}
+
+void percpu_load_gs(uint32_t cpu) {
+    uint16_t sel = (GDT_PERCPU_BASE + cpu) * 8;
+    asm volatile("mov %0, %%gs" : : "r"(sel) : "memory");
 }
 
 void cpu_init_percpu() {
-    // 初始化CPU本地存储
-    log_debug("Initializing CPU %d...\n", apic_get_id());
-    
-    // 初始化GDT
-    GDT::loadGDT();
+    // 初始化CPU本地存储，GDT、TSS和gs已经在ap_entry里装好
+    log_debug("Initializing CPU %d...\n", get_cpu_id());
     
     // 初始化IDT
     IDT::loadIDT();
+    fpu_init();
 
-    // for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
-    //     // 分配每CPU数据区
-    //     percpu_areas[cpu] = (arch::percpu_area*)Kernel::instance().kernel_mm().kmalloc(percpu_size);
-    //
-    //
-    //     // 设置偏移量
-    //     __per_cpu_offset[cpu] = (unsigned long)percpu_areas[cpu];
-    // }
-    //
     // 启用本地APIC
     apic_enable();
     
-    log_debug("CPU %d initialized\n", apic_get_id());
+    log_debug("CPU %d initialized\n", get_cpu_id());
 }
 
-} // namespace arch
\ No newline at end of file
+} // namespace arch
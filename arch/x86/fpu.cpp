@@ -0,0 +1,216 @@
+#include "arch/x86/fpu.h"
+#include "arch/x86/percpu.h"
+#include "lib/debug.h"
+#include "lib/string.h"
+
+#include <kernel/kernel.h>
+
+namespace arch {
+
+constexpr uint32_t CR0_MP = 1 << 1; // WAIT/FWAIT也检查TS
+constexpr uint32_t CR0_EM = 1 << 2; // 置位时所有FPU指令都触发#NM
+constexpr uint32_t CR0_TS = 1 << 3;
+constexpr uint32_t CR0_NE = 1 << 5; // x87异常走#MF，不走外部中断
+constexpr uint32_t CR4_OSFXSR = 1 << 9;
+constexpr uint32_t CR4_OSXMMEXCPT = 1 << 10;
+
+constexpr uint32_t CPUID_EDX_FXSR = 1 << 24;
+constexpr uint32_t CPUID_EDX_SSE = 1 << 25;
+constexpr uint32_t CPUID_EDX_SSE2 = 1 << 26;
+
+// 所有CPU的特性是一样的，BSP检测一次
+static bool has_fxsr;
+static bool has_sse;
+static bool has_sse2;
+// 任务第一次使用FPU时装入的初始状态，不能沿用上一个任务留在寄存器里的值
+static FpuState init_state;
+
+// 寄存器里是哪个任务的状态，任务退出后指针可能失效，只用来比较
+DEFINE_PER_CPU(Task*, fpu_owner);
+// TS已清，fpu_owner可能改了寄存器，换出时要保存
+DEFINE_PER_CPU(uint32_t, fpu_live);
+DEFINE_PER_CPU(FpuStats, fpu_stats);
+
+static inline void clts() { asm volatile("clts" ::: "memory"); }
+
+static inline void stts()
+{
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_TS) : "memory");
+}
+
+static inline void fxsave(FpuState& fpu)
+{
+    asm volatile("fxsave (%0)" : : "r"(fpu.area()) : "memory");
+}
+
+static inline void fxrstor(FpuState& fpu)
+{
+    asm volatile("fxrstor (%0)" : : "r"(fpu.area()) : "memory");
+}
+
+void fpu_init()
+{
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    has_fxsr = edx & CPUID_EDX_FXSR;
+    has_sse = has_fxsr && (edx & CPUID_EDX_SSE);
+    has_sse2 = has_sse && (edx & CPUID_EDX_SSE2);
+
+    uint32_t cr0, cr4;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~CR0_EM) | CR0_MP | CR0_NE;
+    asm volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+    if(has_fxsr) {
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if(has_sse) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        asm volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+    } else {
+        log_err("CPU %d: no FXSAVE/FXRSTOR, FPU is unavailable to tasks\n", get_cpu_id());
+    }
+    asm volatile("fninit");
+    if(has_fxsr && !init_state.used) {
+        // BSP上记下复位后的干净状态，XMM寄存器此时都是0
+        uint32_t mxcsr = MXCSR_DEFAULT;
+        if(has_sse) {
+            asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+        }
+        fxsave(init_state);
+        init_state.used = true;
+    }
+    this_cpu_write(fpu_owner, nullptr);
+    this_cpu_write(fpu_live, 0);
+    stts();
+    log_info("CPU %d: FPU initialized, sse2: %d\n", get_cpu_id(), has_sse2);
+}
+
+bool fpu_has_sse2() { return has_sse2; }
+
+void fpu_switch(Task* prev, Task* next)
+{
+    auto stats = this_cpu_ptr(fpu_stats);
+    if(this_cpu_read(fpu_live)) {
+        // 只有fpu_owner会让fpu_live置位，就是prev
+        if(prev && prev->state != EXITED) {
+            fxsave(prev->fpu);
+            stats->saves++;
+        } else {
+            this_cpu_write(fpu_owner, nullptr);
+        }
+        this_cpu_write(fpu_live, 0);
+    }
+    // next在别的CPU上装入过状态时last_cpu会变，这里的寄存器已经过时
+    int cpu = get_cpu_id();
+    if(next && next == this_cpu_read(fpu_owner) && next->fpu.last_cpu == cpu) {
+        clts();
+        this_cpu_write(fpu_live, 1);
+        stats->lazy_hits++;
+    } else {
+        stts();
+    }
+}
+
+void kernel_fpu_begin(uint32_t& flags)
+{
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    clts();
+    if(this_cpu_read(fpu_live)) {
+        fxsave(this_cpu_read(fpu_owner)->fpu);
+        this_cpu_ptr(fpu_stats)->saves++;
+        this_cpu_write(fpu_live, 0);
+    }
+    // 内核要覆盖寄存器，谁的状态都不在里面了
+    this_cpu_write(fpu_owner, nullptr);
+}
+
+void kernel_fpu_end(uint32_t flags)
+{
+    stts();
+    asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+void copy_page(void* to, const void* from)
+{
+    if(!has_sse2) {
+        memcpy(to, from, PAGE_SIZE);
+        return;
+    }
+    uint32_t flags;
+    kernel_fpu_begin(flags);
+    auto d = (uint8_t*)to;
+    auto s = (const uint8_t*)from;
+    for(uint32_t off = 0; off < PAGE_SIZE; off += 64) {
+        asm volatile("movdqa (%0), %%xmm0\n\t"
+                     "movdqa 16(%0), %%xmm1\n\t"
+                     "movdqa 32(%0), %%xmm2\n\t"
+                     "movdqa 48(%0), %%xmm3\n\t"
+                     "movdqa %%xmm0, (%1)\n\t"
+                     "movdqa %%xmm1, 16(%1)\n\t"
+                     "movdqa %%xmm2, 32(%1)\n\t"
+                     "movdqa %%xmm3, 48(%1)"
+            :
+            : "r"(s + off), "r"(d + off)
+            : "memory");
+    }
+    kernel_fpu_end(flags);
+}
+
+void clear_page(void* page)
+{
+    if(!has_sse2) {
+        memset(page, 0, PAGE_SIZE);
+        return;
+    }
+    uint32_t flags;
+    kernel_fpu_begin(flags);
+    auto d = (uint8_t*)page;
+    asm volatile("pxor %%xmm0, %%xmm0" ::: "memory");
+    for(uint32_t off = 0; off < PAGE_SIZE; off += 64) {
+        asm volatile("movdqa %%xmm0, (%0)\n\t"
+                     "movdqa %%xmm0, 16(%0)\n\t"
+                     "movdqa %%xmm0, 32(%0)\n\t"
+                     "movdqa %%xmm0, 48(%0)"
+            :
+            : "r"(d + off)
+            : "memory");
+    }
+    kernel_fpu_end(flags);
+}
+
+void fpu_cpu_stats(uint32_t cpu, FpuStats& stats)
+{
+    stats = per_cpu(fpu_stats, cpu);
+}
+
+} // namespace arch
+
+using namespace arch;
+
+// 任务切换后第一次使用FPU指令，把当前任务的状态装进寄存器
+extern "C" void device_not_available_handler()
+{
+    Task* task = ProcessManager::get_current_task();
+    if(!has_fxsr || !task) {
+        log_err("unexpected #NM, task 0x%x\n", task);
+        while(true) {
+            asm volatile("hlt");
+        }
+    }
+    clts();
+    // 上一个用FPU的任务在换出时已经保存过，寄存器可以直接覆盖
+    if(task->fpu.used) {
+        fxrstor(task->fpu);
+    } else {
+        // 第一次使用，从初始状态开始
+        fxrstor(init_state);
+        task->fpu.used = true;
+    }
+    task->fpu.last_cpu = get_cpu_id();
+    this_cpu_write(fpu_owner, task);
+    this_cpu_write(fpu_live, 1);
+    this_cpu_ptr(fpu_stats)->traps++;
+}
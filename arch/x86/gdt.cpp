@@ -4,7 +4,8 @@
 
 // 定义TSS
 TSSEntry GDT::tss[MAX_CPUS];
-GDTEntry GDT::entries[6+MAX_CPUS]; // 增加一个表项用于调用门
+TSSEntry GDT::df_tss;
+GDTEntry GDT::entries[GDT_ENTRIES];
 GDTPointer GDT::gdtPointer;
 
 uint32_t gdt_entries = (uint32_t)GDT::entries;
@@ -23,8 +24,6 @@ void GDT::init()
         0xCF); // 用户代码段
     setEntry(4, 0, 0xBFFFFFFF, GDT_PRESENT | GDT_DPL_3 | GDT_TYPE_DATA,
         0xCF); // 用户数据段
-    setEntry(5, 0, 0, 0, 0); // Null段
-
     for(int i = 0 ; i < MAX_CPUS; i++) {
         // 初始化TSS
         tss[i].ss0 = 0x10; // 内核数据段选择子
@@ -34,9 +33,14 @@ void GDT::init()
         // 设置TSS描述符
         log_debug("tss base for %d is  0x%x\n", i, &tss[i]);
         uint32_t tss_base = reinterpret_cast<uint32_t>(&tss[i]);
-        setEntry(5 + i, tss_base, sizeof(TSSEntry), GDT_PRESENT | GDT_TYPE_TSS, 0x00);
+        setEntry(GDT_TSS_BASE + i, tss_base, sizeof(TSSEntry), GDT_PRESENT | GDT_TYPE_TSS, 0x00);
+        // per-CPU段先按平坦段设置，setup_per_cpu_areas再填上各CPU的偏移
+        setEntry(GDT_PERCPU_BASE + i, 0, 0xFFFFFFFF, GDT_PRESENT | GDT_DPL_0 | GDT_TYPE_DATA, 0xCF);
 
     }
+    df_tss.iomap_base = sizeof(TSSEntry);
+    setEntry(GDT_DF_TSS, reinterpret_cast<uint32_t>(&df_tss), sizeof(TSSEntry),
+        GDT_PRESENT | GDT_TYPE_TSS, 0x00);
 
 
     // 设置调用门描述符
@@ -47,7 +51,7 @@ void GDT::init()
     // user_mode_entry_addr, 3, 0);
 
     // 加载GDT
-    gdtPointer.limit = (sizeof(GDTEntry) * 7) - 1;
+    gdtPointer.limit = sizeof(entries) - 1;
     gdtPointer.base = reinterpret_cast<uintptr_t>(&entries[0]);
     loadGDT();
 
@@ -118,6 +122,18 @@ void GDT::updateTSSCR3(uint32_t cpu, uint32_t cr3)
     tss[cpu].cr3 = cr3;
 }
 
+// 任务门切换时CPU从TSS装入全部寄存器，关中断，段寄存器都用内核段
+void GDT::setDoubleFaultTask(uint32_t eip, uint32_t esp, uint32_t cr3)
+{
+    df_tss.eip = eip;
+    df_tss.esp = esp;
+    df_tss.esp0 = esp;
+    df_tss.cr3 = cr3;
+    df_tss.eflags = 0x2;
+    df_tss.cs = 0x08;
+    df_tss.ss = df_tss.ss0 = df_tss.ds = df_tss.es = df_tss.fs = df_tss.gs = 0x10;
+}
+
 // 保存当前进程状态到TSS
 // void GDT::saveTSSState(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t
 // edx,
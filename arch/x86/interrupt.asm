@@ -7,11 +7,12 @@
 [GLOBAL remap_pic]
 [EXTERN handleInterrupt]
 [EXTERN handleSyscall]
-[EXTERN save_context_wrapper]
-[EXTERN restore_context_wrapper]
+[EXTERN interrupt_exit_schedule]
+[EXTERN schedule_tail]
 [EXTERN page_fault_handler]
 [EXTERN segmentation_fault_handler]
 [EXTERN stack_fault_handler]
+[EXTERN device_not_available_handler]
 [EXTERN apic_send_eoi]
 
 [section .data]
@@ -26,28 +27,39 @@ fault_errno: dd 0
 
 [section .text]
 
-%macro SAVE_REGS_FOR_CONTEXT_SWITCH 1
+; 本CPU的TSS选择子加上它就是本CPU的per-CPU段选择子，见gdt.h
+PERCPU_SEL_DELTA equ 32 * 8 ; MAX_CPUS * 8
+
+; gs装上本CPU的per-CPU段，从用户态进来时gs是用户的值。
+; TR里是本CPU的TSS，不用读本地APIC就能知道在哪个CPU上。破坏ax
+%macro LOAD_PERCPU_GS 0
+    str ax
+    add ax, PERCPU_SEL_DELTA
+    mov gs, ax
+%endmacro
+
+; 可能切换任务的中断入口，帧留在当前任务的内核栈上，切回来时按它返回。
+; 帧的布局：edi,esi,ebp,esp,ebx,edx,ecx,eax,ds,es,fs,gs,eip,cs,eflags[,esp,ss]，
+; 新任务的第一个帧由ProcessManager::prepare_stack按同样的布局构造
+%macro SAVE_REGS_FOR_CONTEXT_SWITCH 0
     push gs
     push fs
     push es
     push ds
     pushad
-    push esp
-    push %1
     mov ax, 0x10
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
-    call save_context_wrapper
-    add esp, 8
+    LOAD_PERCPU_GS
 %endmacro
 
-%macro RESTORE_REGS_FOR_CONTEXT_SWITCH 1
-    push esp
-    push %1
-    call restore_context_wrapper
-    add esp, 8
+; 任务可能在另一个CPU上切回来，返回内核态时gs换成现在这个CPU的per-CPU段
+%macro RESTORE_REGS_FOR_CONTEXT_SWITCH 0
+    test dword [esp + 13 * 4], 3
+    jnz %%restore
+    mov [esp + 11 * 4], gs
+%%restore:
     popad
     pop ds
     pop es
@@ -64,6 +76,7 @@ fault_errno: dd 0
     push eax
     mov ax, 0x10
     mov ds, ax
+    LOAD_PERCPU_GS
     pop eax
 %endmacro
 
@@ -79,7 +92,7 @@ fault_errno: dd 0
 [global %2]
 %2:
     cli
-    SAVE_REGS_FOR_CONTEXT_SWITCH %1
+    SAVE_REGS_FOR_CONTEXT_SWITCH
 
     push 0
     push %1
@@ -87,9 +100,10 @@ fault_errno: dd 0
     add esp, 8      ; 清理错误码和中断号
 
     ; 对于APIC中断，C函数中已经调用了apic_send_eoi
-    ; 所以这里不需要额外的EOI调用
+    ; 所以这里不需要额外的EOI调用，EOI之后再切换任务
+    call interrupt_exit_schedule
 
-    RESTORE_REGS_FOR_CONTEXT_SWITCH %1
+    RESTORE_REGS_FOR_CONTEXT_SWITCH
     sti
     iretd            ; 返回
 %endmacro
@@ -148,6 +162,19 @@ idtentry 0x2F, ide2_interrupt, handleInterrupt
 idtentry 0x40, ipi_interrupt, handleInterrupt  ; 处理器间中断
 idtentry 0x41, ipi_reschedule, handleInterrupt ; 重新调度IPI
 
+; 设备不可用(#NM)：CR0.TS置位后任务第一次使用FPU/SSE指令，装入它的FPU状态后重新执行那条指令。
+; 只换FPU寄存器，不切换任务，也不是APIC中断，不发EOI
+[global device_not_available_interrupt]
+device_not_available_interrupt:
+    SAVE_REGS
+    push es
+    mov ax, 0x10
+    mov es, ax
+    call device_not_available_handler
+    pop es
+    RESTORE_REGS
+    iretd
+
 ; 页面错误中断处理
 [global page_fault_interrupt]
 page_fault_interrupt:
@@ -184,7 +211,7 @@ syscall_interrupt:
     mov [arg2], ecx
     mov [arg3], edx
     mov [arg4], esi
-    SAVE_REGS_FOR_CONTEXT_SWITCH 0x80
+    SAVE_REGS_FOR_CONTEXT_SWITCH
 
     mov esi, [arg4]
     push esi ; arg4
@@ -197,14 +224,40 @@ syscall_interrupt:
     mov eax, [syscall_number]
     push eax ; syscall number
     call handleSyscall         ; 调用C函数
-    mov [arg1], eax
     add esp, 20
+    mov [esp + 7 * 4], eax     ; 返回值写到帧里的eax，睡眠的任务醒来后也按它返回
 
-    RESTORE_REGS_FOR_CONTEXT_SWITCH 0x80
-    mov eax, [arg1]
+    call interrupt_exit_schedule
+    RESTORE_REGS_FOR_CONTEXT_SWITCH
     sti
     iretd            ; 返回
 
+; void switch_to(uint32_t* prev_esp, uint32_t next_esp)
+; 只保存callee-saved寄存器，调用方按C调用约定已经保存了其他寄存器。
+; 返回到next上次调用switch_to的地方，新任务返回到ret_from_fork
+[global switch_to]
+switch_to:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; 新任务第一次运行，栈上是prepare_stack构造的中断帧
+[global ret_from_fork]
+ret_from_fork:
+    call schedule_tail
+    RESTORE_REGS_FOR_CONTEXT_SWITCH
+    iretd
+
 remap_pic:
     ; 警告：此函数已弃用！系统现在使用APIC而不是PIC
     ; 此函数不应被调用，保留仅用于兼容性目的
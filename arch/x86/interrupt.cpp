@@ -86,9 +86,12 @@ void InterruptManager::init(ControllerType type)
 // 声明中断号到中断名称的映射表
 extern const char* interrupt_names[256];
 
+DEFINE_PER_CPU(uint32_t, irq_nesting);
+
 extern "C" void handleInterrupt(uint32_t interrupt)
 {
     auto& im = Kernel::instance().interrupt_manager();
+    asm volatile("incl %%gs:%0" : "+m"(irq_nesting) : : "memory");
     // 设置当前中断号
     if(im.get_controller()) {
         im.get_controller()->current_interrupt = interrupt;
@@ -100,6 +103,7 @@ extern "C" void handleInterrupt(uint32_t interrupt)
         debug_rate_limited("[INT] Unhandled interrupt %d(0x%x), name:%s\n", interrupt, interrupt,
             interrupt_names[interrupt]);
     }
+    asm volatile("decl %%gs:%0" : "+m"(irq_nesting) : : "memory");
 
     // 发送EOI（由具体的中断控制器决定是否需要发送）
     im.sendEOI();
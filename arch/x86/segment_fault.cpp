@@ -1,6 +1,53 @@
+#include "arch/x86/gdt.h"
+#include "arch/x86/idt.h"
 #include "arch/x86/interrupt.h"
+#include "arch/x86/percpu.h"
+#include "kernel/kstack.h"
 #include "lib/debug.h"
 
+// 双重错误任务的栈。内核栈溢出时CPU往保护页上压缺页异常的栈帧，再次出错变成双重错误，
+// 原来的栈已经不能用，中断门进不了处理函数，只能经任务门换到独立的TSS和栈上报告
+static uint8_t double_fault_stack[PAGE_SIZE] __attribute__((aligned(16)));
+
+/**
+ * @brief 双重错误任务的入口，经任务门进入，栈上只有CPU压入的错误码(总是0)，不返回
+ * 出错时的寄存器由CPU保存在原来的TSS里，df_tss.prev_tss是它的选择子
+ */
+extern "C" __attribute__((noreturn)) void double_fault_task()
+{
+    uint32_t cpu = (GDT::df_tss.prev_tss - GDT_TSS_BASE * 8) / 8;
+    const TSSEntry& old = GDT::tss[cpu < MAX_CPUS ? cpu : 0];
+    // gs从df_tss装入的是平坦段，换成出错CPU的per-CPU段，日志和当前任务才是这个CPU的
+    arch::percpu_load_gs(cpu < MAX_CPUS ? cpu : 0);
+    uint32_t cr2;
+    asm volatile("mov %%cr2, %0" : "=r"(cr2));
+
+    auto pcb = ProcessManager::get_current_task();
+    if(KernelStackAllocator::is_guard_page(cr2) || KernelStackAllocator::is_guard_page(old.esp)) {
+        log_err("kernel stack overflow on cpu %d, tid:%d, name:%s, eip:0x%x, esp:0x%x, cr2:0x%x\n",
+            cpu, pcb ? pcb->task_id : -1, pcb ? pcb->name : "", old.eip, old.esp, cr2);
+    } else {
+        log_err("double fault on cpu %d, eip:0x%x, esp:0x%x, cr2:0x%x\n", cpu, old.eip, old.esp,
+            cr2);
+    }
+    while(1) {
+        asm volatile("cli; hlt");
+    }
+}
+
+/**
+ * @brief 把双重错误设成任务门，指向GDT_DF_TSS，在开启分页、初始化IDT之后调用
+ */
+void install_double_fault_task()
+{
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    GDT::setDoubleFaultTask(reinterpret_cast<uint32_t>(double_fault_task),
+        reinterpret_cast<uint32_t>(double_fault_stack + sizeof(double_fault_stack)), cr3);
+    // 任务门：P=1，DPL=0，类型5，偏移不用
+    IDT::setGate(INT_DOUBLE_FAULT, 0, GDT_DF_TSS * 8, 0x85);
+}
+
 extern "C" void general_fault_errno_handler(uint32_t isr_no, uint32_t error_code)
 {
     log_debug("fault occurred! NO. %d, Error code: %d\n", isr_no, error_code);
@@ -4,6 +4,7 @@
 #include <arch/x86/smp.h>
 #include <kernel/kernel.h>
 #include <kernel/scheduler.h>
+#include <kernel/tick.h>
 #include <lib/debug.h>
 #include <lib/serial.h>
 
@@ -62,6 +63,10 @@ void ap_entry()
     // AP 从 0x8000 的启动代码跳转到这里继续执行
     // 初始化当前 AP 的 LAPIC，使其能够接收中断
     uint32_t current_cpu_id = apic_get_id();
+    // 先装好GDT、TSS和per-CPU段，之后的per-CPU变量(包括日志里的当前任务)才是这个CPU的
+    GDT::loadGDT();
+    GDT::loadTR(current_cpu_id);
+    percpu_load_gs(current_cpu_id);
     log_debug("ap_entry, CPU ID: %d\n", current_cpu_id);
     apic_init();
     log_debug("CPU %d 已启动\n", current_cpu_id);
@@ -76,9 +81,7 @@ void ap_entry()
     cpu_init_percpu();
 
     auto &kernel = Kernel::instance();
-    GDT::loadGDT();
-    GDT::loadTR(current_cpu_id);
-    kernel.kernel_mm().paging().loadPageDirectory(0x400000);
+    kernel.kernel_mm().paging().loadPageDirectory(PageManager::kernelCr3());
     kernel.kernel_mm().paging().enablePaging();
     auto task = kernel.scheduler().get_current_task();
     auto cr3 = task->regs.cr3;
@@ -109,7 +112,7 @@ void ap_entry()
     // // 任务调度将在中断处理函数中进行，例如定时器中断
     while(true) {
 //        debug_rate_limited("CPU %d 空闲中，等待中断...\n", current_cpu_id);
-        asm volatile("hlt");
+        Tick::idle();
     }
 }
 
@@ -3,10 +3,77 @@
 #include <arch/x86/interrupt.h>
 #include <lib/debug.h>
 
-// SpinLock类的实现已经移到头文件中
-// 这里保留一些辅助函数
+// SpinLock类的实现在头文件中，这里是锁统计的部分
 
-// 调试用锁状态检查
-// bool spin_is_locked(const SpinLock& lock) {
-//     return __atomic_load_n(&lock.locked, __ATOMIC_RELAXED);
-// }
\ No newline at end of file
+#ifdef CONFIG_LOCKSTAT
+
+// 登记过的类，只增加不删除，读的时候不加锁
+static LockClass* lockstat_head;
+
+// 第一次用到时挂到链表上，不能加锁也不能打日志，这两条路径上都会加锁
+static void lockstat_register(LockClass* cls)
+{
+    if(__atomic_exchange_n(&cls->registered, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    LockClass* head = __atomic_load_n(&lockstat_head, __ATOMIC_ACQUIRE);
+    do {
+        cls->next = head;
+    } while(!__atomic_compare_exchange_n(&lockstat_head, &head, cls, true, __ATOMIC_RELEASE,
+        __ATOMIC_ACQUIRE));
+}
+
+static uint32_t wait_bucket(uint32_t cycles)
+{
+    uint32_t bucket = 0;
+    for(cycles >>= 8; cycles && bucket < LOCKSTAT_WAIT_BUCKETS - 1; cycles >>= 2) {
+        bucket++;
+    }
+    return bucket;
+}
+
+// 最大值只是统计，并发更新时丢掉一次无所谓
+static inline void update_max(uint32_t* max, uint32_t value)
+{
+    if(value > __atomic_load_n(max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(max, value, __ATOMIC_RELAXED);
+    }
+}
+
+void lockstat_acquired(LockClass* cls, uint32_t wait_cycles, bool contended)
+{
+    if(!cls->registered) {
+        lockstat_register(cls);
+    }
+    arch::atomic_add(&cls->acquisitions, 1);
+    if(contended) {
+        arch::atomic_add(&cls->contended, 1);
+        arch::atomic_add(&cls->wait_hist[wait_bucket(wait_cycles)], 1);
+        update_max(&cls->max_wait_cycles, wait_cycles);
+    }
+}
+
+void lockstat_released(LockClass* cls, uint32_t hold_cycles)
+{
+    update_max(&cls->max_hold_cycles, hold_cycles);
+}
+
+LockClass* lockstat_classes()
+{
+    return __atomic_load_n(&lockstat_head, __ATOMIC_ACQUIRE);
+}
+
+void lockstat_reset()
+{
+    for(LockClass* cls = lockstat_classes(); cls; cls = cls->next) {
+        cls->acquisitions = 0;
+        cls->contended = 0;
+        for(uint32_t i = 0; i < LOCKSTAT_WAIT_BUCKETS; i++) {
+            cls->wait_hist[i] = 0;
+        }
+        cls->max_wait_cycles = 0;
+        cls->max_hold_cycles = 0;
+    }
+}
+
+#endif // CONFIG_LOCKSTAT
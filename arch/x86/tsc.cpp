@@ -0,0 +1,63 @@
+#include "arch/x86/tsc.h"
+
+#include <lib/debug.h>
+#include <lib/ioport.h>
+
+namespace arch {
+
+// PIT输入时钟频率
+static constexpr uint32_t PIT_HZ = 1193182;
+// 测量窗口，越长越准，启动时多等这么久
+static constexpr uint32_t CALIBRATE_MS = 20;
+// 换算系数的定点小数位数
+static constexpr uint32_t TSC_SHIFT = 22;
+
+static uint32_t khz;
+static uint64_t boot_tsc;
+static uint32_t cyc2ns_mult; // ns = cycles * cyc2ns_mult >> TSC_SHIFT
+static uint32_t ns2cyc_mult; // cycles = ns * ns2cyc_mult >> TSC_SHIFT
+
+void tsc_calibrate()
+{
+    // 端口0x61：bit0是通道2的GATE，bit1是扬声器输出，bit5是通道2的OUT
+    outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+    // 通道2，先低字节后高字节，模式0(计数到0时OUT变高)
+    outb(0x43, 0xB0);
+    uint32_t latch = PIT_HZ / (1000 / CALIBRATE_MS);
+    outb(0x42, latch & 0xFF);
+    outb(0x42, latch >> 8);
+    uint64_t start = rdtsc();
+    while(!(inb(0x61) & 0x20)) {
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    boot_tsc = start;
+    khz = (uint32_t)div_u64(cycles, CALIBRATE_MS);
+    cyc2ns_mult = (uint32_t)div_u64((uint64_t)1000000 << TSC_SHIFT, khz);
+    ns2cyc_mult = (uint32_t)div_u64((uint64_t)khz << TSC_SHIFT, 1000000);
+    log_info("TSC: %d kHz\n", khz);
+}
+
+uint32_t tsc_khz() { return khz; }
+
+uint64_t tsc_cycles_to_ns(uint64_t cycles)
+{
+    return mul_u64_u32_shr(cycles, cyc2ns_mult, TSC_SHIFT);
+}
+
+uint64_t tsc_ns_to_cycles(uint64_t ns)
+{
+    return mul_u64_u32_shr(ns, ns2cyc_mult, TSC_SHIFT);
+}
+
+uint64_t tsc_boot_ns()
+{
+    return tsc_cycles_to_ns(rdtsc() - boot_tsc);
+}
+
+uint64_t tsc_from_boot_ns(uint64_t ns)
+{
+    return boot_tsc + tsc_ns_to_cycles(ns);
+}
+
+} // namespace arch
@@ -16,6 +16,8 @@ _start:
     cli                         ; 禁用中断
     mov esp, stack_top          ; 设置栈指针
     mov ebp, stack_top          ; 设置栈指针
+    push ebx                    ; multiboot_info物理地址, kernel_main的第二个参数
+    push eax                    ; multiboot魔数, kernel_main的第一个参数
 
     call copy_ap_boot_to_8k
 ;    call copy_ap_boot_to_0k
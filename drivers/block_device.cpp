@@ -52,7 +52,9 @@ void RamDisk::sync() {
     // 内存设备不需要同步操作
 }
 
-DiskDevice::DiskDevice() {
+SpinLock DiskDevice::channel_lock;
+
+DiskDevice::DiskDevice(uint8_t drive) : drive(drive) {
     // 初始化设备信息
     info.sector_size = 512;  // 标准扇区大小
     info.total_sectors = 0;  // 总块数在init时设置
@@ -64,12 +66,15 @@ DiskDevice::~DiskDevice() {
 
 bool DiskDevice::init() {
     // 发送ATA IDENTIFY命令
-    outb(0x1F6, 0xE0);  // LBA主设备
+    uint32_t flags;
+    channel_lock.acquire_irqsave(flags);
+    outb(0x1F6, drive_select());  // LBA模式，选择主盘或从盘
     outb(0x1F7, 0xEC);  // IDENTIFY命令
 
     // 等待命令就绪
     if ((inb(0x1F7) & 0x88) != 0x08) {
-        log_err("IDENTIFY command failed\n");
+        channel_lock.release_irqrestore(flags);
+        log_err("IDENTIFY command failed, drive:%d\n", drive);
         return false;
     }
 
@@ -78,6 +83,7 @@ bool DiskDevice::init() {
     for (int i = 0; i < 256; i++) {
         identify_data[i] = inw(0x1F0);
     }
+    channel_lock.release_irqrestore(flags);
 
     // 解析最大LBA值（WORD 60-61为LBA28，WORD 100-103为LBA48）
     uint32_t lba28 = (identify_data[61] << 16) | identify_data[60];
@@ -125,7 +131,9 @@ bool DiskDevice::read_sector(uint32_t sector_num, void* buffer) {
     size_t offset = sector_num * info.sector_size;
 
     // 设置LBA地址
-    outb(0x1F6, 0xE0 | ((sector_num >> 24) & 0x0F));
+    uint32_t flags;
+    channel_lock.acquire_irqsave(flags);
+    outb(0x1F6, drive_select() | ((sector_num >> 24) & 0x0F));
     outb(0x1F2, 1);                           // 扇区数
     outb(0x1F3, sector_num & 0xFF);
     outb(0x1F4, (sector_num >> 8) & 0xFF);
@@ -145,6 +153,7 @@ bool DiskDevice::read_sector(uint32_t sector_num, void* buffer) {
         ((uint8_t*)buffer)[i] = data & 0xFF;
         ((uint8_t*)buffer)[i + 1] = (data >> 8) & 0xFF;
     }
+    channel_lock.release_irqrestore(flags);
 
     return true;
 }
@@ -169,7 +178,9 @@ bool DiskDevice::write_sector(uint32_t sector_num, const void* buffer) {
     size_t offset = sector_num * info.sector_size;
     
     // 设置LBA地址
-    outb(0x1F6, 0xE0 | ((sector_num >> 24) & 0x0F));
+    uint32_t flags;
+    channel_lock.acquire_irqsave(flags);
+    outb(0x1F6, drive_select() | ((sector_num >> 24) & 0x0F));
     outb(0x1F2, 1);                           // 扇区数
     outb(0x1F3, sector_num & 0xFF);
     outb(0x1F4, (sector_num >> 8) & 0xFF);
@@ -189,6 +200,7 @@ bool DiskDevice::write_sector(uint32_t sector_num, const void* buffer) {
     
     // 等待写入完成
     while (inb(0x1F7) & 0x80);
+    channel_lock.release_irqrestore(flags);
     
     return true;
 }
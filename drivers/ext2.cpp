@@ -1,6 +1,8 @@
 #include "drivers/block_device.h"
 #include <drivers/ext2.h>
 #include <kernel/dirent.h>
+#include <kernel/process.h>
+#include <kernel/syscall.h>
 #include <lib/debug.h>
 #include <lib/string.h>
 #include "kernel/fs/SimplePageCache.h"
@@ -288,12 +290,14 @@ uint32_t Ext2FileSystem::allocate_block()
 {
     log_debug("[ext2] 开始分配数据块 (first_data_block:%u blocks_count:%u)\n",
         super_block->first_data_block, super_block->blocks_count);
-    auto block_buffer = new uint8_t[device->get_info().sector_size];
+    // read_block读一整个文件系统块
+    size_t block_size = super_block->block_size();
+    auto block_buffer = new uint8_t[block_size];
     for(uint32_t i = super_block->first_data_block; i < super_block->blocks_count; i++) {
         log_debug("检查块%u...", i);
         if(device->read_block(i, block_buffer)) {
             bool is_free = true;
-            for(size_t j = 0; j < device->get_info().sector_size; j++) {
+            for(size_t j = 0; j < block_size; j++) {
                 if(block_buffer[j] != 0) {
                     is_free = false;
                     break;
@@ -533,7 +537,7 @@ Ext2FileDescriptor::Ext2FileDescriptor(uint32_t inode, Ext2FileSystem* fs)
 {
 }
 
-Ext2FileDescriptor::~Ext2FileDescriptor() {}
+Ext2FileDescriptor::~Ext2FileDescriptor() { delete[] m_mmap_blocks; }
 
 int Ext2FileDescriptor::seek(size_t offset)
 {
@@ -687,29 +691,45 @@ int Ext2FileDescriptor::iterate(void* buffer, size_t buffer_size, uint32_t* pos)
  */
 uint32_t Ext2FileDescriptor::get_block_id(uint32_t block_idx, Ext2Inode *inode)
 {
-    auto dev = m_fs->device;
+    // 一个间接块里的块号个数，1KiB的块是256，4KiB的块是1024
+    uint32_t ptrs_per_block = m_fs->super_block->block_size() / sizeof(uint32_t);
     if (block_idx < 12) {
         return inode->i_block[block_idx];
-    } else if (block_idx < 12+ 256) {
+    }
+    block_idx -= 12;
+    if (block_idx < ptrs_per_block) {
         uint32_t indirect_block_id = inode->i_block[12];
-        uint32_t indirect_offset = (block_idx - 12) * sizeof(uint32_t);
+        uint32_t indirect_offset = block_idx * sizeof(uint32_t);
 
-        uint32_t block_id;
+        uint32_t block_id = 0;
 
+        // 缓存页可能在高端内存，通过read_page读，由页缓存负责kmap
         auto key = PageKey{indirect_block_id};
-        auto page = m_fs->page_cache->get_page(key);
-
-        block_id = *((uint32_t*)(page->data + indirect_offset));
-        log_debug("inode_block_idx:%d, indirect_block_id:%d, block_id:%d\n", block_idx, indirect_block_id, block_id);
+        if(!m_fs->page_cache->get_page(key)) {
+            return 0;
+        }
+        m_fs->page_cache->read_page(key, indirect_offset, &block_id, sizeof(block_id));
+        log_debug("indirect_idx:%d, indirect_block_id:%d, block_id:%d\n", block_idx, indirect_block_id, block_id);
         return block_id;
-    } else if (block_idx < 12 + 256 + 256*256) {
-        uint32_t indirect_block = inode->i_block[13];
-        auto page = m_fs->page_cache->get_page(PageKey{indirect_block});
-        uint32_t indirect_block_offset = ((block_idx - 12 - 256)%(256*256));
-        uint32_t double_indirect_block = *(uint32_t*)(page->data + indirect_block_offset*sizeof(uint32_t));
-        uint32_t double_indirect_offset = (block_idx - 12 - 256)%256;
-        auto page2 = m_fs->page_cache->get_page(PageKey{double_indirect_block});
-        uint32_t block_id = *((uint32_t*)(page2->data + double_indirect_offset*sizeof(uint32_t)));
+    }
+    block_idx -= ptrs_per_block;
+    if (block_idx < ptrs_per_block * ptrs_per_block) {
+        auto key = PageKey{inode->i_block[13]};
+        uint32_t indirect_block_offset = block_idx / ptrs_per_block;
+        uint32_t double_indirect_block = 0;
+        if(!m_fs->page_cache->get_page(key)) {
+            return 0;
+        }
+        m_fs->page_cache->read_page(key, indirect_block_offset * sizeof(uint32_t),
+            &double_indirect_block, sizeof(double_indirect_block));
+        uint32_t double_indirect_offset = block_idx % ptrs_per_block;
+        uint32_t block_id = 0;
+        auto key2 = PageKey{double_indirect_block};
+        if(!double_indirect_block || !m_fs->page_cache->get_page(key2)) {
+            return 0;
+        }
+        m_fs->page_cache->read_page(key2, double_indirect_offset * sizeof(uint32_t), &block_id,
+            sizeof(block_id));
         return block_id;
     }
     return 0;
@@ -736,11 +756,20 @@ ssize_t Ext2FileDescriptor::read(void* buffer, size_t size)
         uint32_t data_offset = m_position % block_size;
 
         auto device_block_id = get_block_id(m_position/block_size, inode);
-        auto page = m_fs->page_cache->get_page(PageKey{device_block_id});
+        auto key = PageKey{device_block_id};
+        if(!m_fs->page_cache->get_page(key)) {
+            break;
+        }
 
-        // 复制数据到缓冲区
-        size_t copy_size = min(block_size - data_offset, bytes_to_read);
-        memcpy(static_cast<uint8_t*>(buffer) + total_read, page->data + data_offset, copy_size);
+        // 缓存页可能在高端内存，由read_page在页缓存的锁里kmap读出。buffer在用户空间，
+        // 复制时可能缺页，所以先读到栈上的缓冲区，放掉锁以后再复制给用户
+        uint8_t chunk[256];
+        size_t copy_size = min(min(block_size - data_offset, bytes_to_read), sizeof(chunk));
+        copy_size = m_fs->page_cache->read_page(key, data_offset, chunk, copy_size);
+        if(copy_size == 0) {
+            break;
+        }
+        memcpy(static_cast<uint8_t*>(buffer) + total_read, chunk, copy_size);
 
         m_position += copy_size;
         total_read += copy_size;
@@ -758,7 +787,106 @@ void* Ext2FileDescriptor::mmap(void* addr, size_t length, int prot, int flags, s
     if(!inode) {
         return (void*)(-1);
     }
-    return (void*)(-1);
+    bool is_dir = (inode->mode & 0xF000) == 0x4000;
+    uint32_t file_size = inode->size;
+
+    if(is_dir || length == 0 || (offset & (PAGE_SIZE - 1)) || offset >= file_size) {
+        log_err("mmap: invalid argument\n");
+        delete inode;
+        return (void*)(-1);
+    }
+    if(!(flags & (MAP_SHARED | MAP_PRIVATE))) {
+        log_err("mmap: need MAP_SHARED or MAP_PRIVATE\n");
+        delete inode;
+        return (void*)(-1);
+    }
+    // 缺页时直接映射页缓存页，要求一个文件块正好是一页
+    if(m_fs->super_block->block_size() != PAGE_SIZE || m_fs->device->block_size() != PAGE_SIZE) {
+        log_err("mmap: block size %d is not PAGE_SIZE\n", m_fs->super_block->block_size());
+        delete inode;
+        return (void*)(-1);
+    }
+    bool built = build_mmap_blocks(inode);
+    delete inode;
+    if(!built) {
+        return (void*)(-1);
+    }
+
+    // addr只是提示，总是由内核选择地址；页表项在缺页时才建立
+    uint32_t pte_flags = (prot & PROT_WRITE) ? PAGE_WRITE : 0;
+    auto& user_mm = ProcessManager::get_current_task()->context->user_mm;
+    auto ret = user_mm.allocate_file_area(length, pte_flags, this, offset, flags & MAP_SHARED);
+    if(!ret) {
+        return (void*)(-1);
+    }
+    return ret;
+}
+
+bool Ext2FileDescriptor::build_mmap_blocks(Ext2Inode* inode)
+{
+    uint32_t nr_blocks = (inode->size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t flags;
+    m_mmap_lock.acquire_irqsave(flags);
+    bool fresh = m_mmap_blocks && m_mmap_nr_blocks >= nr_blocks;
+    m_mmap_lock.release_irqrestore(flags);
+    if(fresh) {
+        return true;
+    }
+
+    uint32_t* blocks = new uint32_t[nr_blocks];
+    if(!blocks) {
+        log_err("mmap: no memory for the block map of inode %u\n", m_inode);
+        return false;
+    }
+    for(uint32_t i = 0; i < nr_blocks; i++) {
+        blocks[i] = get_block_id(i, inode);
+    }
+    m_mmap_lock.acquire_irqsave(flags);
+    uint32_t* old = m_mmap_blocks;
+    m_mmap_blocks = blocks;
+    m_mmap_nr_blocks = nr_blocks;
+    m_mmap_lock.release_irqrestore(flags);
+    // 查表的地方都在锁里拿到块号就放锁，旧表可以直接释放
+    delete[] old;
+    return true;
+}
+
+// offset处的页对应的设备块号，超出mmap时的文件大小或者是空洞时返回0
+uint32_t Ext2FileDescriptor::mmap_block_id(size_t offset)
+{
+    uint32_t idx = offset / PAGE_SIZE;
+    uint32_t flags;
+    m_mmap_lock.acquire_irqsave(flags);
+    uint32_t block_id = idx < m_mmap_nr_blocks ? m_mmap_blocks[idx] : 0;
+    m_mmap_lock.release_irqrestore(flags);
+    return block_id;
+}
+
+Page* Ext2FileDescriptor::get_mmap_page(size_t offset)
+{
+    auto block_id = mmap_block_id(offset);
+    return block_id ? m_fs->page_cache->get_page(PageKey{block_id}) : nullptr;
+}
+
+void Ext2FileDescriptor::mark_mmap_dirty(size_t offset)
+{
+    auto block_id = mmap_block_id(offset);
+    if(block_id) {
+        m_fs->page_cache->mark_dirty(PageKey{block_id});
+    }
+}
+
+int Ext2FileDescriptor::sync(size_t offset, size_t length)
+{
+    // 页缓存是整个文件系统共享的，只写回这个范围内的块，别的文件的脏页留给延迟写回
+    // sys_msync已经检查过范围在映射里，不会溢出
+    for(size_t pos = offset; pos < offset + length; pos += PAGE_SIZE) {
+        auto block_id = mmap_block_id(pos);
+        if(block_id) {
+            m_fs->page_cache->flush(PageKey{block_id});
+        }
+    }
+    return 0;
 }
 
 
@@ -771,51 +899,75 @@ ssize_t Ext2FileDescriptor::write(const void* buffer, size_t size)
         return 0;
     }
 
-    uint32_t block_size = m_fs->device->get_info().sector_size;
     const uint8_t* src = static_cast<const uint8_t*>(buffer);
     size_t total_written = 0;
 
+    // 覆盖已有内容时经过页缓存，mmap映射和read都能马上看到新数据，脏页由kworker延迟写回
+    size_t fs_block_size = m_fs->super_block->block_size();
+    size_t old_size = inode->size;
+    while(total_written < size && (size_t)m_position < old_size) {
+        size_t block_offset = m_position % fs_block_size;
+        PageKey key{get_block_id(m_position / fs_block_size, inode)};
+        size_t write_size = min(size - total_written, fs_block_size - block_offset);
+        write_size = min(write_size, old_size - (size_t)m_position);
+        if(!key.block_id || !m_fs->page_cache->get_page(key)) {
+            break;
+        }
+        m_fs->page_cache->write_page(key, block_offset, src + total_written, write_size);
+        total_written += write_size;
+        m_position += write_size;
+    }
+    if(total_written == size || (size_t)m_position < old_size) {
+        delete inode;
+        return total_written;
+    }
+
+    // 追加写：文件最后一个块里剩下的地方经过页缓存，和覆盖写一样；新分配的块直接写设备
+    uint32_t allocated = (old_size + fs_block_size - 1) / fs_block_size;
+    uint8_t* block_data = nullptr;
     while(total_written < size) {
-        // 计算当前块索引和偏移
-        uint32_t block_idx = m_position / block_size;
-        uint32_t block_offset = m_position % block_size;
+        uint32_t block_idx = m_position / fs_block_size;
+        size_t block_offset = m_position % fs_block_size;
+        size_t write_size = min(size - total_written, fs_block_size - block_offset);
 
-        // 需要分配新块的情况
-        if(block_idx >= inode->blocks) {
+        if(block_idx < allocated) {
+            PageKey key{get_block_id(block_idx, inode)};
+            if(!key.block_id || !m_fs->page_cache->get_page(key)) {
+                break;
+            }
+            m_fs->page_cache->write_page(key, block_offset, src + total_written, write_size);
+        } else {
+            // 新块只能挂在直接块上
+            if(block_idx >= 12) {
+                log_err("ext2: append past the direct blocks is not supported\n");
+                break;
+            }
             uint32_t new_block = m_fs->allocate_block();
-            if(!new_block)
+            if(!new_block) {
                 break;
-
+            }
+            if(!block_data) {
+                block_data = new uint8_t[fs_block_size];
+            }
+            memset(block_data, 0, fs_block_size);
+            memcpy(block_data + block_offset, src + total_written, write_size);
+            if(!m_fs->device->write_block(new_block, block_data)) {
+                break;
+            }
+            // 块号可能以前用过，丢掉页缓存里旧的内容
+            m_fs->page_cache->invalidate(PageKey{new_block});
             inode->i_block[block_idx] = new_block;
-            inode->blocks++;
+            inode->blocks += fs_block_size / 512; // i_blocks以512字节为单位
+            allocated = block_idx + 1;
         }
 
-        // 读取现有块数据（如果需要部分写入）
-        uint8_t* block_data = new uint8_t[block_size];
-        if(block_offset > 0 || (size - total_written) < block_size) {
-            m_fs->device->read_block(inode->i_block[block_idx], block_data);
-        }
-
-        // 计算本次写入量
-        size_t write_size = min(size - total_written, block_size - block_offset);
-        memcpy(block_data + block_offset, src + total_written, write_size);
-
-        // 写入块设备
-        if(!m_fs->device->write_block(inode->i_block[block_idx], block_data)) {
-            delete[] block_data;
-            break;
-        }
-
-        // 更新状态
         total_written += write_size;
         m_position += write_size;
-        delete[] block_data;
-
-        // 扩展文件大小
         if(m_position > inode->size) {
             inode->size = m_position;
         }
     }
+    delete[] block_data;
 
     // 更新inode信息
     // inode->mtime = time(nullptr);
@@ -22,15 +22,19 @@ namespace arch {
 
 // APIC定时器相关常量
 #define APIC_TIMER_VECTOR 0x30
+#define APIC_TIMER_ONESHOT 0x0
 #define APIC_TIMER_PERIODIC 0x20000
+#define APIC_TIMER_TSC_DEADLINE 0x40000
 #define APIC_TIMER_DIVIDE_16 0x3
 
 // APIC寄存器定义
 #define LAPIC_LVT_TIMER 0x320
 #define LAPIC_INITIAL_COUNT 0x380
+#define LAPIC_CURRENT_COUNT 0x390
 #define LAPIC_DIVIDE_CONFIG 0x3E0
 
 // APIC ICR相关常量
+#define APIC_ICR_DELIVERY_FIXED 0
 #define APIC_ICR_DELIVERY_INIT 5
 #define APIC_ICR_DELIVERY_SIPI 6
 #define APIC_ICR_PHYSICAL_MODE 0
@@ -42,10 +46,13 @@ namespace arch {
 // 中断向量号定义
 #define IRQ_USER_BASE 0x32
 #define IRQ_IPI 0x37
+// 重新调度IPI，目标CPU检查运行队列并切换任务
+#define IPI_RESCHEDULE_VECTOR 0x41
 
 // MSR寄存器地址
 #define MSR_APIC_BASE 0x1B
 #define MSR_APIC_ENABLE_BIT 11
+#define MSR_TSC_DEADLINE 0x6E0
 
 // PIC端口地址
 #define PIC_MASTER_CMD 0x20
@@ -96,10 +103,20 @@ public:
 // APIC函数声明
 void apic_init();
 void apic_init_timer(uint32_t frequency);
+// 本地APIC定时器是否支持TSC-deadline模式(CPUID.01H:ECX[24])
+bool apic_timer_has_tsc_deadline();
+// 停掉周期中断，TSC到达deadline时触发一次中断
+void apic_timer_set_deadline(uint64_t tsc);
+// 停掉周期中断，倒数count个定时器时钟后触发一次中断
+void apic_timer_set_oneshot(uint32_t count);
+// 周期模式下一个tick的定时器计数值，切到一次性模式以后返回切换前的值
+uint32_t apic_timer_period();
 void apic_send_eoi();
 void apic_enable();
 void apic_send_init(uint32_t target);
 void apic_send_sipi(uint32_t physical_address, uint32_t target);
+// 向目标CPU发送一个固定向量的IPI，可以在中断打开时调用
+void apic_send_ipi(uint32_t vector, uint32_t target);
 uint32_t apic_get_id();
 uint32_t apic_get_cpu_count();
 
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+struct Task;
+
+// FPU/SSE状态的惰性切换
+// 每个CPU启动时打开CR4.OSFXSR/OSXMMEXCPT，之后用户态可以使用x87、MMX和SSE指令。
+// 任务切换时不保存恢复FPU寄存器，只置上CR0.TS，新任务第一次使用FPU指令时触发#NM，
+// 在#NM里把它的状态装回寄存器。换出时只有这个时间片里用过FPU的任务才需要FXSAVE。
+// 寄存器里的状态属于哪个任务记在per-CPU的fpu_owner里，任务切回来时如果还是它的，
+// 直接清掉TS，连#NM都不用触发。
+// 内核默认不使用FPU，需要SSE的代码放在kernel_fpu_begin/end之间
+namespace arch {
+
+constexpr uint32_t FXSAVE_SIZE = 512;
+constexpr uint32_t FXSAVE_ALIGN = 16;
+constexpr uint32_t MXCSR_DEFAULT = 0x1F80; // 屏蔽所有SIMD浮点异常
+
+// 任务的FPU状态，Task是kmalloc出来的，不保证16字节对齐，多留一点空间在里面对齐
+struct FpuState {
+    uint8_t buf[FXSAVE_SIZE + FXSAVE_ALIGN - 1];
+    bool used = false;  // 用过FPU，area()里保存着有效状态
+    // 状态最后一次装入的是哪个CPU的寄存器。
+    // 回收的任务地址可能被新任务复用，新任务是-1，不会误认为fpu_owner里的是它
+    int last_cpu = -1;
+
+    void* area() { return (void*)(((uintptr_t)buf + FXSAVE_ALIGN - 1) & ~(uintptr_t)(FXSAVE_ALIGN - 1)); }
+};
+
+// 每个CPU的FPU切换统计
+struct FpuStats {
+    uint32_t traps;     // #NM次数，每次都要装入任务的状态
+    uint32_t saves;     // FXSAVE次数
+    uint32_t lazy_hits; // 切回来时寄存器里还是它的状态，不用#NM
+};
+
+/**
+ * @brief 在每个CPU上调用一次，检测FXSR和SSE，设置CR0和CR4，
+ * 之后置上TS，第一个使用FPU的任务会触发#NM
+ */
+void fpu_init();
+
+// CPU支持SSE2，内核可以用它复制页面
+bool fpu_has_sse2();
+
+/**
+ * @brief 任务切换时调用，调用方已关中断。
+ * prev这个时间片里用过FPU就保存它的状态；next的状态还在本CPU的寄存器里时清掉TS，否则置上TS
+ * @param prev 换出的任务，可以为nullptr，已经退出的任务不保存
+ * @param next 换入的任务
+ */
+void fpu_switch(Task* prev, Task* next);
+
+/**
+ * @brief 开始使用FPU/SSE，关中断，当前任务的状态如果在寄存器里就先保存
+ * @param flags 输出进入前的EFLAGS，传给kernel_fpu_end
+ */
+void kernel_fpu_begin(uint32_t& flags);
+// 结束使用FPU，置上TS，用户任务下次使用FPU时从保存的状态恢复
+void kernel_fpu_end(uint32_t flags);
+
+// 复制和清零一个页面，地址按页对齐，支持SSE2时一次处理16字节
+void copy_page(void* to, const void* from);
+void clear_page(void* page);
+
+void fpu_cpu_stats(uint32_t cpu, FpuStats& stats);
+
+} // namespace arch
+
+// #NM异常处理，interrupt.asm里调用
+extern "C" void device_not_available_handler();
@@ -64,6 +64,15 @@ struct CallGateDescriptor {
 #define GDT_TYPE_TSS 0x09       // TSS类型
 #define GDT_TYPE_CALL_GATE 0x0C // 调用门类型
 
+// GDT布局：0~4是空段和内核、用户的代码段数据段，之后每个CPU一个TSS，再之后每个CPU一个per-CPU数据段，
+// 最后是双重错误任务门用的TSS。
+// CPU的TSS选择子加上PERCPU_SEL_DELTA就是它的per-CPU段选择子，中断入口用str算出gs
+#define GDT_TSS_BASE 5
+#define GDT_PERCPU_BASE (GDT_TSS_BASE + MAX_CPUS)
+#define GDT_DF_TSS (GDT_PERCPU_BASE + MAX_CPUS)
+#define GDT_ENTRIES (GDT_DF_TSS + 1)
+#define PERCPU_SEL_DELTA (MAX_CPUS * 8)
+
 struct GDTPointer {
     uint16_t limit;
     uintptr_t base;
@@ -76,13 +85,21 @@ public:
 
     static void updateTSS(uint32_t cpu, uint32_t esp0, uint32_t ss0);
     static void updateTSSCR3(uint32_t cpu, uint32_t cr3);
+    /**
+     * @brief 设置双重错误任务的入口，IDT的8号向量设成指向GDT_DF_TSS的任务门以后生效
+     * @param eip 入口函数，不返回
+     * @param esp 独立的栈顶
+     * @param cr3 能访问内核地址空间的页目录，所有进程的内核部分相同，用哪个都可以
+     */
+    static void setDoubleFaultTask(uint32_t eip, uint32_t esp, uint32_t cr3);
     static void setEntry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
     static void setCallGate(
         int index, uint16_t selector, uint32_t offset, uint8_t dpl, uint8_t param_count);
     static void loadGDT();
     static void loadTR(uint32_t cpu);
-    static GDTEntry entries[6 + MAX_CPUS];
+    static GDTEntry entries[GDT_ENTRIES];
     static TSSEntry tss[MAX_CPUS];
+    static TSSEntry df_tss; // 所有CPU共用，两个CPU同时双重错误时后一个因为TSS忙变成三重错误
     static GDTPointer gdtPointer;
 };
 
@@ -3,6 +3,8 @@
 
 #include <cstdint>
 
+#include <arch/x86/percpu.h>
+
 // 处理器异常中断
 #define INT_DIVIDE_ERROR 0x00       // 除零错误
 #define INT_DEBUG 0x01              // 调试异常
@@ -106,4 +108,10 @@ private:
     arch::InterruptController* controller;
 };
 
+// 本CPU正在处理的设备中断的嵌套层数，handleInterrupt里增减
+DECLARE_PER_CPU(uint32_t, irq_nesting);
+
+// 是否在设备中断处理里，这时不能睡眠
+inline bool in_interrupt() { return this_cpu_read(irq_nesting) != 0; }
+
 #endif // ARCH_X86_INTERRUPT_H
\ No newline at end of file
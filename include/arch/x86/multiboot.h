@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+// Multiboot 1 规范中内核用到的部分
+
+constexpr uint32_t MULTIBOOT_BOOTLOADER_MAGIC = 0x2BADB002; // 引导器传入eax的魔数
+constexpr uint32_t MULTIBOOT_INFO_MEMORY = 0x1;             // mem_lower/mem_upper有效
+constexpr uint32_t MULTIBOOT_INFO_CMDLINE = 0x4;            // cmdline有效
+constexpr uint32_t MULTIBOOT_INFO_MEM_MAP = 0x40;           // mmap_*有效
+constexpr uint32_t MULTIBOOT_MEMORY_AVAILABLE = 1;          // 可用内存
+
+struct multiboot_info {
+    uint32_t flags;
+    uint32_t mem_lower; // KB
+    uint32_t mem_upper; // KB, 从1MB开始
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed));
+
+// 内存映射表项，size不包含自身
+struct multiboot_mmap_entry {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed));
@@ -13,6 +13,29 @@ constexpr uint32_t PAGE_ACCESSED = 0x20;      // 已访问 (位5)
 constexpr uint32_t PAGE_DIRTY = 0x40;         // 已修改 (位6)
 constexpr uint32_t PAGE_GLOBAL = 0x100;       // 全局 (位8)
 constexpr uint32_t PAGE_COW = 0x200;          // 写时复制 (位9), 系统自定义位
+constexpr uint32_t PAGE_SHARED = 0x400;       // 共享映射 (位10), 系统自定义位, fork时不做COW
+constexpr uint32_t PAGE_SWAPPED = 0x800;      // 已换出 (位11), 系统自定义位, 只在页面不存在时有效, 地址部分是交换槽位号
+
+// CONFIG_PAE: 三级页表(PDPT -> PD -> PT)，页表项为64位，可以寻址4GB以上的物理内存
+// 为了让上层代码不必区分两种模式，PAE下4个页目录在物理上连续存放，
+// 当作一个2048项的扁平页目录使用，PDPT只在加载CR3时使用
+#ifdef CONFIG_PAE
+using pte_t = uint64_t;
+constexpr pte_t PAGE_NX = 1ULL << 63;                   // 禁止执行 (位63)，需要EFER.NXE
+constexpr pte_t PTE_ADDR_MASK = 0x000FFFFFFFFFF000ULL; // 页表项中的物理地址部分
+constexpr uint32_t PTRS_PER_PT = 512;                   // 每个页表512项，覆盖2MB
+constexpr uint32_t PTRS_PER_PGD = 2048;                 // 4个页目录 * 512项
+constexpr uint32_t PGD_SHIFT = 21;
+constexpr uint32_t PGD_ORDER = 2;                       // 页目录占用4个连续物理页
+#else
+using pte_t = uint32_t;
+constexpr pte_t PAGE_NX = 0;                            // 非PAE模式不支持NX
+constexpr pte_t PTE_ADDR_MASK = 0xFFFFF000;
+constexpr uint32_t PTRS_PER_PT = 1024;                  // 每个页表1024项，覆盖4MB
+constexpr uint32_t PTRS_PER_PGD = 1024;
+constexpr uint32_t PGD_SHIFT = 22;
+constexpr uint32_t PGD_ORDER = 0;
+#endif
 
 // 4M 以后开始分配内存
 // 4M -> 4M + 4K 是PDT
@@ -30,16 +53,23 @@ constexpr uint32_t DMA_ZONE_END = 0x1000; // 16MB (4096页)
 constexpr uint32_t NORMAL_ZONE_START = DMA_ZONE_END;
 constexpr uint32_t NORMAL_ZONE_END = 0x38000; // 896MB (229376页)
 constexpr uint32_t HIGH_ZONE_START = NORMAL_ZONE_END;
+#ifdef CONFIG_PAE
+constexpr uint32_t HIGH_ZONE_END = 0x1000000; // 64GB, PAE最多支持36位物理地址
+#else
 constexpr uint32_t HIGH_ZONE_END = 0x100000; // 4GB (1048576页)
+#endif
 
 // 虚拟地址空间布局
 constexpr uint32_t KERNEL_DIRECT_MAP_START = 0xC0000000; // 3GB (内核空间起始地址)
 constexpr uint32_t KERNEL_DIRECT_MAP_END =
     0xF8000000; // 3GB + 896MB (直接映射区，用于映射DMA_ZONE和NORMAL_ZONE)
-constexpr uint32_t VMALLOC_START = KERNEL_DIRECT_MAP_END; // 3GB + 896MB
-constexpr uint32_t VMALLOC_END = 0xF8000000; // 3GB + 896MB (VMALLOC区域，64MB，用于非连续内存分配)
 constexpr uint32_t KMAP_START = 0xF8000000;  // 3GB + 896MB
 constexpr uint32_t KMAP_END = 0xFC000000;    // 3GB + 960MB (KMAP区域，64MB，用于临时内核映射)
+constexpr uint32_t VMALLOC_START = KMAP_END; // 3GB + 960MB
+constexpr uint32_t VMALLOC_END = 0xFE000000; // 3GB + 992MB (VMALLOC区域，32MB，用于非连续内存分配)
+// VMALLOC区域的前16MB专门放内核栈，按固定大小的槽位分配
+constexpr uint32_t KSTACK_START = VMALLOC_START;
+constexpr uint32_t KSTACK_END = VMALLOC_START + 0x1000000;
 } // namespace MemoryConstants
 
 // 4M 以后开始分配内存
@@ -48,9 +78,25 @@ constexpr uint32_t KMAP_END = 0xFC000000;    // 3GB + 960MB (KMAP区域，64MB
 // 以上是指物理内存，不需要虚拟地
 
 constexpr uint32_t PAGE_DIRECTORY_ADDR = 0x400000; // 4MB地址处是页目录
+#ifdef CONFIG_PAE
+// PAE: 4MB -> 4MB + 16K 是4个页目录, 之后是PDPT和前4M的2个页表
+constexpr uint32_t K_PDPT_ADDR = 0x404000;         // 内核PDPT
+constexpr uint32_t K_FIRST_4M_PT = 0x405000;       // 前4M页表, 2个
+constexpr uint32_t K_PAGE_TABLE_START = 0x407000;  // 直接映射区页表
+constexpr uint32_t K_PAGE_TABLE_COUNT = 448;       // 448 * 512page/table * 4KB/page = 896MB
+#else
 constexpr uint32_t K_FIRST_4M_PT = 0x401000;       // 4MB + 4KB地址处是前4M页表
 constexpr uint32_t K_PAGE_TABLE_START = 0x402000;  // 4MB + 8KB地址处是页表
 constexpr uint32_t K_PAGE_TABLE_COUNT = 224;       // 224 * 1024page/table * 4KB/page = 896MB
+#endif
+// KMAP区域的页表紧跟在直接映射区页表之后，所有地址空间共享
+constexpr uint32_t K_KMAP_PT_START = K_PAGE_TABLE_START + K_PAGE_TABLE_COUNT * 0x1000;
+constexpr uint32_t K_KMAP_PT_COUNT =
+    (MemoryConstants::KMAP_END - MemoryConstants::KMAP_START) >> PGD_SHIFT;
+// VMALLOC区域的页表紧跟在KMAP页表之后，同样由所有地址空间共享
+constexpr uint32_t K_VMALLOC_PT_START = K_KMAP_PT_START + K_KMAP_PT_COUNT * 0x1000;
+constexpr uint32_t K_VMALLOC_PT_COUNT =
+    (MemoryConstants::VMALLOC_END - MemoryConstants::VMALLOC_START) >> PGD_SHIFT;
 
 static const uint32_t PAGE_SIZE = 0x1000;      // 页面大小
 static const uint32_t USER_START = 0x40000000; // 用户空间起始地址
@@ -60,7 +106,17 @@ static const uint32_t USER_END = 0xC0000000;   // 用户空间结束地址
 
 using PFN = uint32_t;
 using VADDR = void*;
+#ifdef CONFIG_PAE
+using PADDR = uint64_t;
+#else
 using PADDR = uint32_t;
+#endif
+
+// 页目录项/页表项下标
+inline uint32_t pgd_index(uint32_t vaddr) { return vaddr >> PGD_SHIFT; }
+inline uint32_t pt_index(uint32_t vaddr) { return (vaddr >> 12) & (PTRS_PER_PT - 1); }
+// 页表项中的物理地址
+inline PADDR pte_paddr(pte_t entry) { return static_cast<PADDR>(entry & PTE_ADDR_MASK); }
 
 
 // 页面状态标志
@@ -84,18 +140,25 @@ struct page {
 };
 
 struct PageDirectory {
-    uint32_t entries[1024];
+    pte_t entries[PTRS_PER_PGD];
 } __attribute__((aligned(4096)));
 
 struct PageTable {
-    uint32_t entries[1024];
+    pte_t entries[PTRS_PER_PT];
 } __attribute__((aligned(4096)));
 
+#ifdef CONFIG_PAE
+// 页目录指针表，CR3指向它，要求32字节对齐且位于4GB以下
+struct PageDirPointerTable {
+    uint64_t entries[4];
+} __attribute__((aligned(32)));
+#endif
+
 void printPDPTE(VADDR vaddr);
 void printPDE(PageDirectory* pdVirt, uint32_t index);
 void printPD(PageDirectory* pdVirt, uint32_t startIndex, uint32_t count);
 void __printPDPTE(VADDR vaddr, PageDirectory* pdVirt);
-void printPTEFlags(uint32_t pte);
+void printPTEFlags(pte_t pte);
 
 
 void PagingValidate(PageDirectory * pd);
@@ -117,8 +180,25 @@ public:
     static void enablePaging();
     static void disablePaging();
 
+    /**
+     * @brief 根据页目录计算要加载到CR3的值
+     * 非PAE模式下就是页目录的物理地址；PAE模式下为页目录分配一个PDPT，返回PDPT的物理地址
+     * @param pgdPhys 页目录物理地址(PAE下为4个连续页的起始地址)
+     * @return CR3的值，0表示失败
+     */
+    static uint32_t makeCr3(PADDR pgdPhys);
+    /**
+     * @brief 释放makeCr3分配的资源
+     * @param cr3 makeCr3的返回值
+     */
+    static void releaseCr3(uint32_t cr3);
+    // 内核页目录对应的CR3
+    static uint32_t kernelCr3();
+    // 是否已开启NX
+    static bool nxEnabled() { return nx_enabled; }
+
     // 映射虚拟地址到物理地址
-    void mapPage(uint32_t virt_addr, uint32_t phys_addr, uint32_t flags);
+    void mapPage(uint32_t virt_addr, PADDR phys_addr, pte_t flags);
     void unmapPage(uint32_t virt_addr);
 
     // 获取页表项标志位
@@ -140,6 +220,7 @@ public:
 private:
     static void copyKernelSpace(PageDirectory* src, PageDirectory* dst);
     PageDirectory* curPgdVirt;
+    static bool nx_enabled;
 };
 
-#endif // ARCH_X86_PAGING_H
\ No newline at end of file
+#endif // ARCH_X86_PAGING_H
\ No newline at end of file
@@ -3,45 +3,72 @@
 #include <arch/x86/gdt.h>
 #include <arch/x86/atomic.h>
 
-// 声明per_cpu_offset数组
-// extern unsigned long __per_cpu_offset[MAX_CPUS];
-
-unsigned long get_cpu_id();
-
-// // 定义per-cpu变量宏
-// #define DEFINE_PER_CPU(type, name) \
-//     type name
-//
-// // 获取当前CPU的per-cpu变量指针
-// #define get_cpu_var(name) \
-//     ({ \
-//         typeof(name)* __ptr = (typeof(name)*)(__per_cpu_offset[get_cpu_id()] + (unsigned long)(&name)); \
-//         __ptr; \
-//     })
-//
-// // 获取当前CPU的per-cpu变量引用
-// #define get_cpu_ptr(name) \
-//     ({ \
-//         typeof(&(name)) __ptr = (typeof(&(name)))(__per_cpu_offset[get_cpu_id()] + (unsigned long)(&name)); \
-//         __ptr; \
-//     })
-//
-// // 获取其他CPU的per-cpu变量指针
-// #define get_cpu_var_smp(cpu, name) \
-//     ({ \
-//         typeof(name)* __ptr = (typeof(name)*)(__per_cpu_offset[cpu] + (unsigned long)(&name)); \
-//         __ptr; \
-//     })
+#include <cstdint>
+
+// 每CPU数据区
+// DEFINE_PER_CPU定义的变量放在.percpu段里，链接出来的这一段就是CPU 0的数据，
+// 其他CPU的副本在启动时从它复制，每份按缓存行对齐，不同CPU的数据不会落在同一个缓存行里。
+// 每个CPU在GDT里有一个数据段，基址是它的副本相对.percpu段的偏移，内核态的gs装的就是这个段，
+// 读写本CPU的变量是一条带gs前缀的指令，不用再读本地APIC的ID寄存器。
+// CPU 0的偏移是0，gs还是平坦数据段的时候(启动早期)访问到的就是CPU 0的数据
+#define DEFINE_PER_CPU(type, name) __attribute__((section(".percpu"))) __typeof__(type) name
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) name
+
+// 本CPU的变量，只支持4字节的类型(整数和指针)
+#define this_cpu_read(var) arch::percpu_read(&(var))
+#define this_cpu_write(var, val) arch::percpu_write(&(var), (__typeof__(var))(val))
+// 指定CPU的变量，可以读写
+#define per_cpu(var, cpu) (*(__typeof__(var)*)((char*)&(var) + arch::per_cpu_offset[cpu]))
+// 本CPU副本的地址
+#define this_cpu_ptr(var) ((__typeof__(var)*)((char*)&(var) + this_cpu_read(arch::this_cpu_off)))
 
 void print_pointer(void *ptr);
 namespace arch {
 
+constexpr uint32_t PERCPU_ALIGN = 64; // 缓存行大小
+
+// 各CPU副本相对.percpu段的偏移
+extern uint32_t per_cpu_offset[MAX_CPUS];
+DECLARE_PER_CPU(uint32_t, cpu_number);
+DECLARE_PER_CPU(uint32_t, this_cpu_off);
+
+template<typename T>
+inline T percpu_read(const T* var)
+{
+    static_assert(sizeof(T) == 4, "per-cpu access supports 4-byte types only");
+    T ret;
+    asm volatile("movl %%gs:%1, %0" : "=r"(ret) : "m"(*var));
+    return ret;
+}
+
+template<typename T>
+inline void percpu_write(T* var, T val)
+{
+    static_assert(sizeof(T) == 4, "per-cpu access supports 4-byte types only");
+    asm volatile("movl %1, %%gs:%0" : "=m"(*var) : "ri"(val));
+}
+
+// 当前gs里的段选择子，内核态就是本CPU的per-CPU段
+inline uint16_t percpu_gs()
+{
+    uint16_t sel;
+    asm volatile("mov %%gs, %0" : "=r"(sel));
+    return sel;
+}
+
+/**
+ * @brief 复制各CPU的数据区，设置GDT里的per-CPU段
+ * 在BSP上初始化GDT之后、初始化调度器和启动其他CPU之前调用，此时CPU 0的数据还是初始值
+ */
+void setup_per_cpu_areas();
+// 本CPU的per-CPU段装进gs，加载GDT之后调用，之后per-CPU变量访问的是本CPU的副本
+void percpu_load_gs(uint32_t cpu);
 
 // 初始化每CPU数据区
 void cpu_init_percpu();
 
 // 获取当前CPU ID
-unsigned int get_cpu_id();
+inline unsigned int get_cpu_id() { return this_cpu_read(cpu_number); }
 
 template<typename T>
 class PerCPU {
@@ -77,4 +104,4 @@ private:
     T* data_[MAX_CPUS] = {nullptr};
 };
 
-} // namespace arch
\ No newline at end of file
+} // namespace arch
@@ -0,0 +1,73 @@
+#ifndef ARCH_X86_RWLOCK_H
+#define ARCH_X86_RWLOCK_H
+
+#include <cstdint>
+
+#include "arch/x86/spinlock.h"
+
+// 读写自旋锁
+// 读的一方只把计数加1，多个CPU可以同时读，互相不等待；写的一方先拿到写者之间的SpinLock，
+// 再置上WRITER位，等已经进去的读者走完。WRITER位置上以后新来的读者退回去等，
+// 写者不会被源源不断的读者饿死。全零就是没有持有的锁。
+// 和SpinLock一样，读写两边都可能在中断里用时要用irqsave版本
+class RWLock {
+public:
+    constexpr RWLock() : count(0), writer_lock() {}
+    // lock_class用于写者之间的锁的统计
+    constexpr explicit RWLock(LockClass* lock_class) : count(0), writer_lock(lock_class) {}
+
+    void read_lock() {
+        while (__atomic_add_fetch(&count, 1, __ATOMIC_ACQUIRE) & WRITER) {
+            // 有写者持有或者在等，退回去等它做完
+            __atomic_sub_fetch(&count, 1, __ATOMIC_RELAXED);
+            while (__atomic_load_n(&count, __ATOMIC_RELAXED) & WRITER) {
+                asm volatile("pause");
+            }
+        }
+    }
+
+    void read_unlock() {
+        __atomic_sub_fetch(&count, 1, __ATOMIC_RELEASE);
+    }
+
+    void write_lock() {
+        writer_lock.acquire();
+        __atomic_fetch_or(&count, WRITER, __ATOMIC_ACQUIRE);
+        while (__atomic_load_n(&count, __ATOMIC_ACQUIRE) != WRITER) {
+            asm volatile("pause");
+        }
+    }
+
+    void write_unlock() {
+        __atomic_fetch_and(&count, ~WRITER, __ATOMIC_RELEASE);
+        writer_lock.release();
+    }
+
+    void read_lock_irqsave(uint32_t& flags) {
+        asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+        read_lock();
+    }
+
+    void read_unlock_irqrestore(uint32_t flags) {
+        read_unlock();
+        asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+    }
+
+    void write_lock_irqsave(uint32_t& flags) {
+        asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+        write_lock();
+    }
+
+    void write_unlock_irqrestore(uint32_t flags) {
+        write_unlock();
+        asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+    }
+
+private:
+    static constexpr uint32_t WRITER = 1u << 31; // 写者持有或者正在等读者走完
+
+    volatile uint32_t count; // 低31位是读者数
+    SpinLock writer_lock;    // 写者之间互斥
+};
+
+#endif // ARCH_X86_RWLOCK_H
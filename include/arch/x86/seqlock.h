@@ -0,0 +1,64 @@
+#ifndef ARCH_X86_SEQLOCK_H
+#define ARCH_X86_SEQLOCK_H
+
+#include <cstdint>
+
+#include "arch/x86/spinlock.h"
+
+// 顺序锁
+// 适合很小、写得少读得多的数据，例如32位上的64位计数。写的一方在修改前后各把序号加1，
+// 修改期间序号是奇数；读的一方不写任何共享数据，读之前和读之后序号相同且是偶数才算读到一致的值，
+// 否则重读：
+//     uint32_t seq;
+//     do {
+//         seq = lock.read_begin();
+//         value = data;
+//     } while (lock.read_retry(seq));
+// 写者之间用SpinLock互斥，写者不等读者，读者可能要重读几次。
+// 有读者在中断里时写者要关中断，否则中断里的读者会一直等被它打断的写者
+class SeqLock {
+public:
+    constexpr SeqLock() : sequence(0), writer_lock() {}
+    constexpr explicit SeqLock(LockClass* lock_class) : sequence(0), writer_lock(lock_class) {}
+
+    uint32_t read_begin() const {
+        uint32_t seq;
+        while ((seq = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE)) & 1) {
+            asm volatile("pause");
+        }
+        return seq;
+    }
+
+    // 读到的数据不一致，需要重读
+    bool read_retry(uint32_t seq) const {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&sequence, __ATOMIC_RELAXED) != seq;
+    }
+
+    void write_lock() {
+        writer_lock.acquire();
+        __atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    void write_unlock() {
+        __atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELEASE);
+        writer_lock.release();
+    }
+
+    void write_lock_irqsave(uint32_t& flags) {
+        asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+        write_lock();
+    }
+
+    void write_unlock_irqrestore(uint32_t flags) {
+        write_unlock();
+        asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+    }
+
+private:
+    volatile uint32_t sequence; // 奇数表示写者正在修改
+    SpinLock writer_lock;
+};
+
+#endif // ARCH_X86_SEQLOCK_H
@@ -3,31 +3,110 @@
 
 #include <cstdint>
 
+// 锁的统计(lockstat)
+// 同一类用途的锁(例如所有CPU的运行队列锁)共用一个LockClass，定义CONFIG_LOCKSTAT时
+// 统计加锁次数、需要等待的次数、等待周期数的分布和最长的持有时间。
+// 没有指定类的锁不统计；没有定义CONFIG_LOCKSTAT时LockClass只是一个名字，加锁路径上没有额外的代码
+
+// 等待周期数的分布，第i个桶是[256*4^(i-1), 256*4^i)，第0个桶小于256，最后一个桶不封顶
+constexpr uint32_t LOCKSTAT_WAIT_BUCKETS = 8;
+
+struct LockClass {
+    const char* name;
+    LockClass* next;                // 已经登记的类串成链表，第一次加锁时登记
+    volatile uint32_t registered;
+    volatile uint32_t acquisitions; // 加锁次数
+    volatile uint32_t contended;    // 加锁时锁已经被持有的次数
+    volatile uint32_t wait_hist[LOCKSTAT_WAIT_BUCKETS];
+    uint32_t max_wait_cycles;
+    uint32_t max_hold_cycles;       // 从加锁到解锁的最长周期数
+};
+
+// 全局对象不执行构造函数，用聚合初始化，除了名字都是0
+#define DEFINE_LOCK_CLASS(var, lock_name) LockClass var = {lock_name, nullptr, 0, 0, 0, {}, 0, 0}
+
+#ifdef CONFIG_LOCKSTAT
+// 以下在spinlock.cpp里实现
+void lockstat_acquired(LockClass* cls, uint32_t wait_cycles, bool contended);
+void lockstat_released(LockClass* cls, uint32_t hold_cycles);
+// 已经登记的第一个类，沿next遍历
+LockClass* lockstat_classes();
+// 所有已经登记的类的统计清零
+void lockstat_reset();
+
+static inline uint32_t lockstat_cycles()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+#endif
+
+// 排队自旋锁(ticket lock)
+// 加锁时取号(next加1)，等到owner等于自己的号；解锁时owner加1，交给下一个号。
+// 按取号的先后得到锁，不会有CPU一直抢不到；等待时只读owner，不会反复写同一个缓存行。
+// 全零就是没有持有的锁
 class SpinLock {
 public:
-    SpinLock() : locked(0) {}
-    
-    // 拷贝构造函数
-    SpinLock([[maybe_unused]] const SpinLock& other) : locked(0) {}
-    
-    // 赋值运算符
+    constexpr SpinLock() : owner(0), next(0)
+#ifdef CONFIG_LOCKSTAT
+        , cls(nullptr), hold_start(0)
+#endif
+    {}
+
+    constexpr explicit SpinLock([[maybe_unused]] LockClass* lock_class) : owner(0), next(0)
+#ifdef CONFIG_LOCKSTAT
+        , cls(lock_class), hold_start(0)
+#endif
+    {}
+
+    // 拷贝出来的是没有持有的锁，统计类相同
+    SpinLock([[maybe_unused]] const SpinLock& other) : owner(0), next(0)
+#ifdef CONFIG_LOCKSTAT
+        , cls(other.cls), hold_start(0)
+#endif
+    {}
+
     SpinLock& operator=(const SpinLock& other) {
         // 自赋值检查
         if (this != &other) {
             // 确保锁是释放状态
-            locked = 0;
+            owner = 0;
+            next = 0;
+#ifdef CONFIG_LOCKSTAT
+            cls = other.cls;
+#endif
         }
         return *this;
     }
 
     void acquire() {
-        while(__atomic_test_and_set(&locked, __ATOMIC_ACQUIRE)) {
-            asm volatile("pause");
+        uint16_t ticket = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED);
+        bool contended = __atomic_load_n(&owner, __ATOMIC_ACQUIRE) != ticket;
+#ifdef CONFIG_LOCKSTAT
+        uint32_t start = (cls && contended) ? lockstat_cycles() : 0;
+#endif
+        if (contended) {
+            while (__atomic_load_n(&owner, __ATOMIC_ACQUIRE) != ticket) {
+                asm volatile("pause");
+            }
+        }
+#ifdef CONFIG_LOCKSTAT
+        if (cls) {
+            hold_start = lockstat_cycles();
+            lockstat_acquired(cls, contended ? hold_start - start : 0, contended);
         }
+#endif
     }
 
     void release() {
-        __atomic_clear(&locked, __ATOMIC_RELEASE);
+#ifdef CONFIG_LOCKSTAT
+        if (cls) {
+            lockstat_released(cls, lockstat_cycles() - hold_start);
+        }
+#endif
+        // 只有持有者写owner
+        __atomic_store_n(&owner, (uint16_t)(owner + 1), __ATOMIC_RELEASE);
     }
 
     // 保存中断状态并获取锁
@@ -44,7 +123,12 @@ public:
     }
 
 private:
-    volatile uint8_t locked;
+    volatile uint16_t owner; // 正在持有锁的号
+    volatile uint16_t next;  // 下一个取到的号
+#ifdef CONFIG_LOCKSTAT
+    LockClass* cls;
+    uint32_t hold_start;     // 加锁时的TSC低32位，只有持有者读写
+#endif
 };
 
 // 全局函数封装
@@ -56,4 +140,4 @@ inline void spin_unlock(SpinLock* lock) {
     if (lock) lock->release();
 }
 
-#endif // ARCH_X86_SPINLOCK_H
\ No newline at end of file
+#endif // ARCH_X86_SPINLOCK_H
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+namespace arch {
+
+inline uint64_t rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * @brief 64位数除以32位数，内核里没有__udivdi3，拆成两次32位divl
+ * @param rem 输出余数，可以为nullptr
+ */
+inline uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t* rem)
+{
+    uint32_t hi = (uint32_t)(dividend >> 32);
+    uint32_t lo = (uint32_t)dividend;
+    uint32_t q_hi = hi / divisor;
+    uint32_t r = hi % divisor;
+    uint32_t q_lo;
+    // r < divisor，商一定在32位以内
+    asm("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(divisor));
+    if(rem) {
+        *rem = r;
+    }
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+inline uint64_t div_u64(uint64_t dividend, uint32_t divisor)
+{
+    return div_u64_rem(dividend, divisor, nullptr);
+}
+
+// a * mul >> shift(shift <= 32)，a拆成高低32位分别乘，不需要128位乘法
+inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift)
+{
+    uint32_t lo = (uint32_t)a;
+    uint32_t hi = (uint32_t)(a >> 32);
+    uint64_t ret = ((uint64_t)lo * mul) >> shift;
+    if(hi) {
+        ret += ((uint64_t)hi * mul) << (32 - shift);
+    }
+    return ret;
+}
+
+// 用PIT通道2测量TSC频率，只在BSP启动时调用一次，调用方已关中断
+void tsc_calibrate();
+// TSC频率(kHz)，还没有测量时为0
+uint32_t tsc_khz();
+// 启动以来的纳秒数
+uint64_t tsc_boot_ns();
+uint64_t tsc_cycles_to_ns(uint64_t cycles);
+uint64_t tsc_ns_to_cycles(uint64_t ns);
+// 把启动以来的纳秒数换成TSC值
+uint64_t tsc_from_boot_ns(uint64_t ns);
+
+} // namespace arch
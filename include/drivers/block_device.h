@@ -2,6 +2,8 @@
 #include <stddef.h>
 #include <cstdint>
 
+#include "arch/x86/spinlock.h"
+
 namespace kernel {
 
 // 块设备的基本参数
@@ -48,10 +50,10 @@ private:
     BlockDeviceInfo info;
 };
 
-// 物理磁盘设备实现
+// 物理磁盘设备实现，主IDE通道上的ATA硬盘，drive为0是主盘，1是从盘
 class DiskDevice : public BlockDevice {
 public:
-    DiskDevice();
+    explicit DiskDevice(uint8_t drive = 0);
     virtual ~DiskDevice();
 
     // 初始化磁盘设备
@@ -65,8 +67,14 @@ public:
     virtual void sync() override;
 
 private:
+    // 选中本设备时写入驱动器寄存器(0x1F6)的值
+    uint8_t drive_select() const { return 0xE0 | (drive << 4); }
+
+    uint8_t drive;
     uint32_t block_size;
     BlockDeviceInfo info;
+    // 主从盘共用一组端口，一次扇区读写要在锁内完成
+    static SpinLock channel_lock;
 };
 
 } // namespace kernel
@@ -203,6 +203,9 @@ public:
     ssize_t read(void* buffer, size_t size) override;
     ssize_t write(const void* buffer, size_t size) override;
     void *mmap(void* addr, size_t length, int prot, int flags, size_t offset) override;
+    Page* get_mmap_page(size_t offset) override;
+    void mark_mmap_dirty(size_t offset) override;
+    int sync(size_t offset, size_t length) override;
     int seek([[maybe_unused]] size_t offset) override;
     int close() override;
     int iterate([[maybe_unused]] void* buffer, [[maybe_unused]] size_t buffer_size, [[maybe_unused]] uint32_t* pos) override;
@@ -213,7 +216,15 @@ private:
     off_t m_position = 0;
     Ext2FileSystem* m_fs;
 
+    // mmap时建立的块号表，第i项是文件第i页的设备块号。缺页、标脏和写回直接查表，
+    // 不用每次读inode、走间接块。文件变长以后再次mmap时重建
+    uint32_t* m_mmap_blocks = nullptr;
+    uint32_t m_mmap_nr_blocks = 0;
+    SpinLock m_mmap_lock;
+
     uint32_t get_block_id(uint32_t block_idx, Ext2Inode *inode);
+    bool build_mmap_blocks(Ext2Inode* inode);
+    uint32_t mmap_block_id(size_t offset);
 };
 
 } // namespace kernel
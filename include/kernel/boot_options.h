@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+
+// 内核启动参数
+// 引导器通过multiboot传入命令行，例如grub.cfg里的 multiboot /boot/kernel.bin isolcpus=2-3，
+// 参数之间用空格分隔，形式是name或name=value
+class BootOptions
+{
+public:
+    static constexpr uint32_t CMDLINE_MAX = 256;
+
+    /**
+     * @brief 保存multiboot传入的命令行，必须在开启分页前调用
+     * @param magic 引导器传入的魔数
+     * @param mbi_phys multiboot_info的物理地址
+     */
+    static void init(uint32_t magic, uint32_t mbi_phys);
+
+    static const char* cmdline() { return buffer; }
+
+    /**
+     * @brief 查找参数
+     * @param name 参数名
+     * @param len 输出，值的长度(到空格或命令行结尾)
+     * @return 值的起始位置，没有"="的参数返回指向空串的指针，找不到返回nullptr
+     */
+    static const char* get(const char* name, uint32_t& len);
+
+    // 参数的值是off，例如nohz=off
+    static bool is_off(const char* name);
+
+    // isolcpus=1,3-5 指定的CPU掩码，这些CPU只运行绑定到它们上的任务
+    static uint32_t isolated_cpus();
+
+private:
+    static char buffer[CMDLINE_MAX];
+};
@@ -1,46 +1,68 @@
 #pragma once
 #include <cstdint>
 
+// 伙伴系统分配器
+// 以页帧号(pfn)为单位管理一段物理内存，空闲链表挂在PageInfo上而不是空闲页本身，
+// 因此也可以管理没有直接映射的高端内存(包括PAE下4GB以上的内存)
 class BuddyAllocator
 {
 public:
-    // 初始化伙伴系统分配器
-    void init(uint32_t start_addr, uint32_t size);
+    /**
+     * @brief 初始化伙伴系统分配器
+     * @param start_pfn 管理区域的起始页帧号
+     * @param nr_pages 管理区域的页数
+     * @param meta PageInfo元数据存放位置，为nullptr时从区域头部划出(要求区域已直接映射)，
+     *             此时剩余页面全部加入空闲链表；否则需要调用add_free_range添加空闲页面
+     * @return 加入空闲链表的页数
+     */
+    uint32_t init(uint32_t start_pfn, uint32_t nr_pages, void* meta = nullptr);
 
+    /**
+     * @brief 把[start_pfn, end_pfn)加入空闲链表，用于跳过内存空洞
+     * @return 加入空闲链表的页数
+     */
+    uint32_t add_free_range(uint32_t start_pfn, uint32_t end_pfn);
+
+    // 管理nr_pages个页面需要的元数据字节数
+    static uint32_t meta_bytes(uint32_t nr_pages);
+
+    // 分配2^order个连续页面，返回首页的pfn，0表示失败
     uint32_t allocate_pages(uint32_t gfp_mask, uint32_t order);
-    void free_pages(uint32_t phys, uint32_t order);
-    void increment_ref_count(uint32_t phys, uint32_t order = 0);
-    void decrement_ref_count(uint32_t phys, uint32_t order = 0);
+    void free_pages(uint32_t pfn, uint32_t order);
+    void increment_ref_count(uint32_t pfn, uint32_t order = 0);
+    void decrement_ref_count(uint32_t pfn, uint32_t order = 0);
+    // 页面的引用计数，复合页返回首页的计数
+    uint32_t ref_count(uint32_t pfn) const;
+
+    uint32_t free_page_count() const { return nr_free; }
+    // 是否还有不小于2^order的空闲块，即按order分配连续页面能否成功
+    bool has_free_block(uint32_t order) const;
 
 private:
     static constexpr uint32_t MIN_ORDER = 0;  // 最小分配单位为1页(4KB)
     static constexpr uint32_t MAX_ORDER = 20; // 最大分配单位为 4GB
-
-    // 空闲内存块链表节点
-    struct FreeBlock {
-        FreeBlock* next;
-        uint32_t size; // 块大小(以页为单位)
-    };
-
-    // 每个order对应的空闲链表
-    FreeBlock* free_lists[MAX_ORDER + 1];
-    uint32_t real_start;
-    uint32_t memory_start;
-    uint32_t memory_size;
+    static constexpr uint32_t NO_PAGE = 0xFFFFFFFF; // 空闲链表结束标记
 
     struct PageInfo {
         uint32_t ref_count;
-        bool is_cow;
-        bool is_compound;     // 是否为复合页的一部分
-        uint32_t compound_order;  // 如果是复合页，记录复合页的order
-        uint32_t compound_head;   // 复合页的首页物理地址
+        uint32_t compound_head;   // 复合页首页的页下标
+        uint32_t next_free;       // 空闲块链表，仅对空闲块首页有效
+        uint32_t prev_free;
+        uint8_t compound_order;   // 如果是复合页，记录复合页的order
+        uint8_t free_order;       // 空闲块的order
+        bool is_compound;         // 是否为复合页的一部分
+        bool is_free;             // 是否为空闲块的首页
     };
-    PageInfo* page_info = nullptr;
+
+    // 每个order对应的空闲链表，保存首页的页下标
+    uint32_t free_lists[MAX_ORDER + 1];
+    uint32_t base_pfn = 0;
     uint32_t page_count = 0;
+    uint32_t nr_free = 0;
+    PageInfo* page_info = nullptr;
 
     // 内部辅助函数
-    uint32_t get_buddy_address(uint32_t addr, uint32_t size);
-    uint32_t get_block_order(uint32_t num_pages);
-    void split_block(uint32_t addr, uint32_t order);
-    bool try_merge_buddy(uint32_t addr, uint32_t order);
-};
\ No newline at end of file
+    bool valid_pfn(uint32_t pfn) const { return pfn >= base_pfn && pfn < base_pfn + page_count; }
+    void list_add(uint32_t idx, uint32_t order);
+    void list_del(uint32_t idx);
+};
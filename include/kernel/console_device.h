@@ -60,9 +60,11 @@ public:
 
     FileDescriptor* open([[maybe_unused]] const char* path) override
     {
+        // 所有打开的都是同一个设备，g_console_device自己持有一个引用，不会关闭
         if(!g_console_device) {
             g_console_device = new ConsoleDevice();
         }
+        get_file(g_console_device);
         return g_console_device;
     }
 
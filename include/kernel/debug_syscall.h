@@ -0,0 +1,124 @@
+#ifndef DEBUG_SYSCALL_H
+#define DEBUG_SYSCALL_H
+
+#include <cstdint>
+
+// 调试系统调用SYS_DEBUG的操作。基准测试和锁统计这类只给调试命令用的接口都走这一个系统调用，
+// 不占用正式的系统调用号。参数放在用户空间的uint32_t[DEBUG_NR_ARGS]里，下面按顺序说明
+enum DebugOp : uint32_t {
+    DEBUG_WAITBENCH = 0,
+    DEBUG_SWITCHBENCH = 1,
+    DEBUG_CPUHOG = 2,
+    DEBUG_LOCKSTAT = 3,
+    DEBUG_LOCKBENCH = 4,
+    DEBUG_RCUBENCH = 5,
+    DEBUG_LOGBENCH = 6,
+    DEBUG_NR_OPS,
+};
+#define DEBUG_NR_ARGS 4
+
+/**
+ * @brief 调试系统调用，op不认识时返回-1
+ * @param op DebugOp
+ * @param args_ptr 用户空间的uint32_t[DEBUG_NR_ARGS]
+ */
+int debugHandler(uint32_t op, uint32_t args_ptr, uint32_t, uint32_t);
+
+// DEBUG_WAITBENCH(op, arg)
+// waitbench的操作，测量等待队列的唤醒延迟。
+// 定时器回调释放一个基准信号量，模拟另一个任务释放锁
+#define WAITBENCH_ARM 0     // arg: 延迟的微秒数，清空信号量后启动定时器
+#define WAITBENCH_DOWN 1    // 在信号量上阻塞，直到定时器释放它，返回0
+#define WAITBENCH_TRYDOWN 2 // 不阻塞，拿到返回0，否则返回-1
+#define WAITBENCH_RESULT 3  // arg: timespec指针，写入最近一次释放信号量或互斥锁的时间
+// arg: 延迟的微秒数。内核线程拿住基准互斥锁，睡arg微秒后释放，调用方在互斥锁上阻塞，
+// 拿到锁以后马上释放并返回0。释放时间用WAITBENCH_RESULT读
+#define WAITBENCH_MUTEX 4
+
+// switchbench的结果
+struct SwitchBench {
+    uint32_t switches;      // 两个任务之间的切换次数
+    uint32_t cycles;        // 平均每次切换的TSC周期数
+    uint32_t ns;            // 平均每次切换的纳秒数
+};
+/**
+ * DEBUG_SWITCHBENCH(rounds, result)
+ * 在当前CPU上创建两个内核任务，各自调用rounds次yield，测量它们之间来回切换的开销。
+ * 调用方阻塞到两个任务都结束，同一时间只能有一个测试，正在进行时返回-1
+ */
+
+// DEBUG_CPUHOG(cpu, count, ms, group)
+// 在cpu上启动count个普通优先级的内核任务，各自空转ms毫秒后退出，返回启动的任务数，用来制造CPU负载。
+// group不为0时任务放进这个任务组。count为0时让所有还在空转的任务立即退出
+
+// 一个锁类的统计
+struct LockStat {
+    char name[16];
+    uint32_t acquisitions;    // 加锁次数
+    uint32_t contended;       // 需要等待的次数
+    uint32_t wait_hist[8];    // 等待周期数的分布：<256、<1K、<4K ... <1M、>=1M
+    uint32_t max_wait_cycles; // 最长的等待周期数
+    uint32_t max_hold_cycles; // 最长的持有周期数
+};
+#define LOCKSTAT_RESET 0xffffffff // 作为index时把所有锁类的统计清零
+/**
+ * DEBUG_LOCKSTAT(index, stat)
+ * 读取第index个锁类的统计，按第一次加锁的先后倒序
+ * @return index超出锁类的个数，或者内核编译时没有打开锁统计(USE_LOCKSTAT)时返回-1
+ */
+
+// lockbench用的锁
+#define LOCKBENCH_TAS 0    // 测试并设置，所有CPU同时抢一个字节
+#define LOCKBENCH_TICKET 1 // 排队自旋锁，也就是SpinLock
+// lockbench的结果
+struct LockBench {
+    uint32_t total;     // 所有CPU的加锁次数
+    uint32_t min_count; // 加锁最少的CPU的次数
+    uint32_t max_count; // 加锁最多的CPU的次数
+    uint32_t cycles;    // 平均每次加锁的TSC周期数，包括等待和临界区
+    uint32_t ns;
+};
+/**
+ * DEBUG_LOCKBENCH(mode, cpus, rounds, result)
+ * 在CPU 0到cpus-1上各绑定一个内核任务，关中断抢同一把锁，临界区里改几个共享的缓存行。
+ * 有一个CPU加锁rounds次后所有任务停止，各CPU的加锁次数相差越大越不公平。
+ * 调用方阻塞到所有任务结束，同一时间只能有一个测试
+ */
+
+// rcubench里查找挂载表和fd表的方式
+#define RCUBENCH_RCU 0      // 不加锁，RCU读侧临界区
+#define RCUBENCH_RWLOCK 1   // 外面再加一把全局的读写锁的读锁
+#define RCUBENCH_SPINLOCK 2 // 外面再加一把全局的自旋锁
+// rcubench的结果
+struct RcuBench {
+    uint32_t total;        // 所有CPU的查找次数
+    uint32_t cycles;       // 每个CPU平均每次查找的TSC周期数
+    uint32_t ns;
+    uint32_t gp_completed; // 测试期间结束的宽限期数
+    uint32_t sync_us;      // 测试后synchronize_rcu的平均延迟
+};
+/**
+ * DEBUG_RCUBENCH(mode, cpus, rounds, result)
+ * 在CPU 0到cpus-1上各绑定一个内核任务，每个任务做rounds次open和read开头的查找：
+ * 按路径找挂载点(find_fs)，在调用方的fd表里取fd 1的引用再放掉。
+ * 各CPU都做完以后按总时间算每次查找的开销，CPU越多开销不变说明查找没有互相等待。
+ * 调用方阻塞到所有任务结束，同一时间只能有一个测试
+ */
+
+// logbench的结果
+struct LogBench {
+    uint32_t deferred;      // 日志经过日志环推迟格式化，为0时是logbuf=off的同步输出
+    uint32_t record_cycles; // 每次log_debug的TSC周期数
+    uint32_t record_ns;
+    uint32_t format_cycles; // 同样的日志同步格式化的周期数，也就是推迟到消费者的开销
+    uint32_t format_ns;
+    uint32_t recorded;      // 测试期间写进日志环的记录数
+    uint32_t dropped;       // 测试期间日志环满丢掉的记录数
+};
+/**
+ * DEBUG_LOGBENCH(rounds, result)
+ * 在当前CPU上打rounds条log_debug，每批之间把日志环排空(不计时)，算每次调用的开销；
+ * 再把同样的日志同步格式化rounds次作对比
+ */
+
+#endif // DEBUG_SYSCALL_H
@@ -1,6 +1,7 @@
 #pragma once
 #include <cstddef>
 #include <cstdint>
+#include "arch/x86/paging.h"
 
 // 页标识，可根据你的需求扩展
 struct PageKey {
@@ -13,9 +14,11 @@ struct PageKey {
 
 // 单页抽象
 struct Page {
-    void* data;         // 指向实际页缓冲区
     size_t size;        // 页大小
     bool dirty;         // 脏页标志
+    PADDR phys;         // 页缓冲区所在的物理页，可能在高端内存，访问时要kmap；mmap时直接映射到用户空间
+    uint32_t shared_writers; // 可写映射这一页的共享页表项数，写缺页时加，解除映射时减
+    bool referenced;    // 最近被get_page取过，淘汰时清掉再给一次机会
     // 可扩展引用计数、锁、时间戳等
 };
 
@@ -80,6 +83,14 @@ public:
     template<typename Func>
     void for_each(Func f);
 
+    /**
+     * @brief 从hand指向的桶开始最多检查max_scan个元素，f返回true的删掉，
+     * 删掉target个或者检查完就停下，hand记下下次开始的桶
+     * @return 删掉的个数
+     */
+    template<typename Func>
+    size_t sweep(size_t& hand, size_t max_scan, size_t target, Func f);
+
 private:
     size_t bucket_count_;
     size_t size_;
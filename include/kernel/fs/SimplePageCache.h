@@ -1,6 +1,11 @@
 #pragma once
 #include "../../lib/mutex.h"
 #include "kernel/fs/PageCache.h"
+#include "kernel/workqueue.h"
+
+namespace kernel {
+class BlockDevice;
+}
 
 class SimplePageCache : public PageCache {
 public:
@@ -19,11 +24,36 @@ public:
     size_t page_count() const override;
     void set_max_pages(size_t max_pages) override;
 
+    /**
+     * @brief 内存不足时调用，从所有页缓存里淘汰最多target个干净并且没有被映射的页
+     * @return 释放的页数
+     */
+    static size_t shrink_all(size_t target);
+
 private:
+    // 延迟写回的工作，cache指回所属的页缓存
+    struct WritebackWork {
+        kernel::delayed_work dwork;
+        SimplePageCache* cache;
+    };
+
+    bool writeback(const PageKey& key, Page& page);
+    void set_dirty(const PageKey& key, Page& page);
+    static void writeback_work_fn(kernel::work_struct* work);
+    // 调用方持有mtx_，最多检查max_scan页
+    size_t evict_clean(size_t target, size_t max_scan);
+
+    // 所有页缓存连成一串，内存不足时挨个收缩
+    static SimplePageCache* caches_;
+    static SpinLock caches_lock_;
+    SimplePageCache* next_cache_;
+    size_t clock_hand_ = 0;
+
     size_t page_size_;
     size_t max_pages_;
     kernel::BlockDevice *dev_;
     mutable kernel::Mutex mtx_;
     HashList cache_;
+    WritebackWork writeback_work_;
 };
 
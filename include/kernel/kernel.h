@@ -8,12 +8,15 @@
 #include "user_memory.h"
 
 #include <arch/x86/interrupt.h>
+#include <arch/x86/seqlock.h>
 
 extern "C" void page_fault_handler(uint32_t error_code, uint32_t fault_addr);
 void debugPTE(VADDR vaddr);
 #define E_OK 0
 #define E_NOT_COW 1
 #define E_PANIC 2
+#define E_NOMEM 3
+#define E_LIMIT 4 // 任务组到了内存上限
 int copyCOWPage(uint32_t fault_addr, uint32_t original_pgd, UserMemory& user_mm);
 void* operator new(size_t size);
 void* operator new[](size_t size);
@@ -52,11 +55,22 @@ public:
         // instance0 = new Kernel();
     }
 
-    inline void tick() { (*timer_ticks)++;}
-    uint32_t get_ticks()
+    // 启动以来的tick数，所有CPU共用。32位上64位数的读写不是原子的，用顺序锁保护，读的一方不加锁
+    // tick数加nr，只在启动早期还没有测出TSC频率时由BSP调用，调用方已关中断
+    void tick(uint32_t nr = 1);
+    // tick数推进到ticks，已经不小于ticks时什么也不做。多个CPU可以同时调用，调用方已关中断
+    void update_ticks(uint64_t ticks);
+    uint64_t get_ticks64() const
     {
-        return *timer_ticks;
+        uint32_t seq;
+        uint64_t ticks;
+        do {
+            seq = ticks_lock.read_begin();
+            ticks = timer_ticks;
+        } while(ticks_lock.read_retry(seq));
+        return ticks;
     }
+    uint32_t get_ticks() const { return (uint32_t)get_ticks64(); }
 
 private:
     // 私有构造函数（单例模式）
@@ -71,5 +85,6 @@ private:
 
     kernel::SMP_Scheduler smp_scheduler;
 
-    arch::PerCPU<uint32_t> timer_ticks;
+    SeqLock ticks_lock;
+    uint64_t timer_ticks;
 };
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
+#include "arch/x86/atomic.h"
 #include "arch/x86/paging.h"
+#include "kernel/kstack.h"
 #include "kernel/virtual_memory_tree.h"
 #include "kernel/zone.h"
 #include "slab_allocator.h"
@@ -7,6 +9,17 @@
 
 using namespace MemoryConstants;
 
+// 页面分配标志
+constexpr uint32_t GFP_KERNEL = 0x0;          // 只从直接映射区分配，可以直接用phys2Virt访问
+constexpr uint32_t GFP_HIGHMEM = 0x1;         // 允许从高端内存分配，内核访问需要kmap
+constexpr uint32_t GFP_HIGHUSER = GFP_HIGHMEM; // 用户页面，内核很少直接访问
+
+// 物理内存范围，[start_pfn, end_pfn)
+struct PhysMemRange {
+    uint32_t start_pfn;
+    uint32_t end_pfn;
+};
+
 // 内核内存管理类
 class KernelMemory
 {
@@ -15,6 +28,13 @@ public:
     KernelMemory();
     PageManager& paging() { return page_manager; }
 
+    /**
+     * @brief 从multiboot信息中读取物理内存布局，需要在init之前、开启分页之前调用
+     * @param magic 引导器传入的魔数
+     * @param mbi_phys multiboot_info的物理地址
+     */
+    void setBootInfo(uint32_t magic, uint32_t mbi_phys);
+
     // 初始化内核内存管理
     void init();
 
@@ -23,6 +43,10 @@ public:
     void kfree(VADDR addr);
     VADDR vmalloc(uint32_t size);
     void vfree(VADDR addr);
+    /**
+     * @brief 把物理页面映射到内核空间，直接映射区的页面直接返回对应的虚拟地址
+     * 高端页面映射到KMAP区域，映射只在当前CPU上刷新过TLB，用完要尽快kunmap
+     */
     VADDR kmap(PADDR phys_addr);
     void kunmap(VADDR addr);
 
@@ -31,21 +55,64 @@ public:
     void free_pages(PADDR phys_addr, uint32_t order);
     void decrement_ref_count(PADDR physAddr);
     void increment_ref_count(PADDR physAddr);
+    // 物理页面当前的引用计数
+    uint32_t page_ref_count(PADDR physAddr);
 
     // 地址转换
     PADDR virt2Phys(VADDR virt_addr);
     VADDR phys2Virt(PADDR phys_addr);
     PFN getPfn(VADDR virt_addr);
 
+    // 物理页面是否在直接映射区之外
+    static bool is_highmem(PADDR phys_addr) { return phys_addr >= (PADDR)NORMAL_ZONE_END * PAGE_SIZE; }
+    // 高端内存空闲页数
+    uint32_t highmem_free_pages() const { return high_zone.getFreePages(); }
+    // 直接映射区空闲页数
+    uint32_t normal_free_pages() const { return normal_zone.getFreePages(); }
+    // 直接映射区能否分配2^order个连续页面
+    bool can_alloc_contiguous(uint32_t order) const { return normal_zone.hasFreeBlock(order); }
+
+    // 带保护页的内核栈分配器
+    KernelStackAllocator& kstacks() { return kstack_allocator; }
+
+    /**
+     * @brief 全局只读零页，匿名内存的读缺页都映射到这一页，第一次写时按COW复制
+     * 零页自己持有一个永不释放的引用，每个映射再各加一个
+     */
+    PADDR zero_page() const { return zero_page_phys; }
+    // 零页被映射和被写复制的次数，差值就是省下的物理页分配
+    void note_zero_page_map() { arch::atomic_add(&zero_page_maps, 1); }
+    void note_zero_page_cow() { arch::atomic_add(&zero_page_cows, 1); }
+    uint32_t zero_page_map_count() const { return zero_page_maps; }
+    uint32_t zero_page_cow_count() const { return zero_page_cows; }
+
 private:
     // 根据大小选择合适的内存区域
-    Zone* get_zone_for_allocation(uint32_t size);
+    Zone* get_zone_for_allocation(uint32_t size, uint32_t gfp_mask);
+    // 页帧号所属的区域
+    Zone* zone_for_pfn(uint32_t pfn);
+    // 可用内存的最大页帧号
+    uint32_t max_mem_pfn() const;
+    /**
+     * @brief 初始化高端区域
+     * @param end_pfn 高端区域的结束页帧号，不大于HIGH_ZONE_START时没有高端内存
+     * @param meta 启动时从普通区域划出的PageInfo元数据
+     */
+    void init_highmem(uint32_t end_pfn, void* meta);
+
+    static constexpr uint32_t MAX_MEM_RANGES = 16;
+    PhysMemRange mem_ranges[MAX_MEM_RANGES]; // 可用物理内存，来自multiboot
+    uint32_t nr_mem_ranges = 0;
 
     // 内存区域
     Zone dma_zone;                  // DMA区域
     Zone normal_zone;               // 普通区域
     Zone high_zone;                 // 高端区域
+    PADDR zero_page_phys = 0;       // 共享零页
+    volatile uint32_t zero_page_maps = 0;
+    volatile uint32_t zero_page_cows = 0;
     PageManager page_manager;       // 页表管理器
     kernel::SlabAllocator slab_allocator;
     VirtualMemoryTree vmalloc_tree; // 虚拟内存树
+    KernelStackAllocator kstack_allocator;
 };
\ No newline at end of file
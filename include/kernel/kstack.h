@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+
+#include "arch/x86/paging.h"
+#include "arch/x86/smp.h"
+#include "arch/x86/spinlock.h"
+
+#define KERNEL_STACK_SIZE 1024 * 16
+
+// 内核栈分配器
+// 内核栈放在VMALLOC区域的KSTACK段，每个槽位最低的一页不映射，作为保护页，
+// 栈溢出时落在保护页上触发缺页，不会悄悄踩坏相邻的内存。
+// 栈按单页分配物理内存，不需要order-2的连续块，也可以使用高端内存。
+// 释放的栈不解除映射，先放进本CPU的缓存，缓存满了再放回全局空闲链表，
+// 复用时不需要重新建立映射，也不需要跨CPU刷新TLB
+class KernelStackAllocator
+{
+public:
+    static constexpr uint32_t STACK_PAGES = KERNEL_STACK_SIZE / PAGE_SIZE;
+    static constexpr uint32_t SLOT_SIZE = KERNEL_STACK_SIZE + PAGE_SIZE; // 保护页 + 栈
+    static constexpr uint32_t NR_SLOTS =
+        (MemoryConstants::KSTACK_END - MemoryConstants::KSTACK_START) / SLOT_SIZE;
+    static constexpr uint32_t PERCPU_CACHE_SIZE = 4;
+
+    struct Stats {
+        uint32_t allocs;             // 分配次数
+        uint32_t percpu_hits;        // 从本CPU缓存分配的次数
+        uint32_t reuse_hits;         // 从全局空闲链表分配的次数
+        uint32_t fresh;              // 新建映射的次数
+        uint32_t order2_unavailable; // 新建时直接映射区已没有order-2空闲块的次数，kmalloc方式会失败
+        uint32_t failures;           // 分配失败次数
+        uint64_t alloc_cycles;       // 所有分配花费的TSC周期
+    };
+
+    /**
+     * @brief 分配一个内核栈
+     * @return 栈的最低地址(保护页之上)，失败返回nullptr
+     */
+    VADDR alloc();
+
+    /**
+     * @brief 释放alloc返回的内核栈，调用方保证栈已经不再使用
+     * @param stack alloc返回的地址
+     */
+    void free(VADDR stack);
+
+    // addr是否落在某个内核栈的保护页里
+    static bool is_guard_page(uint32_t addr);
+
+    // 汇总所有CPU的统计
+    Stats stats();
+
+private:
+    static constexpr uint32_t NO_SLOT = 0xFFFFFFFF;
+
+    static uint32_t slot_base(uint32_t slot) { return MemoryConstants::KSTACK_START + slot * SLOT_SIZE; }
+    // 给槽位的栈页面分配物理页并建立映射
+    bool populate(uint32_t slot);
+
+    struct PerCpuCache {
+        SpinLock lock; // 只会被本CPU获取，关中断防止和中断里的分配交错
+        uint32_t count;
+        uint32_t slots[PERCPU_CACHE_SIZE];
+        uint32_t allocs;
+        uint32_t hits;
+        uint64_t cycles;
+    };
+    PerCpuCache caches[MAX_CPUS] = {};
+
+    SpinLock lock;                    // 保护下面的字段
+    uint32_t free_slots[NR_SLOTS];    // 已建立映射的空闲槽位
+    uint32_t nr_free_slots = 0;
+    uint32_t next_fresh = 0;          // 还没用过的槽位从这里开始
+    uint32_t reuse_hits = 0;
+    uint32_t fresh = 0;
+    uint32_t order2_unavailable = 0;
+    uint32_t failures = 0;
+};
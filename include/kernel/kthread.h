@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+
+struct Task;
+
+namespace kernel {
+
+// 内核线程
+// 在kernel_context里运行的任务，不属于用户进程，只访问内核空间，切换到它时沿用上一个任务的CR3。
+// 和用户任务一样参与公平调度，可以在等待队列上睡眠，也会被时钟中断抢占。
+// 线程函数返回时线程退出，返回值记在exit_status里
+typedef int (*kthread_fn_t)(void* arg);
+
+/**
+ * @brief 创建内核线程，还没有放进运行队列，kthread_start以后才开始运行
+ * @param name 线程名，超过PROCNAME_LEN的部分截断
+ * @return 分配不到内核栈时返回nullptr
+ */
+Task* kthread_create(kthread_fn_t fn, void* arg, const char* name);
+// 把还没有启动的线程绑定在cpu上
+void kthread_bind(Task* task, uint32_t cpu);
+// 放进运行队列，绑定了CPU的放到那个CPU上，否则放到当前CPU
+void kthread_start(Task* task);
+// 创建并启动
+Task* kthread_run(kthread_fn_t fn, void* arg, const char* name);
+// 结束当前内核线程，不会返回
+[[noreturn]] void kthread_exit(int status);
+
+} // namespace kernel
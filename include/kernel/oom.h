@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+
+namespace kernel {
+struct TaskGroup;
+}
+
+// OOM killer: 分配不到物理页、也没有页面可以回收时，杀死驻留页最多的进程，释放它的内存
+class OomKiller
+{
+public:
+    /**
+     * @brief 选出驻留页(RSS)最多的进程并杀死它，进程的用户内存立即归还
+     * @param group 不为nullptr时只在驻留页记在这个任务组上的进程里选，任务组到了内存上限时使用
+     * @return 被杀死进程的pid，没有可杀的进程时返回-1
+     */
+    static int out_of_memory(kernel::TaskGroup* group = nullptr);
+
+    // 已经杀死的进程数
+    static uint32_t kill_count() { return kills; }
+
+private:
+    static volatile uint32_t kills;
+};
@@ -3,8 +3,16 @@
 
 #include <cstdint>
 
+#include "arch/x86/fpu.h"
+#include "arch/x86/smp.h"
+#include "arch/x86/spinlock.h"
 #include "kernel/console_device.h"
 #include "kernel/list.h"
+#include "kernel/sched_fair.h"
+#include "kernel/sched_rt.h"
+#include "kernel/shm.h"
+#include "kernel/timer.h"
+#include "kernel/wait.h"
 #include "user_memory.h"
 
 // 进程状态
@@ -18,7 +26,6 @@ enum ProcessState {
     EXITED
 };
 
-#define KERNEL_STACK_SIZE 1024 * 16
 #define USER_STACK_SIZE 1024 * 4096
 #define KERNEL_CS 0x08
 #define KERNEL_DS 0x10
@@ -26,6 +33,7 @@ enum ProcessState {
 #define USER_DS 0x23
 #define PROCNAME_LEN 31
 #define MAX_PROCESS_FDS 256
+#define EXIT_STATUS_KILLED 137 // 被内核杀死的进程的退出码，和shell里SIGKILL的128+9一致
 
 struct Stacks {
     uint32_t user_stack;      // 用户态栈基址
@@ -70,26 +78,37 @@ struct Registers {
 namespace kernel
 {
 class FileDescriptor;
+struct TaskGroup;
 }
 
 // 进程控制块结构
 #define DEBUG_STATUS_HALT 1 << 0
-#define DEFAULT_TIME_SLICE 100
 struct Context;
 struct Task {
     uint32_t task_id;            // 进程ID
     char name[PROCNAME_LEN + 1]; // 进程名称
 
     ProcessState state;          // 进程状态
-    uint32_t priority;           // 进程优先级
-    int32_t time_slice = DEFAULT_TIME_SLICE;         // 时间片
+    uint32_t priority;           // 静态优先级，nice + 20，决定调度权重
     uint32_t total_time;         // 总执行时间
     uint32_t exit_status;        // 退出状态码
-    uint32_t sleep_ticks;
-    struct kernel::list_head sched_list; // 调度链表节点
+    kernel::SchedEntity se;              // 公平调度实体
+    kernel::RtEntity rt;                 // 实时调度实体，rt.policy决定任务在哪个调度类里
+    kernel::timer_list sleep_timer;      // 按tick睡眠的唤醒定时器
+    kernel::hrtimer sleep_hrtimer;       // 精确睡眠的唤醒定时器
+    kernel::WaitEntry wait_entry;        // 系统调用里阻塞在等待队列上时使用
+    struct kernel::list_head ctx_node;   // 所属Context的任务链表节点
     uint32_t affinity = 0;               // CPU亲和性掩码
+    int (*thread_fn)(void*) = nullptr;   // 内核线程的函数和参数，见kthread.h
+    void* thread_arg = nullptr;
+    kernel::TaskGroup* group = nullptr;  // 所属任务组，nullptr表示根组，见task_group.h
+    uint64_t group_charged = 0;          // 已经记到任务组上的se.sum_exec
+    struct kernel::list_head group_node; // 任务组被限流时挂在组上
 
-    Registers regs;
+    Registers regs;                      // 创建任务时的初始寄存器，第一次切换到它时压到内核栈上
+    uint32_t kernel_esp = 0;             // 切走时内核栈的栈顶，0表示还没有运行过
+    volatile bool on_cpu = false;        // 正在某个CPU上运行或者正在切走，还在用自己的内核栈
+    arch::FpuState fpu;                  // FPU/SSE状态，惰性保存恢复
     Stacks stacks;
     Task* next = nullptr;
     Task* prev = nullptr;
@@ -97,21 +116,31 @@ struct Task {
     volatile uint32_t debug_status = 0;
     void print();
     void alloc_stack(KernelMemory& mm);
+    // 释放内核栈，调用方保证任务已经不会再运行
+    void free_stack(KernelMemory& mm);
     int allocUserStack();
 
     int cpu = -1;
 };
 struct Context {
+    Context();
     uint32_t context_id;
 
     UserMemory user_mm; // 用户空间内存管理器
 
+    // 打开的文件，每一项持有文件的一个引用，用kernel::fdget/fd_install/fd_close访问
     kernel::FileDescriptor* fd_table[MAX_PROCESS_FDS] = {nullptr};
-    int next_fd = 3;     // 0, 1, 2 保留给标准输入、输出和错误
+    // 通过ShmManager::open拿到的共享内存句柄，每一项是打开时对象的代数，0表示没有打开
+    uint32_t shm_handles[ShmManager::MAX_SHM_OBJECTS] = {0};
 
     char cwd[256] = "/"; // 当前工作目录，默认为根目录
 
-    int allocate_fd();
+    struct kernel::list_head tasks; // 属于这个进程的任务
+    struct kernel::list_head node;  // 进程表链表节点
+    bool killed = false;            // 已被杀死，任务不再被调度
+    // 页目录的引用：进程本身一个，每个CR3里装着它的CPU一个，都释放以后才释放页目录
+    uint32_t mm_refs = 1;
+
     void print();
     void cloneMemorySpace(Context *source);
     void cloneFiles(Context *source);
@@ -140,16 +169,69 @@ public:
     static int fork();
     static Task* get_current_task();
     // static int32_t execute_process(const char* path);
-    static bool schedule(); // false for no more processes
+    /**
+     * @brief 需要时切换到下一个任务，调用方已关中断。
+     * 切换只换内核栈和callee-saved寄存器，当前任务再被选中时从这里返回
+     * @return 切换过任务返回true
+     */
+    static bool schedule();
+    // 当前任务让出CPU，排到同一CPU上其他等待的任务后面，没有其他任务时直接返回
+    static void yield();
+    // 切换完成后在新任务的内核栈上调用，让上一个任务可以在别的CPU上运行，回收退出的任务
+    static void finish_switch();
     // static int switch_process(uint32_t pid);
     static PidManager pid_manager;
     static PidManager tid_manager;
     static void switch_to_user_mode(uint32_t entry_point, Task* task);
-    static void save_context(uint32_t int_num, uint32_t* esp);
-    static void restore_context(uint32_t int_num, uint32_t* esp);
+
+    // 每个CPU的地址空间切换统计
+    struct SwitchStats {
+        uint32_t cr3_loads; // 重新装入CR3的次数
+        uint32_t cr3_skips; // 同一个进程的任务之间切换，不换CR3的次数
+        uint32_t lazy_tlb;  // 切到内核任务，沿用上一个任务的CR3的次数
+    };
+    static void switch_stats(uint32_t cpu, SwitchStats& stats);
 
     // static void cloneMemory(ProcessControlBlock* pcb);
+    /**
+     * @brief 当前任务睡眠ticks个tick，调用方已关中断，醒来以后才返回。
+     * 进程在睡眠时被杀死的不会再返回
+     */
     static void sleep_current_process(uint32_t ticks);
+    // 同sleep_current_process，用高精度定时器睡眠ns纳秒
+    static void sleep_current_ns(uint64_t ns);
+    /**
+     * @brief 把任务标记为睡眠，之后由调用方安排唤醒再调用schedule()
+     * @return 任务已经退出或者已经在睡眠时返回false
+     */
+    static bool prepare_sleep(Task* task);
+    /**
+     * @brief 唤醒睡眠的任务，放回它上次所在CPU的运行队列
+     * @return 任务在睡眠并且由这次调用唤醒时返回true
+     */
+    static bool wake_up(Task* task);
+
+    // 把进程加入进程表，之后可以按pid查找，也会被OOM killer考虑
+    static void register_context(Context* ctx);
+    /**
+     * @brief 遍历进程表，回调期间持有进程表锁，回调里不能创建或杀死进程
+     * @param fn 回调函数，arg原样传入
+     */
+    static void for_each_context(void (*fn)(Context* ctx, void* arg), void* arg);
+    // 取一个页目录的引用，在进程表锁外使用ctx时保证它不被释放，用完以后mm_drop
+    static void mm_grab(Context* ctx) { __atomic_add_fetch(&ctx->mm_refs, 1, __ATOMIC_SEQ_CST); }
+    // 释放页目录的引用，最后一个引用释放时释放页目录和进程
+    static void mm_drop(Context* ctx);
+    /**
+     * @brief 杀死进程，所有任务标记为退出，用户内存立即释放
+     * 有任务正在其他CPU上运行时，由那个CPU在下一次调度时释放
+     * @param pid 进程号
+     * @param status 退出码
+     * @return 成功返回true，进程不存在或已经被杀死返回false
+     */
+    static bool kill_process(uint32_t pid, uint32_t status);
+    // 当前任务已经退出，切到其他任务，不会返回
+    [[noreturn]] static void exit_current();
     static Context* kernel_context;
     static struct Debug
     {
@@ -159,5 +241,28 @@ public:
     } debug;
 
 private:
+    // 释放已退出任务的内核栈，进程的最后一个任务退出时再释放进程本身
+    static void reap(Task* task);
+    // 在新任务的内核栈上构造中断返回的帧，第一次切换到它时从ret_from_fork返回到regs
+    static void prepare_stack(Task* task);
+    /**
+     * @brief 切换地址空间。内核任务不访问用户空间，沿用上一个任务的CR3(lazy TLB)；
+     * 同一个进程的任务之间也不换CR3
+     */
+    static void switch_mm(Task* prev, Task* next);
+    static void free_mm(Context* ctx);
+
     static kernel::ConsoleFS console_fs;
-};
\ No newline at end of file
+    static kernel::list_head context_list; // 进程表
+    static SpinLock context_lock;          // 保护进程表和每个进程的任务链表
+    static Task* zombies[MAX_CPUS];        // 每个CPU上刚退出、还在用自己内核栈的任务
+};
+
+// interrupt.asm里的任务切换
+// 把callee-saved寄存器压到当前内核栈上，栈顶存到*prev_esp，换到next_esp的栈上弹出它的寄存器返回
+extern "C" void switch_to(uint32_t* prev_esp, uint32_t next_esp);
+// 新任务第一次被切换到时从这里开始，调用schedule_tail后按prepare_stack构造的帧中断返回
+extern "C" void ret_from_fork();
+extern "C" void schedule_tail();
+// 中断和系统调用返回前调用，需要时切换任务
+extern "C" void interrupt_exit_schedule();
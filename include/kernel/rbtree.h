@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+
+#include "kernel/list.h"
+
+namespace kernel {
+
+// 侵入式红黑树节点，嵌在需要排序的结构体里，用rb_entry取回外层结构
+// 树本身不比较键值，插入时调用方自己从根往下找到位置，
+// 用rb_link_node挂上去，再调用rb_insert_color恢复红黑性质
+struct rb_node {
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    bool red;
+};
+
+struct rb_root {
+    struct rb_node *node;
+};
+
+// 额外缓存最左节点，取最小值是O(1)
+struct rb_root_cached {
+    struct rb_root root;
+    struct rb_node *leftmost;
+};
+
+inline void RB_INIT_ROOT(struct rb_root_cached *root) {
+    root->root.node = nullptr;
+    root->leftmost = nullptr;
+}
+
+// 把新节点挂到parent的link位置(&parent->left或&parent->right，空树时是&root->node)
+inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link) {
+    node->parent = parent;
+    node->left = nullptr;
+    node->right = nullptr;
+    *link = node;
+}
+
+// 插入节点后着色和旋转，恢复红黑性质
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+// 从树中删除节点
+void rb_erase(struct rb_node *node, struct rb_root *root);
+// 中序遍历的第一个节点和下一个节点，没有时返回nullptr
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+// 中序遍历的最后一个节点，树为空时返回nullptr
+struct rb_node *rb_last(const struct rb_root *root);
+
+/**
+ * @brief 带最左节点缓存的插入
+ * @param leftmost 查找插入位置时是否一直往左走，是的话新节点成为最左节点
+ */
+inline void rb_insert_color_cached(struct rb_node *node, struct rb_root_cached *root, bool leftmost) {
+    if (leftmost) {
+        root->leftmost = node;
+    }
+    rb_insert_color(node, &root->root);
+}
+
+inline void rb_erase_cached(struct rb_node *node, struct rb_root_cached *root) {
+    if (root->leftmost == node) {
+        root->leftmost = rb_next(node);
+    }
+    rb_erase(node, &root->root);
+}
+
+inline struct rb_node *rb_first_cached(const struct rb_root_cached *root) {
+    return root->leftmost;
+}
+
+#define rb_entry(ptr, type, member) \
+    container_of(ptr, type, member)
+
+} // namespace kernel
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+
+#include <arch/x86/percpu.h>
+
+namespace kernel {
+
+// RCU(read-copy-update)
+// 读的一方用rcu_read_lock/rcu_read_unlock包住对共享指针的访问，只改本CPU的嵌套计数，不加锁，
+// 不写共享的缓存行；写的一方复制一份修改好的数据，用rcu_assign_pointer替换指针，
+// 旧的数据等一个宽限期(grace period)以后再释放。
+// 宽限期开始时在线并且没有停掉tick空闲的CPU都要经过一次静止状态：上下文切换、
+// 不在读侧临界区里的tick、停掉tick进入空闲。读侧临界区里不能睡眠，schedule也不会在临界区里切走，
+// 所以每个CPU都经过静止状态以后，宽限期开始前进入的读侧临界区都已经退出。
+// 停掉tick的空闲CPU上的中断处理不能进入读侧临界区
+
+struct rcu_head {
+    rcu_head* next;
+    void (*func)(rcu_head* head);
+};
+
+// 本CPU的读侧临界区嵌套层数
+DECLARE_PER_CPU(uint32_t, rcu_nesting);
+
+// 可以嵌套，可以在中断里使用
+static inline void rcu_read_lock()
+{
+    asm volatile("incl %%gs:%0" : "+m"(rcu_nesting) : : "memory");
+}
+
+static inline void rcu_read_unlock()
+{
+    asm volatile("decl %%gs:%0" : "+m"(rcu_nesting) : : "memory");
+}
+
+static inline bool rcu_read_lock_held() { return this_cpu_read(rcu_nesting) != 0; }
+
+// 读侧临界区里取受保护的指针
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+// 发布新的数据，之前对数据的初始化对读到新指针的一方都可见
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/**
+ * @brief 所有CPU的kworker启动以后、开中断之前在BSP上调用，已经启动的CPU都算在线。
+ * 之前call_rcu排的回调留到第一个宽限期以后执行
+ */
+void rcu_init();
+
+/**
+ * @brief 当前已经开始的读侧临界区都退出以后，在这个CPU的kworker里调用func(head)。
+ * 可以在中断里、持有自旋锁时调用，回调里可以kfree、可以睡眠
+ */
+void call_rcu(rcu_head* head, void (*func)(rcu_head* head));
+
+/**
+ * @brief 等到当前已经开始的读侧临界区都退出，调用时已经替换掉的数据之后没有读的一方。
+ * 在任务上下文里调用，不能在读侧临界区里、持有自旋锁时调用，可能睡眠
+ */
+void synchronize_rcu();
+
+// 以下由调度和时钟调用，中断已关
+
+// 上下文切换，schedule在切走之前调用
+void rcu_note_context_switch();
+// 每个tick调用：报告静止状态，推进本CPU的回调
+void rcu_check_callbacks();
+// 本CPU还有等待宽限期的回调，不能停掉tick
+bool rcu_needs_cpu();
+// 停掉tick进入空闲，宽限期不再等这个CPU
+void rcu_idle_enter();
+// 恢复tick或者从空闲切到任务
+void rcu_idle_exit();
+
+struct RcuStats {
+    uint32_t gp_completed;     // 结束的宽限期数
+    uint32_t callbacks_queued; // call_rcu排的回调数
+    uint32_t callbacks_invoked;
+};
+void rcu_get_stats(RcuStats& stats);
+
+} // namespace kernel
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+
+namespace kernel {
+
+// CPU带宽控制
+// 任务组每个周期(period)里最多运行配额(quota)这么长的CPU时间，所有CPU上的运行时间合在一起算，
+// 配额可以大于周期，表示最多同时占用几个CPU。周期内用完配额以后组被限流，
+// 组里的普通任务离开CPU时不再放回运行队列，到下一个周期开始时一起放回。
+// 运行时间在时钟中断和任务切换时结算，一次最多超出一个tick，超出的部分从下一个周期的配额里扣
+
+constexpr uint64_t BW_MIN_PERIOD_NS = 1000000ULL;    // 周期最短1ms
+constexpr uint64_t BW_MAX_PERIOD_NS = 1000000000ULL; // 周期最长1s
+constexpr uint64_t BW_MIN_QUOTA_NS = 1000000ULL;     // 配额最少1ms
+constexpr uint64_t BW_DEFAULT_PERIOD_NS = 100000000ULL; // 默认周期100ms
+
+// 一个任务组的带宽状态，调用方负责加锁
+class CpuBandwidth {
+public:
+    // 不限制，周期为默认值
+    void init();
+
+    /**
+     * @brief 修改配额和周期，清空本周期已用的时间，不限制时解除限流
+     * @param quota_ns 0表示不限制
+     * @param period_ns 0表示默认周期
+     * @return 超出范围时返回false，不做修改
+     */
+    bool set(uint64_t quota_ns, uint64_t period_ns);
+
+    bool limited() const { return quota_ns != 0; }
+
+    /**
+     * @brief 记入ns纳秒的运行时间
+     * @return 这次用完了配额，组从未限流变成限流时返回true
+     */
+    bool charge(uint64_t ns);
+
+    /**
+     * @brief 周期到了，补充配额，上个周期超出的部分最多扣掉一个配额
+     * @return 组从限流变成未限流时返回true
+     */
+    bool refill();
+
+    uint64_t quota_ns;
+    uint64_t period_ns;
+    uint64_t runtime_used; // 本周期已经用掉的时间
+    bool throttled;
+    uint64_t usage_ns;     // 累计运行时间，不限制时也统计
+    uint32_t nr_periods;   // 经过的周期数
+    uint32_t nr_throttled; // 被限流的周期数
+};
+
+} // namespace kernel
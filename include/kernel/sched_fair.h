@@ -0,0 +1,157 @@
+#pragma once
+#include <cstdint>
+
+#include "kernel/rbtree.h"
+
+namespace kernel {
+
+// 公平调度类
+// 每个任务按权重累计虚拟运行时间(vruntime)：实际运行时间 * NICE_0_LOAD / weight，
+// 运行队列用红黑树按vruntime排序，总是选最左边(vruntime最小)的任务运行，
+// 权重大的任务vruntime涨得慢，得到的CPU时间按权重成比例分配。
+// 时间片不固定：一个调度周期内每个可运行任务都运行一次，按权重分配周期长度，
+// 可运行任务越多时间片越短，但不短于最小粒度。
+// 时钟由调用方传入(内核里是TSC周期)，切换只发生在时钟中断里，
+// 所以调度周期和粒度以tick为单位配置，再按测得的每tick周期数换算
+
+// nice值范围和对应的静态优先级(0~39，数值越小优先级越高)
+constexpr int MIN_NICE = -20;
+constexpr int MAX_NICE = 19;
+constexpr uint32_t NICE_WIDTH = MAX_NICE - MIN_NICE + 1;
+constexpr uint32_t DEFAULT_PRIO = 20; // nice 0
+inline uint32_t nice_to_prio(int nice) { return (uint32_t)(nice - MIN_NICE); }
+inline int prio_to_nice(uint32_t prio) { return (int)prio + MIN_NICE; }
+
+constexpr uint32_t NICE_0_LOAD = 1024;
+// nice每差1，CPU份额大约差10%，相邻权重比约为1.25
+extern const uint32_t sched_prio_to_weight[NICE_WIDTH];
+// 2^32 / weight，把除以权重变成乘法和移位
+extern const uint32_t sched_prio_to_wmult[NICE_WIDTH];
+
+// 以tick的1/1024为单位的调度参数
+constexpr uint32_t SCHED_FIXEDPOINT_SHIFT = 10;
+constexpr uint32_t SCHED_LATENCY = 4 << SCHED_FIXEDPOINT_SHIFT;         // 调度周期
+constexpr uint32_t SCHED_MIN_GRANULARITY = 1 << SCHED_FIXEDPOINT_SHIFT; // 最短时间片
+constexpr uint32_t SCHED_NR_LATENCY = SCHED_LATENCY / SCHED_MIN_GRANULARITY;
+constexpr uint32_t SCHED_WAKEUP_GRANULARITY = 1 << (SCHED_FIXEDPOINT_SHIFT - 2); // 唤醒抢占的门槛
+// 离开CPU不到这么久的任务认为缓存还是热的，迁移到别的CPU代价大
+constexpr uint32_t SCHED_MIGRATION_COST = 1 << (SCHED_FIXEDPOINT_SHIFT - 1);
+
+// enqueue的flags
+constexpr uint32_t ENQUEUE_NEW = 0x1;    // 新任务，vruntime从队列当前位置之后开始
+constexpr uint32_t ENQUEUE_WAKEUP = 0x2; // 睡眠后唤醒，补偿有上限，可能抢占当前任务
+constexpr uint32_t ENQUEUE_MIGRATED = 0x4; // 从其他CPU迁移过来，vruntime是相对原队列min_vruntime的值
+
+// 嵌在Task里的调度实体
+struct SchedEntity {
+    struct rb_node run_node;
+    uint32_t weight;
+    uint32_t inv_weight;    // 2^32 / weight
+    uint64_t vruntime;      // 按权重折算的运行时间
+    uint64_t exec_start;    // 这次开始计时的时钟
+    uint64_t sum_exec;      // 累计运行时间
+    uint64_t prev_sum_exec; // 这次被选中运行时的sum_exec，用来判断时间片是否用完
+    bool on_rq;             // 是否在红黑树里，正在运行的实体不在树里
+    uint32_t cpu;           // 最近一次加入的队列所属的CPU
+
+    // 按静态优先级设置权重，调用方保证实体不在树里
+    void set_prio(uint32_t prio);
+};
+
+// 迁移时判断实体能否放到目标CPU上，由调用方按CPU亲和性实现
+typedef bool (*migrate_filter_t)(SchedEntity* se, void* arg);
+
+// 一个CPU的公平调度队列
+// 等待运行的实体在红黑树里，正在运行的实体是curr，不在树里，
+// load_weight和nr_running只统计树里的实体。调用方负责加锁
+class CfsRunQueue {
+public:
+    void init(uint32_t cpu = 0);
+
+    /**
+     * @brief 实体加入红黑树
+     * @param flags ENQUEUE_NEW/ENQUEUE_WAKEUP/ENQUEUE_MIGRATED决定vruntime的放置，
+     * 0表示被抢占的实体，保持原值
+     */
+    void enqueue(SchedEntity* se, uint32_t flags);
+    void dequeue(SchedEntity* se);
+    // vruntime最小的实体，树为空时返回nullptr
+    SchedEntity* pick_first() const;
+
+    /**
+     * @brief 切换正在运行的实体
+     * @param se 从树里取出的实体，nullptr表示切到idle
+     * @param now 当前时钟
+     */
+    void set_next(SchedEntity* se, uint64_t now);
+    /**
+     * @brief 当前实体停止运行，结算运行时间
+     * @param runnable 还能运行时放回树里，退出或睡眠时不放回
+     */
+    void put_prev(uint64_t now, bool runnable);
+
+    // 把curr从上次结算到now的运行时间加到sum_exec和vruntime上
+    void update_curr(uint64_t now);
+
+    /**
+     * @brief 时钟中断时调用，更新每tick周期数的估计，结算当前实体
+     * @return 当前实体用完了时间片或者落后太多，需要重新调度
+     */
+    bool tick(uint64_t now);
+
+    // 实体在一个调度周期里应得的时间片(时钟周期)
+    uint64_t sched_slice(const SchedEntity* se) const;
+
+    // 读取并清除重新调度标记
+    bool test_and_clear_resched();
+
+    /**
+     * @brief 当前实体主动让出CPU，vruntime排到所有等待的实体后面并设置重新调度标记。
+     * 没有等待的实体时不变，继续运行
+     */
+    void yield(uint64_t now);
+
+    // 包括正在运行的实体在内的任务数
+    uint32_t nr_total() const { return nr_running + (curr ? 1 : 0); }
+
+    /**
+     * @brief 负载均衡时应该从busiest搬过来多少个实体，两边都按nr_total计算
+     * 搬完以后两边相差不超过1，只搬busiest树里等待的实体
+     */
+    uint32_t calc_imbalance(const CfsRunQueue& busiest) const;
+
+    /**
+     * @brief 从src的红黑树里搬最多max个实体到这个队列，调用方持有两个队列的锁
+     * vruntime按两个队列min_vruntime的差值平移，迁移后的相对位置不变
+     * @param now 当前时钟，用来判断缓存是否还热
+     * @param check_hot 为true时跳过离开CPU不到SCHED_MIGRATION_COST的实体
+     * @param filter 过滤不能放到这个CPU上的实体，为nullptr时都可以
+     * @param hot_skipped 输出，因为缓存热跳过的实体数
+     * @return 搬过来的实体数
+     */
+    uint32_t pull_from(CfsRunQueue& src, uint32_t max, uint64_t now, bool check_hot,
+        migrate_filter_t filter, void* arg, uint32_t* hot_skipped);
+
+    SchedEntity* curr;
+    uint32_t cpu;
+    uint32_t nr_running;
+    uint32_t load_weight;
+    uint64_t min_vruntime; // 单调不减，新实体和唤醒实体以它为基准放置
+    uint32_t tick_cycles;  // 每个tick的时钟周期数，滑动平均
+    uint64_t last_tick;
+    bool resched;
+    struct rb_root_cached timeline; // 等待运行的实体，按vruntime排序
+
+private:
+    // 以tick/1024为单位的时长换算成时钟周期
+    uint64_t units_to_cycles(uint32_t units) const;
+    void place_entity(SchedEntity* se, uint32_t flags);
+    void update_min_vruntime();
+    bool check_preempt_tick();
+    void check_preempt_wakeup(SchedEntity* se);
+};
+
+// 实际运行时间折算成vruntime
+uint64_t calc_delta_fair(uint64_t delta, const SchedEntity* se);
+
+} // namespace kernel
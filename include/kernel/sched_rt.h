@@ -0,0 +1,118 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "kernel/list.h"
+
+namespace kernel {
+
+// 实时调度类
+// SCHED_FIFO和SCHED_RR的任务排在公平调度类前面：运行队列里有实时任务时总是先运行实时任务，
+// 实时任务被唤醒时立即抢占正在运行的普通任务。实时优先级1~99，数值越大越优先，
+// 每个优先级一个FIFO链表，位图记录哪些链表非空，取最高优先级是常数时间。
+// SCHED_FIFO一直运行到睡眠、让出或者被更高优先级抢占；
+// SCHED_RR用完RR_TIMESLICE个tick以后排到同优先级的队尾。
+// 被更高优先级抢占的任务放回队首，再次轮到这个优先级时先运行它
+
+// 调度策略，和Linux的编号一致
+constexpr uint32_t SCHED_NORMAL = 0;
+constexpr uint32_t SCHED_FIFO = 1;
+constexpr uint32_t SCHED_RR = 2;
+
+constexpr uint32_t MAX_RT_PRIO = 100; // 实时优先级1~99
+constexpr uint32_t RR_TIMESLICE = 10; // SCHED_RR的时间片，tick数
+
+// 每个CPU当前运行的任务的优先级，数值越大越优先。push/pull不加锁比较各CPU的优先级
+constexpr uint32_t CPUPRIO_IDLE = 0;
+constexpr uint32_t CPUPRIO_NORMAL = 1;
+inline uint32_t rt_to_cpuprio(uint32_t prio) { return CPUPRIO_NORMAL + prio; }
+
+// 嵌在Task里的实时调度实体
+struct RtEntity {
+    struct list_head run_list;
+    uint32_t policy = SCHED_NORMAL; // SCHED_NORMAL表示任务在公平调度类里
+    uint32_t prio = 0;              // 实时优先级，SCHED_NORMAL时为0
+    uint32_t time_slice = RR_TIMESLICE; // SCHED_RR剩余的tick数
+    bool on_rq = false;
+    uint32_t cpu = 0; // 最近一次加入的队列所属的CPU
+};
+
+inline bool rt_policy(uint32_t policy) { return policy == SCHED_FIFO || policy == SCHED_RR; }
+
+// 迁移时判断实体能否放到目标CPU上，由调用方按CPU亲和性实现
+typedef bool (*rt_filter_t)(RtEntity* rt, void* arg);
+
+// 一个CPU的实时调度队列
+// 等待运行的实体在按优先级分开的链表里，正在运行的实体是curr，不在链表里，
+// nr_running只统计链表里的实体。调用方负责加锁
+class RtRunQueue {
+public:
+    void init(uint32_t cpu = 0);
+
+    /**
+     * @brief 实体加入优先级链表，比正在运行的实体优先级高、或者正在运行的不是实时任务时设置重新调度标记
+     * @param head 为true时放到同优先级的队首，被抢占的实体回到队首
+     */
+    void enqueue(RtEntity* rt, bool head = false);
+    void dequeue(RtEntity* rt);
+    // 优先级最高的等待实体，同优先级里最早入队的，没有时返回nullptr
+    RtEntity* pick_first() const;
+    // 等待实体的最高优先级，没有等待的实体时返回0
+    uint32_t highest_prio() const;
+
+    /**
+     * @brief 切换正在运行的实体
+     * @param rt 从链表里取出的实体，nullptr表示切到普通任务或idle
+     */
+    void set_next(RtEntity* rt);
+    /**
+     * @brief 当前实体停止运行
+     * @param runnable 还能作为实时任务运行时放回链表：时间片用完或者让出的放到队尾，被抢占的放到队首
+     */
+    void put_prev(bool runnable);
+
+    /**
+     * @brief 时钟中断时调用，SCHED_RR的当前实体用完时间片、同优先级有等待的实体时让出
+     * @return 需要重新调度
+     */
+    bool tick();
+
+    /**
+     * @brief 当前实体主动让出，同优先级有等待的实体时设置重新调度标记，放回时排到队尾
+     */
+    void yield();
+
+    /**
+     * @brief 当前实体是否应该继续运行：没有更高优先级的等待实体，
+     * 同优先级有等待的实体时只有没用完时间片、没有让出才继续运行
+     */
+    bool curr_keeps_cpu() const;
+
+    // 读取并清除重新调度标记
+    bool test_and_clear_resched();
+
+    /**
+     * @brief 从src的链表里取优先级最高、并且高于min_prio的实体放到这个队列，调用方持有两个队列的锁
+     * @param filter 过滤不能放到这个CPU上的实体，为nullptr时都可以
+     * @return 搬过来的实体，没有时返回nullptr
+     */
+    RtEntity* pull_from(RtRunQueue& src, uint32_t min_prio, rt_filter_t filter, void* arg);
+
+    // 等待实体里第一个能通过filter的，按优先级从高到低、同优先级按入队顺序查找
+    RtEntity* find_first(rt_filter_t filter, void* arg) const;
+
+    RtEntity* curr;
+    uint32_t cpu;
+    uint32_t nr_running;
+    bool resched;
+    bool requeue_tail; // 当前实体用完了时间片或者让出了，放回时排到队尾
+
+private:
+    static constexpr uint32_t BITMAP_WORDS = (MAX_RT_PRIO + 31) / 32;
+    uint32_t bitmap[BITMAP_WORDS]; // 第prio位为1表示queue[prio]非空
+    struct list_head queue[MAX_RT_PRIO];
+
+    bool has_waiting(uint32_t prio) const;
+};
+
+} // namespace kernel
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+
+#include "arch/x86/paging.h"
+#include "arch/x86/spinlock.h"
+
+class UserMemory;
+struct Context;
+
+// 共享内存对象，同一组物理页映射到多个地址空间
+// 对象本身持有每个物理页的一个引用，每个映射再各持有一个
+struct ShmObject {
+    static constexpr uint32_t NAME_LEN = 32;
+
+    char name[NAME_LEN];
+    uint32_t size;     // 按页对齐后的大小
+    uint32_t nr_pages; // 物理页数量
+    PADDR* pages;      // 物理页数组
+    uint32_t refs;     // 映射数量，名字未被unlink时再加1，归零时释放物理页
+    uint32_t gen;      // 创建时分配的代数，槽位被新对象重用后旧的句柄不再有效
+    bool linked;       // 是否还能通过名字打开
+    bool used;         // 槽位是否在使用
+};
+
+// 共享内存管理器，接口风格参考POSIX shm_open/mmap/munmap/shm_unlink
+class ShmManager
+{
+public:
+    static constexpr uint32_t MAX_SHM_OBJECTS = 32;
+
+    /**
+     * @brief 按名字打开共享内存对象，把句柄记到ctx的shm_handles上
+     * @param name 对象名
+     * @param size 创建时的大小，打开已有对象时忽略
+     * @param flags SHM_CREAT/SHM_EXCL
+     * @return 对象id，失败返回-1
+     */
+    static int open(const char* name, uint32_t size, uint32_t flags, Context& ctx);
+
+    /**
+     * @brief 把共享内存对象映射到ctx的地址空间，页表项立即建立。
+     * 只能映射ctx通过open拿到句柄的对象，句柄和fd表一起在cloneFiles里复制
+     * @return 映射起始地址，失败返回nullptr
+     */
+    static void* map(int id, Context& ctx);
+
+    /**
+     * @brief 解除map建立的映射
+     * @param addr map返回的地址
+     * @return 成功返回0，失败返回-1
+     */
+    static int unmap(void* addr, UserMemory& user_mm);
+
+    /**
+     * @brief 删除名字，已有的映射继续有效，最后一个映射解除后释放物理页
+     * @return 成功返回0，失败返回-1
+     */
+    static int unlink(const char* name);
+
+private:
+    // 以下调用方持有lock
+    static ShmObject* lookup(const char* name);
+    static int install(const char* name, PADDR* pages, uint32_t nr_pages);
+    static void put(ShmObject& obj);
+
+    // 分配清零的物理页，不持有lock，失败返回nullptr
+    static PADDR* alloc_pages(uint32_t nr_pages);
+    static void free_pages(PADDR* pages, uint32_t nr_pages);
+
+    static ShmObject objects[MAX_SHM_OBJECTS];
+    static uint32_t next_gen;
+    // 保护objects和next_gen。进程被杀死时release_all在context_lock里解除映射，不能用会睡眠的锁
+    static SpinLock lock;
+};
@@ -6,53 +6,193 @@
 #include <arch/x86/percpu.h>
 #include <arch/x86/smp.h>
 #include <kernel/list.h>
+#include <kernel/sched_fair.h>
+#include <kernel/sched_rt.h>
+#include <kernel/task_group.h>
 
 namespace kernel {
 
+DECLARE_PER_CPU(Task*, current_task);
+DECLARE_PER_CPU(Task*, idle_task);
+
 // 每CPU运行队列结构
 struct RunQueue {
     SpinLock lock;           // 运行队列锁
-    uint32_t nr_running;     // 可运行进程数量
-    struct list_head runnable_list;  // 可运行进程链表
+    uint32_t cpu;            // 所属CPU，同时锁两个队列时按它排序
+    uint32_t nr_running;     // 等待运行的普通任务数量，和cfs.nr_running一致，不含正在运行的任务
+    CfsRunQueue cfs;         // 按vruntime排序的公平调度队列
+    RtRunQueue rt;           // 实时调度队列，有实时任务时先于cfs运行
+    volatile uint32_t curr_prio; // 正在运行的任务的优先级(CPUPRIO_*)，其他CPU选择push目标时不加锁读
+    uint32_t balance_ticks;  // 距离下一次周期性负载均衡的tick数
+    uint32_t balance_failed; // 连续因为缓存热一个都没搬成的次数
+    volatile bool ipi_pending; // 已经发出还没处理的重新调度IPI，每个CPU最多一个
+
+    struct Stats {
+        uint32_t nr_switches;    // 任务切换次数
+        uint32_t migrations_in;  // 从其他CPU拉过来的任务数
+        uint32_t migrations_out; // 被其他CPU拉走的任务数
+        uint32_t idle_pulls;     // 其中在idle时拉过来的任务数
+        uint32_t periodic_pulls; // 其中周期性均衡拉过来的任务数
+        uint32_t hot_skipped;    // 因为缓存还热没有迁移的次数
+        uint32_t idle_ticks;     // 时钟中断时在运行idle的次数
+        uint32_t busy_ticks;     // 时钟中断时在运行任务的次数
+        uint32_t resched_ipis;   // 收到的重新调度IPI数
+        uint32_t ipis_coalesced; // 已经有IPI在路上，没有重复发送的次数
+        uint32_t rt_pushes;      // 推给优先级更低的CPU的实时任务数
+        uint32_t rt_pulls;       // 从其他CPU拉过来的实时任务数
+    } stats;
     void print_list();
 };
 
-// 定义每CPU运行队列
-#define SPINLOCK_INIT SpinLock()
-
 // SMP调度器类
 class SMP_Scheduler {
 public:
     // 初始化SMP调度器
     void init();
     
-    // 选择下一个要运行的任务
+    /**
+     * @brief 选择下一个要运行的任务，实时任务优先，其次是vruntime最小的普通任务，都没有时返回idle任务。
+     * 本CPU没有实时任务时先从有实时任务在等待的CPU拉一个过来。
+     * 当前的实时任务还应该继续运行时返回当前任务
+     */
     Task* pick_next_task();
-    
-    // 将任务加入运行队列
-    void enqueue_task(Task* p);
-    void enqueue_task(Task* p, int cpu_id);
 
-    // 执行负载均衡
+    /**
+     * @brief 将任务加入运行队列
+     * @param cpu_id 目标CPU
+     * @param flags ENQUEUE_NEW表示新任务，ENQUEUE_WAKEUP表示唤醒
+     */
+    void enqueue_task(Task* p, int cpu_id, uint32_t flags = ENQUEUE_WAKEUP);
+
+    // 当前任务被切走，结算运行时间，还能运行时放回本CPU的运行队列，idle和已退出的任务不放回
+    void put_prev_task(Task* prev);
+
+    /**
+     * @brief 切换完成、上一个任务离开内核栈以后调用，调用方已关中断。
+     * 本CPU在运行实时任务，还有实时任务在等待时，把一个推给正在运行更低优先级任务的CPU
+     */
+    void post_switch();
+
+    // 时钟中断里调用，结算当前任务的运行时间，判断是否需要切换
+    void scheduler_tick();
+
+    // 读取并清除本CPU的重新调度标记
+    bool need_resched();
+
+    // 当前任务让出CPU，本CPU上还有等待的任务时设置重新调度标记，调用方接着调用schedule()
+    void yield();
+
+    // 普通任务所在的任务组被限流了，不能继续运行，要切走
+    bool task_throttled(Task* p) { return !rt_policy(p->rt.policy) && task_group_throttled(p->group); }
+
+    /**
+     * @brief 通知cpu重新调度，调用方已经设置了它的重新调度标记。
+     * 本CPU在中断返回前自己会调度；其他CPU发重新调度IPI，
+     * 已经有一个IPI没处理时不重复发送，空闲CPU会从hlt醒来
+     */
+    void resched_cpu(uint32_t cpu);
+    // 重新调度IPI的处理，清除pending，之后的唤醒会再发IPI
+    void resched_ipi();
+
+    /**
+     * @brief idle时判断能否停掉本CPU的tick，调用方已关中断
+     * @return 没有等待运行的任务并且没有待处理的重新调度时返回true
+     */
+    bool nohz_idle_enter();
+    // tick恢复了，下一个tick和上一个tick之间隔了很久，不用来估计tick长度
+    void nohz_idle_exit();
+
+    /**
+     * @brief 修改当前任务的nice值，立即影响它的权重
+     * @param nice 超出[-20, 19]时截断
+     * @return 修改后的nice值
+     */
+    int set_current_nice(int nice);
+
+    /**
+     * @brief 修改任务的调度策略和实时优先级，正在排队的任务换到新调度类的队列里，
+     * 正在运行的任务在下一次调度时换
+     * @param policy SCHED_NORMAL/SCHED_FIFO/SCHED_RR
+     * @param prio 实时策略为1~99，SCHED_NORMAL为0
+     * @return 参数不合法时返回false
+     */
+    bool set_scheduler(Task* p, uint32_t policy, uint32_t prio);
+
+    // 本CPU没有可运行的任务时，从最忙的CPU拉任务过来，拉不到返回idle任务
     Task* load_balance();
-    
-    // 查找最繁忙的CPU
+
+    // 查找等待运行的任务最多的CPU，都没有等待的任务时返回当前CPU
     uint32_t find_busiest_cpu();
+
+    /**
+     * @brief 读取一个CPU的调度统计
+     * @param nr_running 输出，当前等待运行的任务数
+     * @return cpu超出范围时返回false
+     */
+    bool cpu_stats(uint32_t cpu, RunQueue::Stats& stats, uint32_t& nr_running);
+
+    static constexpr uint32_t BALANCE_INTERVAL = 10;  // 忙碌CPU每隔多少tick做一次负载均衡
+    static constexpr uint32_t BALANCE_FAILED_MAX = 2; // 连续失败这么多次以后也迁移缓存热的任务
     
-    // 设置进程的CPU亲和性
-    void set_affinity(Task* p, uint32_t cpu_mask);
+    /**
+     * @brief 设置任务的CPU亲和性，任务在不允许的CPU上排队时立即迁移，
+     * 正在不允许的CPU上运行时，那个CPU在下一个tick把它换走
+     * @param cpu_mask 0表示不限制，只在没有被隔离的CPU上运行
+     * @return 掩码里没有在线的CPU时返回false，亲和性不变
+     */
+    bool set_affinity(Task* p, uint32_t cpu_mask);
+
+    // 任务实际可以运行的CPU：没有设置亲和性的任务不会放到isolcpus隔离的CPU上
+    uint32_t allowed_cpus(Task* p);
+    bool cpu_allowed(Task* p, uint32_t cpu) { return allowed_cpus(p) & (1u << cpu); }
+    uint32_t isolated_cpus() { return online_mask & ~housekeeping_mask; }
     
     // 获取当前CPU的运行队列
     RunQueue* get_current_runqueue();
 
-    Task * get_current_task();
+    // 当前任务和idle任务放在per-CPU数据区里，读取是一条指令
+    Task * get_current_task() { return this_cpu_read(current_task); }
+    // 任务正在哪个CPU上运行，没有运行时返回-1
+    int running_cpu(Task* p);
     void set_current_task(Task* p);
-    Task * get_idle_task();
+    Task * get_idle_task() { return this_cpu_read(idle_task); }
     void set_idle_task(Task* p);
 private:
+    /**
+     * @brief 从最忙的CPU拉任务到rq，按cpu号顺序锁两个队列
+     * @param idle rq所在的CPU是否空闲，只影响统计
+     * @return 是否拉到了任务
+     */
+    bool balance(RunQueue* rq, bool idle);
+    // 为任务选择运行队列：preferred允许时就用它，否则选允许的CPU里任务最少的
+    uint32_t select_cpu(Task* p, uint32_t preferred);
+    void double_lock(RunQueue* a, RunQueue* b);
+    void double_unlock(RunQueue* a, RunQueue* b);
+    // 是否需要重新调度，运行实时任务时cfs的标记不算
+    bool rq_resched(RunQueue* rq) { return rq->rt.resched || (rq->cfs.resched && !rq->rt.curr); }
+    // 运行队列上的任务都算上的最高优先级(CPUPRIO_*)，不加锁读，只是参考
+    uint32_t rq_prio(RunQueue* rq);
+    // 为实时任务选择CPU：preferred上能立即运行就用它，否则选优先级最低并且低于它的CPU
+    uint32_t select_rt_cpu(Task* p, uint32_t preferred);
+    // 调用方持有rq的锁，记录rq上是否有等待运行的实时任务
+    void update_rt_overload(RunQueue* rq);
+    // 从有实时任务在等待的CPU拉一个优先级高于floor的实时任务到rq，返回是否拉到
+    bool pull_rt(RunQueue* rq, uint32_t floor);
+    // 把rq上等待的一个实时任务推给优先级更低的CPU
+    void push_rt(RunQueue* rq);
+    /**
+     * @brief 把普通任务上次结算以来的运行时间记到它的任务组上，调用方持有运行队列的锁
+     * @return 任务组已经被限流
+     */
+    bool charge_group(Task* p);
+    // 调用方持有rq的锁，取出vruntime最小的普通任务，所在任务组被限流的挂到组上，没有时返回nullptr
+    SchedEntity* pick_fair(RunQueue* rq);
+
     arch::PerCPU<RunQueue> scheduler_runqueue;
-    arch::PerCPU<Task> current_task;
-    arch::PerCPU<Task> idle_task;
+    uint32_t online_mask = 1;       // 所有在线CPU
+    uint32_t housekeeping_mask = 1; // 没有被隔离、运行普通任务的CPU
+    bool resched_ipi_enabled = true; // resched_ipi=off时其他CPU等到自己的tick才发现新任务
+    volatile uint32_t rt_overload_mask = 0; // 有实时任务在等待运行的CPU，空出来的CPU从这些CPU拉任务
 };
 
 // 遍历所有CPU的宏
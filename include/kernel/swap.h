@@ -0,0 +1,150 @@
+#pragma once
+#include <cstdint>
+
+#include "arch/x86/paging.h"
+#include "arch/x86/spinlock.h"
+#include "drivers/block_device.h"
+#include "kernel/wait.h"
+
+class UserMemory;
+struct Context;
+namespace kernel {
+struct TaskGroup;
+}
+
+// 换出页面的页表项：PAGE_PRESENT为0，PAGE_SWAPPED为1，地址部分保存交换槽位号，
+// 低位保留原来的PAGE_USER/PAGE_WRITE，NX位也保留，换入时按原权限恢复映射
+inline bool pte_is_swap(pte_t pte) { return !(pte & PAGE_PRESENT) && (pte & PAGE_SWAPPED); }
+inline uint32_t swap_pte_slot(pte_t pte) { return (uint32_t)(pte_paddr(pte) / PAGE_SIZE); }
+inline pte_t swap_pte_prot(pte_t pte) { return pte & (PAGE_USER | PAGE_WRITE | PAGE_NX); }
+inline pte_t make_swap_pte(uint32_t slot, pte_t prot)
+{
+    return ((pte_t)slot * PAGE_SIZE) | PAGE_SWAPPED | swap_pte_prot(prot);
+}
+
+// 交换空间管理
+// 交换设备是一个按mkswap格式(SWAPSPACE2)初始化的块设备，第0块是头部，
+// 第i块就是第i个交换槽位。回收时用CLOCK算法扫描进程的页表：
+// PAGE_ACCESSED为1的页面清掉访问位再给一次机会，为0的私有匿名页写到交换槽位，
+// 页表项换成交换项。换入时顺带把同一簇里相邻的槽位读进交换缓存(预读)，
+// 顺序换出的页面在槽位上也是相邻的，之后的缺页直接从缓存取页，不用再读盘。
+// 读写交换设备时不持有lock：槽位先标记为正在读写，访问同一槽位的缺页在io_wq上等它结束，
+// 释放的槽位在读写结束前也不会被重新分配；重新加锁以后按页表项是否变化决定结果
+class SwapManager
+{
+public:
+    static constexpr uint32_t MAX_SLOTS = 65536;   // 最多256MB交换空间
+    static constexpr uint32_t CLUSTER_SLOTS = 8;   // 预读窗口，按簇对齐
+    static constexpr uint32_t CACHE_SIZE = 32;     // 交换缓存能容纳的预读页面数
+    static constexpr uint32_t SCAN_BATCH = 512;    // 每个进程每轮最多检查的驻留页数
+    static constexpr uint32_t RECLAIM_BATCH = 32;  // 内存不足时一次回收的页数
+    static constexpr uint32_t READAHEAD_MIN_FREE = 256; // 空闲页少于这个数时不预读
+
+    struct Stats {
+        uint32_t total_slots;   // 交换槽位总数
+        uint32_t used_slots;    // 已使用的槽位数
+        uint32_t swap_outs;     // 换出的页数
+        uint32_t swap_ins;      // 换入的页数(包括从交换缓存取到的)
+        uint32_t readahead;     // 预读进交换缓存的页数
+        uint32_t readahead_hits; // 缺页时在交换缓存里找到的次数
+        uint32_t scanned;       // CLOCK扫描检查过的驻留页数
+    };
+
+    /**
+     * @brief 启用交换设备，检查mkswap写入的头部
+     * @param dev 交换设备，块大小需要等于页大小
+     * @return 启用成功返回true
+     */
+    static bool activate(kernel::BlockDevice* dev);
+    static bool active() { return device != nullptr; }
+
+    /**
+     * @brief 处理换出页面的缺页，把页面读回来重新映射
+     * @param user_mm 缺页进程的地址空间
+     * @param vaddr 缺页地址
+     * @return E_OK已处理(包括页面已被其他任务换入)，E_NOMEM内存不足，
+     * E_LIMIT进程的任务组到了内存上限，E_PANIC读盘失败
+     */
+    static int swap_in(UserMemory& user_mm, uint32_t vaddr);
+
+    /**
+     * @brief 扫描所有进程，把不常用的匿名页换出
+     * @param target 希望释放的页数
+     * @param group 不为nullptr时只扫描驻留页记在这个任务组上的进程，也不收缩交换缓存
+     * @return 实际释放的页数
+     */
+    static uint32_t reclaim(uint32_t target, kernel::TaskGroup* group = nullptr);
+
+    // 页表项被复制(fork)时增加槽位引用
+    static void dup_entry(pte_t pte);
+    // 页表项被清除时释放槽位引用
+    static void free_entry(pte_t pte);
+
+    static Stats stats();
+
+private:
+    struct CacheEntry {
+        uint32_t slot;
+        PADDR page; // 0表示空闲
+    };
+
+    // 准备换出的页面，页表项已经换成交换项，槽位正在写
+    struct Evict {
+        Context* ctx;  // 持有页目录的引用，写盘期间进程不会被释放
+        uint32_t vaddr;
+        pte_t entry;   // 原来的页表项
+        uint32_t slot;
+        bool written;  // 已经写到槽位上
+        bool done;     // 已经确认换出或者恢复了映射
+    };
+    struct ReclaimScan;
+
+    static uint32_t alloc_slot();
+    static void put_slot(uint32_t slot);
+    static bool read_slot(uint32_t slot, PADDR page);
+    static bool write_slot(uint32_t slot, PADDR page);
+    static PADDR cache_take(uint32_t slot);
+    static bool cache_contains(uint32_t slot);
+    static void cache_insert(uint32_t slot, PADDR page);
+    static void cache_drop(uint32_t slot);
+    static uint32_t cache_shrink();
+    // 不持有lock调用，读的槽位标记为正在读
+    static void readahead(uint32_t slot);
+
+    // 槽位是否正在读写
+    static bool io_busy(uint32_t slot);
+    // 标记槽位正在读写，调用方持有lock
+    static void start_io(uint32_t slot);
+    // 读写结束，唤醒在wait_io里等这个槽位的任务
+    static void end_io(uint32_t slot);
+    // 不持有lock调用，等到槽位的读写结束
+    static void wait_io(uint32_t slot);
+
+    /**
+     * @brief CLOCK扫描一个进程，选出的页面换成交换项，放进batch等写盘，调用方持有lock
+     * @return 放进batch的页面数，不超过max
+     */
+    static uint32_t scan_context(Context* ctx, Evict* batch, uint32_t max, bool current);
+    static bool prepare_evict(Context* ctx, uint32_t vaddr, pte_t* pte, bool current, Evict& ev);
+    /**
+     * @brief 写盘以后确认换出或者恢复原来的映射，调用方持有lock
+     * @param commit 写盘成功并且可以释放页面
+     * @return 页面已经换出释放
+     */
+    static bool finish_evict(Evict& ev, bool commit);
+    static void reclaim_context(Context* ctx, void* arg);
+    static void finish_context(Context* ctx, void* arg);
+    // 不持有锁写出scan里的页面，再确认结果，返回释放的页数
+    static uint32_t write_batch(ReclaimScan& scan);
+
+    static kernel::BlockDevice* device;
+    static SpinLock lock;         // 保护下面的字段和页表项在交换项和页面之间的转换
+    static uint8_t* slot_refs;    // 每个槽位被多少个页表项引用，0表示空闲
+    static uint32_t* io_bitmap;   // 正在读写的槽位，用原子操作修改
+    static kernel::WaitQueue io_wq; // 等槽位读写结束的任务
+    static uint32_t nr_slots;     // 槽位号范围[1, nr_slots]，第0块是头部
+    static uint32_t next_slot;    // 下次从这里开始找空闲槽位，换出的页面尽量连续
+    static CacheEntry cache[CACHE_SIZE];
+    static uint32_t cache_next;   // 缓存满时按FIFO替换
+    static Stats counters;
+};
@@ -27,6 +27,26 @@ enum SyscallNumber {
     SYS_PWD = 18,
     SYS_GETCWD = 19,
     SYS_MMAP = 20,
+    SYS_MSYNC = 21,
+    SYS_SHM_OPEN = 22,
+    SYS_SHM_MAP = 23,
+    SYS_SHM_UNMAP = 24,
+    SYS_SHM_UNLINK = 25,
+    SYS_MEMINFO = 26,
+    SYS_PROCSTAT = 27,
+    SYS_NICE = 28,
+    SYS_SCHEDSTAT = 29,
+    SYS_SCHED_SETAFFINITY = 30,
+    SYS_SCHED_GETAFFINITY = 31,
+    SYS_CLOCK_GETTIME = 32,
+    SYS_DEBUG = 33, // 基准测试和调试统计，操作见kernel/debug_syscall.h
+    SYS_SCHED_SETSCHEDULER = 34,
+    SYS_SCHED_GETSCHEDULER = 35,
+    SYS_TASKGROUP_CREATE = 36,
+    SYS_TASKGROUP_SET = 37,
+    SYS_TASKGROUP_ATTACH = 38,
+    SYS_TASKGROUP_STAT = 39,
+    SYS_LOGLEVEL = 40,
 };
 
 // 系统调用处理函数类型
@@ -52,8 +72,144 @@ int getcwdHandler(uint32_t buf_ptr, uint32_t size, uint32_t, uint32_t);
 int sys_getcwd(char* buf, size_t size);
 
 #define MAP_FAILED -1
+// mmap的prot参数
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+// mmap的flags参数
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+// msync的flags参数
+#define MS_ASYNC 0x1
+#define MS_INVALIDATE 0x2
+#define MS_SYNC 0x4
 void* sys_mmap(void* addr, size_t length, int prot, int flags, int fd, size_t offset);
 int mmapHandler(uint32_t addr, uint32_t length, uint32_t prot, uint32_t user_buf_p);
+int sys_msync(void* addr, size_t length, int flags);
+int msyncHandler(uint32_t addr, uint32_t length, uint32_t flags, uint32_t);
+
+// shm_open的flags参数
+#define SHM_CREAT 0x1
+#define SHM_EXCL 0x2
+int shmOpenHandler(uint32_t name_ptr, uint32_t size, uint32_t flags, uint32_t);
+int shmMapHandler(uint32_t id, uint32_t, uint32_t, uint32_t);
+int shmUnmapHandler(uint32_t addr, uint32_t, uint32_t, uint32_t);
+int shmUnlinkHandler(uint32_t name_ptr, uint32_t, uint32_t, uint32_t);
+
+// meminfo系统调用返回的内存统计
+struct MemInfo {
+    uint32_t normal_free_pages; // 直接映射区空闲页数
+    uint32_t high_free_pages;   // 高端内存空闲页数
+    uint32_t zero_page_maps;    // 读缺页映射共享零页的次数
+    uint32_t zero_page_cows;    // 共享零页被写时复制的次数
+    uint32_t kstack_allocs;     // 内核栈分配次数
+    uint32_t kstack_cached;     // 其中复用已映射栈的次数
+    uint32_t kstack_avg_cycles; // 内核栈平均分配耗时(TSC周期)
+    uint32_t kstack_order2_unavailable; // 新建内核栈时没有order-2连续块的次数
+    uint32_t oom_kills;         // OOM killer杀死的进程数
+    uint32_t swap_total;        // 交换空间总页数，0表示没有启用交换
+    uint32_t swap_used;         // 已使用的交换页数
+    uint32_t swap_outs;         // 换出的页数
+    uint32_t swap_ins;          // 换入的页数
+    uint32_t swap_readahead;    // 预读的页数
+    uint32_t swap_readahead_hits; // 换入时命中预读的次数
+};
+int meminfoHandler(uint32_t info_ptr, uint32_t, uint32_t, uint32_t);
+
+// procstat系统调用返回的进程内存统计
+struct ProcStat {
+    uint32_t pid;
+    uint32_t total_vm; // 虚拟内存页数
+    uint32_t rss_anon; // 驻留的匿名页数
+    uint32_t rss_file; // 驻留的文件页数(文件映射和共享内存)
+    char name[32];     // 进程第一个任务的名字
+};
+// 读取进程表中第index个进程的统计，index超出范围时返回-1
+int procstatHandler(uint32_t index, uint32_t stat_ptr, uint32_t, uint32_t);
+// 调整当前任务的nice值，结果截断到[-20, 19]，返回调整后的值
+int niceHandler(uint32_t inc, uint32_t, uint32_t, uint32_t);
+
+// schedstat系统调用返回的每CPU调度统计
+struct SchedStat {
+    uint32_t nr_running;     // 等待运行的任务数，不含正在运行的任务
+    uint32_t nr_switches;    // 任务切换次数
+    uint32_t migrations_in;  // 从其他CPU拉过来的任务数
+    uint32_t migrations_out; // 被其他CPU拉走的任务数
+    uint32_t idle_pulls;     // 其中空闲时拉过来的任务数
+    uint32_t periodic_pulls; // 其中周期性均衡拉过来的任务数
+    uint32_t hot_skipped;    // 因为缓存还热没有迁移的次数
+    uint32_t idle_ticks;     // 时钟中断时在运行idle的次数
+    uint32_t busy_ticks;     // 时钟中断时在运行任务的次数
+    uint32_t nohz_entries;   // idle时停掉周期tick的次数
+    uint32_t nohz_ticks;     // 停掉期间少处理的时钟中断数
+    uint32_t resched_ipis;   // 收到的重新调度IPI数
+    uint32_t ipis_coalesced; // 已经有IPI在路上没有重复发送的次数
+    uint32_t fpu_traps;      // 装入任务FPU状态的#NM次数
+    uint32_t fpu_saves;      // 保存FPU状态的次数
+    uint32_t fpu_lazy_hits;  // 切回来时FPU寄存器里还是它的状态的次数
+    uint32_t cr3_loads;      // 任务切换时重新装入CR3的次数
+    uint32_t cr3_skips;      // 同一个进程的任务之间切换，没有换CR3的次数
+    uint32_t lazy_tlb;       // 切到内核任务沿用上一个CR3的次数
+    uint32_t rt_pushes;      // 推给优先级更低的CPU的实时任务数
+    uint32_t rt_pulls;       // 从其他CPU拉过来的实时任务数
+};
+// 读取第cpu个CPU的统计，cpu超出范围时返回-1
+int schedstatHandler(uint32_t cpu, uint32_t stat_ptr, uint32_t, uint32_t);
+// 设置任务可以运行的CPU掩码，pid是任务号，0表示当前任务，mask为0表示不限制
+int schedSetaffinityHandler(uint32_t pid, uint32_t mask, uint32_t, uint32_t);
+// 读取任务实际可以运行的CPU掩码，找不到任务时返回-1
+int schedGetaffinityHandler(uint32_t pid, uint32_t mask_ptr, uint32_t, uint32_t);
+/**
+ * 设置任务的调度策略，pid为0表示当前任务
+ * @param policy kernel::SCHED_NORMAL/SCHED_FIFO/SCHED_RR
+ * @param prio 实时策略为1~99，SCHED_NORMAL为0
+ * @return 找不到任务或者参数不合法时返回-1
+ */
+int schedSetschedulerHandler(uint32_t pid, uint32_t policy, uint32_t prio, uint32_t);
+// 返回任务的调度策略，prio_ptr不为空时写入实时优先级，找不到任务时返回-1
+int schedGetschedulerHandler(uint32_t pid, uint32_t prio_ptr, uint32_t, uint32_t);
+
+// taskgroup_stat系统调用返回的任务组统计
+struct TaskGroupStat {
+    char name[16];
+    uint32_t quota_us;        // 每个周期的CPU配额，0表示不限制
+    uint32_t period_us;       // 周期
+    uint32_t usage_ms;        // 组里任务累计的运行时间
+    uint32_t throttled_ms;    // 累计被限流的时间
+    uint32_t nr_periods;      // 经过的周期数
+    uint32_t nr_throttled;    // 被限流的周期数
+    uint32_t nr_tasks;        // 组里的任务数
+    uint32_t mem_limit_pages; // 驻留页上限，0表示不限制
+    uint32_t mem_usage_pages; // 组里进程的驻留页数
+    uint32_t mem_max_pages;   // 驻留页数的峰值
+    uint32_t mem_failcnt;     // 到了上限需要回收的次数
+};
+// 创建任务组，同名的组已经存在时返回它的组号，组满了返回-1
+int taskgroupCreateHandler(uint32_t name_ptr, uint32_t, uint32_t, uint32_t);
+/**
+ * 设置任务组的限制
+ * @param quota_us 每个周期的CPU时间，0表示不限制
+ * @param period_us 周期，0表示默认的100ms
+ * @param mem_limit_kb 内存上限，0表示不限制
+ * @return 组不存在或者配额、周期超出范围时返回-1
+ */
+int taskgroupSetHandler(uint32_t id, uint32_t quota_us, uint32_t period_us, uint32_t mem_limit_kb);
+// 把任务移到组里，pid为0表示当前任务，id为0表示移回根组
+int taskgroupAttachHandler(uint32_t id, uint32_t pid, uint32_t, uint32_t);
+// 读取任务组的统计，组不存在时返回-1
+int taskgroupStatHandler(uint32_t id, uint32_t stat_ptr, uint32_t, uint32_t);
+// 读取时钟写到timespec里，只支持CLOCK_MONOTONIC
+int clockGettimeHandler(uint32_t clock_id, uint32_t ts_ptr, uint32_t, uint32_t);
+
+// loglevel系统调用的level参数
+#define LOGLEVEL_GET (-1)   // 读取级别
+#define LOGLEVEL_RESET (-2) // 删除name的规则
+/**
+ * name为空时读取或者设置全局日志级别，否则是源文件路径包含name的日志的级别。
+ * 读取时返回级别，设置时成功返回0，name太长、规则已满或者级别不对时返回-1
+ */
+int loglevelHandler(uint32_t name_ptr, uint32_t level, uint32_t, uint32_t);
 
 
 // 系统调用管理器
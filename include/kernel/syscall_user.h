@@ -2,6 +2,7 @@
 #define SYSCALL_USER_H
 
 #include "syscall.h"
+#include "debug_syscall.h"
 
 #include <cstdint>
 #include <unistd.h>
@@ -173,6 +174,218 @@ inline void* syscall_mmap(void* addr, size_t length, int prot, int flags, int fd
         : "a"(SYS_MMAP), "b"(addr), "c"(length), "d"(prot), "S"(user_buf));
     return ret;
 }
+
+// 把共享文件映射的脏页写回文件
+inline int syscall_msync(void* addr, size_t length, int flags)
+{
+    int ret;
+    asm volatile("int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_MSYNC), "b"(addr), "c"(length), "d"(flags)
+        : "memory");
+    return ret;
+}
+
+// 打开或创建共享内存对象，返回对象id
+inline int syscall_shm_open(const char* name, size_t size, int flags)
+{
+    int ret;
+    asm volatile("int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_SHM_OPEN), "b"((uint32_t)name), "c"(size), "d"(flags)
+        : "memory");
+    return ret;
+}
+
+// 把共享内存对象映射到当前进程
+inline void* syscall_shm_map(int id)
+{
+    void* ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_SHM_MAP), "b"(id) : "memory");
+    return ret;
+}
+
+inline int syscall_shm_unmap(void* addr)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_SHM_UNMAP), "b"(addr) : "memory");
+    return ret;
+}
+
+inline int syscall_shm_unlink(const char* name)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_SHM_UNLINK), "b"((uint32_t)name) : "memory");
+    return ret;
+}
+
+// 获取内存统计
+inline int syscall_meminfo(MemInfo* info)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_MEMINFO), "b"(info) : "memory");
+    return ret;
+}
+
+inline int syscall_procstat(uint32_t index, ProcStat* stat)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_PROCSTAT), "b"(index), "c"(stat) : "memory");
+    return ret;
+}
+
+// 当前进程的nice值加上inc，返回调整后的nice值
+inline int syscall_nice(int inc)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_NICE), "b"(inc) : "memory");
+    return ret;
+}
+
+inline int syscall_schedstat(uint32_t cpu, SchedStat* stat)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_SCHEDSTAT), "b"(cpu), "c"(stat) : "memory");
+    return ret;
+}
+
+// pid为0表示当前任务，mask为0表示可以在任何没有被隔离的CPU上运行
+inline int syscall_sched_setaffinity(uint32_t pid, uint32_t mask)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_SCHED_SETAFFINITY), "b"(pid), "c"(mask) : "memory");
+    return ret;
+}
+
+inline int syscall_sched_getaffinity(uint32_t pid, uint32_t* mask)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_SCHED_GETAFFINITY), "b"(pid), "c"(mask) : "memory");
+    return ret;
+}
+
+// pid为0表示当前任务，policy为kernel::SCHED_*，prio是实时优先级1~99，SCHED_NORMAL时为0
+inline int syscall_sched_setscheduler(uint32_t pid, uint32_t policy, uint32_t prio)
+{
+    int ret;
+    asm volatile("int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_SCHED_SETSCHEDULER), "b"(pid), "c"(policy), "d"(prio)
+        : "memory");
+    return ret;
+}
+
+// 返回调度策略，prio不为空时写入实时优先级
+inline int syscall_sched_getscheduler(uint32_t pid, uint32_t* prio)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_SCHED_GETSCHEDULER), "b"(pid), "c"(prio) : "memory");
+    return ret;
+}
+
+// 创建任务组，同名的已经存在时返回它，返回组号
+inline int syscall_taskgroup_create(const char* name)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_TASKGROUP_CREATE), "b"(name) : "memory");
+    return ret;
+}
+
+// 设置任务组的CPU配额(微秒，0不限制)、周期(微秒，0默认)和内存上限(KB，0不限制)
+inline int syscall_taskgroup_set(uint32_t id, uint32_t quota_us, uint32_t period_us,
+    uint32_t mem_limit_kb)
+{
+    int ret;
+    asm volatile("int $0x80"
+        : "=a"(ret)
+        : "a"(SYS_TASKGROUP_SET), "b"(id), "c"(quota_us), "d"(period_us), "S"(mem_limit_kb)
+        : "memory");
+    return ret;
+}
+
+// 把任务移到组里，pid为0表示当前任务，id为0表示移回根组
+inline int syscall_taskgroup_attach(uint32_t id, uint32_t pid)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_TASKGROUP_ATTACH), "b"(id), "c"(pid) : "memory");
+    return ret;
+}
+
+// 读取任务组的统计
+inline int syscall_taskgroup_stat(uint32_t id, TaskGroupStat* stat)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_TASKGROUP_STAT), "b"(id), "c"(stat) : "memory");
+    return ret;
+}
+
+// 读取时钟，目前只支持CLOCK_MONOTONIC
+inline int syscall_clock_gettime(uint32_t clock_id, struct timespec* ts)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_CLOCK_GETTIME), "b"(clock_id), "c"(ts) : "memory");
+    return ret;
+}
+
+// 调试系统调用，op见DebugOp
+inline int syscall_debug(
+    uint32_t op, uint32_t arg0 = 0, uint32_t arg1 = 0, uint32_t arg2 = 0, uint32_t arg3 = 0)
+{
+    int ret;
+    uint32_t args[DEBUG_NR_ARGS] = {arg0, arg1, arg2, arg3};
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_DEBUG), "b"(op), "c"(args) : "memory");
+    return ret;
+}
+
+// 等待队列唤醒延迟测试，op见WAITBENCH_*
+inline int syscall_waitbench(uint32_t op, uint32_t arg)
+{
+    return syscall_debug(DEBUG_WAITBENCH, op, arg);
+}
+
+// 两个内核任务互相yield，测量任务切换开销
+inline int syscall_switchbench(uint32_t rounds, struct SwitchBench* result)
+{
+    return syscall_debug(DEBUG_SWITCHBENCH, rounds, (uint32_t)result);
+}
+
+// 在cpu上启动count个空转ms毫秒的内核任务，group不为0时放进这个任务组，返回启动的个数
+inline int syscall_cpuhog(uint32_t cpu, uint32_t count, uint32_t ms, uint32_t group = 0)
+{
+    return syscall_debug(DEBUG_CPUHOG, cpu, count, ms, group);
+}
+
+// 读取第index个锁类的统计，index为LOCKSTAT_RESET时清零
+inline int syscall_lockstat(uint32_t index, struct LockStat* stat)
+{
+    return syscall_debug(DEBUG_LOCKSTAT, index, (uint32_t)stat);
+}
+
+// 在cpus个CPU上抢同一把锁，mode为LOCKBENCH_TAS或LOCKBENCH_TICKET
+inline int syscall_lockbench(uint32_t mode, uint32_t cpus, uint32_t rounds, struct LockBench* result)
+{
+    return syscall_debug(DEBUG_LOCKBENCH, mode, cpus, rounds, (uint32_t)result);
+}
+
+// 在cpus个CPU上并行查找挂载表和fd表，mode见RCUBENCH_*
+inline int syscall_rcubench(uint32_t mode, uint32_t cpus, uint32_t rounds, struct RcuBench* result)
+{
+    return syscall_debug(DEBUG_RCUBENCH, mode, cpus, rounds, (uint32_t)result);
+}
+
+// 测量rounds次log_debug的开销
+inline int syscall_logbench(uint32_t rounds, struct LogBench* result)
+{
+    return syscall_debug(DEBUG_LOGBENCH, rounds, (uint32_t)result);
+}
+
+// 读取或者设置日志级别，name为nullptr时是全局级别，level见LOGLEVEL_*
+inline int syscall_loglevel(const char* name, int level)
+{
+    int ret;
+    asm volatile("int $0x80" : "=a"(ret) : "a"(SYS_LOGLEVEL), "b"(name), "c"(level) : "memory");
+    return ret;
+}
 }
 
 #endif // SYSCALL_USER_H
\ No newline at end of file
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+
+#include "arch/x86/spinlock.h"
+#include "kernel/list.h"
+#include "kernel/sched_bandwidth.h"
+#include "kernel/timer.h"
+
+struct Task;
+
+namespace kernel {
+
+// 任务组
+// 一组任务共享CPU带宽和内存上限。
+// CPU按任务计：组里普通任务的运行时间合在一起受配额限制，用完以后任务离开CPU时挂到组上，
+// 下一个周期开始时由周期定时器放回运行队列。实时任务不结算运行时间，不受限流影响。
+// 内存按进程计：进程的驻留页记在它的地址空间所属的组上，缺页和brk新增页面之前检查上限，
+// 到了上限先在组内换出匿名页，换不出来就在组内选进程杀死。
+// 组号0是根组，表示不属于任何组，不统计也不限制；创建出来的组不能删除
+
+constexpr uint32_t MAX_TASK_GROUPS = 8; // 包括根组
+constexpr uint32_t TASK_GROUP_NAME_LEN = 15;
+
+struct TaskGroup {
+    uint32_t id;
+    char name[TASK_GROUP_NAME_LEN + 1];
+    SpinLock lock;          // 保护带宽状态和被限流的任务，在运行队列的锁里面加
+    CpuBandwidth bandwidth;
+    uint64_t throttled_at;  // 这次开始限流的时间(ktime_get)
+    uint64_t throttled_ns;  // 累计被限流的时间
+    struct list_head throttled_tasks; // 被限流、等下一个周期放回运行队列的任务
+    hrtimer period_timer;   // 有配额时每个周期触发一次
+    volatile uint32_t nr_tasks;    // 组里的任务数
+    volatile uint32_t mem_usage;   // 组里进程的驻留页数
+    uint32_t mem_limit;            // 驻留页上限，0表示不限制
+    uint32_t mem_max_usage;        // 驻留页数的峰值
+    volatile uint32_t mem_failcnt; // 新增页面时已经到了上限的次数
+};
+
+/**
+ * @brief 创建任务组，同名的组已经存在时直接返回它
+ * @param name 超过TASK_GROUP_NAME_LEN的部分截断
+ * @return 组号，名字为空或者组已经满了时返回-1
+ */
+int task_group_create(const char* name);
+// 组号对应的组，根组和不存在的组返回nullptr
+TaskGroup* task_group_get(uint32_t id);
+
+/**
+ * @brief 设置CPU配额和内存上限，本周期已用的时间清零
+ * @param quota_ns 每个周期的CPU时间，0表示不限制
+ * @param period_ns 周期，0表示默认的100ms
+ * @param mem_limit_pages 驻留页上限，0表示不限制。低于当前用量时，之后的缺页先回收
+ * @return 配额或周期超出范围时返回false
+ */
+bool task_group_set_limits(TaskGroup* tg, uint64_t quota_ns, uint64_t period_ns,
+    uint32_t mem_limit_pages);
+
+/**
+ * @brief 把任务移到组里，tg为nullptr表示移回根组。
+ * 任务属于用户进程时，进程的地址空间连同已有的驻留页一起记到新组上
+ */
+void task_group_attach(Task* p, TaskGroup* tg);
+// 任务被回收时调用
+void task_group_exit(Task* p);
+
+inline bool task_group_throttled(const TaskGroup* tg) { return tg && tg->bandwidth.throttled; }
+
+/**
+ * @brief 把ns纳秒的运行时间记到组上，调用方已关中断
+ * @return 组已经被限流
+ */
+bool task_group_charge(TaskGroup* tg, uint64_t ns);
+
+/**
+ * @brief 组还在限流时把任务挂到组上。调用方持有运行队列的锁，
+ * 任务已经离开运行队列，vruntime换成了相对队列min_vruntime的值
+ * @return 组已经解除限流时返回false，由调用方放回运行队列
+ */
+bool task_group_throttle_task(TaskGroup* tg, Task* p);
+
+// 驻留页数变化，UserMemory::account_rss里调用，可以在中断里
+void task_group_charge_pages(TaskGroup* tg, int delta);
+/**
+ * @brief 不超过上限时把pages个驻留页记到组上，超过时不记账并记一次失败。
+ * 成功以后调用方用UserMemory::map_pages(..., charged=true)映射这些页面，映射不成时
+ * 用task_group_charge_pages(tg, -pages)退回
+ * @return tg为nullptr、没有上限或者记账成功时返回true
+ */
+bool task_group_try_charge(TaskGroup* tg, uint32_t pages);
+
+} // namespace kernel
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+
+// 时钟事件管理
+// 每个CPU的本地APIC定时器启动时是周期模式，用前几个tick测出APIC定时器计数和TSC的比例后
+// 切到一次性模式(支持时用TSC-deadline模式)，每次中断按下一个tick和最早的hrtimer中更早的
+// 那个编程下一次中断，hrtimer的精度不再受tick长度限制。
+// tick固定为HZ分之一秒，按TSC计算，中断来晚了按实际经过的tick数补上。
+// CPU空闲时(运行队列为空)停掉tick，睡到最近的timer_list或hrtimer到期，
+// 醒来时把停掉期间错过的tick补到内核的tick计数和时间轮上。
+// 忙碌的CPU保持tick，时间片只在tick上检查
+class Tick
+{
+public:
+    static constexpr uint32_t HZ = 100;
+    // 空闲CPU最多停掉这么多个tick，还要定期醒来做负载均衡
+    static constexpr uint32_t NOHZ_MAX_IDLE_TICKS = 10;
+
+    struct Stats {
+        uint32_t nohz_entries; // 停掉tick的次数
+        uint32_t nohz_ticks;   // 停掉期间少处理的时钟中断数
+    };
+
+    /**
+     * @brief 在BSP上启动其他CPU之前调用，测量TSC频率，初始化定时器，读取启动参数
+     * nohz=off时一直保持tick，highres=off时一直用周期模式，hrtimer按tick精度到期
+     */
+    static void init();
+
+    /**
+     * @brief idle循环的一次迭代：没有可运行的任务时停掉tick，然后hlt，
+     * 被任意中断唤醒后恢复tick再返回
+     */
+    static void idle();
+
+    /**
+     * @brief idle时停掉的tick恢复，调用方已关中断。
+     * 中断处理要从idle直接切到任务时调用，切走以后idle里hlt之后的代码不会马上执行
+     */
+    static void nohz_exit();
+
+    /**
+     * @brief 本地APIC定时器中断入口，补上经过的tick，执行到期的定时器，编程下一次中断
+     * @return 到了tick的时间，调用方要做调度器的tick；只是hrtimer到期时返回false
+     */
+    static bool timer_interrupt();
+
+    // 本CPU最早的hrtimer变了，重新编程下一次中断
+    static void reprogram();
+
+    static void cpu_stats(uint32_t cpu, Stats& stats);
+
+private:
+    enum Mode {
+        MODE_PERIODIC, // 启动时的周期模式，同时测量APIC定时器
+        MODE_ONESHOT,
+    };
+
+    struct CpuState {
+        Mode mode;
+        uint32_t calibrate_ticks; // 周期模式下数过的tick数
+        uint64_t calibrate_tsc;   // 开始数tick时的TSC
+        uint32_t apic_count;      // 周期模式下一个tick的APIC定时器计数
+        uint32_t apic_tsc;        // 同一个tick的TSC周期数
+        uint64_t next_tick;       // 下一个tick的TSC
+        bool stopped;             // tick已经停掉
+        uint64_t stop_until;      // 停掉时睡到的TSC
+        Stats stats;
+    };
+
+    // 周期模式下测量这么多个tick后切到一次性模式
+    static constexpr uint32_t CALIBRATE_TICKS = 8;
+
+    /**
+     * @brief 补上到now为止经过的tick，调用方已关中断
+     * @return 经过的tick数，还没到下一个tick时返回0
+     */
+    static uint32_t account_ticks(CpuState& state, uint64_t now);
+    // 把所有CPU共用的tick数推进到now，调用方已关中断
+    static void update_global_ticks(uint64_t now);
+    static void periodic_tick(CpuState& state, uint64_t now);
+    // 按下一个tick(停掉时是stop_until)和最早的hrtimer编程一次性中断，调用方已关中断
+    static void program_next(CpuState& state, uint64_t now);
+
+    static bool initialized;
+    static bool nohz_enabled;
+    static bool highres_enabled;
+    static uint32_t tick_cycles; // 一个tick的TSC周期数
+    static CpuState cpu_state[];
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <cstdint>
+
+#include "kernel/list.h"
+#include "kernel/rbtree.h"
+
+namespace kernel {
+
+// 定时器
+// 粗粒度的超时用按tick计时的定时器轮(timer_list)：每个CPU一个分层的时间轮，
+// 第一层256个槽每槽1个tick，后面四层各64个槽，每层一个槽覆盖前一层的一整圈，
+// 加入和删除是O(1)，前一层转完一圈时把后一层的一个槽重新分散下来(cascade)。
+// 精确的睡眠用高精度定时器(hrtimer)：每个CPU一棵按到期TSC排序的红黑树，
+// 由一次性LAPIC定时器或TSC-deadline中断在最早的定时器到期时触发。
+// 两种定时器都加在调用的CPU上，回调在那个CPU的时钟中断里执行，回调执行期间不持有锁
+
+struct TimerBase;
+
+struct timer_list {
+    struct list_head entry;
+    uint32_t expires; // 到期时本CPU的jiffies
+    void (*function)(struct timer_list* timer);
+    TimerBase* base;  // 最近一次加入的CPU
+};
+
+// 第一层的位数和后面各层的位数
+constexpr uint32_t TVR_BITS = 8;
+constexpr uint32_t TVN_BITS = 6;
+constexpr uint32_t TVR_SIZE = 1 << TVR_BITS;
+constexpr uint32_t TVN_SIZE = 1 << TVN_BITS;
+constexpr uint32_t TVN_LEVELS = 4;
+
+// 一个CPU的时间轮，不加锁，由调用方保护
+class TimerWheel {
+public:
+    // 时间轮从now开始转
+    void init(uint32_t now);
+    void add(timer_list* timer);
+    void del(timer_list* timer);
+    /**
+     * @brief 时间轮转到now，到期的定时器从轮上摘下来挂到expired链表上
+     * 已经过期的定时器(expires不晚于now)都会被摘下来
+     */
+    void advance(uint32_t now, list_head* expired);
+    /**
+     * @brief 最早可能有定时器到期的jiffies，最多看到clk + limit
+     * 只查第一层，第一层转完之前没有定时器时返回下一次cascade的时间
+     */
+    uint32_t next_expiry(uint32_t limit) const;
+
+    uint32_t clk; // 下一个要处理的jiffies
+
+private:
+    void internal_add(timer_list* timer);
+    // 把第level+1层的第index个槽重新分散到前面的层
+    uint32_t cascade(uint32_t level, uint32_t index);
+
+    list_head tv1[TVR_SIZE];
+    list_head tvn[TVN_LEVELS][TVN_SIZE];
+};
+
+enum hrtimer_restart {
+    HRTIMER_NORESTART,
+    HRTIMER_RESTART, // 回调里已经修改了expires，重新加入队列
+};
+
+struct HrtimerBase;
+
+struct hrtimer {
+    struct rb_node node;
+    uint64_t expires; // 到期时的TSC
+    enum hrtimer_restart (*function)(struct hrtimer* timer);
+    HrtimerBase* base;
+    bool queued;
+};
+
+// 按到期时间排序的高精度定时器队列，不加锁，由调用方保护
+class HrtimerQueue {
+public:
+    void init();
+    // 加入队列，成为最早到期的定时器时返回true
+    bool enqueue(hrtimer* timer);
+    void remove(hrtimer* timer);
+    // 最早到期的定时器，队列为空时返回nullptr
+    hrtimer* first() const;
+
+private:
+    struct rb_root_cached active;
+};
+
+// 相对时间和绝对时间(启动以来的纳秒数，见ktime_get)
+constexpr uint32_t HRTIMER_MODE_ABS = 0;
+constexpr uint32_t HRTIMER_MODE_REL = 1;
+
+// 定时器基础设施初始化，在启动其他CPU之前调用
+void timers_init();
+
+// 本CPU的tick计数，timer_list的expires以它为准
+uint32_t jiffies();
+void timer_setup(timer_list* timer, void (*function)(timer_list*));
+// 按timer->expires加入本CPU的时间轮，定时器不能已经在等待
+void add_timer(timer_list* timer);
+/**
+ * @brief 修改到期时间，定时器移到本CPU
+ * @return 修改前定时器还在等待时返回true
+ */
+bool mod_timer(timer_list* timer, uint32_t expires);
+// 取消定时器，修改前还在等待时返回true，不等待正在执行的回调
+bool del_timer(timer_list* timer);
+// 取消定时器并等待正在其他CPU上执行的回调结束
+bool del_timer_sync(timer_list* timer);
+inline bool timer_pending(const timer_list* timer) { return !list_empty(&timer->entry); }
+
+// 启动以来的纳秒数
+uint64_t ktime_get();
+void hrtimer_init(hrtimer* timer, enum hrtimer_restart (*function)(hrtimer*));
+/**
+ * @brief 启动高精度定时器，已经在等待的先取消
+ * @param ns mode为HRTIMER_MODE_REL时是从现在开始的纳秒数，否则是ktime_get()的绝对值
+ */
+void hrtimer_start(hrtimer* timer, uint64_t ns, uint32_t mode);
+// 回调里修改下一次到期时间，返回HRTIMER_RESTART后生效
+void hrtimer_forward_ns(hrtimer* timer, uint64_t ns);
+/**
+ * @brief 尝试取消
+ * @return 1取消成功，0定时器没有在等待，-1回调正在执行
+ */
+int hrtimer_try_to_cancel(hrtimer* timer);
+// 取消并等待正在执行的回调结束，返回取消前是否在等待
+bool hrtimer_cancel(hrtimer* timer);
+inline bool hrtimer_active(const hrtimer* timer) { return timer->queued; }
+
+/**
+ * @brief 时钟中断里调用，本CPU前进nr_ticks个tick，执行到期的timer_list
+ */
+void run_timers(uint32_t nr_ticks);
+// 时钟中断里调用，执行本CPU到期(TSC不晚于now)的hrtimer
+void hrtimer_run_queues(uint64_t now);
+// 本CPU最早的hrtimer到期时的TSC，没有时返回false
+bool hrtimer_next_event(uint64_t& expires);
+// 本CPU最早可能有timer_list到期的jiffies，最多看到limit个tick之后
+uint32_t timer_next_expiry(uint32_t limit);
+
+} // namespace kernel
@@ -2,12 +2,19 @@
 #include <cstdint>
 #include "arch/x86/paging.h"
 
+namespace kernel {
+struct TaskGroup;
+}
+
 // 内存区域描述符
 struct MemoryArea {
     uint32_t start_addr; // 起始地址
     uint32_t end_addr;   // 结束地址
     uint32_t flags;      // 访问权限标志
     uint32_t type;       // 区域类型(代码段、数据段、堆、栈等)
+    void* file;          // 文件映射对应的kernel::FileDescriptor，共享内存对应的ShmObject
+    uint32_t file_offset; // 区域起始地址对应的文件偏移
+    bool shared;         // MAP_SHARED映射，写入直接落到页缓存
 };
 
 // 内存区域类型定义
@@ -29,44 +36,96 @@ class UserMemory
 {
 public:
     // 初始化内存管理器
-    void init(PADDR pgd_phys, VADDR page_dir, uint32_t (*alloc_page)(), void (*free_page)(uint32_t),
-        void* (*phys_to_virt)(uint32_t));
+    void init(PADDR pgd_phys, VADDR page_dir, PADDR (*alloc_page)(), void (*free_page)(PADDR),
+        void* (*phys_to_virt)(PADDR));
 
     // 分配一个新的内存区域
     void* allocate_area(uint32_t size, uint32_t flags, uint32_t type);
+    /**
+     * @brief 分配文件映射区域，页表项先不建立，缺页时从文件的页缓存取页
+     * @param size 映射长度
+     * @param flags 页表权限标志，可写映射带PAGE_WRITE
+     * @param file 被映射文件的kernel::FileDescriptor
+     * @param offset 文件偏移，需要按页对齐
+     * @param shared 是否是MAP_SHARED映射
+     * @return 映射起始地址，失败返回nullptr
+     */
+    void* allocate_file_area(uint32_t size, uint32_t flags, void* file, uint32_t offset, bool shared);
+    // 查找包含addr的内存区域，没有时返回nullptr
+    MemoryArea* find_area(uint32_t addr);
     // 释放指定地址范围的内存区域
     void free_area(uint32_t start);
 
     // 扩展或收缩堆区
     uint32_t brk(uint32_t new_brk);
 
-    // 映射物理页面到虚拟地址空间
-    bool map_pages(uint32_t virt_addr, uint32_t phys_addr, uint32_t size, uint32_t flags);
+    // 映射物理页面到虚拟地址空间。charged为true时新页面已经用task_group_try_charge记到任务组上，
+    // 这里只调整驻留页计数
+    bool map_pages(uint32_t virt_addr, PADDR phys_addr, uint32_t size, pte_t flags,
+        bool charged = false);
 
-    // 解除虚拟地址空间的映射
+    // 解除虚拟地址空间的映射，换出页面的交换槽位一起释放
     void unmap_pages(uint32_t virt_addr, uint32_t size);
 
+    // vaddr对应的页表项，页表不存在时返回nullptr
+    pte_t* find_pte(uint32_t vaddr);
+
+    /**
+     * @brief 共享文件映射[start, end)里页表项的脏位(PAGE_DIRTY)转到页缓存上：
+     * 清掉脏位，把页缓存页标脏，下次写回时写到文件。msync写回之前调用
+     */
+    void collect_dirty(const MemoryArea& area, uint32_t start, uint32_t end);
+
     bool copyFrom(const UserMemory& src);
 
     void print();
     VADDR getPageDirectory() { return pgd;};
     PADDR getPageDirectoryPhysical() { return pgd_phys;};
+    // 切换到该地址空间时加载到CR3的值，PAE下是PDPT的地址
+    uint32_t getCr3() { return cr3; };
     void clone(UserMemory& src);
 
+    // 驻留页数(RSS)，匿名页和文件页(文件映射、共享内存)分开统计，共享零页不计入
+    uint32_t rss_anon_pages() const { return rss_anon; }
+    uint32_t rss_file_pages() const { return rss_file; }
+    uint32_t rss_pages() const { return rss_anon + rss_file; }
+    uint32_t total_vm_pages() const { return total_vm; }
+
+    // 驻留页记在哪个任务组上，nullptr表示根组
+    kernel::TaskGroup* group() const { return mem_group; }
+    // 换到另一个任务组，已有的驻留页一起转过去
+    void set_group(kernel::TaskGroup* group);
+
+    /**
+     * @brief 解除所有内存区域的映射并释放用户页表，物理页立即归还，用于杀死进程
+     * 可以重复调用
+     */
+    void release_all();
+
 private:
+    // 换出换入时要调整驻留页计数，并记录CLOCK指针
+    friend class SwapManager;
+
+    // 按vaddr所在区域的类型调整驻留页计数，charge为false时不再记到任务组上
+    void account_rss(uint32_t vaddr, PADDR paddr, int delta, bool charge = true);
+
     // 使用first-fit策略查找合适的空闲区域
     uint32_t find_free_area(uint32_t size);
 
+    // 解除共享文件映射之前，放掉可写页表项在页缓存页上的写者计数，写过的页在页缓存上标脏
+    void release_shared_writers(const MemoryArea& area);
+
     // 查找最大的连续空闲区域
     uint32_t find_largest_free_area();
 
     static const uint32_t MAX_MEMORY_AREAS = 32;   // 最大内存区域数
 
     // 物理页面分配和释放函数声明
-    uint32_t (*allocate_physical_page)() = nullptr;
-    void (*free_physical_page)(uint32_t page) = nullptr;
-    void* (*phys_to_virt)(uint32_t phys_addr) = nullptr;
+    PADDR (*allocate_physical_page)() = nullptr;
+    void (*free_physical_page)(PADDR page) = nullptr;
+    void* (*phys_to_virt)(PADDR phys_addr) = nullptr;
     PADDR pgd_phys;
+    uint32_t cr3 = 0;
     VADDR pgd;                       // 页目录基地址, 虚拟地址
     uint32_t start_code;                // 代码段起始地址
     uint32_t end_code;                  // 代码段结束地址
@@ -80,4 +139,8 @@ private:
     uint32_t locked_vm = 0;                 // 锁定的虚拟内存大小(页数)
     MemoryArea areas[MAX_MEMORY_AREAS]; // 内存区域数组
     uint32_t num_areas = 0;                 // 当前内存区域数量
+    volatile uint32_t rss_anon = 0;         // 驻留的匿名页数
+    volatile uint32_t rss_file = 0;         // 驻留的文件页数
+    uint32_t clock_hand = USER_START;       // 换出扫描下次开始的地址
+    kernel::TaskGroup* mem_group = nullptr; // 驻留页记在这个任务组上
 };
\ No newline at end of file
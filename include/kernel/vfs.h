@@ -5,7 +5,11 @@
 #include <unistd.h>
 //#include <sys/types.h>
 
+#include <kernel/rcu.h>
+
 struct Task;
+struct Page;
+struct Context;
 namespace kernel
 {
 
@@ -38,10 +42,24 @@ struct FileAttribute {
 int sys_open(uint32_t path_ptr, Task* task);
 int sys_read(uint32_t fd_num, uint32_t buffer_ptr, uint32_t size, Task* pcb);
 int sys_write(uint32_t fd_num, uint32_t buffer_ptr, uint32_t size, Task* task);
+/**
+ * @brief 关闭文件描述符
+ * 文件的close在最后一个引用放掉、RCU宽限期结束以后才在kworker里执行，这时调用方已经返回，
+ * 所以close的结果(例如写回失败)不会传回来。需要确认映射写回的调用方先调用msync
+ * @return fd已经从fd表上摘下时返回0，fd_num没有打开时返回-1
+ */
 int sys_close(uint32_t fd_num, Task* pcb);
 int sys_seek(uint32_t fd_num, uint32_t offset, Task* pcb);
 
 void init_vfs();
+
+class FileDescriptor;
+// 有虚函数的类不能用container_of，RCU回调从这里找回文件
+struct FileRcu {
+    rcu_head head; // 必须是第一个成员
+    FileDescriptor* file;
+};
+
 // 文件描述符
 class FileDescriptor
 {
@@ -56,8 +74,42 @@ public:
     virtual void* mmap(void* addr, size_t length, int prot, int flags, size_t offset) {
         return nullptr;
     }
+    // 文件映射缺页时取offset处的页缓存页，offset按页对齐，不支持时返回nullptr
+    virtual Page* get_mmap_page(size_t offset) { return nullptr; }
+    // 共享映射写了offset处的页，经过页缓存标脏，由延迟写回写到设备
+    virtual void mark_mmap_dirty(size_t offset) {}
+    // 把文件[offset, offset+length)范围内映射产生的脏页写回设备，offset按页对齐
+    virtual int sync(size_t offset, size_t length) { return 0; }
+
+    // 引用计数，open返回的和fd表的每一项各持有一个。减到0以后等一个RCU宽限期再close，
+    // 别的CPU上的fdget可能刚从fd表上读到这个指针
+    volatile uint32_t refs = 1;
+    FileRcu rcu;
 };
 
+// 以下是进程fd表的访问。fd表的每一项用rcu_assign_pointer发布，
+// 查找不加锁，读到的文件要在RCU读侧临界区里取到引用才能在临界区外使用
+
+// 再取一个引用，调用方已经持有一个
+void get_file(FileDescriptor* file);
+// 放掉一个引用，最后一个引用等宽限期以后在kworker里close
+void fdput(FileDescriptor* file);
+/**
+ * @brief 查找打开的文件并取一个引用，用完以后fdput
+ * @return fd_num没有打开或者正在关闭时返回nullptr
+ */
+FileDescriptor* fdget(Context* context, uint32_t fd_num);
+/**
+ * @brief 把文件装到最小的空闲fd上，fd表拿走调用方的引用
+ * @return fd号，fd表满时返回-1，调用方仍然持有引用
+ */
+int fd_install(Context* context, FileDescriptor* file);
+/**
+ * @brief 从fd表上摘下fd_num，放掉fd表的引用
+ * @return fd_num没有打开时返回-1
+ */
+int fd_close(Context* context, uint32_t fd_num);
+
 // 文件系统接口
 class FileSystem
 {
@@ -83,6 +135,14 @@ public:
     virtual int rmdir(const char* path) = 0;
 };
 
+/**
+ * @brief 按最长前缀查找路径所在的挂载点，挂载表由RCU保护，查找不加锁。
+ * 挂载点不会卸载，返回的文件系统一直有效
+ * @param remaining_path 返回path里挂载点后面的部分
+ * @return 没有匹配的挂载点时返回nullptr
+ */
+FileSystem* find_fs(const char* path, const char** remaining_path);
+
 // VFS管理器
 class VFSManager
 {
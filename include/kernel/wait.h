@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+
+#include "arch/x86/spinlock.h"
+#include "kernel/list.h"
+
+struct Task;
+
+namespace kernel {
+
+// 等待队列
+// 等待方把等待项挂到队列上，唤醒方从队列上摘下等待项，把结果(交出的锁、信号量的一个计数等)
+// 直接交给它，等待方醒来时已经拿到了资源，不用再去竞争，也不用按tick轮询。
+// 内核态的等待方(可能在中断处理里、持有自旋锁)在自己的等待项上自旋；
+// 系统调用里的等待方离开运行队列切走，醒来时从block返回唤醒方交出的结果。
+// 内核不执行全局对象的构造函数，全零的队列也能直接使用
+
+class WaitQueue;
+
+constexpr uint32_t WAIT_FOREVER = 0xFFFFFFFF;
+constexpr int WAIT_TIMEOUT = -1;
+constexpr int WAIT_KILLED = -2;
+
+struct WaitEntry {
+    struct list_head node;
+    Task* task;
+    WaitQueue* wq;      // 所在的队列，不在队列上时为nullptr，由队列的锁保护
+    bool blocking;      // 任务已经离开运行队列，唤醒方要把它放回去
+    volatile bool done; // 唤醒方已经交出结果，之后不再访问等待项
+    int result;
+};
+
+class WaitQueue {
+public:
+    WaitQueue();
+
+    // 保护队列，同步原语也用它保护自己的状态，检查状态和挂上队列是原子的
+    SpinLock lock;
+
+    // 以下函数调用方持有lock
+    bool empty() const { return !waiters.next || list_empty(&waiters); }
+    // 最早挂上来的等待方，队列为空时返回nullptr
+    WaitEntry* first() const;
+    void add(WaitEntry* entry);
+    void remove(WaitEntry* entry);
+    /**
+     * @brief 把entry从队列上摘下来，交出结果并唤醒
+     * @param result 等待方wait或block的返回值
+     */
+    void wake(WaitEntry* entry, int result);
+    // 唤醒所有等待方，返回唤醒的个数
+    uint32_t wake_all(int result);
+
+    /**
+     * @brief 内核态等待：当前任务挂到队列尾，释放lock，自旋到被唤醒或者超时
+     * @param flags 调用方acquire_irqsave得到的中断状态，返回时已经恢复
+     * @param timeout 超时的tick数，WAIT_FOREVER表示一直等
+     * @return 唤醒方交出的结果，超时返回WAIT_TIMEOUT
+     */
+    int wait(uint32_t flags, uint32_t timeout = WAIT_FOREVER);
+
+    /**
+     * @brief 系统调用里阻塞：当前任务离开运行队列挂到队列尾，释放lock后切走，被唤醒后返回。
+     * 阻塞期间进程被杀死的任务不会再返回
+     * @param flags 调用方acquire_irqsave得到的中断状态，系统调用入口已关中断
+     * @return 唤醒方交出的结果；任务已经被杀死时不阻塞，返回WAIT_KILLED
+     */
+    int block(uint32_t flags);
+
+    /**
+     * @brief 当前上下文能否用block阻塞：有当前任务并且不是空闲任务，不在设备中断处理和
+     * RCU读侧临界区里。持有自旋锁的调用方不能阻塞，这一点由调用方保证
+     */
+    static bool can_block();
+
+    /**
+     * @brief 把阻塞的等待项从所在的队列上摘下来，用于杀死阻塞的任务
+     * @return 等待项还在队列上并且被摘下时返回true，此时调用方负责唤醒任务
+     */
+    static bool cancel(WaitEntry* entry);
+
+private:
+    struct list_head waiters;
+};
+
+} // namespace kernel
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+
+#include "kernel/list.h"
+#include "kernel/timer.h"
+
+struct Task;
+
+namespace kernel {
+
+// 工作队列
+// 每个CPU一个内核线程kworker/N，按加入的顺序执行排到这个CPU上的工作。
+// 中断处理、定时器回调和持有自旋锁的代码把不能在原地做的事情(写串口、写回磁盘)包成工作排进来，
+// 由kworker在任务上下文里执行，工作函数可以睡眠、可以持有互斥锁。
+// 同一个工作在执行前只会排一次，执行期间可以再排一次。
+// 延迟工作先挂一个timer_list，到期后在定时器回调里排到指定的CPU上
+
+struct work_struct;
+typedef void (*work_func_t)(work_struct* work);
+
+struct WorkerPool;
+
+struct work_struct {
+    struct list_head entry;
+    work_func_t func;
+    volatile bool pending; // 在队列上还没有开始执行
+    WorkerPool* pool;      // 最近一次排到的CPU，flush_work等这个CPU
+    uint32_t seq;          // 排队时的序号，这个CPU执行完这个序号以后工作就完成了
+};
+
+struct delayed_work {
+    work_struct work;
+    timer_list timer;
+    int cpu; // 到期后排到哪个CPU
+};
+
+/**
+ * @brief 启动每个CPU的kworker，在调度器初始化之后、开中断之前调用。
+ * 之前排队的工作返回false
+ */
+void workqueue_init();
+
+void init_work(work_struct* work, work_func_t func);
+void init_delayed_work(delayed_work* dwork, work_func_t func);
+
+/**
+ * @brief 把工作排到cpu上，可以在中断里调用
+ * @return 工作已经在队列上时返回false
+ */
+bool queue_work_on(uint32_t cpu, work_struct* work);
+// 排到当前CPU上
+bool queue_work(work_struct* work);
+
+/**
+ * @brief delay个tick以后把工作排到cpu上，delay为0时立即排队
+ * @return 工作已经在等待或者已经在队列上时返回false，不修改到期时间
+ */
+bool queue_delayed_work_on(uint32_t cpu, delayed_work* dwork, uint32_t delay);
+bool queue_delayed_work(delayed_work* dwork, uint32_t delay);
+/**
+ * @brief 取消还在等待定时器的延迟工作，已经排队的工作不取消
+ * @return 取消前定时器还在等待时返回true
+ */
+bool cancel_delayed_work(delayed_work* dwork);
+
+/**
+ * @brief 等待工作最近一次排队的执行完成，没有排过队或者已经执行完时直接返回。
+ * 在任务上下文里调用，调用方的中断状态不变；不能在中断里，也不能在同一个CPU的工作函数里调用
+ * @return 工作从来没有排过队时返回false
+ */
+bool flush_work(work_struct* work);
+// 延迟工作还在等待定时器时立即排队，然后等待执行完成
+bool flush_delayed_work(delayed_work* dwork);
+
+// 每个CPU的工作队列统计
+struct WorkqueueStats {
+    uint32_t queued;   // 排队的工作数
+    uint32_t executed; // 执行完的工作数
+};
+void workqueue_cpu_stats(uint32_t cpu, WorkqueueStats& stats);
+
+} // namespace kernel
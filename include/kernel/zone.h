@@ -24,8 +24,21 @@ public:
     // 构造函数
     Zone();
 
-    // 初始化区域
-    void init(ZoneType type, uint32_t start_pfn, uint32_t end_pfn);
+    /**
+     * @brief 初始化区域
+     * @param meta 伙伴系统元数据的存放位置，nullptr表示从区域头部划出并把整个区域设为空闲，
+     *             高端内存没有直接映射，需要传入从普通区域分配的元数据，再用addFreeRange添加内存
+     */
+    void init(ZoneType type, uint32_t start_pfn, uint32_t end_pfn, void* meta = nullptr);
+
+    // 把[start_pfn, end_pfn)中的可用内存加入区域
+    void addFreeRange(uint32_t start_pfn, uint32_t end_pfn);
+
+    // 管理[start_pfn, end_pfn)需要的元数据字节数
+    static uint32_t metaBytes(uint32_t start_pfn, uint32_t end_pfn);
+
+    // 页帧号是否属于本区域
+    bool contains(uint32_t pfn) const { return pfn >= zone_start_pfn && pfn < zone_end_pfn; }
 
     // 分配页面
     uint32_t allocPages(uint32_t gfp_mask, uint32_t order);
@@ -34,10 +47,14 @@ public:
     void freePages(uint32_t pfn, uint32_t order);
     void decRefPage(uint32_t pfn);
     void increment_ref_count(uint32_t pfn);
+    uint32_t refCount(uint32_t pfn) const { return buddy_allocator.ref_count(pfn); }
 
     // 获取区域空闲页面数量
     uint32_t getFreePages() const;
 
+    // 是否还有2^order个连续的空闲页面
+    bool hasFreeBlock(uint32_t order) const { return buddy_allocator.has_free_block(order); }
+
     // 设置水位标记
     void setWatermark(WatermarkLevel level, uint32_t value);
 
@@ -58,7 +75,6 @@ public:
 
 private:
     ZoneType type;                  // 区域类型
-    uint32_t nr_free_pages;         // 空闲页面数量
     uint32_t zone_num;              // 空闲页面数量
     uint32_t zone_start_pfn;        // 区域起始页帧号
     uint32_t zone_end_pfn;          // 区域结束页帧号
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+#include <kernel/wait.h>
+
+namespace kernel {
+
+/**
+ * 完成量，等待某件事情完成
+ * complete唤醒一个等待方，没有等待方时记下来，之后的一次wait直接返回；
+ * complete_all之后所有的wait都直接返回，直到reinit
+ */
+class Completion {
+public:
+    Completion() : done(0) {}
+
+    /**
+     * @brief 内核态等待完成
+     * @param timeout 超时的tick数，0表示不等待，WAIT_FOREVER表示一直等
+     * @return 是否已经完成
+     */
+    bool wait(uint32_t timeout = WAIT_FOREVER);
+
+    /**
+     * @brief 在系统调用里等待完成，没有完成时阻塞到complete
+     * @return 是否已经完成，任务已经被杀死时返回false
+     */
+    bool wait_block();
+
+    void complete();
+    void complete_all();
+    // 重新使用之前清除完成状态，调用方保证没有等待方
+    void reinit() { done = 0; }
+
+private:
+    static constexpr uint32_t COMPLETE_ALL = 0xFFFFFFFF;
+
+    // 是否已经完成，完成时消耗一次，调用方持有wq.lock
+    bool try_consume();
+
+    volatile uint32_t done; // 没有被等待方消耗的完成次数，COMPLETE_ALL表示一直完成
+    WaitQueue wq;
+};
+
+} // namespace kernel
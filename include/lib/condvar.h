@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+
+#include <kernel/wait.h>
+#include <lib/mutex.h>
+
+namespace kernel {
+
+/**
+ * 条件变量，和Mutex配合使用
+ * wait在条件变量的队列锁保护下释放互斥锁再挂上队列，
+ * signal不会在释放互斥锁和挂上队列之间丢失
+ */
+class CondVar {
+public:
+    /**
+     * @brief 释放mutex并等待signal，醒来后重新获取mutex再返回。
+     * 一直等待时在能睡眠的上下文里阻塞，否则在等待项上自旋
+     * 调用方持有mutex，并且是非递归锁或者只加锁了一层
+     * @param timeout 超时的tick数，WAIT_FOREVER表示一直等
+     * @return 是否被signal唤醒，超时也会重新获取mutex
+     */
+    bool wait(Mutex& mutex, uint32_t timeout = WAIT_FOREVER);
+
+    // 唤醒最早的一个等待方
+    void signal();
+    // 唤醒所有等待方
+    void broadcast();
+
+private:
+    WaitQueue wq;
+};
+
+} // namespace kernel
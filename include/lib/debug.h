@@ -7,6 +7,7 @@
 #include <lib/console.h>
 #include <cstdint>
 #include "arch/x86/apic.h"
+#include "arch/x86/percpu.h"
 
 // 定义日志级别
 enum LogLevel {
@@ -24,6 +25,37 @@ enum LogLevel {
 // 当前日志级别，可以根据需要调整
 extern LogLevel current_log_level;
 
+// 编译时的日志级别，比它详细的日志调用连同参数的计算一起去掉，用cmake -DLOG_LEVEL=INFO等设置
+#ifndef CONFIG_LOG_LEVEL
+#define CONFIG_LOG_LEVEL 8 // LOG_TRACE
+#endif
+
+// 按源文件路径设置的日志级别规则的个数和名字的最大长度
+#define LOG_RULES_MAX 8
+#define LOG_RULE_NAME_MAX 16
+
+// 一个打日志的地方。是否输出按源文件路径匹配的规则或者全局级别算出来缓存在state里，
+// 修改级别以后log_generation变化，下次执行时重新计算
+struct LogSite {
+    const char* file;
+    volatile uint32_t state; // 高31位是计算时的log_generation，最低位表示输出
+};
+
+// 从1开始，修改全局级别或者规则时加1
+extern volatile uint32_t log_generation;
+
+// 重新计算site是否输出level级别的日志，返回新的state
+uint32_t log_site_update(LogSite* site, LogLevel level);
+
+inline bool log_site_enabled(LogSite* site, LogLevel level)
+{
+    uint32_t state = site->state;
+    if((state >> 1) != log_generation) {
+        state = log_site_update(site, level);
+    }
+    return state & 1;
+}
+
 // 日志级别对应的颜色
 const uint8_t log_level_colors[] = {
     VGA_COLOR_LIGHT_RED,     // EMERG
@@ -33,7 +65,8 @@ const uint8_t log_level_colors[] = {
     VGA_COLOR_LIGHT_BROWN,   // WARNING
     VGA_COLOR_CYAN,          // NOTICE
     VGA_COLOR_LIGHT_BLUE,    // INFO
-    VGA_COLOR_LIGHT_GREY     // DEBUG
+    VGA_COLOR_LIGHT_GREY,    // DEBUG
+    VGA_COLOR_DARK_GREY      // TRACE
 };
 
 // 日志级别前缀
@@ -45,7 +78,8 @@ inline const char* log_level_prefix[] = {
     "<4>", // WARNING
     "<5>", // NOTICE
     "<6>", // INFO
-    "<7>"  // DEBUG
+    "<7>", // DEBUG
+    "<8>"  // TRACE
 };
 
 // ... 保留前面的枚举和变量定义 ...
@@ -55,6 +89,19 @@ inline const char* log_level_prefix[] = {
 int format_string_v(char* buffer, size_t size, const char* format, va_list args);
 int format_string(char* buffer, size_t size, const char* format, ...);
 
+/**
+ * @brief 推迟格式化：按format把参数原样打包，整数和指针各占一个字，%s的字符串连同结尾的0复制进来，
+ * 之后用format_string_packed格式化。放不下时字符串截断，后面的参数丢掉
+ * @return 用掉的字节数
+ */
+size_t pack_args(void* buf, size_t size, const char* format, va_list args);
+// 用pack_args打包的参数格式化，format要和打包时相同
+int format_string_packed(
+    char* buffer, size_t size, const char* format, const void* packed, size_t packed_size);
+// 日志消息的前缀：这条日志的级别、CPU、任务、文件名、行号和函数名
+int format_log_prefix(char* buffer, size_t size, LogLevel level, uint32_t cpu, int tid,
+    const char* file, int line, const char* func);
+
 const char* get_filename_from_path(const char* path);
 
 struct LogOutputInterface {
@@ -63,12 +110,25 @@ struct LogOutputInterface {
 
 extern LogOutputInterface log_output_handler;
 
+// 推迟格式化的日志：记下格式串和打包的参数，返回false时照常同步格式化输出。
+// 日志消费者启动以后设置，错误级别的日志不经过它
+typedef bool (*LogRecordHandler)(
+    LogLevel level, const char* file, int line, const char* func, const char* format, va_list args);
+extern LogRecordHandler log_record_handler;
+
 // 核心打印函数调整
 inline void _debug_print(
     LogLevel level, const char* file, int line, const char* func, const char* format, ...)
 {
-    if(level > current_log_level)
+    va_list args;
+    va_start(args, format);
+#ifndef NO_PID
+    if(level > LOG_ERR && log_record_handler
+        && log_record_handler(level, file, line, func, format, args)) {
+        va_end(args);
         return;
+    }
+#endif
 
     char msg_buffer[512];
     int len = 0;
@@ -79,18 +139,14 @@ inline void _debug_print(
     if(current) {
         pid = current->task_id;
     }
-    uint32_t cpu_id = arch::apic_get_id();
+    uint32_t cpu_id = arch::get_cpu_id();
     // 打印CPU ID、PID、文件名、行号和函数名
-    len = format_string(msg_buffer, sizeof(msg_buffer),
-        "%s[CPU:%d TID:%d] (%s:%d %s): ", log_level_prefix[current_log_level], cpu_id, pid,
-        get_filename_from_path(file), line, func);
+    len = format_log_prefix(msg_buffer, sizeof(msg_buffer), level, cpu_id, pid, file, line, func);
 #else
     len = format_string(msg_buffer, sizeof(msg_buffer),
-        "%s %s:%d %s(): ", log_level_prefix[current_log_level], get_filename_from_path(file), line, func);
+        "%s %s:%d %s(): ", log_level_prefix[level], get_filename_from_path(file), line, func);
 #endif
 
-    va_list args;
-    va_start(args, format);
     format_string_v(msg_buffer + len, sizeof(msg_buffer) - len, format, args);
     va_end(args);
 
@@ -100,33 +156,53 @@ inline void _debug_print(
 // 新增接口设置函数（需在cpp文件中实现）
 void set_log_output_handler(const LogOutputInterface& new_handler);
 
-// 设置当前日志级别
-inline void set_log_level(LogLevel level)
-{
-    current_log_level = level;
-}
+// 设置全局日志级别，没有匹配规则的源文件用它
+void set_log_level(LogLevel level);
+
+/**
+ * @brief 设置源文件路径包含name的日志的级别，覆盖全局级别，多条规则匹配时用先设置的
+ * @param level 小于0时删除name的规则
+ * @return name太长或者规则已满时返回false
+ */
+bool set_log_level(const char* name, int level);
+
+// name的规则的级别，没有这条规则时返回全局级别
+LogLevel get_log_level(const char* name);
+
+// 级别的名字(emerg、err、warning、info、debug等)或者数字，不认识时返回-1
+int parse_log_level(const char* str, uint32_t len);
+
+/**
+ * @brief 解析loglevel启动参数，逗号分隔的LEVEL或者NAME:LEVEL，例如loglevel=info,ext2:debug
+ * @return 有不认识的项时返回false，前面的项已经生效
+ */
+bool parse_log_levels(const char* config, uint32_t len);
+
+// 打日志的地方。比CONFIG_LOG_LEVEL详细的调用在编译时去掉；
+// 其余的每个地方有一个LogSite，级别没有改变时只检查它缓存的一位
+#define _log_at(level, fmt, ...)                                                                 \
+    do {                                                                                         \
+        if((level) <= CONFIG_LOG_LEVEL) {                                                        \
+            static LogSite _log_site = {__FILE__, 0};                                            \
+            if(log_site_enabled(&_log_site, level)) {                                            \
+                _debug_print(level, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__);           \
+            }                                                                                    \
+        }                                                                                        \
+    } while(0)
 
 // 定义各种日志级别的宏
-#define log_emerg(fmt, ...)                                                                      \
-    _debug_print(LOG_EMERG, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define log_alert(fmt, ...)                                                                      \
-    _debug_print(LOG_ALERT, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define log_crit(fmt, ...)                                                                       \
-    _debug_print(LOG_CRIT, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define log_err(fmt, ...) _debug_print(LOG_ERR, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define log_warn(fmt, ...)                                                                       \
-    _debug_print(LOG_WARNING, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define log_notice(fmt, ...)                                                                     \
-    _debug_print(LOG_NOTICE, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define log_info(fmt, ...)                                                                       \
-    _debug_print(LOG_INFO, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define log_debug(fmt, ...)                                                                      \
-    _debug_print(LOG_DEBUG, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define log_trace(fmt, ...)                                                                      \
-    _debug_print(LOG_TRACE, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+#define log_emerg(fmt, ...) _log_at(LOG_EMERG, fmt, ##__VA_ARGS__)
+#define log_alert(fmt, ...) _log_at(LOG_ALERT, fmt, ##__VA_ARGS__)
+#define log_crit(fmt, ...) _log_at(LOG_CRIT, fmt, ##__VA_ARGS__)
+#define log_err(fmt, ...) _log_at(LOG_ERR, fmt, ##__VA_ARGS__)
+#define log_warn(fmt, ...) _log_at(LOG_WARNING, fmt, ##__VA_ARGS__)
+#define log_notice(fmt, ...) _log_at(LOG_NOTICE, fmt, ##__VA_ARGS__)
+#define log_info(fmt, ...) _log_at(LOG_INFO, fmt, ##__VA_ARGS__)
+#define log_debug(fmt, ...) _log_at(LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define log_trace(fmt, ...) _log_at(LOG_TRACE, fmt, ##__VA_ARGS__)
 
 // 类似printk的函数
-#define printk(fmt, ...) _debug_print(LOG_INFO, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+#define printk(fmt, ...) _log_at(LOG_INFO, fmt, ##__VA_ARGS__)
 // ... 其他日志宏定义保持不变 ...
 
 // 新增速率限制调试宏（每秒最多打印1次）
@@ -136,7 +212,7 @@ inline void set_log_level(LogLevel level)
         static constexpr uint32_t interval_ticks = 100; /* 100 ticks = 1秒（假设1tick=10ms） */    \
         uint32_t current_tick = Kernel::instance().get_ticks();                                    \
         if(current_tick - last_print > interval_ticks) {                                           \
-            _debug_print(LOG_INFO, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__);              \
+            _log_at(LOG_INFO, fmt, ##__VA_ARGS__);                                                 \
             last_print = current_tick;                                                             \
         }                                                                                          \
     } while(0)
@@ -148,7 +224,7 @@ inline void set_log_level(LogLevel level)
         const uint32_t interval_ticks = (ms_interval) / 10;                                        \
         uint32_t current_tick = Kernel::instance().get_ticks();                                    \
         if(current_tick - last_print##__LINE__ > interval_ticks) {                                 \
-            _debug_print(level, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__);                 \
+            _log_at(level, fmt, ##__VA_ARGS__);                                                    \
             last_print##__LINE__ = current_tick;                                                   \
         }                                                                                          \
     } while(0)
@@ -2,72 +2,100 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <arch/x86/percpu.h>
 #include <arch/x86/spinlock.h>
+#include <kernel/workqueue.h>
+#include <lib/debug.h>
 
-// 日志缓冲区的最大容量
-#define LOG_BUFFER_SIZE 4096
-// 单条日志消息的最大长度
-#define MAX_LOG_MESSAGE_SIZE 512
-
-// 日志消息结构体
-struct LogMessage {
-    uint32_t cpu_id;       // 产生日志的CPU ID
-    uint32_t timestamp;    // 时间戳
-    uint32_t level;        // 日志级别
-    char message[MAX_LOG_MESSAGE_SIZE]; // 日志内容
+// 每个CPU的日志环的字节数，必须是2的幂
+#define LOG_RING_SIZE 16384
+// 单条记录(头和打包的参数)的最大字节数，超出的字符串参数截断
+#define MAX_LOG_RECORD_SIZE 512
+// 环尾放不下一条记录时的填充记录
+#define LOG_RECORD_PAD 0xff
+
+// 二进制日志记录：打日志时只记下格式化需要的东西，参数由pack_args打包在头后面，
+// 由消费者格式化。格式串、文件名和函数名都是常量字符串，只记指针
+struct LogRecord {
+    uint16_t size;       // 整条记录的字节数，按8字节对齐
+    uint16_t args_size;  // 打包的参数的字节数
+    uint8_t level;       // LOG_RECORD_PAD表示填充
+    uint8_t cpu;
+    uint16_t line;
+    int32_t tid;
+    uint64_t tsc;        // 各CPU的记录按TSC合并输出
+    const char* format;
+    const char* file;
+    const char* func;
+};
+
+// 一个CPU的日志环(单生产者单消费者)
+// 只有本CPU关中断写tail，只有消费者写head，都是自由增长的计数，取模得到偏移。
+// 环满时丢掉新的记录并计数，打日志的一方不等待
+struct LogRing {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;  // 还没有报告的丢掉的记录数
+    uint32_t recorded;          // 写进环的记录数
+    uint32_t dropped_total;
+    char* data;                 // 启动消费者时分配，为nullptr时这个CPU上同步输出
 };
 
-// 日志缓冲队列类
+DECLARE_PER_CPU(LogRing, log_ring);
+
+struct LogBufferStats {
+    uint32_t recorded;
+    uint32_t dropped;
+};
+
+// 日志缓冲
+// 启动消费者以后，非错误级别的日志写进本CPU的日志环，不加锁、不格式化，
+// 由工作队列在任务上下文里按时间顺序格式化以后写到串口，
+// 打日志的地方(中断处理、持有自旋锁的代码)不用等格式化和串口。
+// 打日志时不碰调度器(调用方可能持有运行队列的锁)，时钟中断里调用tick()把排空的工作排队，
+// 日志最迟在下一个tick被输出。错误级别的日志不进日志环，立即输出
 class LogBuffer {
 private:
     // 私有构造函数，防止外部实例化
     LogBuffer();
-    
+
     // 单例实例
     static LogBuffer* instance;
-    
-    // 环形缓冲区
-    LogMessage buffer[LOG_BUFFER_SIZE];
-    
-    // 队列头尾指针
-    uint32_t head;
-    uint32_t tail;
-    
-    // 缓冲区锁
-    SpinLock buffer_lock;
-    
-    // 消费者线程运行标志
+
+    // 消费者运行标志
     bool consumer_running;
+    // 同一时间只有一个消费者在读日志环
+    volatile bool draining;
+
+    // 把日志环里的记录写出去的工作
+    kernel::work_struct drain_work;
+    // 启动消费者之前的输出处理器，直接写串口
+    LogOutputInterface direct_output;
+
+    static void drain(kernel::work_struct* work);
+    static bool record(LogLevel level, const char* file, int line, const char* func,
+        const char* format, va_list args);
+    void output(const LogRecord* rec);
 
 public:
     // 获取单例实例
     static LogBuffer& get_instance();
-    
-    // 初始化日志缓冲队列
-    void init();
-    
-    // 添加日志消息到队列
-    bool enqueue(uint32_t level, const char* message);
-    
-    // 从队列中取出日志消息
-    bool dequeue(LogMessage& message);
-    
-    // 启动日志消费线程
+
+    // 启动日志消费者，之后的日志经过日志环输出，在workqueue_init之后调用
     void start_consumer();
-    
-    // 日志消费线程函数
-    static void consumer_thread();
-    
-    // 获取队列中的消息数量
-    uint32_t get_message_count();
-    
-    // 检查队列是否为空
-    bool is_empty();
-    
-    // 检查队列是否已满
-    bool is_full();
+
+    // 时钟中断里调用，本CPU的日志环里有记录时把排空的工作排到本CPU上
+    static void tick();
+
+    /**
+     * @brief 把所有CPU的日志环里的记录按时间顺序格式化输出，报告丢掉的记录数。
+     * 在任务上下文里调用，另一个CPU正在输出时直接返回
+     */
+    void flush();
+
+    void get_stats(LogBufferStats& stats);
 };
 
 // 串口和控制台设备的互斥锁
 extern SpinLock serial_lock;
-extern SpinLock console_lock;
\ No newline at end of file
+extern SpinLock console_lock;
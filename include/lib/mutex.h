@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <arch/x86/spinlock.h>
 #include <arch/x86/atomic.h>
+#include <kernel/wait.h>
 
 // 互斥锁状态定义
 #define MUTEX_UNLOCKED 0
@@ -21,7 +22,10 @@ namespace kernel {
 /**
  * 互斥锁(Mutex)类
  * 
- * 与自旋锁不同，互斥锁在无法获取时会让线程睡眠而不是忙等
+ * 与自旋锁不同，互斥锁在无法获取时挂到等待队列上，
+ * 释放时直接把锁交给最早的等待方，等待方醒来时已经持有锁。
+ * 一直等待的调用方在能睡眠的上下文里(WaitQueue::can_block)阻塞让出CPU，
+ * 在中断处理里或者带超时时在等待项上自旋。持有自旋锁时不能调用lock
  * 支持递归锁和非递归锁两种模式
  * 支持超时等待
  * 提供死锁检测功能
@@ -70,27 +74,12 @@ private:
     volatile uint32_t owner;        // 锁的拥有者(进程ID)
     volatile uint32_t recursion;    // 递归计数
     uint8_t type;                   // 锁类型
-    SpinLock spin_lock;             // 内部自旋锁，用于保护互斥锁的状态
-
-    // 等待队列相关
-    struct WaitNode {
-        uint32_t pid;               // 等待的进程ID
-        WaitNode* next;             // 下一个等待节点
-    };
-
-    WaitNode* wait_list;            // 等待队列头
-
-    // 唤醒等待队列中的下一个进程
-    void wakeNextWaiter();
-
-    // 将当前进程加入等待队列
-    void addWaiter();
-
-    // 从等待队列中移除指定进程
-    void removeWaiter(uint32_t pid);
+    WaitQueue wq;                   // 等待队列，它的锁同时保护互斥锁的状态
 
     // 检查是否会导致死锁
-    bool wouldDeadlock() const;
+    bool wouldDeadlock(uint32_t pid) const;
+    // 锁空闲时让pid持有它，调用方持有wq.lock
+    bool takeIfFree(uint32_t pid);
 };
 
 class LockGuard
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+
+#include <kernel/wait.h>
+
+namespace kernel {
+
+/**
+ * 计数信号量
+ * 计数为0时down挂到等待队列上，up时有等待方就把这个计数直接交给最早的等待方，
+ * 等待方醒来时已经拿到了计数
+ */
+class Semaphore {
+public:
+    Semaphore(uint32_t count = 0) : count(count) {}
+
+    /**
+     * @brief 获取一个计数，内核态调用，计数为0时等待
+     * @param timeout 超时的tick数，0表示不等待，WAIT_FOREVER表示一直等
+     * @return 是否拿到计数
+     */
+    bool down(uint32_t timeout = WAIT_FOREVER);
+
+    /**
+     * @brief 在系统调用里获取一个计数，计数为0时阻塞到up把计数交过来
+     * @return 是否拿到计数，任务已经被杀死时返回false
+     */
+    bool down_block();
+
+    // 释放一个计数
+    void up();
+
+    uint32_t value() const { return count; }
+
+private:
+    volatile uint32_t count;
+    WaitQueue wq;
+};
+
+} // namespace kernel
@@ -6,4 +6,7 @@ struct timespec {
     long tv_nsec; // 纳秒
 };
 
+// 启动以来的单调时钟，不受系统时间调整影响
+#define CLOCK_MONOTONIC 1
+
 #endif
\ No newline at end of file
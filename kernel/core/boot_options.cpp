@@ -0,0 +1,110 @@
+#include "kernel/boot_options.h"
+#include "arch/x86/multiboot.h"
+#include "arch/x86/smp.h"
+#include "lib/debug.h"
+#include "lib/string.h"
+
+char BootOptions::buffer[CMDLINE_MAX];
+
+void BootOptions::init(uint32_t magic, uint32_t mbi_phys)
+{
+    buffer[0] = '\0';
+    if(magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        return;
+    }
+    // 此时还没有开启分页，可以直接访问物理地址
+    auto* mbi = reinterpret_cast<multiboot_info*>(mbi_phys);
+    if(!(mbi->flags & MULTIBOOT_INFO_CMDLINE) || !mbi->cmdline) {
+        return;
+    }
+    auto src = reinterpret_cast<const char*>(mbi->cmdline);
+    uint32_t i = 0;
+    for(; i < CMDLINE_MAX - 1 && src[i]; i++) {
+        buffer[i] = src[i];
+    }
+    buffer[i] = '\0';
+}
+
+const char* BootOptions::get(const char* name, uint32_t& len)
+{
+    uint32_t name_len = strlen(name);
+    const char* p = buffer;
+    while(*p) {
+        while(*p == ' ') {
+            p++;
+        }
+        const char* word = p;
+        while(*p && *p != ' ') {
+            p++;
+        }
+        // 第一个词是内核路径，也按参数匹配，不影响结果
+        if((uint32_t)(p - word) < name_len || strncmp(word, name, name_len) != 0) {
+            continue;
+        }
+        const char* rest = word + name_len;
+        if(rest == p) {
+            len = 0;
+            return rest;
+        }
+        if(*rest == '=') {
+            len = p - rest - 1;
+            return rest + 1;
+        }
+    }
+    return nullptr;
+}
+
+bool BootOptions::is_off(const char* name)
+{
+    uint32_t len;
+    const char* value = get(name, len);
+    return value && len == 3 && strncmp(value, "off", 3) == 0;
+}
+
+// 解析十进制数，返回解析到的位置
+static const char* parse_uint(const char* p, const char* end, uint32_t& value)
+{
+    value = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    return p;
+}
+
+uint32_t BootOptions::isolated_cpus()
+{
+    uint32_t len;
+    const char* value = get("isolcpus", len);
+    if(!value) {
+        return 0;
+    }
+    const char* end = value + len;
+    uint32_t mask = 0;
+    const char* p = value;
+    while(p < end) {
+        uint32_t first, last;
+        const char* next = parse_uint(p, end, first);
+        if(next == p) {
+            log_err("BootOptions: bad isolcpus=%s\n", value);
+            return 0;
+        }
+        last = first;
+        p = next;
+        if(p < end && *p == '-') {
+            next = parse_uint(p + 1, end, last);
+            if(next == p + 1 || last < first) {
+                log_err("BootOptions: bad isolcpus range\n");
+                return 0;
+            }
+            p = next;
+        }
+        for(uint32_t cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++) {
+            mask |= 1u << cpu;
+        }
+        if(p < end && *p == ',') {
+            p++;
+        }
+    }
+    return mask;
+}
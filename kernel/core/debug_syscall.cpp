@@ -0,0 +1,552 @@
+#include "kernel/debug_syscall.h"
+#include "kernel/syscall.h"
+
+#include <arch/x86/paging.h>
+#include <arch/x86/rwlock.h>
+#include <arch/x86/tsc.h>
+#include <kernel/kernel.h>
+
+#include "kernel/kthread.h"
+#include "kernel/process.h"
+#include "kernel/rcu.h"
+#include "kernel/task_group.h"
+#include "kernel/timer.h"
+#include "kernel/vfs.h"
+#include "lib/completion.h"
+#include "lib/debug.h"
+#include "lib/log_buffer.h"
+#include "lib/mutex.h"
+#include "lib/semaphore.h"
+#include "lib/string.h"
+#include "lib/time.h"
+
+// 基准测试和锁统计，经过SYS_DEBUG调用
+
+// waitbench的状态，全局对象不执行构造函数，全零就是计数为0的信号量
+static kernel::Semaphore waitbench_sem;
+static kernel::hrtimer waitbench_timer;
+static bool waitbench_timer_ready;
+static volatile uint64_t waitbench_up_ns;
+
+static enum kernel::hrtimer_restart waitbench_timer_fn(kernel::hrtimer*)
+{
+    waitbench_up_ns = kernel::ktime_get();
+    waitbench_sem.up();
+    return kernel::HRTIMER_NORESTART;
+}
+
+// 互斥锁的交接：释放方必须是持有锁的任务，由内核线程扮演
+static kernel::Mutex waitbench_mutex;
+static kernel::Completion waitbench_locked;
+static bool waitbench_mutex_busy;
+
+static int waitbench_mutex_thread(void* arg)
+{
+    waitbench_mutex.lock();
+    waitbench_locked.complete();
+    ProcessManager::sleep_current_ns((uint64_t)(uint32_t)arg * 1000);
+    waitbench_up_ns = kernel::ktime_get();
+    waitbench_mutex.unlock();
+    return 0;
+}
+
+static int waitbench_mutex_handoff(uint32_t delay_us)
+{
+    if(__atomic_exchange_n(&waitbench_mutex_busy, true, __ATOMIC_ACQ_REL)) {
+        return -1;
+    }
+    waitbench_locked.reinit();
+    int ret = -1;
+    if(kernel::kthread_run(waitbench_mutex_thread, (void*)delay_us, "waitbench")) {
+        // 等内核线程拿到锁，再在锁上阻塞到它释放
+        if(waitbench_locked.wait_block() && waitbench_mutex.lock()) {
+            waitbench_mutex.unlock();
+            ret = 0;
+        }
+    }
+    __atomic_store_n(&waitbench_mutex_busy, false, __ATOMIC_RELEASE);
+    return ret;
+}
+
+static int waitbenchHandler(uint32_t op, uint32_t arg, uint32_t, uint32_t)
+{
+    switch(op) {
+    case WAITBENCH_ARM:
+        if(!__atomic_exchange_n(&waitbench_timer_ready, true, __ATOMIC_ACQ_REL)) {
+            kernel::hrtimer_init(&waitbench_timer, waitbench_timer_fn);
+        }
+        kernel::hrtimer_cancel(&waitbench_timer);
+        // 上一轮没有取走的计数丢掉
+        while(waitbench_sem.down(0)) {
+        }
+        kernel::hrtimer_start(&waitbench_timer, (uint64_t)arg * 1000, kernel::HRTIMER_MODE_REL);
+        return 0;
+    case WAITBENCH_DOWN:
+        // 没拿到时阻塞到定时器释放它
+        return waitbench_sem.down_block() ? 0 : -1;
+    case WAITBENCH_TRYDOWN:
+        return waitbench_sem.down(0) ? 0 : -1;
+    case WAITBENCH_MUTEX:
+        return waitbench_mutex_handoff(arg);
+    case WAITBENCH_RESULT: {
+        timespec* ts = reinterpret_cast<timespec*>(arg);
+        if(!ts) {
+            return -1;
+        }
+        uint32_t nsec;
+        uint64_t sec = arch::div_u64_rem(waitbench_up_ns, 1000000000, &nsec);
+        ts->tv_sec = (decltype(ts->tv_sec))sec;
+        ts->tv_nsec = nsec;
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+// switchbench的状态，一次只有一个测试
+static kernel::Completion switchbench_done;
+static bool switchbench_busy;
+static uint32_t switchbench_rounds;
+static volatile uint32_t switchbench_left;  // 还没做完的任务数
+static volatile bool switchbench_started;
+static uint64_t switchbench_start_tsc;
+static uint64_t switchbench_end_tsc;
+
+static int switchbench_thread(void*)
+{
+    // 第一个运行的任务开始计时，之后两个任务交替运行
+    if(!__atomic_exchange_n(&switchbench_started, true, __ATOMIC_ACQ_REL)) {
+        switchbench_start_tsc = arch::rdtsc();
+    }
+    for(uint32_t i = 0; i < switchbench_rounds; i++) {
+        ProcessManager::yield();
+    }
+    if(__atomic_sub_fetch(&switchbench_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        switchbench_end_tsc = arch::rdtsc();
+        switchbench_done.complete();
+    }
+    return 0;
+}
+
+static int switchbenchHandler(uint32_t rounds, uint32_t result_ptr, uint32_t, uint32_t)
+{
+    auto result = reinterpret_cast<SwitchBench*>(result_ptr);
+    if(!rounds || !result || __atomic_exchange_n(&switchbench_busy, true, __ATOMIC_ACQ_REL)) {
+        return -1;
+    }
+    uint32_t cpu = arch::get_cpu_id();
+    switchbench_done.reinit();
+    switchbench_rounds = rounds;
+    switchbench_left = 2;
+    switchbench_started = false;
+    Task* tasks[2];
+    for(int i = 0; i < 2; i++) {
+        char name[16];
+        format_string(name, sizeof(name), "switchbench-%d", i);
+        tasks[i] = kernel::kthread_create(switchbench_thread, nullptr, name);
+        if(!tasks[i]) {
+            __atomic_store_n(&switchbench_busy, false, __ATOMIC_RELEASE);
+            return -1;
+        }
+        // 都留在调用方的CPU上，只在两个任务之间切换
+        kernel::kthread_bind(tasks[i], cpu);
+    }
+    kernel::kthread_start(tasks[0]);
+    kernel::kthread_start(tasks[1]);
+    bool done = switchbench_done.wait_block();
+    if(done) {
+        uint64_t cycles = arch::div_u64(switchbench_end_tsc - switchbench_start_tsc, 2 * rounds);
+        result->switches = 2 * rounds;
+        result->cycles = (uint32_t)cycles;
+        result->ns = (uint32_t)arch::tsc_cycles_to_ns(cycles);
+    }
+    __atomic_store_n(&switchbench_busy, false, __ATOMIC_RELEASE);
+    return done ? 0 : -1;
+}
+
+// 空转到arg指向的截止时间
+static int cpuhog_thread(void* arg)
+{
+    auto until = static_cast<uint64_t*>(arg);
+    while((int64_t)(kernel::ktime_get() - __atomic_load_n(until, __ATOMIC_ACQUIRE)) < 0) {
+        asm volatile("pause");
+    }
+    return 0;
+}
+
+static int cpuhogHandler(uint32_t cpu, uint32_t count, uint32_t ms, uint32_t group)
+{
+    static constexpr uint32_t MAX_HOGS = 16;
+    static constexpr uint32_t MAX_MS = 60000;
+    // 截止时间放在静态变量里，所有空转任务共用，新的一批会推迟之前的
+    static uint64_t cpuhog_until;
+    if(count == 0) {
+        __atomic_store_n(&cpuhog_until, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+    kernel::TaskGroup* tg = kernel::task_group_get(group);
+    if(cpu >= arch::smp_get_cpu_count() || count > MAX_HOGS || !ms || ms > MAX_MS ||
+        (group && !tg)) {
+        return -1;
+    }
+    cpuhog_until = kernel::ktime_get() + (uint64_t)ms * 1000000;
+    uint32_t started = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        char name[16];
+        format_string(name, sizeof(name), "cpuhog/%d", cpu);
+        Task* task = kernel::kthread_create(cpuhog_thread, &cpuhog_until, name);
+        if(!task) {
+            break;
+        }
+        kernel::kthread_bind(task, cpu);
+        if(tg) {
+            kernel::task_group_attach(task, tg);
+        }
+        kernel::kthread_start(task);
+        started++;
+    }
+    return started;
+}
+
+static int lockstatHandler(uint32_t index, uint32_t stat_ptr, uint32_t, uint32_t)
+{
+#ifdef CONFIG_LOCKSTAT
+    static_assert(sizeof(LockStat::wait_hist) / sizeof(uint32_t) == LOCKSTAT_WAIT_BUCKETS);
+    if(index == LOCKSTAT_RESET) {
+        lockstat_reset();
+        return 0;
+    }
+    auto stat = reinterpret_cast<LockStat*>(stat_ptr);
+    LockClass* cls = lockstat_classes();
+    for(uint32_t i = 0; cls && i < index; i++) {
+        cls = cls->next;
+    }
+    if(!cls || !stat) {
+        return -1;
+    }
+    strncpy(stat->name, cls->name, sizeof(stat->name) - 1);
+    stat->name[sizeof(stat->name) - 1] = '\0';
+    stat->acquisitions = cls->acquisitions;
+    stat->contended = cls->contended;
+    for(uint32_t i = 0; i < LOCKSTAT_WAIT_BUCKETS; i++) {
+        stat->wait_hist[i] = cls->wait_hist[i];
+    }
+    stat->max_wait_cycles = cls->max_wait_cycles;
+    stat->max_hold_cycles = cls->max_hold_cycles;
+    return 0;
+#else
+    (void)index;
+    (void)stat_ptr;
+    return -1;
+#endif
+}
+
+// lockbench里和SpinLock对比的测试并设置锁
+struct TasLock {
+    volatile uint8_t locked;
+    void acquire()
+    {
+        while(__atomic_test_and_set(&locked, __ATOMIC_ACQUIRE)) {
+            asm volatile("pause");
+        }
+    }
+    void release() { __atomic_clear(&locked, __ATOMIC_RELEASE); }
+};
+
+// lockbench的状态，一次只有一个测试
+static constexpr uint32_t LOCKBENCH_LINES = 4; // 临界区里写的缓存行数
+static kernel::Completion lockbench_done;
+static bool lockbench_busy;
+static uint32_t lockbench_mode;
+static uint32_t lockbench_cpus;
+static uint32_t lockbench_rounds;
+static volatile uint32_t lockbench_ready; // 已经开始运行的任务数
+static volatile uint32_t lockbench_left;  // 还没做完的任务数
+static volatile bool lockbench_stop;
+static uint32_t lockbench_counts[MAX_CPUS];
+static uint64_t lockbench_start_tsc;
+static uint64_t lockbench_end_tsc;
+static TasLock lockbench_tas;
+static DEFINE_LOCK_CLASS(lockbench_lock_class, "lockbench");
+static SpinLock lockbench_ticket(&lockbench_lock_class);
+static struct {
+    volatile uint32_t value;
+    uint8_t pad[60];
+} lockbench_data[LOCKBENCH_LINES] __attribute__((aligned(64)));
+
+template <typename Lock> static uint32_t lockbench_loop(Lock& lock)
+{
+    uint32_t count = 0;
+    while(!__atomic_load_n(&lockbench_stop, __ATOMIC_ACQUIRE)) {
+        // 和内核里的用法一样关中断持锁，持有者不会被抢占
+        uint32_t flags;
+        asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+        lock.acquire();
+        for(auto& line : lockbench_data) {
+            line.value++;
+        }
+        lock.release();
+        asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+        if(++count == lockbench_rounds) {
+            __atomic_store_n(&lockbench_stop, true, __ATOMIC_RELEASE);
+        }
+    }
+    return count;
+}
+
+static int lockbench_thread(void* arg)
+{
+    uint32_t index = (uint32_t)(uintptr_t)arg;
+    // 所有任务都运行起来以后一起开始抢锁
+    if(__atomic_add_fetch(&lockbench_ready, 1, __ATOMIC_ACQ_REL) == lockbench_cpus) {
+        lockbench_start_tsc = arch::rdtsc();
+    }
+    while(__atomic_load_n(&lockbench_ready, __ATOMIC_ACQUIRE) < lockbench_cpus) {
+        asm volatile("pause");
+    }
+    lockbench_counts[index] = lockbench_mode == LOCKBENCH_TAS ? lockbench_loop(lockbench_tas)
+                                                              : lockbench_loop(lockbench_ticket);
+    if(__atomic_sub_fetch(&lockbench_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        lockbench_end_tsc = arch::rdtsc();
+        lockbench_done.complete();
+    }
+    return 0;
+}
+
+static int lockbenchHandler(uint32_t mode, uint32_t cpus, uint32_t rounds, uint32_t result_ptr)
+{
+    auto result = reinterpret_cast<LockBench*>(result_ptr);
+    if(mode > LOCKBENCH_TICKET || cpus < 2 || cpus > arch::smp_get_cpu_count() || !rounds ||
+        !result || __atomic_exchange_n(&lockbench_busy, true, __ATOMIC_ACQ_REL)) {
+        return -1;
+    }
+    lockbench_done.reinit();
+    lockbench_mode = mode;
+    lockbench_cpus = cpus;
+    lockbench_rounds = rounds;
+    lockbench_ready = 0;
+    lockbench_stop = false;
+    Task* tasks[MAX_CPUS];
+    for(uint32_t cpu = 0; cpu < cpus; cpu++) {
+        char name[16];
+        format_string(name, sizeof(name), "lockbench/%d", cpu);
+        tasks[cpu] = kernel::kthread_create(lockbench_thread, (void*)(uintptr_t)cpu, name);
+        if(!tasks[cpu]) {
+            // 已经创建的任务还没有启动，不会再运行
+            __atomic_store_n(&lockbench_busy, false, __ATOMIC_RELEASE);
+            return -1;
+        }
+        kernel::kthread_bind(tasks[cpu], cpu);
+    }
+    lockbench_left = cpus;
+    for(uint32_t cpu = 0; cpu < cpus; cpu++) {
+        kernel::kthread_start(tasks[cpu]);
+    }
+    bool done = lockbench_done.wait_block();
+    if(done) {
+        result->total = 0;
+        result->min_count = lockbench_counts[0];
+        result->max_count = lockbench_counts[0];
+        for(uint32_t cpu = 0; cpu < cpus; cpu++) {
+            uint32_t count = lockbench_counts[cpu];
+            result->total += count;
+            result->min_count = count < result->min_count ? count : result->min_count;
+            result->max_count = count > result->max_count ? count : result->max_count;
+        }
+        uint64_t cycles = arch::div_u64(lockbench_end_tsc - lockbench_start_tsc, result->total);
+        result->cycles = (uint32_t)cycles;
+        result->ns = (uint32_t)arch::tsc_cycles_to_ns(cycles);
+    }
+    __atomic_store_n(&lockbench_busy, false, __ATOMIC_RELEASE);
+    return done ? 0 : -1;
+}
+
+// rcubench的状态，一次只有一个测试
+static constexpr uint32_t RCUBENCH_SYNC_ROUNDS = 8; // 测量synchronize_rcu延迟的次数
+static const char* const RCUBENCH_PATH = "/mnt/init";
+static kernel::Completion rcubench_done;
+static bool rcubench_busy;
+static uint32_t rcubench_mode;
+static uint32_t rcubench_cpus;
+static uint32_t rcubench_rounds;
+static Context* rcubench_context;          // 调用方的进程，它阻塞到测试结束
+static volatile uint32_t rcubench_ready;
+static volatile uint32_t rcubench_left;
+static volatile uint32_t rcubench_failed;  // 查找失败的次数，不为0时结果无效
+static uint64_t rcubench_start_tsc;
+static uint64_t rcubench_end_tsc;
+static DEFINE_LOCK_CLASS(rcubench_lock_class, "rcubench");
+static SpinLock rcubench_spinlock(&rcubench_lock_class);
+static RWLock rcubench_rwlock(&rcubench_lock_class);
+
+// open和read开头的查找，查找本身都在RCU读侧临界区里
+static bool rcubench_lookup()
+{
+    const char* remaining;
+    bool ok = kernel::find_fs(RCUBENCH_PATH, &remaining) != nullptr;
+    auto file = kernel::fdget(rcubench_context, 1);
+    if(file) {
+        kernel::fdput(file);
+    }
+    return ok && file;
+}
+
+static int rcubench_thread(void*)
+{
+    if(__atomic_add_fetch(&rcubench_ready, 1, __ATOMIC_ACQ_REL) == rcubench_cpus) {
+        rcubench_start_tsc = arch::rdtsc();
+    }
+    while(__atomic_load_n(&rcubench_ready, __ATOMIC_ACQUIRE) < rcubench_cpus) {
+        asm volatile("pause");
+    }
+    uint32_t failed = 0;
+    for(uint32_t i = 0; i < rcubench_rounds; i++) {
+        bool ok;
+        uint32_t flags;
+        // 加锁的两种和内核里的用法一样关中断持锁
+        if(rcubench_mode == RCUBENCH_RWLOCK) {
+            rcubench_rwlock.read_lock_irqsave(flags);
+            ok = rcubench_lookup();
+            rcubench_rwlock.read_unlock_irqrestore(flags);
+        } else if(rcubench_mode == RCUBENCH_SPINLOCK) {
+            rcubench_spinlock.acquire_irqsave(flags);
+            ok = rcubench_lookup();
+            rcubench_spinlock.release_irqrestore(flags);
+        } else {
+            ok = rcubench_lookup();
+        }
+        failed += !ok;
+    }
+    if(failed) {
+        __atomic_add_fetch(&rcubench_failed, failed, __ATOMIC_RELAXED);
+    }
+    if(__atomic_sub_fetch(&rcubench_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        rcubench_end_tsc = arch::rdtsc();
+        rcubench_done.complete();
+    }
+    return 0;
+}
+
+static int rcubenchHandler(uint32_t mode, uint32_t cpus, uint32_t rounds, uint32_t result_ptr)
+{
+    auto result = reinterpret_cast<RcuBench*>(result_ptr);
+    if(mode > RCUBENCH_SPINLOCK || !cpus || cpus > arch::smp_get_cpu_count() || !rounds ||
+        !result || __atomic_exchange_n(&rcubench_busy, true, __ATOMIC_ACQ_REL)) {
+        return -1;
+    }
+    rcubench_done.reinit();
+    rcubench_mode = mode;
+    rcubench_cpus = cpus;
+    rcubench_rounds = rounds;
+    rcubench_context = ProcessManager::get_current_task()->context;
+    rcubench_ready = 0;
+    rcubench_failed = 0;
+    Task* tasks[MAX_CPUS];
+    for(uint32_t cpu = 0; cpu < cpus; cpu++) {
+        char name[16];
+        format_string(name, sizeof(name), "rcubench/%d", cpu);
+        tasks[cpu] = kernel::kthread_create(rcubench_thread, nullptr, name);
+        if(!tasks[cpu]) {
+            __atomic_store_n(&rcubench_busy, false, __ATOMIC_RELEASE);
+            return -1;
+        }
+        kernel::kthread_bind(tasks[cpu], cpu);
+    }
+    kernel::RcuStats before, after;
+    kernel::rcu_get_stats(before);
+    rcubench_left = cpus;
+    for(uint32_t cpu = 0; cpu < cpus; cpu++) {
+        kernel::kthread_start(tasks[cpu]);
+    }
+    bool done = rcubench_done.wait_block();
+    if(done && rcubench_failed) {
+        log_err("rcubench: %d lookups failed\n", rcubench_failed);
+        done = false;
+    }
+    if(done) {
+        kernel::rcu_get_stats(after);
+        result->total = cpus * rounds;
+        // 各CPU同时在查，每个CPU的开销是总时间除以一个CPU的次数
+        uint64_t cycles = arch::div_u64(rcubench_end_tsc - rcubench_start_tsc, rounds);
+        result->cycles = (uint32_t)cycles;
+        result->ns = (uint32_t)arch::tsc_cycles_to_ns(cycles);
+        result->gp_completed = after.gp_completed - before.gp_completed;
+        uint64_t start = arch::rdtsc();
+        for(uint32_t i = 0; i < RCUBENCH_SYNC_ROUNDS; i++) {
+            kernel::synchronize_rcu();
+        }
+        uint64_t sync_cycles = arch::div_u64(arch::rdtsc() - start, RCUBENCH_SYNC_ROUNDS);
+        result->sync_us = (uint32_t)arch::div_u64(arch::tsc_cycles_to_ns(sync_cycles), 1000);
+    }
+    __atomic_store_n(&rcubench_busy, false, __ATOMIC_RELEASE);
+    return done ? 0 : -1;
+}
+
+// logbench每批打的日志数，批之间排空日志环，环不会满
+static constexpr uint32_t LOGBENCH_BATCH = 64;
+
+static int logbenchHandler(uint32_t rounds, uint32_t result_ptr, uint32_t, uint32_t)
+{
+    auto result = reinterpret_cast<LogBench*>(result_ptr);
+    if(!rounds || !result) {
+        return -1;
+    }
+    LogBuffer& log_buffer = LogBuffer::get_instance();
+    LogBufferStats before, after;
+    log_buffer.get_stats(before);
+
+    uint64_t record_cycles = 0;
+    for(uint32_t done = 0; done < rounds;) {
+        uint32_t batch = rounds - done < LOGBENCH_BATCH ? rounds - done : LOGBENCH_BATCH;
+        uint64_t start = arch::rdtsc();
+        for(uint32_t i = 0; i < batch; i++) {
+            log_debug("logbench: %u of %u, %s\n", done + i, rounds, "deferred");
+        }
+        record_cycles += arch::rdtsc() - start;
+        done += batch;
+        log_buffer.flush();
+    }
+
+    // 原来每次打日志都要在调用方做的格式化
+    char message[512];
+    int tid = ProcessManager::get_current_task()->task_id;
+    uint64_t start = arch::rdtsc();
+    for(uint32_t i = 0; i < rounds; i++) {
+        int len = format_log_prefix(message, sizeof(message), LOG_DEBUG, arch::get_cpu_id(), tid,
+            __FILE__, __LINE__, __func__);
+        format_string(message + len, sizeof(message) - len, "logbench: %u of %u, %s\n", i, rounds,
+            "deferred");
+    }
+    uint64_t format_cycles = arch::rdtsc() - start;
+    log_buffer.get_stats(after);
+
+    result->deferred = log_record_handler != nullptr;
+    result->record_cycles = (uint32_t)arch::div_u64(record_cycles, rounds);
+    result->record_ns = (uint32_t)arch::tsc_cycles_to_ns(result->record_cycles);
+    result->format_cycles = (uint32_t)arch::div_u64(format_cycles, rounds);
+    result->format_ns = (uint32_t)arch::tsc_cycles_to_ns(result->format_cycles);
+    result->recorded = after.recorded - before.recorded;
+    result->dropped = after.dropped - before.dropped;
+    return 0;
+}
+
+// 按DebugOp排列
+static const SyscallHandler debug_ops[DEBUG_NR_OPS] = {
+    waitbenchHandler,
+    switchbenchHandler,
+    cpuhogHandler,
+    lockstatHandler,
+    lockbenchHandler,
+    rcubenchHandler,
+    logbenchHandler,
+};
+
+int debugHandler(uint32_t op, uint32_t args_ptr, uint32_t, uint32_t)
+{
+    if(op >= DEBUG_NR_OPS || !args_ptr) {
+        return -1;
+    }
+    auto args = reinterpret_cast<const uint32_t*>(args_ptr);
+    return debug_ops[op](args[0], args[1], args[2], args[3]);
+}
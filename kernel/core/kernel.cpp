@@ -1,14 +1,17 @@
 #include "kernel/kernel.h"
+#include "kernel/fs/SimplePageCache.h"
+#include "kernel/oom.h"
+#include "kernel/swap.h"
+#include "kernel/task_group.h"
+#include "kernel/vfs.h"
 #include "lib/string.h"
 
 #include <lib/serial.h>
 
+#include "arch/x86/fpu.h"
 #include "arch/x86/paging.h"
 #include "lib/debug.h"
 
-#define E_OK 0
-#define E_NOT_COW 1
-#define E_PANIC 2
 int copyCOWPage(uint32_t fault_addr, uint32_t original_pgd, UserMemory& user_mm)
 {
     auto& kernel_mm = Kernel::instance().kernel_mm();
@@ -19,40 +22,166 @@ int copyCOWPage(uint32_t fault_addr, uint32_t original_pgd, UserMemory& user_mm)
     // 检查COW标志
     if((flags & PAGE_COW) && (flags & PAGE_PRESENT)) {
         // 找到对应的物理页
-        auto pd_index = (fault_addr >> 22) & 0x3FF;
-        auto pde = ((uint32_t*)original_pgd)[pd_index];
-        auto pt_phys = pde & 0xFFFFF000;
-        auto pt_virt = pt_phys | 0xC0000000;
-        auto pt_index = (fault_addr >> 12) & 0x3FF;
-        auto pte = ((uint32_t*)pt_virt)[pt_index];
-        uint32_t old_phys = pte & 0xFFFFF000;
-        // 分配新物理页
-        uint32_t new_phys = Kernel::instance().kernel_mm().alloc_pages(0, 0); // order=0表示分配单个页面
+        auto pd_index = pgd_index(fault_addr);
+        auto pde = ((pte_t*)original_pgd)[pd_index];
+        auto pt_virt = (pte_t*)kernel_mm.phys2Virt(pte_paddr(pde));
+        auto pte = pt_virt[pt_index(fault_addr)];
+        PADDR old_phys = pte_paddr(pte);
+        // 零页不算驻留页，替换零页才新增一个；替换其他页面时驻留页数不变
+        bool from_zero = old_phys == kernel_mm.zero_page();
+        auto group = user_mm.group();
+        if(from_zero && !kernel::task_group_try_charge(group, 1)) {
+            return E_LIMIT;
+        }
+        // 分配新物理页，用户页面可以放在高端内存
+        PADDR new_phys = kernel_mm.alloc_pages(GFP_HIGHUSER, 0); // order=0表示分配单个页面
         if(!new_phys) {
+            if(from_zero) {
+                kernel::task_group_charge_pages(group, -1);
+            }
             log_err("COW failed to allocate new page\n");
-            return E_PANIC;
+            return E_NOMEM;
         }
 
         // 旧的地址应该是可以读的，只是不可以写而已
-        // 新物理页先映射到别处完成拷贝
-        uint32_t tmp_virt = TEMP_MAPPING_VADDR; // 使用固定的临时映射地址
-        Kernel::instance().kernel_mm().paging().mapPage(
-            tmp_virt, new_phys, PAGE_PRESENT | PAGE_WRITE);
-        memcpy((void*)tmp_virt, (void*)fault_addr, PAGE_SIZE);
-        Kernel::instance().kernel_mm().paging().unmapPage(tmp_virt);
+        // 新物理页先映射到KMAP区域完成拷贝
+        void* tmp_virt = kernel_mm.kmap(new_phys);
+        if(!tmp_virt) {
+            if(from_zero) {
+                kernel::task_group_charge_pages(group, -1);
+            }
+            kernel_mm.free_pages(new_phys, 0);
+            return E_PANIC;
+        }
+        if(from_zero) {
+            // 零页的内容是已知的，不需要从用户地址拷贝
+            arch::clear_page(tmp_virt);
+            kernel_mm.note_zero_page_cow();
+        } else {
+            arch::copy_page(tmp_virt, (void*)(fault_addr & ~0xFFF));
+        }
+        kernel_mm.kunmap(tmp_virt);
 
         // 更新页表项
-        user_mm.map_pages(
-            fault_addr & ~0xFFF, new_phys, PAGE_SIZE, (flags & ~PAGE_COW) | PAGE_WRITE);
+        user_mm.map_pages(fault_addr & ~0xFFF, new_phys, PAGE_SIZE,
+            (flags & ~PAGE_COW) | PAGE_WRITE, from_zero);
 
         // 减少原页面的引用计数
         // 如果是复合页，BuddyAllocator会自动处理复合页的引用计数
         // 只会减少复合页首页的引用计数，不会导致错误释放
-        //Kernel::instance().kernel_mm().decrement_ref_count(old_phys);
+        Kernel::instance().kernel_mm().decrement_ref_count(old_phys);
         return E_OK;
     }
     return E_NOT_COW;
 }
+
+/**
+ * @brief 处理文件映射区域的缺页，页面直接来自文件的页缓存，不做拷贝
+ * 共享映射写入时标记页缓存页为脏页，私有映射只读共享页缓存页，写入时再复制
+ * @return E_OK已处理，E_NOT_COW交给通用的COW处理，E_NOMEM内存不足，
+ * E_LIMIT任务组到了内存上限，E_PANIC无法处理
+ */
+static int fileMapFault(
+    MemoryArea& area, uint32_t fault_addr, bool is_present, bool is_write, UserMemory& user_mm)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    uint32_t page_addr = fault_addr & ~0xFFF;
+    bool writable = area.flags & PAGE_WRITE;
+
+    if(is_write && !writable) {
+        log_err("write to read-only file mapping at 0x%x\n", fault_addr);
+        return E_PANIC;
+    }
+    // 私有映射的已映射页面带有PAGE_COW，走通用COW流程
+    if(is_present && !area.shared) {
+        return E_NOT_COW;
+    }
+
+    auto file = static_cast<kernel::FileDescriptor*>(area.file);
+    size_t file_offset = area.file_offset + (page_addr - area.start_addr);
+    auto page = file->get_mmap_page(file_offset);
+    if(!page) {
+        log_err("file mapping at 0x%x has no backing page\n", fault_addr);
+        return E_PANIC;
+    }
+    // 只有第一次映射才新增驻留页，已经映射的共享页面打开写权限不用记账
+    auto group = user_mm.group();
+    if(!is_present && !kernel::task_group_try_charge(group, 1)) {
+        return E_LIMIT;
+    }
+
+    if(area.shared) {
+        // 共享映射先只读映射，第一次写时再打开写权限并标脏，这样只读访问不会产生写回
+        pte_t flags = PAGE_USER | PAGE_SHARED;
+        if(is_write) {
+            flags |= PAGE_WRITE;
+            // 每个可写的页表项算一个写者，解除映射时在UserMemory::release_shared_writers里减掉
+            __atomic_add_fetch(&page->shared_writers, 1, __ATOMIC_RELAXED);
+            file->mark_mmap_dirty(file_offset);
+        }
+        if(!is_present) {
+            kernel_mm.increment_ref_count(page->phys);
+        }
+        user_mm.map_pages(page_addr, page->phys, PAGE_SIZE, flags, !is_present);
+        return E_OK;
+    }
+
+    if(is_write) {
+        // 私有映射第一次访问就是写，直接复制一份，不再映射页缓存页
+        PADDR new_phys = kernel_mm.alloc_pages(GFP_HIGHUSER, 0);
+        if(!new_phys) {
+            kernel::task_group_charge_pages(group, -1);
+            log_err("file mapping failed to allocate private page\n");
+            return E_NOMEM;
+        }
+        void* virt = kernel_mm.kmap(new_phys);
+        void* src = virt ? kernel_mm.kmap(page->phys) : nullptr;
+        if(!src) {
+            kernel_mm.kunmap(virt);
+            kernel::task_group_charge_pages(group, -1);
+            kernel_mm.free_pages(new_phys, 0);
+            return E_PANIC;
+        }
+        arch::copy_page(virt, src);
+        kernel_mm.kunmap(src);
+        kernel_mm.kunmap(virt);
+        user_mm.map_pages(page_addr, new_phys, PAGE_SIZE, PAGE_USER | PAGE_WRITE, true);
+        return E_OK;
+    }
+
+    // 私有映射读：只读映射页缓存页，可写映射加PAGE_COW，写时由copyCOWPage复制
+    kernel_mm.increment_ref_count(page->phys);
+    user_mm.map_pages(
+        page_addr, page->phys, PAGE_SIZE, PAGE_USER | (writable ? PAGE_COW : 0), true);
+    return E_OK;
+}
+/**
+ * @brief 用户态缺页分配不到物理页时先换出不常用的匿名页，换不出来再调用OOM killer
+ * 换出了页面或者杀死的是别的进程时返回true，重新执行出错的指令时就能分配到内存；
+ * 杀死的是当前进程时不再返回
+ * @param group 不为nullptr时是进程所在的任务组到了内存上限，只在组内换出和选进程
+ * @return 当前进程不在进程表里(内核进程)，无法处理时返回false
+ */
+static bool userOutOfMemory(Task* task, kernel::TaskGroup* group = nullptr)
+{
+    // 页缓存页不记在任务组上，淘汰干净的页缓存页比换出匿名页便宜
+    if(!group && SimplePageCache::shrink_all(SwapManager::RECLAIM_BATCH) > 0) {
+        return true;
+    }
+    if(SwapManager::reclaim(SwapManager::RECLAIM_BATCH, group) > 0) {
+        return true;
+    }
+    uint32_t pid = task->context->context_id;
+    int victim = OomKiller::out_of_memory(group);
+    if(victim >= 0 && (uint32_t)victim != pid) {
+        return true;
+    }
+    if(victim < 0 && !ProcessManager::kill_process(pid, EXIT_STATUS_KILLED)) {
+        return false;
+    }
+    ProcessManager::exit_current();
+}
+
 // 缺页中断处理函数
 void page_fault_handler(uint32_t error_code, uint32_t fault_addr)
 {
@@ -79,32 +208,109 @@ void page_fault_handler(uint32_t error_code, uint32_t fault_addr)
 
     // 检查是否是内核态还是用户态
     if(is_user) {
+        // 只有换入、文件页第一次映射和分配匿名页新增驻留页，在这些地方记到任务组上。
+        // 组到了内存上限(E_LIMIT)时先在组内腾出位置，再重新执行出错的指令
+        auto group = user_mm.group();
         // 用户态缺页中断
+        if(!is_present) {
+            // 页面已经换出，从交换设备读回来
+            auto pte = user_mm.find_pte(fault_addr);
+            if(pte && pte_is_swap(*pte)) {
+                auto ret = SwapManager::swap_in(user_mm, fault_addr);
+                if(ret == E_OK || (ret == E_NOMEM && userOutOfMemory(pcb)) ||
+                    (ret == E_LIMIT && userOutOfMemory(pcb, group))) {
+                    return;
+                }
+                goto panic;
+            }
+        }
+        auto area = user_mm.find_area(fault_addr);
+        if(area && area->type == MEM_TYPE_MMAP_FILE) {
+            auto ret = fileMapFault(*area, fault_addr, is_present, is_write, user_mm);
+            if(ret == E_OK) {
+                log_debug("fixed file mapping\n");
+                return;
+            } else if(ret == E_NOMEM && userOutOfMemory(pcb)) {
+                return;
+            } else if(ret == E_LIMIT && userOutOfMemory(pcb, group)) {
+                return;
+            } else if(ret != E_NOT_COW) {
+                goto panic;
+            }
+        }
+        // 匿名页只在内存区域里按需分配，不在任何区域里的地址和越权的写入杀死进程
+        if(!is_present) {
+            if(!area || area->type == MEM_TYPE_SHARED || area->type == MEM_TYPE_DEVICE) {
+                log_err("no memory area at 0x%x\n", fault_addr);
+                goto panic;
+            }
+            if(is_write && !(area->flags & PAGE_WRITE)) {
+                log_err("write to read-only area at 0x%x\n", fault_addr);
+                goto panic;
+            }
+        }
+        if(!is_present && !is_write) {
+            // 读一个还没访问过的匿名页面，映射共享零页。可写的区域带PAGE_COW，第一次写时再由
+            // copyCOWPage分配；只读的区域只读映射，写入时没有COW可走
+            auto& kernel_mm = Kernel::instance().kernel_mm();
+            PADDR zero_page = kernel_mm.zero_page();
+            if(zero_page) {
+                pte_t flags = PAGE_USER | ((area->flags & PAGE_WRITE) ? PAGE_COW : 0);
+                kernel_mm.increment_ref_count(zero_page);
+                user_mm.map_pages(fault_addr & ~0xFFF, zero_page, PAGE_SIZE, flags);
+                kernel_mm.note_zero_page_map();
+                log_debug("mapped zero page\n");
+                return;
+            }
+        }
         if(!is_present) {
             // 页面不存在，需要分配新页面
-            auto phys_page = Kernel::instance().kernel_mm().alloc_pages(0, 0); // order=0表示分配单个页面
+            if(!kernel::task_group_try_charge(group, 1)) {
+                if(userOutOfMemory(pcb, group)) {
+                    return;
+                }
+                goto panic;
+            }
+            auto& kernel_mm = Kernel::instance().kernel_mm();
+            // 用户页面可以放在高端内存，清零时通过kmap访问
+            auto phys_page = kernel_mm.alloc_pages(GFP_HIGHUSER, 0); // order=0表示分配单个页面
             // debug_debug("Allocated pfn 0x%x\n", phys_page);
             if(phys_page) {
-                // 建立用户态页表映射
-                uint32_t flags = PAGE_USER | PAGE_WRITE | PAGE_PRESENT;
-                if(!is_write) {
-                    flags &= ~PAGE_WRITE; // 如果不是写操作，清除写权限
+                void* virt = kernel_mm.kmap(phys_page);
+                if(virt) {
+                    arch::clear_page(virt);
+                    kernel_mm.kunmap(virt);
                 }
+                // 建立用户态页表映射，写权限跟随区域
+                pte_t flags = PAGE_USER | PAGE_PRESENT | (area->flags & PAGE_WRITE);
 
-                user_mm.map_pages(fault_addr & ~0xFFF, phys_page, PAGE_SIZE, flags);
+                user_mm.map_pages(fault_addr & ~0xFFF, phys_page, PAGE_SIZE, flags, true);
                 log_debug("fixed page mapping\n");
                 return;
             }
+            kernel::task_group_charge_pages(group, -1);
+            if(userOutOfMemory(pcb)) {
+                return;
+            }
         } else if(is_write) {
             auto ret = copyCOWPage(fault_addr, pgd, user_mm);
             if (ret == E_OK) {
                 log_debug("copied page\n");
                 return;
-            } else if (ret == E_PANIC) {
+            } else if (ret == E_NOMEM && userOutOfMemory(pcb)) {
+                return;
+            } else if (ret == E_LIMIT && userOutOfMemory(pcb, group)) {
+                return;
+            } else if (ret != E_NOT_COW) {
                 goto panic;
             }
         }
     } else {
+        if(KernelStackAllocator::is_guard_page(fault_addr)) {
+            log_err("kernel stack overflow, tid:%d, name:%s, fault_addr:0x%x\n", pcb->task_id,
+                pcb->name, fault_addr);
+            goto panic;
+        }
         log_debug("kernel page fault unexpected\n");
         // return;
         // // 内核态缺页中断
@@ -128,19 +334,20 @@ panic:
     log_debug("Present: %d, Write: %d, User: %d, Reserved: %d, Instruction: %d\n", is_present,
         is_write, is_user, is_reserved, is_instruction);
     printPDPTE((void*)fault_addr);
+
+    // 终止用户进程，内核进程不在进程表里，杀不掉时只能停机
+    if(is_user && ProcessManager::kill_process(pcb->context->context_id, EXIT_STATUS_KILLED)) {
+        log_err("killed process %d: unhandled page fault at 0x%x, error code 0x%x\n",
+            pcb->context->context_id, fault_addr, error_code);
+        ProcessManager::exit_current();
+    }
     log_debug("will panic\n");
     asm volatile("hlt");
 
-    // 终止当前进程或触发内核panic
-    if(is_user) {
-        // 终止用户进程
-        // TODO: 实现进程终止逻辑
-    } else {
-        // 内核panic
-        log_debug("Kernel Panic: Unhandled Page Fault!\n");
-        while(1)
-            ;
-    }
+    // 内核panic
+    log_debug("Kernel Panic: Unhandled Page Fault!\n");
+    while(1)
+        ;
 }
 
 Kernel::Kernel() : memory_manager()
@@ -152,7 +359,26 @@ void Kernel::init()
 {
     serial_puts("kernel init\n");
     memory_manager.init();
-    timer_ticks.init_all(new uint32_t(0));
+}
+
+void Kernel::tick(uint32_t nr)
+{
+    ticks_lock.write_lock();
+    timer_ticks += nr;
+    ticks_lock.write_unlock();
+}
+
+void Kernel::update_ticks(uint64_t ticks)
+{
+    // 同一个tick上别的CPU已经更新过时不用拿写锁
+    if(ticks <= get_ticks64()) {
+        return;
+    }
+    ticks_lock.write_lock();
+    if(ticks > timer_ticks) {
+        timer_ticks = ticks;
+    }
+    ticks_lock.write_unlock();
 }
 
 bool Kernel::is_kernel_mode()
@@ -1,23 +1,32 @@
 #include <arch/x86/apic.h>
+#include <arch/x86/fpu.h>
 #include <arch/x86/gdt.h>
 #include <arch/x86/idt.h>
 #include <arch/x86/interrupt.h>
 #include <arch/x86/paging.h>
+#include <arch/x86/percpu.h>
+#include <arch/x86/tsc.h>
 #include <arch/x86/smp.h>
 #include <drivers/block_device.h>
 #include <drivers/ext2.h>
 #include <drivers/keyboard.h>
+#include <kernel/boot_options.h>
 #include <kernel/buddy_allocator.h>
 #include <kernel/elf_loader.h>
 #include <kernel/memfs.h>
 #include <kernel/process.h>
+#include <kernel/rcu.h>
 #include <kernel/scheduler.h>
 #include <kernel/smp_scheduler.h>
+#include <kernel/swap.h>
 #include <kernel/syscall_user.h>
+#include <kernel/tick.h>
 #include <kernel/vfs.h>
+#include <kernel/workqueue.h>
 #include <lib/console.h>
 #include <lib/debug.h>
 #include <lib/ioport.h>
+#include <lib/log_buffer.h>
 #include <lib/serial.h>
 #include <unistd.h>
 
@@ -31,6 +40,7 @@ void run_format_string_tests();
 // extern "C" void apic_timer_interrupt();
 extern "C" void timer_interrupt();
 extern "C" void apic_timer_interrupt();
+extern "C" void ipi_reschedule();
 extern "C" void keyboard_interrupt();
 extern "C" void cascade_interrupt();
 extern "C" void ide1_interrupt();
@@ -40,16 +50,35 @@ extern "C" void page_fault_interrupt();
 extern "C" void general_protection_interrupt();
 extern "C" void segmentation_fault_interrupt();
 extern "C" void stack_fault_interrupt();
+extern "C" void device_not_available_interrupt();
+void install_double_fault_task();
 Task* init_task = nullptr;
 
 void idle_task_entry()
 {
     while(true) {
-        log_debug("idle task!\n");
-        asm volatile("hlt");
+        Tick::idle();
     }
 }
 
+// 比较读当前任务(per-CPU段，一条指令)和读本地APIC ID寄存器的耗时
+static void percpu_benchmark()
+{
+    constexpr uint32_t ROUNDS = 10000;
+    auto& scheduler = Kernel::instance().scheduler();
+    uint64_t start = arch::rdtsc();
+    for(uint32_t i = 0; i < ROUNDS; i++) {
+        asm volatile("" : : "r"(scheduler.get_current_task()));
+    }
+    uint64_t mid = arch::rdtsc();
+    for(uint32_t i = 0; i < ROUNDS; i++) {
+        asm volatile("" : : "r"(arch::apic_get_id()));
+    }
+    uint64_t end = arch::rdtsc();
+    log_info("get_current_task: %d cycles, apic_get_id: %d cycles\n",
+        (uint32_t)(mid - start) / ROUNDS, (uint32_t)(end - mid) / ROUNDS);
+}
+
 void init()
 {
     log_debug("entering init kernel code!\n");
@@ -73,13 +102,14 @@ void init()
 extern "C" Task* create_init_task(Context* context, KernelMemory& mm)
 {
     auto init_context = new Context();
+    init_context->context_id = ProcessManager::pid_manager.alloc();
     init_context->cloneMemorySpace(context);
     init_context->cloneFiles(context);
+    ProcessManager::register_context(init_context);
     init_task = ProcessManager::kernel_task(init_context, "init", (uint32_t)init, 0, nullptr);
-    init_task->alloc_stack(mm);
     init_task->allocUserStack();
     init_task->state = PROCESS_READY;
-    init_task->regs.cr3 = init_task->context->user_mm.getPageDirectoryPhysical();
+    init_task->regs.cr3 = init_task->context->user_mm.getCr3();
 
     log_debug("init_task: %d(0x%x)\n", init_task->task_id, init_task);
     init_task->print();
@@ -87,15 +117,13 @@ extern "C" Task* create_init_task(Context* context, KernelMemory& mm)
 }
 extern "C" Task* create_idle_task(Context* context, int apic_id)
 {
-    auto& kernel = Kernel::instance();
     // idle task
     char name[32];
     format_string(name, sizeof(name), "idle-%d", apic_id);
     auto idle_task =
         ProcessManager::kernel_task(context, name, (uint32_t)idle_task_entry, 0, nullptr);
-    idle_task->alloc_stack(kernel.kernel_mm());
     idle_task->state = PROCESS_READY;
-    idle_task->regs.cr3 = idle_task->context->user_mm.getPageDirectoryPhysical();
+    idle_task->regs.cr3 = idle_task->context->user_mm.getCr3();
 
     // kernel.scheduler().set_current_task(idle_task);
     // kernel.scheduler().set_idle_task(idle_task);
@@ -109,22 +137,25 @@ int initialize_kernel_context()
     ProcessManager::kernel_context = new Context();
     auto ctx = ProcessManager::kernel_context;
     ctx->user_mm.init(
-        0x400000, (PageDirectory*)0xC0400000,
+        PAGE_DIRECTORY_ADDR, (PageDirectory*)(PAGE_DIRECTORY_ADDR + KERNEL_DIRECT_MAP_START),
         []() {
             auto page = Kernel::instance().kernel_mm().alloc_pages(
                 0, 0); // gfp_mask = 0, order = 0 (1 page)
-            log_debug("ProcessManager: Allocated Page at %x\n", page);
+            log_debug("ProcessManager: Allocated Page at %x\n", (uint32_t)page);
             return page;
         },
-        [](uint32_t physAddr) {
+        [](PADDR physAddr) {
             Kernel::instance().kernel_mm().free_pages(physAddr, 0);
         }, // order=0表示释放单个页面
-        [](uint32_t physAddr) {
+        [](PADDR physAddr) {
             return (void*)Kernel::instance().kernel_mm().phys2Virt(physAddr);
         });
 
     auto fd = VFSManager::instance().open("/dev/console");
     fd->write("hello-world\n", 12);
+    // 三项共用一个文件，各持有一个引用
+    kernel::get_file(fd);
+    kernel::get_file(fd);
     ctx->fd_table[0] = fd;
     ctx->fd_table[1] = fd;
     ctx->fd_table[2] = fd;
@@ -133,7 +164,7 @@ int initialize_kernel_context()
     return 0;
 }
 
-extern "C" void kernel_main()
+extern "C" void kernel_main(uint32_t magic, uint32_t mbi_phys)
 {
     // 初始化串口，用于调试输出
     serial_init();
@@ -142,6 +173,11 @@ extern "C" void kernel_main()
     // 初始化GDT
     GDT::init();
     serial_puts("GDT initialized!\n");
+    // 每CPU数据区，之后gs指向CPU 0的per-CPU段
+    arch::setup_per_cpu_areas();
+    arch::percpu_load_gs(0);
+    // 打开SSE，之后任务切换时惰性保存恢复FPU状态
+    arch::fpu_init();
 
     // 初始化内核内存管理器
     serial_puts("Kernel memory manager initialized!\n");
@@ -150,6 +186,8 @@ extern "C" void kernel_main()
 
     Kernel::init_all();
     Kernel* kernel = &Kernel::instance();
+    kernel->kernel_mm().setBootInfo(magic, mbi_phys);
+    BootOptions::init(magic, mbi_phys);
     kernel->init();
     serial_puts("Kernel initialized!\n");
 
@@ -167,6 +205,11 @@ extern "C" void kernel_main()
         return ProcessManager::fork();
     });
     set_log_level(LOG_DEBUG);
+    uint32_t loglevel_len;
+    const char* loglevel = BootOptions::get("loglevel", loglevel_len);
+    if(loglevel && !parse_log_levels(loglevel, loglevel_len)) {
+        log_err("BootOptions: bad loglevel=%s\n", loglevel);
+    }
 
     // 注册时钟中断处理函数
     kernel->interrupt_manager().registerHandler(0x20, []() {
@@ -175,20 +218,34 @@ extern "C" void kernel_main()
     });
 
     kernel->interrupt_manager().registerHandler(IRQ_TIMER, []() {
-        auto cpu_id = arch::apic_get_id();
+        auto cpu_id = arch::get_cpu_id();
         // if(cpu_id != 0) {
         //     debug_rate_limited("timer interrupt on cpu %d\n", cpu_id);
         // }
-        Kernel::instance().tick();
-        ProcessManager::schedule();
+        // 只有hrtimer到期的中断不算tick，不结算时间片，但唤醒的任务可能要抢占
+        if(Tick::timer_interrupt()) {
+            Kernel::instance().scheduler().scheduler_tick();
+            kernel::rcu_check_callbacks();
+            LogBuffer::tick();
+        }
     });
     kernel->interrupt_manager().registerHandler(APIC_TIMER_VECTOR, []() {
-        auto cpu_id = arch::apic_get_id();
+        auto cpu_id = arch::get_cpu_id();
         // if(cpu_id != 0) {
         //     debug_rate_limited("timer interrupt on cpu %d\n", cpu_id);
         // }
-        Kernel::instance().tick();
-        ProcessManager::schedule();
+        // 只有hrtimer到期的中断不算tick，不结算时间片，但唤醒的任务可能要抢占
+        if(Tick::timer_interrupt()) {
+            Kernel::instance().scheduler().scheduler_tick();
+            kernel::rcu_check_callbacks();
+            LogBuffer::tick();
+        }
+    });
+    // 其他CPU往本CPU的运行队列放了要抢占的任务，发过EOI以后在中断返回前切换
+    kernel->interrupt_manager().registerHandler(IPI_RESCHEDULE_VECTOR, []() {
+        Kernel::instance().scheduler().resched_ipi();
+        // 可能是把idle从hlt里唤醒，直接切到任务，idle来不及恢复停掉的tick
+        Tick::nohz_exit();
     });
     // 注册键盘中断处理函数
     keyboard_init();
@@ -214,9 +271,13 @@ extern "C" void kernel_main()
     IDT::setGate(INT_GP_FAULT, (uint32_t)general_protection_interrupt, 0x08, 0xEE);
     IDT::setGate(INT_SEGMENT_NP, (uint32_t)segmentation_fault_interrupt, 0x08, 0xEE);
     IDT::setGate(INT_STACK_FAULT, (uint32_t)stack_fault_interrupt, 0x08, 0xEE);
+    IDT::setGate(INT_DEVICE_NA, (uint32_t)device_not_available_interrupt, 0x08, 0xEE);
+    // 双重错误走任务门换栈，内核栈溢出到保护页时才能报告出来
+    install_double_fault_task();
     // IDT::setGate(INT_COPROCESSOR_SEG, (uint32_t)stack_fault_interrupt, 0x08, 0xEE);
 
     IDT::setGate(APIC_TIMER_VECTOR, (uint32_t)apic_timer_interrupt, 0x08, 0xEE);
+    IDT::setGate(IPI_RESCHEDULE_VECTOR, (uint32_t)ipi_reschedule, 0x08, 0xEE);
     IDT::setGate(IRQ_TIMER, (uint32_t)timer_interrupt, 0x08, 0xEE);
     IDT::setGate(IRQ_KEYBOARD, (uint32_t)keyboard_interrupt, 0x08, 0xEE);
     IDT::setGate(IRQ_CASCADE, (uint32_t)cascade_interrupt, 0x08, 0xEE);
@@ -240,6 +301,7 @@ extern "C" void kernel_main()
     ProcessManager::init();
     Scheduler::init();
     Console::print("Process and Scheduler systems initialized!\n");
+    percpu_benchmark();
 
     // // // 创建并初始化第一个进程
     // uint32_t init_pid = ProcessManager::create_process("idle");
@@ -271,6 +333,13 @@ extern "C" void kernel_main()
     VFSManager::instance().register_fs("/mnt", ext2fs);
     log_debug("Ext2 filesystem mounted at /mnt\n");
 
+    // 从盘用mkswap格式化后作为交换设备，没有接从盘时不启用交换
+    auto swap_disk = new DiskDevice(1);
+    if(!swap_disk->init() || !SwapManager::activate(swap_disk)) {
+        log_info("No swap device\n");
+        delete swap_disk;
+    }
+
     // 打印根目录内容
     auto root = VFSManager::instance().open("/mnt");
     if(root) {
@@ -347,12 +416,21 @@ extern "C" void kernel_main()
     kernel->scheduler().init();
     kernel->scheduler().set_idle_task(idle_task);
     kernel->scheduler().set_current_task(idle_task);
-    kernel->scheduler().enqueue_task(init_task, 1);
+    kernel->scheduler().enqueue_task(init_task, 1, kernel::ENQUEUE_NEW);
+    Tick::init();
 
     log_debug("Initializing SMP...\n");
     arch::smp_init();
     log_debug("SMP initialized\n");
 
+    // kworker要在第一个tick之前就绪，之后的日志由kworker写到串口
+    kernel::workqueue_init();
+    // RCU回调在kworker里执行
+    kernel::rcu_init();
+    if(!BootOptions::is_off("logbuf")) {
+        LogBuffer::get_instance().start_consumer();
+    }
+
     log_debug("Enabling interrupt...\n");
     asm volatile("sti");
 
@@ -361,6 +439,6 @@ extern "C" void kernel_main()
 
     while(1) {
         // debug_rate_limited("idle process!\n");
-        asm volatile("hlt");
+        Tick::idle();
     }
 }
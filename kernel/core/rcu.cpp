@@ -0,0 +1,311 @@
+#include "kernel/rcu.h"
+
+#include <arch/x86/smp.h>
+#include <arch/x86/spinlock.h>
+#include <kernel/list.h>
+#include <kernel/wait.h>
+#include <kernel/workqueue.h>
+#include <lib/debug.h>
+
+namespace kernel {
+
+DEFINE_PER_CPU(uint32_t, rcu_nesting);
+
+// 回调的单链表，head为nullptr时为空
+struct RcuList {
+    rcu_head* head;
+    rcu_head* tail;
+};
+
+static void rcu_list_append(RcuList& list, rcu_head* head)
+{
+    if(list.head) {
+        list.tail->next = head;
+    } else {
+        list.head = head;
+    }
+    list.tail = head;
+}
+
+// src整个挂到dst后面，src变成空
+static void rcu_list_splice(RcuList& dst, RcuList& src)
+{
+    if(!src.head) {
+        return;
+    }
+    if(dst.head) {
+        dst.tail->next = src.head;
+    } else {
+        dst.head = src.head;
+    }
+    dst.tail = src.tail;
+    src.head = nullptr;
+    src.tail = nullptr;
+}
+
+// 一个CPU的回调，只在这个CPU上关中断访问
+struct RcuData {
+    RcuList next;      // 刚排进来，还没有等的宽限期
+    RcuList wait;      // 等第wait_gp个宽限期结束
+    RcuList done;      // 宽限期已经结束，等kworker执行
+    uint32_t wait_gp;
+    uint32_t qs_gp;    // 已经报告过静止状态的宽限期
+    uint32_t queued;
+    uint32_t invoked;
+    work_struct work;
+};
+
+// 全零就是没有回调
+DEFINE_PER_CPU(RcuData, rcu_data);
+
+// 全局的宽限期状态，lock保护；gp_seq、completed和本CPU的idle位可以不加锁读
+struct RcuState {
+    SpinLock lock;
+    volatile uint32_t gp_seq;    // 最近开始的宽限期
+    volatile uint32_t completed; // 最近结束的宽限期，等于gp_seq时没有进行中的宽限期
+    uint32_t pending;            // 还没有报告静止状态的CPU
+    uint32_t online;
+    volatile uint32_t idle;      // 停掉tick空闲的CPU
+    bool need_gp;                // 当前宽限期结束后再开始一个
+    volatile bool ready;
+};
+
+static DEFINE_LOCK_CLASS(rcu_lock_class, "rcu");
+static RcuState rcu_state = {SpinLock(&rcu_lock_class), 0, 0, 0, 0, 0, false, false};
+// synchronize_rcu的等待方，宽限期结束后全部唤醒，各自检查等的宽限期。
+// 宽限期可能在schedule里报告静止状态时结束，那里不能唤醒任务，只记下来，由tick或者进入空闲时唤醒
+static WaitQueue gp_wq;
+static volatile bool gp_wake_pending;
+
+static bool gp_done(uint32_t gp)
+{
+    return (int32_t)(__atomic_load_n(&rcu_state.completed, __ATOMIC_ACQUIRE) - gp) >= 0;
+}
+
+static void start_gp_locked();
+
+// 以下调用方持有rcu_state.lock
+
+static void end_gp_locked()
+{
+    __atomic_store_n(&rcu_state.completed, rcu_state.gp_seq, __ATOMIC_RELEASE);
+    gp_wake_pending = true;
+    if(rcu_state.need_gp) {
+        start_gp_locked();
+    }
+}
+
+static void start_gp_locked()
+{
+    rcu_state.need_gp = false;
+    rcu_state.gp_seq++;
+    rcu_state.pending = rcu_state.online & ~rcu_state.idle;
+    // 所有CPU都停掉tick空闲，没有读的一方
+    if(!rcu_state.pending) {
+        end_gp_locked();
+    }
+}
+
+// 返回现在以后开始的宽限期，它结束时现在已经进入的读侧临界区都已经退出
+static uint32_t request_gp_locked()
+{
+    if(rcu_state.gp_seq != rcu_state.completed) {
+        // 进行中的宽限期可能比现在开始得早，要等下一个
+        rcu_state.need_gp = true;
+        return rcu_state.gp_seq + 1;
+    }
+    start_gp_locked();
+    return rcu_state.gp_seq;
+}
+
+static void clear_pending_locked(uint32_t cpu)
+{
+    if(rcu_state.pending & (1u << cpu)) {
+        rcu_state.pending &= ~(1u << cpu);
+        if(!rcu_state.pending) {
+            end_gp_locked();
+        }
+    }
+}
+
+// 本CPU处在静止状态，报告给进行中的宽限期，中断已关
+static void report_qs(RcuData* rdp, uint32_t cpu)
+{
+    uint32_t gp = __atomic_load_n(&rcu_state.gp_seq, __ATOMIC_ACQUIRE);
+    // 每个宽限期只加一次锁
+    if(rdp->qs_gp == gp || gp_done(gp)) {
+        rdp->qs_gp = gp;
+        return;
+    }
+    rcu_state.lock.acquire();
+    if(rcu_state.gp_seq == gp) {
+        clear_pending_locked(cpu);
+    }
+    rcu_state.lock.release();
+    rdp->qs_gp = gp;
+}
+
+// 中断已关，不在schedule里
+static void wake_gp_waiters()
+{
+    if(!gp_wake_pending || !__atomic_exchange_n(&gp_wake_pending, false, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    gp_wq.lock.acquire();
+    gp_wq.wake_all(0);
+    gp_wq.lock.release();
+}
+
+// 宽限期已经结束的回调交给kworker，新排的回调等下一个宽限期，中断已关
+static void advance_callbacks(RcuData* rdp)
+{
+    if(rdp->wait.head && gp_done(rdp->wait_gp)) {
+        rcu_list_splice(rdp->done, rdp->wait);
+        queue_work(&rdp->work);
+    }
+    if(!rdp->wait.head && rdp->next.head) {
+        rcu_list_splice(rdp->wait, rdp->next);
+        rcu_state.lock.acquire();
+        rdp->wait_gp = request_gp_locked();
+        rcu_state.lock.release();
+    }
+}
+
+// 在kworker里执行宽限期已经结束的回调
+static void rcu_do_batch(work_struct* work)
+{
+    RcuData* rdp = container_of(work, RcuData, work);
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    rcu_head* head = rdp->done.head;
+    rdp->done.head = nullptr;
+    rdp->done.tail = nullptr;
+    asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+    uint32_t count = 0;
+    while(head) {
+        rcu_head* next = head->next;
+        head->func(head);
+        head = next;
+        count++;
+    }
+    __atomic_add_fetch(&rdp->invoked, count, __ATOMIC_RELAXED);
+}
+
+void rcu_init()
+{
+    uint32_t online = 0;
+    for(uint32_t cpu = 0; cpu < arch::smp_get_cpu_count(); cpu++) {
+        init_work(&per_cpu(rcu_data, cpu).work, rcu_do_batch);
+        online |= 1u << cpu;
+    }
+    uint32_t flags;
+    rcu_state.lock.acquire_irqsave(flags);
+    rcu_state.online = online;
+    __atomic_store_n(&rcu_state.ready, true, __ATOMIC_RELEASE);
+    rcu_state.lock.release_irqrestore(flags);
+    log_info("rcu: %d cpus online\n", arch::smp_get_cpu_count());
+}
+
+void call_rcu(rcu_head* head, void (*func)(rcu_head* head))
+{
+    head->func = func;
+    head->next = nullptr;
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    RcuData* rdp = this_cpu_ptr(rcu_data);
+    rcu_list_append(rdp->next, head);
+    rdp->queued++;
+    asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+void synchronize_rcu()
+{
+    // 启动早期只有BSP在运行内核代码
+    if(!__atomic_load_n(&rcu_state.ready, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    uint32_t flags;
+    rcu_state.lock.acquire_irqsave(flags);
+    uint32_t gp = request_gp_locked();
+    rcu_state.lock.release_irqrestore(flags);
+
+    gp_wq.lock.acquire_irqsave(flags);
+    while(!gp_done(gp)) {
+        if(gp_wq.block(flags) == WAIT_KILLED) {
+            // 被杀死的任务不能再阻塞，开中断等其他CPU和本CPU的tick推进宽限期
+            asm volatile("sti");
+            while(!gp_done(gp)) {
+                asm volatile("pause");
+            }
+            asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+            return;
+        }
+        gp_wq.lock.acquire_irqsave(flags);
+    }
+    gp_wq.lock.release_irqrestore(flags);
+}
+
+void rcu_note_context_switch()
+{
+    // 可能是从停掉tick的空闲直接切到被唤醒的任务
+    rcu_idle_exit();
+    if(!rcu_state.ready || rcu_read_lock_held()) {
+        return;
+    }
+    report_qs(this_cpu_ptr(rcu_data), arch::get_cpu_id());
+}
+
+void rcu_check_callbacks()
+{
+    if(!rcu_state.ready) {
+        return;
+    }
+    RcuData* rdp = this_cpu_ptr(rcu_data);
+    advance_callbacks(rdp);
+    // 时钟中断打断的不是读侧临界区
+    if(!rcu_read_lock_held()) {
+        report_qs(rdp, arch::get_cpu_id());
+    }
+    wake_gp_waiters();
+}
+
+bool rcu_needs_cpu()
+{
+    RcuData* rdp = this_cpu_ptr(rcu_data);
+    return rdp->next.head || rdp->wait.head || gp_wake_pending;
+}
+
+void rcu_idle_enter()
+{
+    uint32_t cpu = arch::get_cpu_id();
+    rcu_state.lock.acquire();
+    rcu_state.idle |= 1u << cpu;
+    clear_pending_locked(cpu);
+    rcu_state.lock.release();
+    wake_gp_waiters();
+}
+
+void rcu_idle_exit()
+{
+    uint32_t bit = 1u << arch::get_cpu_id();
+    // 只有本CPU改自己的位
+    if(!(rcu_state.idle & bit)) {
+        return;
+    }
+    rcu_state.lock.acquire();
+    rcu_state.idle &= ~bit;
+    rcu_state.lock.release();
+}
+
+void rcu_get_stats(RcuStats& stats)
+{
+    stats.gp_completed = rcu_state.completed;
+    stats.callbacks_queued = 0;
+    stats.callbacks_invoked = 0;
+    for(uint32_t cpu = 0; cpu < arch::smp_get_cpu_count(); cpu++) {
+        stats.callbacks_queued += per_cpu(rcu_data, cpu).queued;
+        stats.callbacks_invoked += per_cpu(rcu_data, cpu).invoked;
+    }
+}
+
+} // namespace kernel
@@ -1,4 +1,5 @@
 #include "kernel/syscall.h"
+#include "kernel/debug_syscall.h"
 #include "lib/string.h"
 #include "lib/time.h"
 
@@ -9,17 +10,25 @@
 #include "lib/debug.h"
 
 #include <arch/x86/paging.h>
+#include <arch/x86/tsc.h>
 #include <kernel/kernel.h>
 #include <kernel/syscall_user.h>
 
 #include "kernel/elf_loader.h"
+#include "kernel/oom.h"
 #include "kernel/process.h"
+#include "kernel/shm.h"
+#include "kernel/swap.h"
+#include "kernel/task_group.h"
+#include "kernel/tick.h"
+#include "kernel/timer.h"
 #include "kernel/user_memory.h"
 #include "kernel/vfs.h"
 #include "lib/debug.h"
 
 extern "C" uint32_t handleSyscall(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4)
 {
+    // 返回值由入口写到栈上帧里的eax。系统调用里睡眠的任务醒来以后才返回到这里
     return SyscallManager::handleSyscall(syscall_num, arg1, arg2, arg3, arg4);
 }
 // 系统调用处理函数声明
@@ -34,18 +43,19 @@ int sys_getdents(uint32_t fd_num, uint32_t dirp, uint32_t count, uint32_t pos_pt
 {
     log_debug("getdentsHandler called with fd_num=%d, dirp=0x%x, count=%d, pos_ptr=0x%x,value(%d)\n", fd_num, dirp, count, pos_ptr, *(uint32_t*)pos_ptr);
     auto pcb = ProcessManager::get_current_task();
-    if(fd_num >= 256 || !pcb->context->fd_table[fd_num]) {
+    // 获取文件描述符
+    auto fd = kernel::fdget(pcb->context, fd_num);
+    if(!fd) {
         return -1; // 无效的文件描述符
     }
 
-    // 获取文件描述符
-    auto fd = pcb->context->fd_table[fd_num];
-
     // 获取位置指针
     uint32_t* pos = reinterpret_cast<uint32_t*>(pos_ptr);
 
     // 调用文件描述符的iterate方法
-    return fd->iterate(reinterpret_cast<void*>(dirp), count, pos);
+    int ret = fd->iterate(reinterpret_cast<void*>(dirp), count, pos);
+    kernel::fdput(fd);
+    return ret;
 }
 
 int mkdirHandler(uint32_t path_ptr, uint32_t, uint32_t, uint32_t)
@@ -133,42 +143,390 @@ void* sys_mmap(void* addr, size_t length, int prot, int flags, int fd, size_t of
 
     log_trace("addr = %x, length = %x, prot = %x, flags = %x, fd = %x, offset = %x\n", addr, length, prot, flags, fd, offset);
 
-    if(fd < 0) {
+    if(fd < 0 || (flags & MAP_ANONYMOUS)) {
         auto task = ProcessManager::get_current_task();
-        auto mapped_addr = task->context->user_mm.allocate_area(length, 0, MEM_TYPE_ANONYMOUS);
+        // 缺页时按区域的PAGE_WRITE决定能不能写
+        auto mapped_addr = task->context->user_mm.allocate_area(
+            length, (prot & PROT_WRITE) ? PAGE_WRITE : 0, MEM_TYPE_ANONYMOUS);
         log_trace("return mapped_addr = %x\n", mapped_addr);
         return mapped_addr;
     }
-    if(fd >= 256 || !ProcessManager::get_current_task()->context->fd_table[fd]) {
+    auto fd_ptr = kernel::fdget(ProcessManager::get_current_task()->context, fd);
+    if(!fd_ptr) {
         log_err("Invalid file descriptor\n");
         return (void*)MAP_FAILED;
     }
-    auto fd_ptr = ProcessManager::get_current_task()->context->fd_table[fd];
     // if(fd_ptr-> != FILE_TYPE_REGULAR) {
     //     log_err("Invalid file type\n");
     //     return (void*)MAP_FAILED;
     // }
     auto ret = fd_ptr->mmap(addr, length, prot, flags, offset);
+    kernel::fdput(fd_ptr);
 
     log_trace("return 0x%x\n", ret);
     return ret;
 }
 
+int msyncHandler(uint32_t addr, uint32_t length, uint32_t flags, uint32_t)
+{
+    return sys_msync(reinterpret_cast<void*>(addr), length, flags);
+}
+
+int sys_msync(void* addr, size_t length, int flags)
+{
+    if((flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC)) || ((flags & MS_ASYNC) && (flags & MS_SYNC))) {
+        log_err("msync: invalid flags 0x%x\n", flags);
+        return -1;
+    }
+    uint32_t start = (uint32_t)addr;
+    if(start & (PAGE_SIZE - 1)) {
+        log_err("msync: 0x%x is not page aligned\n", start);
+        return -1;
+    }
+    if(length == 0) {
+        return 0;
+    }
+    auto& user_mm = ProcessManager::get_current_task()->context->user_mm;
+    auto area = user_mm.find_area(start);
+    if(!area || area->type != MEM_TYPE_MMAP_FILE) {
+        log_err("msync: 0x%x is not a file mapping\n", start);
+        return -1;
+    }
+    // 范围必须落在同一个映射区域里
+    if(length > area->end_addr - start) {
+        log_err("msync: 0x%x+0x%x is outside the mapping\n", start, length);
+        return -1;
+    }
+    // 私有映射的修改不写回文件；MS_ASYNC的脏页已经交给页缓存的延迟写回
+    if(!area->shared || !(flags & MS_SYNC)) {
+        return 0;
+    }
+    user_mm.collect_dirty(*area, start, start + length);
+    auto file = static_cast<kernel::FileDescriptor*>(area->file);
+    return file->sync(area->file_offset + (start - area->start_addr), length);
+}
+
+int shmOpenHandler(uint32_t name_ptr, uint32_t size, uint32_t flags, uint32_t)
+{
+    auto ctx = ProcessManager::get_current_task()->context;
+    return ShmManager::open(reinterpret_cast<const char*>(name_ptr), size, flags, *ctx);
+}
+
+int shmMapHandler(uint32_t id, uint32_t, uint32_t, uint32_t)
+{
+    auto ctx = ProcessManager::get_current_task()->context;
+    auto addr = ShmManager::map((int)id, *ctx);
+    return addr ? (int)addr : MAP_FAILED;
+}
+
+int shmUnmapHandler(uint32_t addr, uint32_t, uint32_t, uint32_t)
+{
+    auto& user_mm = ProcessManager::get_current_task()->context->user_mm;
+    return ShmManager::unmap(reinterpret_cast<void*>(addr), user_mm);
+}
+
+int shmUnlinkHandler(uint32_t name_ptr, uint32_t, uint32_t, uint32_t)
+{
+    return ShmManager::unlink(reinterpret_cast<const char*>(name_ptr));
+}
+
+int meminfoHandler(uint32_t info_ptr, uint32_t, uint32_t, uint32_t)
+{
+    auto info = reinterpret_cast<MemInfo*>(info_ptr);
+    if(!info) {
+        return -1;
+    }
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    info->normal_free_pages = kernel_mm.normal_free_pages();
+    info->high_free_pages = kernel_mm.highmem_free_pages();
+    info->zero_page_maps = kernel_mm.zero_page_map_count();
+    info->zero_page_cows = kernel_mm.zero_page_cow_count();
+
+    auto kstack = kernel_mm.kstacks().stats();
+    info->kstack_allocs = kstack.allocs;
+    info->kstack_cached = kstack.percpu_hits + kstack.reuse_hits;
+    // 避免64位除法
+    uint32_t cycles = kstack.alloc_cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)kstack.alloc_cycles;
+    info->kstack_avg_cycles = kstack.allocs ? cycles / kstack.allocs : 0;
+    info->kstack_order2_unavailable = kstack.order2_unavailable;
+    info->oom_kills = OomKiller::kill_count();
+
+    auto swap = SwapManager::stats();
+    info->swap_total = swap.total_slots;
+    info->swap_used = swap.used_slots;
+    info->swap_outs = swap.swap_outs;
+    info->swap_ins = swap.swap_ins;
+    info->swap_readahead = swap.readahead;
+    info->swap_readahead_hits = swap.readahead_hits;
+    return 0;
+}
+
+struct ProcStatQuery {
+    uint32_t index;
+    ProcStat* stat;
+    bool found;
+};
+
+static void fillProcStat(Context* ctx, void* arg)
+{
+    auto query = static_cast<ProcStatQuery*>(arg);
+    if(query->found || query->index-- > 0) {
+        return;
+    }
+    auto stat = query->stat;
+    stat->pid = ctx->context_id;
+    stat->total_vm = ctx->user_mm.total_vm_pages();
+    stat->rss_anon = ctx->user_mm.rss_anon_pages();
+    stat->rss_file = ctx->user_mm.rss_file_pages();
+    stat->name[0] = '\0';
+    if(!kernel::list_empty(&ctx->tasks)) {
+        auto task = list_entry(ctx->tasks.next, Task, ctx_node);
+        strncpy(stat->name, task->name, sizeof(stat->name) - 1);
+        stat->name[sizeof(stat->name) - 1] = '\0';
+    }
+    query->found = true;
+}
+
+int procstatHandler(uint32_t index, uint32_t stat_ptr, uint32_t, uint32_t)
+{
+    auto stat = reinterpret_cast<ProcStat*>(stat_ptr);
+    if(!stat) {
+        return -1;
+    }
+    // 先拷贝到内核栈上，持有进程表锁时不访问用户内存，避免缺页
+    ProcStat tmp = {};
+    ProcStatQuery query = {index, &tmp, false};
+    ProcessManager::for_each_context(fillProcStat, &query);
+    if(!query.found) {
+        return -1;
+    }
+    memcpy(stat, &tmp, sizeof(tmp));
+    return 0;
+}
+
+int niceHandler(uint32_t inc, uint32_t, uint32_t, uint32_t)
+{
+    auto& scheduler = Kernel::instance().scheduler();
+    int nice = kernel::prio_to_nice(scheduler.get_current_task()->priority);
+    return scheduler.set_current_nice(nice + (int32_t)inc);
+}
+
+int schedstatHandler(uint32_t cpu, uint32_t stat_ptr, uint32_t, uint32_t)
+{
+    auto stat = reinterpret_cast<SchedStat*>(stat_ptr);
+    kernel::RunQueue::Stats rq_stats;
+    uint32_t nr_running;
+    if(!stat || !Kernel::instance().scheduler().cpu_stats(cpu, rq_stats, nr_running)) {
+        return -1;
+    }
+    stat->nr_running = nr_running;
+    stat->nr_switches = rq_stats.nr_switches;
+    stat->migrations_in = rq_stats.migrations_in;
+    stat->migrations_out = rq_stats.migrations_out;
+    stat->idle_pulls = rq_stats.idle_pulls;
+    stat->periodic_pulls = rq_stats.periodic_pulls;
+    stat->hot_skipped = rq_stats.hot_skipped;
+    stat->idle_ticks = rq_stats.idle_ticks;
+    stat->busy_ticks = rq_stats.busy_ticks;
+    stat->resched_ipis = rq_stats.resched_ipis;
+    stat->ipis_coalesced = rq_stats.ipis_coalesced;
+    Tick::Stats tick_stats;
+    Tick::cpu_stats(cpu, tick_stats);
+    stat->nohz_entries = tick_stats.nohz_entries;
+    stat->nohz_ticks = tick_stats.nohz_ticks;
+    arch::FpuStats fpu_stats;
+    arch::fpu_cpu_stats(cpu, fpu_stats);
+    stat->fpu_traps = fpu_stats.traps;
+    stat->fpu_saves = fpu_stats.saves;
+    stat->fpu_lazy_hits = fpu_stats.lazy_hits;
+    ProcessManager::SwitchStats switch_stats;
+    ProcessManager::switch_stats(cpu, switch_stats);
+    stat->cr3_loads = switch_stats.cr3_loads;
+    stat->cr3_skips = switch_stats.cr3_skips;
+    stat->lazy_tlb = switch_stats.lazy_tlb;
+    stat->rt_pushes = rq_stats.rt_pushes;
+    stat->rt_pulls = rq_stats.rt_pulls;
+    return 0;
+}
+
+struct TaskQuery {
+    uint32_t task_id;
+    Task* task;
+};
+
+static void findTask(Context* ctx, void* arg)
+{
+    auto query = static_cast<TaskQuery*>(arg);
+    for(auto entry = ctx->tasks.next; entry != &ctx->tasks; entry = entry->next) {
+        auto task = list_entry(entry, Task, ctx_node);
+        if(task->task_id == query->task_id) {
+            query->task = task;
+            return;
+        }
+    }
+}
+
+// pid为0时是当前任务。任务没有引用计数，调用方要在任务退出前用完
+static Task* lookupTask(uint32_t pid)
+{
+    if(pid == 0) {
+        return Kernel::instance().scheduler().get_current_task();
+    }
+    TaskQuery query = {pid, nullptr};
+    ProcessManager::for_each_context(findTask, &query);
+    return query.task;
+}
+
+int schedSetaffinityHandler(uint32_t pid, uint32_t mask, uint32_t, uint32_t)
+{
+    Task* task = lookupTask(pid);
+    if(!task || !Kernel::instance().scheduler().set_affinity(task, mask)) {
+        return -1;
+    }
+    return 0;
+}
+
+int schedGetaffinityHandler(uint32_t pid, uint32_t mask_ptr, uint32_t, uint32_t)
+{
+    auto mask = reinterpret_cast<uint32_t*>(mask_ptr);
+    Task* task = lookupTask(pid);
+    if(!mask || !task) {
+        return -1;
+    }
+    *mask = Kernel::instance().scheduler().allowed_cpus(task);
+    return 0;
+}
+
+int schedSetschedulerHandler(uint32_t pid, uint32_t policy, uint32_t prio, uint32_t)
+{
+    Task* task = lookupTask(pid);
+    if(!task || !Kernel::instance().scheduler().set_scheduler(task, policy, prio)) {
+        return -1;
+    }
+    return 0;
+}
+
+int schedGetschedulerHandler(uint32_t pid, uint32_t prio_ptr, uint32_t, uint32_t)
+{
+    Task* task = lookupTask(pid);
+    if(!task) {
+        return -1;
+    }
+    if(prio_ptr) {
+        *reinterpret_cast<uint32_t*>(prio_ptr) = task->rt.prio;
+    }
+    return task->rt.policy;
+}
+
+int taskgroupCreateHandler(uint32_t name_ptr, uint32_t, uint32_t, uint32_t)
+{
+    return kernel::task_group_create(reinterpret_cast<const char*>(name_ptr));
+}
+
+int taskgroupSetHandler(uint32_t id, uint32_t quota_us, uint32_t period_us, uint32_t mem_limit_kb)
+{
+    kernel::TaskGroup* tg = kernel::task_group_get(id);
+    if(!tg || !kernel::task_group_set_limits(tg, (uint64_t)quota_us * 1000,
+                  (uint64_t)period_us * 1000, (mem_limit_kb + 3) / 4)) {
+        return -1;
+    }
+    return 0;
+}
+
+int taskgroupAttachHandler(uint32_t id, uint32_t pid, uint32_t, uint32_t)
+{
+    kernel::TaskGroup* tg = kernel::task_group_get(id);
+    Task* task = lookupTask(pid);
+    if(!task || (id && !tg)) {
+        return -1;
+    }
+    kernel::task_group_attach(task, tg);
+    return 0;
+}
+
+int taskgroupStatHandler(uint32_t id, uint32_t stat_ptr, uint32_t, uint32_t)
+{
+    auto stat = reinterpret_cast<TaskGroupStat*>(stat_ptr);
+    kernel::TaskGroup* tg = kernel::task_group_get(id);
+    if(!stat || !tg) {
+        return -1;
+    }
+    uint32_t flags;
+    tg->lock.acquire_irqsave(flags);
+    const kernel::CpuBandwidth& bw = tg->bandwidth;
+    // 正在限流的这一段也算上
+    uint64_t throttled_ns = tg->throttled_ns;
+    if(bw.throttled) {
+        throttled_ns += kernel::ktime_get() - tg->throttled_at;
+    }
+    strncpy(stat->name, tg->name, sizeof(stat->name));
+    stat->quota_us = (uint32_t)(bw.quota_ns / 1000);
+    stat->period_us = (uint32_t)(bw.period_ns / 1000);
+    stat->usage_ms = (uint32_t)(bw.usage_ns / 1000000);
+    stat->throttled_ms = (uint32_t)(throttled_ns / 1000000);
+    stat->nr_periods = bw.nr_periods;
+    stat->nr_throttled = bw.nr_throttled;
+    tg->lock.release_irqrestore(flags);
+    stat->nr_tasks = tg->nr_tasks;
+    stat->mem_limit_pages = tg->mem_limit;
+    stat->mem_usage_pages = tg->mem_usage;
+    stat->mem_max_pages = tg->mem_max_usage;
+    stat->mem_failcnt = tg->mem_failcnt;
+    return 0;
+}
+
 int nanosleepHandler(uint32_t req_ptr, uint32_t rem_ptr, uint32_t, uint32_t)
 {
     // 将用户空间指针转换为内核可访问的指针
     timespec* req = reinterpret_cast<timespec*>(req_ptr);
+    if(!req || req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000) {
+        return -1;
+    }
+    uint64_t total_ns = (uint64_t)(uint32_t)req->tv_sec * 1000000000ULL + (uint32_t)req->tv_nsec;
 
-    // 计算总纳秒数（简单实现，不考虑溢出）
-    uint64_t total_ns = req->tv_sec * 1000000000ULL + req->tv_nsec;
+    // 不会被信号打断，剩余时间总是0
+    timespec* rem = reinterpret_cast<timespec*>(rem_ptr);
+    if(rem) {
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
+    }
 
-    // 转换为时钟滴答数（假设1 tick=10ms）
-    uint32_t ticks = total_ns >> 24;
+    // 用高精度定时器睡眠，醒来以后返回
+    ProcessManager::sleep_current_ns(total_ns);
+    return 0;
+}
 
-    // 挂起当前进程
-    ProcessManager::sleep_current_process(ticks);
+int clockGettimeHandler(uint32_t clock_id, uint32_t ts_ptr, uint32_t, uint32_t)
+{
+    timespec* ts = reinterpret_cast<timespec*>(ts_ptr);
+    if(clock_id != CLOCK_MONOTONIC || !ts) {
+        return -1;
+    }
+    uint32_t nsec;
+    uint64_t sec = arch::div_u64_rem(kernel::ktime_get(), 1000000000, &nsec);
+    ts->tv_sec = (decltype(ts->tv_sec))sec;
+    ts->tv_nsec = nsec;
+    return 0;
+}
 
-    return 0; // 返回成功
+int loglevelHandler(uint32_t name_ptr, uint32_t level, uint32_t, uint32_t)
+{
+    auto name = reinterpret_cast<const char*>(name_ptr);
+    bool global = !name || !name[0];
+    if((int)level == LOGLEVEL_GET) {
+        return global ? current_log_level : get_log_level(name);
+    }
+    if(global) {
+        if(level > LOG_TRACE) {
+            return -1;
+        }
+        set_log_level((LogLevel)level);
+        return 0;
+    }
+    if((int)level < LOGLEVEL_RESET) {
+        return -1;
+    }
+    return set_log_level(name, (int)level) ? 0 : -1;
 }
 
 // 静态成员初始化
@@ -195,6 +553,26 @@ void SyscallManager::init()
     registerHandler(SYS_LOG, logHandler);
     registerHandler(SYS_CHDIR, chdirHandler);
     registerHandler(SYS_MMAP, mmapHandler);
+    registerHandler(SYS_MSYNC, msyncHandler);
+    registerHandler(SYS_SHM_OPEN, shmOpenHandler);
+    registerHandler(SYS_SHM_MAP, shmMapHandler);
+    registerHandler(SYS_SHM_UNMAP, shmUnmapHandler);
+    registerHandler(SYS_SHM_UNLINK, shmUnlinkHandler);
+    registerHandler(SYS_MEMINFO, meminfoHandler);
+    registerHandler(SYS_PROCSTAT, procstatHandler);
+    registerHandler(SYS_NICE, niceHandler);
+    registerHandler(SYS_SCHEDSTAT, schedstatHandler);
+    registerHandler(SYS_SCHED_SETAFFINITY, schedSetaffinityHandler);
+    registerHandler(SYS_SCHED_GETAFFINITY, schedGetaffinityHandler);
+    registerHandler(SYS_CLOCK_GETTIME, clockGettimeHandler);
+    registerHandler(SYS_DEBUG, debugHandler);
+    registerHandler(SYS_SCHED_SETSCHEDULER, schedSetschedulerHandler);
+    registerHandler(SYS_SCHED_GETSCHEDULER, schedGetschedulerHandler);
+    registerHandler(SYS_TASKGROUP_CREATE, taskgroupCreateHandler);
+    registerHandler(SYS_TASKGROUP_SET, taskgroupSetHandler);
+    registerHandler(SYS_TASKGROUP_ATTACH, taskgroupAttachHandler);
+    registerHandler(SYS_TASKGROUP_STAT, taskgroupStatHandler);
+    registerHandler(SYS_LOGLEVEL, loglevelHandler);
 
     Console::print("SyscallManager initialized\n");
 }
@@ -284,7 +662,7 @@ int sys_execve(uint32_t path_ptr, uint32_t argv_ptr, uint32_t envp_ptr, Task* ta
     log_debug("File allocated at %x\n", filep);
     uint32_t num_pages = (attr->size + PAGE_SIZE - 1) / PAGE_SIZE;
     for(uint32_t i = 0; i < num_pages; i++) {
-        auto phys_addr = Kernel::instance().kernel_mm().alloc_pages(0, 0); // 每次分配一页
+        auto phys_addr = Kernel::instance().kernel_mm().alloc_pages(GFP_HIGHUSER, 0); // 每次分配一页
         task->context->user_mm.map_pages((uint32_t)filep + i * PAGE_SIZE, phys_addr, PAGE_SIZE,
             PAGE_USER | PAGE_WRITE | PAGE_PRESENT);
     }
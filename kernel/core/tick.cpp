@@ -0,0 +1,191 @@
+#include "kernel/tick.h"
+
+#include <arch/x86/apic.h>
+#include <arch/x86/percpu.h>
+#include <arch/x86/smp.h>
+#include <arch/x86/tsc.h>
+#include <kernel/boot_options.h>
+#include <kernel/kernel.h>
+#include <kernel/rcu.h>
+#include <kernel/timer.h>
+#include <lib/debug.h>
+
+bool Tick::initialized = false;
+bool Tick::nohz_enabled = true;
+bool Tick::highres_enabled = true;
+uint32_t Tick::tick_cycles;
+Tick::CpuState Tick::cpu_state[MAX_CPUS];
+
+void Tick::init()
+{
+    arch::tsc_calibrate();
+    kernel::timers_init();
+    tick_cycles = arch::tsc_khz() * (1000 / HZ);
+    highres_enabled = !BootOptions::is_off("highres");
+    nohz_enabled = !BootOptions::is_off("nohz");
+    // 一次性模式靠TSC换算时间，停掉tick又依赖一次性模式
+    if(!tick_cycles) {
+        highres_enabled = false;
+    }
+    if(!highres_enabled) {
+        nohz_enabled = false;
+    }
+    initialized = true;
+    log_info("clock event %s, tickless idle %s\n",
+        !highres_enabled ? "periodic" : arch::apic_timer_has_tsc_deadline() ? "tsc-deadline" : "one-shot",
+        nohz_enabled ? "on" : "off");
+}
+
+void Tick::idle()
+{
+    // 关中断检查和编程定时器，检查之后来的中断要能把hlt唤醒
+    asm volatile("cli");
+    auto& state = cpu_state[arch::get_cpu_id()];
+    // 还有等宽限期的RCU回调时要靠tick推进，不能停
+    if(nohz_enabled && state.mode == MODE_ONESHOT && !kernel::rcu_needs_cpu()
+        && Kernel::instance().scheduler().nohz_idle_enter()) {
+        // 下一个tick是jiffies + 1，最早的timer_list在第nr_ticks个tick到期，中间的tick都可以跳过
+        uint32_t nr_ticks = kernel::timer_next_expiry(NOHZ_MAX_IDLE_TICKS) - kernel::jiffies();
+        if(nr_ticks > 1) {
+            state.stop_until = state.next_tick + (uint64_t)(nr_ticks - 1) * tick_cycles;
+            state.stopped = true;
+            state.stats.nohz_entries++;
+            kernel::rcu_idle_enter();
+            program_next(state, arch::rdtsc());
+        }
+    }
+    // sti之后的一条指令执行完才响应中断，中断不会落在sti和hlt之间
+    asm volatile("sti; hlt");
+    // 被时钟以外的中断唤醒时tick还停着，补上经过的tick，再按正常的tick编程
+    asm volatile("cli");
+    nohz_exit();
+    asm volatile("sti");
+}
+
+void Tick::nohz_exit()
+{
+    auto& state = cpu_state[arch::get_cpu_id()];
+    if(state.stopped) {
+        uint64_t now = arch::rdtsc();
+        account_ticks(state, now);
+        program_next(state, now);
+    }
+}
+
+bool Tick::timer_interrupt()
+{
+    // 启动过程中还没有初始化定时器
+    if(!initialized) {
+        Kernel::instance().tick();
+        return true;
+    }
+    auto& state = cpu_state[arch::get_cpu_id()];
+    uint64_t now = arch::rdtsc();
+    if(state.mode == MODE_PERIODIC) {
+        periodic_tick(state, now);
+        return true;
+    }
+    bool ticked = account_ticks(state, now) > 0;
+    kernel::hrtimer_run_queues(now);
+    program_next(state, arch::rdtsc());
+    return ticked;
+}
+
+void Tick::periodic_tick(CpuState& state, uint64_t now)
+{
+    update_global_ticks(now);
+    kernel::run_timers(1);
+    kernel::hrtimer_run_queues(now);
+    if(!highres_enabled) {
+        return;
+    }
+    if(state.calibrate_ticks == 0) {
+        state.calibrate_tsc = now;
+    }
+    if(state.calibrate_ticks++ < CALIBRATE_TICKS) {
+        return;
+    }
+    // 第一次计数到现在正好经过CALIBRATE_TICKS个周期，得到APIC定时器计数和TSC的比例
+    state.apic_count = arch::apic_timer_period();
+    state.apic_tsc = (uint32_t)arch::div_u64(now - state.calibrate_tsc, CALIBRATE_TICKS);
+    if(!state.apic_count || !state.apic_tsc) {
+        return;
+    }
+    state.mode = MODE_ONESHOT;
+    state.next_tick = now + tick_cycles;
+    program_next(state, now);
+}
+
+uint32_t Tick::account_ticks(CpuState& state, uint64_t now)
+{
+    bool stopped = state.stopped;
+    if(stopped) {
+        state.stopped = false;
+        Kernel::instance().scheduler().nohz_idle_exit();
+        kernel::rcu_idle_exit();
+    }
+    if((int64_t)(now - state.next_tick) < 0) {
+        return 0;
+    }
+    uint32_t ticks = 1 + (uint32_t)arch::div_u64(now - state.next_tick, tick_cycles);
+    state.next_tick += (uint64_t)ticks * tick_cycles;
+    // 这次算一个tick，之前的都是停掉期间少处理的
+    if(stopped) {
+        state.stats.nohz_ticks += ticks - 1;
+    }
+    update_global_ticks(now);
+    kernel::run_timers(ticks);
+    return ticks;
+}
+
+void Tick::update_global_ticks(uint64_t now)
+{
+    // 各CPU的tick时间不同，共用的tick数按启动以来的TSC周期数算，先到新tick的CPU更新。
+    // 没有测出TSC频率时只由BSP计数
+    if(tick_cycles) {
+        Kernel::instance().update_ticks(arch::div_u64(now - arch::tsc_from_boot_ns(0), tick_cycles));
+    } else if(arch::get_cpu_id() == 0) {
+        Kernel::instance().tick();
+    }
+}
+
+void Tick::program_next(CpuState& state, uint64_t now)
+{
+    uint64_t next = state.stopped ? state.stop_until : state.next_tick;
+    uint64_t hrtimer_expires;
+    if(kernel::hrtimer_next_event(hrtimer_expires) && (int64_t)(hrtimer_expires - next) < 0) {
+        next = hrtimer_expires;
+    }
+    if(arch::apic_timer_has_tsc_deadline()) {
+        // deadline已经过了会立刻触发
+        arch::apic_timer_set_deadline(next);
+        return;
+    }
+    // 最多停NOHZ_MAX_IDLE_TICKS个tick，delta * apic_count不会溢出
+    uint32_t count = 1;
+    int64_t delta = (int64_t)(next - now);
+    if(delta > 0) {
+        uint64_t cycles = arch::div_u64((uint64_t)delta * state.apic_count, state.apic_tsc);
+        count = cycles > 0xFFFFFFFFull ? 0xFFFFFFFF : cycles ? (uint32_t)cycles : 1;
+    }
+    arch::apic_timer_set_oneshot(count);
+}
+
+void Tick::reprogram()
+{
+    if(!initialized) {
+        return;
+    }
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    auto& state = cpu_state[arch::get_cpu_id()];
+    if(state.mode == MODE_ONESHOT) {
+        program_next(state, arch::rdtsc());
+    }
+    asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+void Tick::cpu_stats(uint32_t cpu, Stats& stats)
+{
+    stats = cpu_state[cpu].stats;
+}
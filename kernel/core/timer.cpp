@@ -0,0 +1,285 @@
+#include "kernel/timer.h"
+
+#include <arch/x86/apic.h>
+#include <arch/x86/percpu.h>
+#include <arch/x86/smp.h>
+#include <arch/x86/spinlock.h>
+#include <arch/x86/tsc.h>
+#include <kernel/tick.h>
+#include <lib/debug.h>
+
+namespace kernel {
+
+static DEFINE_LOCK_CLASS(timer_lock_class, "timer");
+static DEFINE_LOCK_CLASS(hrtimer_lock_class, "hrtimer");
+
+struct TimerBase {
+    SpinLock lock{&timer_lock_class};
+    TimerWheel wheel;
+    uint32_t jiffies;
+    timer_list* running; // 正在执行回调的定时器
+};
+
+struct HrtimerBase {
+    SpinLock lock{&hrtimer_lock_class};
+    HrtimerQueue queue;
+    hrtimer* running;
+};
+
+static TimerBase* timer_bases[MAX_CPUS];
+static HrtimerBase* hrtimer_bases[MAX_CPUS];
+
+static inline TimerBase* this_timer_base() { return timer_bases[arch::get_cpu_id()]; }
+static inline HrtimerBase* this_hrtimer_base() { return hrtimer_bases[arch::get_cpu_id()]; }
+
+void timers_init()
+{
+    for(uint32_t cpu = 0; cpu < arch::apic_get_cpu_count(); cpu++) {
+        auto base = new TimerBase();
+        base->jiffies = 0;
+        base->running = nullptr;
+        // 时间轮下一个要处理的是jiffies + 1
+        base->wheel.init(1);
+        timer_bases[cpu] = base;
+
+        auto hrbase = new HrtimerBase();
+        hrbase->running = nullptr;
+        hrbase->queue.init();
+        hrtimer_bases[cpu] = hrbase;
+    }
+}
+
+uint32_t jiffies()
+{
+    return this_timer_base()->jiffies;
+}
+
+void timer_setup(timer_list* timer, void (*function)(timer_list*))
+{
+    INIT_LIST_HEAD(&timer->entry);
+    timer->expires = 0;
+    timer->function = function;
+    timer->base = nullptr;
+}
+
+// 锁住定时器所在的基，加锁期间定时器可能被移到别的CPU，所以加锁后再检查一次
+template<typename Timer, typename Base>
+static Base* lock_base(Timer* timer, uint32_t& flags)
+{
+    while(true) {
+        Base* base = __atomic_load_n(&timer->base, __ATOMIC_ACQUIRE);
+        if(!base) {
+            return nullptr;
+        }
+        base->lock.acquire_irqsave(flags);
+        if(timer->base == base) {
+            return base;
+        }
+        base->lock.release_irqrestore(flags);
+    }
+}
+
+bool mod_timer(timer_list* timer, uint32_t expires)
+{
+    uint32_t flags;
+    bool pending = false;
+    TimerBase* new_base = this_timer_base();
+    TimerBase* base = lock_base<timer_list, TimerBase>(timer, flags);
+    if(base) {
+        if(timer_pending(timer)) {
+            base->wheel.del(timer);
+            pending = true;
+        }
+        // 回调正在原来的CPU上执行时留在原来的CPU，del_timer_sync才能等到它
+        if(base != new_base && base->running != timer) {
+            __atomic_store_n(&timer->base, new_base, __ATOMIC_RELEASE);
+            base->lock.release();
+            new_base->lock.acquire();
+        } else {
+            new_base = base;
+        }
+    } else {
+        new_base->lock.acquire_irqsave(flags);
+        __atomic_store_n(&timer->base, new_base, __ATOMIC_RELEASE);
+    }
+    timer->expires = expires;
+    new_base->wheel.add(timer);
+    new_base->lock.release_irqrestore(flags);
+    return pending;
+}
+
+void add_timer(timer_list* timer)
+{
+    mod_timer(timer, timer->expires);
+}
+
+bool del_timer(timer_list* timer)
+{
+    uint32_t flags;
+    TimerBase* base = lock_base<timer_list, TimerBase>(timer, flags);
+    if(!base) {
+        return false;
+    }
+    bool pending = timer_pending(timer);
+    if(pending) {
+        base->wheel.del(timer);
+    }
+    base->lock.release_irqrestore(flags);
+    return pending;
+}
+
+bool del_timer_sync(timer_list* timer)
+{
+    bool pending = del_timer(timer);
+    TimerBase* base = __atomic_load_n(&timer->base, __ATOMIC_ACQUIRE);
+    while(base && __atomic_load_n(&base->running, __ATOMIC_ACQUIRE) == timer) {
+        asm volatile("pause");
+    }
+    return pending;
+}
+
+uint32_t timer_next_expiry(uint32_t limit)
+{
+    TimerBase* base = this_timer_base();
+    uint32_t flags;
+    base->lock.acquire_irqsave(flags);
+    uint32_t next = base->wheel.next_expiry(limit);
+    base->lock.release_irqrestore(flags);
+    return next;
+}
+
+void run_timers(uint32_t nr_ticks)
+{
+    TimerBase* base = this_timer_base();
+    uint32_t flags;
+    base->lock.acquire_irqsave(flags);
+    base->jiffies += nr_ticks;
+    list_head expired;
+    INIT_LIST_HEAD(&expired);
+    base->wheel.advance(base->jiffies, &expired);
+    // 摘下来的定时器在expired链表上仍然算在等待，del_timer可以把它取消
+    while(!list_empty(&expired)) {
+        auto timer = list_entry(expired.next, timer_list, entry);
+        list_del_init(&timer->entry);
+        base->running = timer;
+        base->lock.release();
+        timer->function(timer);
+        base->lock.acquire();
+        base->running = nullptr;
+    }
+    base->lock.release_irqrestore(flags);
+}
+
+uint64_t ktime_get()
+{
+    return arch::tsc_boot_ns();
+}
+
+void hrtimer_init(hrtimer* timer, enum hrtimer_restart (*function)(hrtimer*))
+{
+    timer->expires = 0;
+    timer->function = function;
+    timer->base = nullptr;
+    timer->queued = false;
+}
+
+void hrtimer_start(hrtimer* timer, uint64_t ns, uint32_t mode)
+{
+    uint64_t expires = mode == HRTIMER_MODE_REL ? arch::rdtsc() + arch::tsc_ns_to_cycles(ns)
+                                                : arch::tsc_from_boot_ns(ns);
+    uint32_t flags;
+    HrtimerBase* new_base = this_hrtimer_base();
+    HrtimerBase* base = lock_base<hrtimer, HrtimerBase>(timer, flags);
+    if(base) {
+        if(timer->queued) {
+            base->queue.remove(timer);
+        }
+        if(base != new_base && base->running != timer) {
+            __atomic_store_n(&timer->base, new_base, __ATOMIC_RELEASE);
+            base->lock.release();
+            new_base->lock.acquire();
+        } else {
+            new_base = base;
+        }
+    } else {
+        new_base->lock.acquire_irqsave(flags);
+        __atomic_store_n(&timer->base, new_base, __ATOMIC_RELEASE);
+    }
+    timer->expires = expires;
+    bool first = new_base->queue.enqueue(timer);
+    new_base->lock.release_irqrestore(flags);
+    // 成为本CPU最早的定时器，时钟事件要提前
+    if(first && new_base == this_hrtimer_base()) {
+        Tick::reprogram();
+    }
+}
+
+void hrtimer_forward_ns(hrtimer* timer, uint64_t ns)
+{
+    timer->expires += arch::tsc_ns_to_cycles(ns);
+}
+
+int hrtimer_try_to_cancel(hrtimer* timer)
+{
+    uint32_t flags;
+    HrtimerBase* base = lock_base<hrtimer, HrtimerBase>(timer, flags);
+    if(!base) {
+        return 0;
+    }
+    int ret = 0;
+    if(base->running == timer) {
+        ret = -1;
+    } else if(timer->queued) {
+        base->queue.remove(timer);
+        ret = 1;
+    }
+    base->lock.release_irqrestore(flags);
+    return ret;
+}
+
+bool hrtimer_cancel(hrtimer* timer)
+{
+    while(true) {
+        int ret = hrtimer_try_to_cancel(timer);
+        if(ret >= 0) {
+            return ret;
+        }
+        asm volatile("pause");
+    }
+}
+
+void hrtimer_run_queues(uint64_t now)
+{
+    HrtimerBase* base = this_hrtimer_base();
+    uint32_t flags;
+    base->lock.acquire_irqsave(flags);
+    hrtimer* timer;
+    while((timer = base->queue.first()) && (int64_t)(timer->expires - now) <= 0) {
+        base->queue.remove(timer);
+        base->running = timer;
+        base->lock.release();
+        enum hrtimer_restart restart = timer->function(timer);
+        base->lock.acquire();
+        base->running = nullptr;
+        // 回调里可能已经重新启动了定时器
+        if(restart == HRTIMER_RESTART && !timer->queued && timer->base == base) {
+            base->queue.enqueue(timer);
+        }
+    }
+    base->lock.release_irqrestore(flags);
+}
+
+bool hrtimer_next_event(uint64_t& expires)
+{
+    HrtimerBase* base = this_hrtimer_base();
+    uint32_t flags;
+    base->lock.acquire_irqsave(flags);
+    hrtimer* first = base->queue.first();
+    if(first) {
+        expires = first->expires;
+    }
+    base->lock.release_irqrestore(flags);
+    return first != nullptr;
+}
+
+} // namespace kernel
@@ -0,0 +1,155 @@
+#include "kernel/timer.h"
+
+namespace kernel {
+
+static constexpr uint32_t TVR_MASK = TVR_SIZE - 1;
+static constexpr uint32_t TVN_MASK = TVN_SIZE - 1;
+
+// 第level层(0是第一层之后的那层)的槽号
+static inline uint32_t tvn_index(uint32_t expires, uint32_t level)
+{
+    return (expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+}
+
+void TimerWheel::init(uint32_t now)
+{
+    clk = now;
+    for(uint32_t i = 0; i < TVR_SIZE; i++) {
+        INIT_LIST_HEAD(&tv1[i]);
+    }
+    for(uint32_t level = 0; level < TVN_LEVELS; level++) {
+        for(uint32_t i = 0; i < TVN_SIZE; i++) {
+            INIT_LIST_HEAD(&tvn[level][i]);
+        }
+    }
+}
+
+void TimerWheel::internal_add(timer_list* timer)
+{
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - clk;
+    list_head* vec;
+    if((int32_t)delta < 0) {
+        // 已经过期，下一次转动时执行
+        vec = &tv1[clk & TVR_MASK];
+    } else if(delta < TVR_SIZE) {
+        vec = &tv1[expires & TVR_MASK];
+    } else {
+        uint32_t level = 0;
+        while(level < TVN_LEVELS - 1 && delta >= (1u << (TVR_BITS + (level + 1) * TVN_BITS))) {
+            level++;
+        }
+        vec = &tvn[level][tvn_index(expires, level)];
+    }
+    list_add_tail(&timer->entry, vec);
+}
+
+void TimerWheel::add(timer_list* timer)
+{
+    internal_add(timer);
+}
+
+void TimerWheel::del(timer_list* timer)
+{
+    list_del_init(&timer->entry);
+}
+
+uint32_t TimerWheel::cascade(uint32_t level, uint32_t index)
+{
+    list_head* head = &tvn[level][index];
+    // 先整体摘下来，重新加入时可能又落回同一层的其他槽
+    list_head pending;
+    INIT_LIST_HEAD(&pending);
+    if(!list_empty(head)) {
+        pending.next = head->next;
+        pending.prev = head->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        INIT_LIST_HEAD(head);
+    }
+    while(!list_empty(&pending)) {
+        auto timer = list_entry(pending.next, timer_list, entry);
+        list_del_init(&timer->entry);
+        internal_add(timer);
+    }
+    return index;
+}
+
+void TimerWheel::advance(uint32_t now, list_head* expired)
+{
+    while((int32_t)(now - clk) >= 0) {
+        uint32_t index = clk & TVR_MASK;
+        // 第一层转完一圈，从下一层取一个槽下来，那一层也转完一圈时继续往上
+        if(!index) {
+            for(uint32_t level = 0; level < TVN_LEVELS; level++) {
+                if(cascade(level, tvn_index(clk, level))) {
+                    break;
+                }
+            }
+        }
+        list_head* head = &tv1[index];
+        while(!list_empty(head)) {
+            list_head* entry = head->next;
+            list_del_init(entry);
+            list_add_tail(entry, expired);
+        }
+        clk++;
+    }
+}
+
+uint32_t TimerWheel::next_expiry(uint32_t limit) const
+{
+    uint32_t index = clk & TVR_MASK;
+    // 下一次cascade之前只有第一层的定时器会到期
+    uint32_t span = TVR_SIZE - index;
+    if(span > limit) {
+        span = limit;
+    }
+    for(uint32_t i = 0; i < span; i++) {
+        if(!list_empty(&tv1[index + i])) {
+            return clk + i;
+        }
+    }
+    return clk + span;
+}
+
+void HrtimerQueue::init()
+{
+    RB_INIT_ROOT(&active);
+}
+
+bool HrtimerQueue::enqueue(hrtimer* timer)
+{
+    struct rb_node** link = &active.root.node;
+    struct rb_node* parent = nullptr;
+    bool leftmost = true;
+    while(*link) {
+        parent = *link;
+        auto entry = rb_entry(parent, hrtimer, node);
+        // 到期时间相同的按加入顺序执行
+        if((int64_t)(timer->expires - entry->expires) < 0) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    rb_link_node(&timer->node, parent, link);
+    rb_insert_color_cached(&timer->node, &active, leftmost);
+    timer->queued = true;
+    return leftmost;
+}
+
+void HrtimerQueue::remove(hrtimer* timer)
+{
+    rb_erase_cached(&timer->node, &active);
+    timer->queued = false;
+}
+
+hrtimer* HrtimerQueue::first() const
+{
+    struct rb_node* left = rb_first_cached(&active);
+    return left ? rb_entry(left, hrtimer, node) : nullptr;
+}
+
+} // namespace kernel
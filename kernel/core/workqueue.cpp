@@ -0,0 +1,220 @@
+#include "kernel/workqueue.h"
+
+#include <arch/x86/percpu.h>
+#include <arch/x86/smp.h>
+#include <kernel/kthread.h>
+#include <kernel/process.h>
+#include <kernel/wait.h>
+#include <lib/debug.h>
+
+namespace kernel {
+
+// 一个CPU的工作队列和执行它的kworker
+struct WorkerPool {
+    WaitQueue wq;               // wq.lock保护works和queued_seq，kworker没有工作时阻塞在上面
+    struct list_head works;
+    Task* worker;               // 为nullptr表示这个CPU没有工作队列
+    uint32_t queued_seq;        // 最近一次排队的序号
+    volatile uint32_t done_seq; // 执行完的最大序号，工作按排队顺序执行
+    WaitQueue flush_wq;         // flush_work的等待方
+    WorkqueueStats stats;
+};
+
+// 全零的队列可以直接使用，works在workqueue_init里初始化
+DEFINE_PER_CPU(WorkerPool, worker_pool);
+
+static WorkerPool* get_pool(uint32_t cpu)
+{
+    if(cpu >= MAX_CPUS) {
+        return nullptr;
+    }
+    WorkerPool* pool = &per_cpu(worker_pool, cpu);
+    return __atomic_load_n(&pool->worker, __ATOMIC_ACQUIRE) ? pool : nullptr;
+}
+
+// 工作已经标记为pending，挂到pool上并唤醒kworker
+static void insert_work(WorkerPool* pool, work_struct* work)
+{
+    uint32_t flags;
+    pool->wq.lock.acquire_irqsave(flags);
+    work->pool = pool;
+    work->seq = ++pool->queued_seq;
+    list_add_tail(&work->entry, &pool->works);
+    pool->stats.queued++;
+    WaitEntry* idle = pool->wq.first();
+    if(idle) {
+        pool->wq.wake(idle, 0);
+    }
+    pool->wq.lock.release_irqrestore(flags);
+}
+
+static int worker_thread(void* arg)
+{
+    auto pool = static_cast<WorkerPool*>(arg);
+    uint32_t flags;
+    while(true) {
+        // block要求切走之前不被本CPU的中断打断，先关中断再加锁，block返回时仍然关着
+        asm volatile("cli");
+        pool->wq.lock.acquire_irqsave(flags);
+        if(list_empty(&pool->works)) {
+            pool->wq.block(flags);
+            asm volatile("sti");
+            continue;
+        }
+        work_struct* work = list_entry(pool->works.next, work_struct, entry);
+        list_del_init(&work->entry);
+        uint32_t seq = work->seq;
+        // 清掉pending以后工作可以再排队，这次执行之后的修改由下一次执行处理
+        __atomic_store_n(&work->pending, false, __ATOMIC_RELEASE);
+        pool->wq.lock.release_irqrestore(flags);
+        asm volatile("sti");
+
+        work->func(work);
+
+        // 工作函数可能已经释放了work，之后只用seq
+        pool->flush_wq.lock.acquire_irqsave(flags);
+        __atomic_store_n(&pool->done_seq, seq, __ATOMIC_RELEASE);
+        pool->stats.executed++;
+        pool->flush_wq.wake_all(0);
+        pool->flush_wq.lock.release_irqrestore(flags);
+    }
+    return 0;
+}
+
+void workqueue_init()
+{
+    uint32_t count = arch::smp_get_cpu_count();
+    for(uint32_t cpu = 0; cpu < count && cpu < MAX_CPUS; cpu++) {
+        WorkerPool* pool = &per_cpu(worker_pool, cpu);
+        INIT_LIST_HEAD(&pool->works);
+        char name[16];
+        format_string(name, sizeof(name), "kworker/%d", cpu);
+        Task* worker = kthread_create(worker_thread, pool, name);
+        if(!worker) {
+            log_err("workqueue: failed to create %s\n", name);
+            continue;
+        }
+        kthread_bind(worker, cpu);
+        __atomic_store_n(&pool->worker, worker, __ATOMIC_RELEASE);
+        kthread_start(worker);
+    }
+    log_info("workqueue: %d kworkers started\n", count);
+}
+
+void init_work(work_struct* work, work_func_t func)
+{
+    INIT_LIST_HEAD(&work->entry);
+    work->func = func;
+    work->pending = false;
+    work->pool = nullptr;
+    work->seq = 0;
+}
+
+static void delayed_work_timer_fn(timer_list* timer)
+{
+    auto dwork = container_of(timer, delayed_work, timer);
+    WorkerPool* pool = get_pool(dwork->cpu);
+    if(pool) {
+        insert_work(pool, &dwork->work);
+    } else {
+        __atomic_store_n(&dwork->work.pending, false, __ATOMIC_RELEASE);
+    }
+}
+
+void init_delayed_work(delayed_work* dwork, work_func_t func)
+{
+    init_work(&dwork->work, func);
+    timer_setup(&dwork->timer, delayed_work_timer_fn);
+    dwork->cpu = 0;
+}
+
+bool queue_work_on(uint32_t cpu, work_struct* work)
+{
+    WorkerPool* pool = get_pool(cpu);
+    if(!pool || __atomic_exchange_n(&work->pending, true, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+    insert_work(pool, work);
+    return true;
+}
+
+bool queue_work(work_struct* work)
+{
+    return queue_work_on(arch::get_cpu_id(), work);
+}
+
+bool queue_delayed_work_on(uint32_t cpu, delayed_work* dwork, uint32_t delay)
+{
+    WorkerPool* pool = get_pool(cpu);
+    if(!pool || __atomic_exchange_n(&dwork->work.pending, true, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+    if(delay == 0) {
+        insert_work(pool, &dwork->work);
+        return true;
+    }
+    dwork->cpu = cpu;
+    mod_timer(&dwork->timer, jiffies() + delay);
+    return true;
+}
+
+bool queue_delayed_work(delayed_work* dwork, uint32_t delay)
+{
+    return queue_delayed_work_on(arch::get_cpu_id(), dwork, delay);
+}
+
+bool cancel_delayed_work(delayed_work* dwork)
+{
+    if(!del_timer(&dwork->timer)) {
+        return false;
+    }
+    __atomic_store_n(&dwork->work.pending, false, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool flush_work(work_struct* work)
+{
+    WorkerPool* pool = __atomic_load_n(&work->pool, __ATOMIC_ACQUIRE);
+    if(!pool) {
+        return false;
+    }
+    uint32_t irq;
+    asm volatile("pushfl; popl %0; cli" : "=r"(irq) : : "memory");
+    uint32_t flags;
+    pool->wq.lock.acquire_irqsave(flags);
+    uint32_t target = work->seq;
+    pool->wq.lock.release_irqrestore(flags);
+    while(true) {
+        pool->flush_wq.lock.acquire_irqsave(flags);
+        if((int32_t)(pool->done_seq - target) >= 0) {
+            pool->flush_wq.lock.release_irqrestore(flags);
+            break;
+        }
+        // 每执行完一个工作唤醒一次，醒来后重新检查
+        if(pool->flush_wq.block(flags) == WAIT_KILLED) {
+            break;
+        }
+    }
+    asm volatile("pushl %0; popfl" : : "r"(irq) : "memory", "cc");
+    return true;
+}
+
+bool flush_delayed_work(delayed_work* dwork)
+{
+    if(del_timer(&dwork->timer)) {
+        WorkerPool* pool = get_pool(dwork->cpu);
+        if(pool) {
+            insert_work(pool, &dwork->work);
+        } else {
+            __atomic_store_n(&dwork->work.pending, false, __ATOMIC_RELEASE);
+        }
+    }
+    return flush_work(&dwork->work);
+}
+
+void workqueue_cpu_stats(uint32_t cpu, WorkqueueStats& stats)
+{
+    stats = per_cpu(worker_pool, cpu).stats;
+}
+
+} // namespace kernel
@@ -1,13 +1,67 @@
 #include "kernel/fs/PageCache.h"
 #include <drivers/block_device.h>
 #include <kernel/fs/SimplePageCache.h>
+#include <kernel/kernel.h>
+#include <kernel/tick.h>
+#include <lib/debug.h>
 #include <lib/string.h>
 
+// 脏页最晚在第一次变脏之后一秒写回
+static constexpr uint32_t WRITEBACK_DELAY = Tick::HZ;
+// 超过max_pages时每次缺页最多检查的页数，页都被映射着淘汰不掉时缺页也不会变慢
+static constexpr size_t EVICT_SCAN = 64;
+
+SimplePageCache* SimplePageCache::caches_ = nullptr;
+SpinLock SimplePageCache::caches_lock_;
+
 SimplePageCache::SimplePageCache(kernel::BlockDevice* dev, size_t page_size, size_t max_pages)
     : dev_(dev), page_size_(page_size), max_pages_(max_pages)
 {
+    // 缓存页直接使用物理页，这样mmap可以不经拷贝把它映射到用户空间
+    if(page_size_ != PAGE_SIZE) {
+        log_err("SimplePageCache: page_size %d is not PAGE_SIZE\n", page_size_);
+    }
+    kernel::init_delayed_work(&writeback_work_.dwork, writeback_work_fn);
+    writeback_work_.cache = this;
+
+    uint32_t flags;
+    caches_lock_.acquire_irqsave(flags);
+    next_cache_ = caches_;
+    caches_ = this;
+    caches_lock_.release_irqrestore(flags);
+}
+
+// 缓存页优先从高端内存分配，把直接映射区留给内核自己的数据结构，内核访问时临时kmap
+static bool alloc_cache_page(Page& page)
+{
+    page.phys = Kernel::instance().kernel_mm().alloc_pages(GFP_HIGHUSER, 0);
+    return page.phys != 0;
+}
+
+// 页缓存持有一个引用，用户映射各持有一个，最后一个引用释放时物理页才回到伙伴系统
+static void release_cache_page(Page& page)
+{
+    if(page.phys) {
+        Kernel::instance().kernel_mm().decrement_ref_count(page.phys);
+    }
+    page.phys = 0;
+}
+SimplePageCache::~SimplePageCache()
+{
+    uint32_t flags;
+    caches_lock_.acquire_irqsave(flags);
+    for(SimplePageCache** p = &caches_; *p; p = &(*p)->next_cache_) {
+        if(*p == this) {
+            *p = next_cache_;
+            break;
+        }
+    }
+    caches_lock_.release_irqrestore(flags);
+
+    kernel::cancel_delayed_work(&writeback_work_.dwork);
+    kernel::flush_work(&writeback_work_.dwork.work);
+    clear();
 }
-SimplePageCache::~SimplePageCache() { clear(); }
 
 bool SimplePageCache::exists(const PageKey& key) const
 {
@@ -19,19 +73,29 @@ Page* SimplePageCache::get_page(const PageKey& key)
     kernel::LockGuard lock(mtx_);
     auto it = cache_.find(key);
     if (it) {
+        it->referenced = true;
         return it;
     }
 
-    // 从设备读取页面
+    // 超出上限时先淘汰干净的页；被映射着的页淘汰不掉，这时上限只是软限制
     if(cache_.size() >= max_pages_) {
-        // 淘汰策略：移除最早插入的页
-        // TODO:
-        // cache_.erase(cache_.begin());
+        evict_clean(cache_.size() - max_pages_ + 1, EVICT_SCAN);
     }
     Page page{};
     page.size = page_size_;
-    page.data = new uint8_t[page_size_];
-    dev_->read_block(key.block_id, page.data);
+    page.referenced = true;
+    if(!alloc_cache_page(page)) {
+        log_err("SimplePageCache: out of memory, block:%d\n", (uint32_t)key.block_id);
+        return nullptr;
+    }
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    void* data = kernel_mm.kmap(page.phys);
+    if(!data) {
+        release_cache_page(page);
+        return nullptr;
+    }
+    dev_->read_block(key.block_id, data);
+    kernel_mm.kunmap(data);
     page.dirty = false;
     auto ret = cache_.insert(key, page);
     return ret;
@@ -48,7 +112,13 @@ size_t SimplePageCache::read_page(
     if(offset >= page_size_)
         return 0;
     size_t n = min(size, page_size_ - offset);
-    memcpy(buf, static_cast<uint8_t*>(it->data) + offset, n);
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    void* data = kernel_mm.kmap(it->phys);
+    if(!data) {
+        return 0;
+    }
+    memcpy(buf, static_cast<uint8_t*>(data) + offset, n);
+    kernel_mm.kunmap(data);
     return n;
 }
 
@@ -63,8 +133,14 @@ size_t SimplePageCache::write_page(
     if(offset >= page_size_)
         return 0;
     size_t n = min(size, page_size_ - offset);
-    memcpy(static_cast<uint8_t*>(it->data) + offset, buf, n);
-    it->dirty = true;
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    void* data = kernel_mm.kmap(it->phys);
+    if(!data) {
+        return 0;
+    }
+    memcpy(static_cast<uint8_t*>(data) + offset, buf, n);
+    kernel_mm.kunmap(data);
+    set_dirty(key, *it);
     return n;
 }
 
@@ -73,10 +149,28 @@ void SimplePageCache::mark_dirty(const PageKey& key)
     kernel::LockGuard lock(mtx_);
     auto it = cache_.find(key);
     if(it) {
-        it->dirty = true;
+        set_dirty(key, *it);
     }
 }
 
+// 调用方持有mtx_。脏页交给kworker延迟写回，同一段时间里的多次写入合并成一次写块设备；
+// 工作队列还没有启动时立即写回
+void SimplePageCache::set_dirty(const PageKey& key, Page& page)
+{
+    page.dirty = true;
+    if(!kernel::queue_delayed_work(&writeback_work_.dwork, WRITEBACK_DELAY)
+        && !__atomic_load_n(&writeback_work_.dwork.work.pending, __ATOMIC_ACQUIRE)) {
+        writeback(key, page);
+    }
+}
+
+// 在kworker里执行，写回期间的新写入会重新排队
+void SimplePageCache::writeback_work_fn(kernel::work_struct* work)
+{
+    auto writeback_work = container_of(work, WritebackWork, dwork.work);
+    writeback_work->cache->flush_all();
+}
+
 bool SimplePageCache::flush(const PageKey& key)
 {
     kernel::LockGuard lock(mtx_);
@@ -86,18 +180,69 @@ bool SimplePageCache::flush(const PageKey& key)
     }
     if(!it->dirty)
         return true;
-    // TODO: 实际写回到后端存储，这里仅标记为已刷写
-    it->dirty = false;
+    return writeback(key, *it);
+}
+
+// 调用方持有mtx_
+bool SimplePageCache::writeback(const PageKey& key, Page& page)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    void* data = kernel_mm.kmap(page.phys);
+    bool ok = data && dev_->write_block(key.block_id, data);
+    kernel_mm.kunmap(data);
+    if(!ok) {
+        log_err("SimplePageCache: writeback failed, block:%d\n", (uint32_t)key.block_id);
+        return false;
+    }
+    // 之后经过可写的共享映射写入的内容记在页表项的脏位上，msync或者解除映射时再标脏
+    page.dirty = false;
     return true;
 }
 
+// CLOCK淘汰：最近取过的页清掉referenced再给一次机会；脏页等写回，
+// 引用计数不为1的页还被用户映射着，都不能淘汰
+size_t SimplePageCache::evict_clean(size_t target, size_t max_scan)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    return cache_.sweep(clock_hand_, max_scan, target, [&](const PageKey&, Page& page) {
+        if(page.referenced) {
+            page.referenced = false;
+            return false;
+        }
+        if(page.dirty || page.shared_writers || kernel_mm.page_ref_count(page.phys) != 1) {
+            return false;
+        }
+        release_cache_page(page);
+        return true;
+    });
+}
+
+size_t SimplePageCache::shrink_all(size_t target)
+{
+    size_t freed = 0;
+    uint32_t flags;
+    caches_lock_.acquire_irqsave(flags);
+    SimplePageCache* cache = caches_;
+    caches_lock_.release_irqrestore(flags);
+    // 页缓存只在卸载文件系统时销毁，遍历时不加caches_lock_
+    for(; cache && freed < target; cache = cache->next_cache_) {
+        // 缺页路径上调用，拿不到锁时跳过，不在这里等写回或者读盘
+        if(!cache->mtx_.tryLock()) {
+            continue;
+        }
+        // 扫两圈，第一圈清掉的referenced第二圈才能淘汰
+        freed += cache->evict_clean(target - freed, cache->cache_.size() * 2);
+        cache->mtx_.unlock();
+    }
+    return freed;
+}
+
 void SimplePageCache::flush_all()
 {
     kernel::LockGuard lock(mtx_);
-    cache_.for_each([](const PageKey& key, Page& page) {
+    cache_.for_each([this](const PageKey& key, Page& page) {
         if(page.dirty) {
-            // TODO: 实际写回到后端存储
-            page.dirty = false;
+            writeback(key, page);
         }
     });
 }
@@ -107,7 +252,7 @@ void SimplePageCache::invalidate(const PageKey& key)
     kernel::LockGuard lock(mtx_);
     auto it = cache_.find(key);
     if(it != nullptr) {
-        delete[] static_cast<uint8_t*>(it->data);
+        release_cache_page(*it);
         cache_.erase(key);
     }
 }
@@ -115,8 +260,8 @@ void SimplePageCache::invalidate(const PageKey& key)
 void SimplePageCache::clear()
 {
     kernel::LockGuard lock(mtx_);
-    cache_.for_each([this](const PageKey& key, Page& page) {
-        delete[] static_cast<uint8_t*>(page.data);
+    cache_.for_each([](const PageKey& key, Page& page) {
+        release_cache_page(page);
     });
     cache_.clear();
 }
@@ -131,9 +276,8 @@ void SimplePageCache::set_max_pages(size_t max_pages)
 {
     kernel::LockGuard lock(mtx_);
     max_pages_ = max_pages;
-    while(cache_.size() > max_pages_) {
-        //cache_.erase(cache_.begin());
-        // TODO:
+    if(cache_.size() > max_pages_) {
+        evict_clean(cache_.size() - max_pages_, cache_.size() * 2);
     }
 }
 
@@ -219,6 +363,31 @@ void HashList::clear() {
 
 size_t HashList::size() const { return size_; }
 
+template<typename Func>
+size_t HashList::sweep(size_t& hand, size_t max_scan, size_t target, Func f) {
+    size_t removed = 0;
+    size_t scanned = 0;
+    // 最多转两圈，配合referenced的第二次机会
+    for (size_t n = 0; n < bucket_count_ * 2 && scanned < max_scan && removed < target; ++n) {
+        size_t idx = hand;
+        hand = (hand + 1) % bucket_count_;
+        HashListNode** pnode = &buckets[idx];
+        while (*pnode && scanned < max_scan && removed < target) {
+            scanned++;
+            HashListNode* node = *pnode;
+            if (f(node->key, node->value)) {
+                *pnode = node->next;
+                delete node;
+                --size_;
+                removed++;
+            } else {
+                pnode = &node->next;
+            }
+        }
+    }
+    return removed;
+}
+
 template<typename Func>
 void HashList::for_each(Func f) {
     for (size_t i = 0; i < bucket_count_; ++i) {
@@ -1,4 +1,7 @@
 #include <arch/x86/interrupt.h>
+#include <arch/x86/spinlock.h>
+#include <kernel/list.h>
+#include <kernel/rcu.h>
 #include <kernel/syscall.h>
 #include <kernel/vfs.h>
 #include <lib/console.h>
@@ -15,11 +18,93 @@ const int MAX_MOUNT_POINTS = 16;
 struct MountPoint {
     FileSystem* fs;
     char path[256];
-    bool used;
 };
 
-// 挂载点列表
-static MountPoint mount_points[MAX_MOUNT_POINTS];
+// 挂载表
+// 每次路径查找都要读挂载表，挂载很少：查找在RCU读侧临界区里不加锁遍历，
+// 挂载时复制一份加上新的挂载点再替换，旧表等宽限期以后释放
+struct MountTable {
+    rcu_head rcu;
+    uint32_t count;
+    MountPoint mounts[MAX_MOUNT_POINTS];
+};
+static MountTable* mount_table;
+// 挂载的一方互斥
+static DEFINE_LOCK_CLASS(mount_lock_class, "mount");
+static SpinLock mount_lock(&mount_lock_class);
+
+void get_file(FileDescriptor* file)
+{
+    __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+}
+
+// 引用已经减到0的文件正在关闭，不能再取引用
+static bool get_file_not_zero(FileDescriptor* file)
+{
+    uint32_t refs = __atomic_load_n(&file->refs, __ATOMIC_RELAXED);
+    do {
+        if(!refs) {
+            return false;
+        }
+    } while(!__atomic_compare_exchange_n(
+        &file->refs, &refs, refs + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    return true;
+}
+
+static void file_free_rcu(rcu_head* head)
+{
+    reinterpret_cast<FileRcu*>(head)->file->close();
+}
+
+void fdput(FileDescriptor* file)
+{
+    if(__atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        file->rcu.file = file;
+        call_rcu(&file->rcu.head, file_free_rcu);
+    }
+}
+
+FileDescriptor* fdget(Context* context, uint32_t fd_num)
+{
+    if(fd_num >= MAX_PROCESS_FDS) {
+        return nullptr;
+    }
+    rcu_read_lock();
+    FileDescriptor* file = rcu_dereference(context->fd_table[fd_num]);
+    // 已经从fd表上摘下来的文件在宽限期结束前内存还有效
+    if(file && !get_file_not_zero(file)) {
+        file = nullptr;
+    }
+    rcu_read_unlock();
+    return file;
+}
+
+int fd_install(Context* context, FileDescriptor* file)
+{
+    // 0、1、2留给标准输入、输出和错误。同一个进程的任务可能同时打开文件，
+    // 用CAS占住空闲的一项，同时发布file
+    for(int fd_num = 3; fd_num < MAX_PROCESS_FDS; fd_num++) {
+        FileDescriptor* expected = nullptr;
+        if(__atomic_compare_exchange_n(&context->fd_table[fd_num], &expected, file, false,
+               __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return fd_num;
+        }
+    }
+    return -1;
+}
+
+int fd_close(Context* context, uint32_t fd_num)
+{
+    if(fd_num >= MAX_PROCESS_FDS) {
+        return -1;
+    }
+    FileDescriptor* file = __atomic_exchange_n(&context->fd_table[fd_num], nullptr, __ATOMIC_ACQ_REL);
+    if(!file) {
+        return -1;
+    }
+    fdput(file);
+    return 0;
+}
 
 // 打开文件系统调用处理函数
 int openHandler(uint32_t path_ptr, uint32_t b, uint32_t c, uint32_t d)
@@ -41,8 +126,12 @@ int sys_open(uint32_t path_ptr, Task* task)
     }
 
     // 分配文件描述符
-    int fd_num = task->context->allocate_fd();
-    task->context->fd_table[fd_num] = fd;
+    int fd_num = fd_install(task->context, fd);
+    if(fd_num < 0) {
+        log_debug("Too many open files: %s\n", path);
+        fdput(fd);
+        return -1;
+    }
 
     log_trace("File opened successfully, pcb:0x%x, pid:%d, fd: %d\n", task, task->task_id, fd_num);
     return fd_num;
@@ -58,36 +147,17 @@ int sys_read(uint32_t fd_num, uint32_t buffer_ptr, uint32_t size, Task* pcb)
 {
     log_trace("readHandler called with fd: %d, buffer: %x, size: %d\n", fd_num, buffer_ptr, size);
 
-    if(fd_num >= 256 || !pcb->context->fd_table[fd_num]) {
+    // 读的时候可能睡眠，引用保证别的任务关掉这个fd以后文件还在
+    auto fd = fdget(pcb->context, fd_num);
+    if(!fd) {
         log_debug("Invalid file descriptor: %d\n", fd_num);
         return -1;
     }
 
     void* buffer = reinterpret_cast<void*>(buffer_ptr);
 
-    auto process = pcb;
-    if(!process) {
-        log_debug("No current process\n");
-        return -1;
-    }
- //   debug_debug("process: %x\n", process);
-
-    auto fd_table = process->context->fd_table;
-    if(!fd_table[fd_num]) {
-        log_debug("File descriptor %d not open\n", fd_num);
-        return -1;
-    }
-//    debug_debug("fd_table: %x\n", fd_table);
-
-    auto fd = fd_table[fd_num];
-    if(!fd) {
-        log_err("File descriptor %d not open\n", fd_num);
-        return -1;
-    }
-    //log_debug("fd: %x\n", fd);
-
-    ssize_t bytes_read = 0;
-    bytes_read = fd->read(buffer, size);
+    ssize_t bytes_read = fd->read(buffer, size);
+    fdput(fd);
 
     log_trace("Read %d bytes from fd %d, buffer:0x%x, exit\n", bytes_read, fd_num, buffer);
     return bytes_read;
@@ -104,18 +174,16 @@ int sys_write(uint32_t fd_num, uint32_t buffer_ptr, uint32_t size, Task* task)
     log_trace(
         "writeHandler called with fd: %d, buffer: 0x%x, size: %d\n", fd_num, buffer_ptr, size);
 
-    auto context = task->context;
-    // log_debug("context: 0x%x\n", context);
-    if(fd_num >= 256 || !context->fd_table[fd_num]) {
+    auto fd = fdget(task->context, fd_num);
+    if(!fd) {
         log_debug("Invalid file descriptor, pcb:0x%x, pid:%d, fd: %d\n", task, task->task_id, fd_num);
         return -1;
     }
 
     const void* buffer = reinterpret_cast<const void*>(buffer_ptr);
     // log_debug("Writing %d bytes to fd %d, buffer: 0x%x\n", size, fd_num, buffer);
-    auto fd = context->fd_table[fd_num];
-    // log_debug("fd 0x%x\n", fd);
     ssize_t bytes_written = fd->write(buffer, size);
+    fdput(fd);
 
     log_trace("Wrote %d bytes to fd %d\n", bytes_written, fd_num);
     return bytes_written;
@@ -131,14 +199,13 @@ int sys_close(uint32_t fd_num, Task* pcb)
 {
     log_trace("closeHandler called with fd: %d\n", fd_num);
 
-    if(fd_num >= 256 || !pcb->context->fd_table[fd_num]) {
+    // 别的任务还在用这个文件时，放掉最后一个引用的一方关闭它
+    int result = fd_close(pcb->context, fd_num);
+    if(result < 0) {
         log_debug("Invalid file descriptor: %d\n", fd_num);
         return -1;
     }
 
-    int result = pcb->context->fd_table[fd_num]->close();
-    pcb->context->fd_table[fd_num] = nullptr;
-
     log_trace("File descriptor %d closed\n", fd_num);
     return result;
 }
@@ -154,12 +221,14 @@ int sys_seek(uint32_t fd_num, uint32_t offset, Task* pcb)
 {
     log_trace("seekHandler called with fd: %d, offset: %d\n", fd_num, offset);
 
-    if(fd_num >= 256 || !pcb->context->fd_table[fd_num]) {
+    auto fd = fdget(pcb->context, fd_num);
+    if(!fd) {
         log_debug("Invalid file descriptor: %d\n", fd_num);
         return -1;
     }
 
-    int result = pcb->context->fd_table[fd_num]->seek(offset);
+    int result = fd->seek(offset);
+    fdput(fd);
 
     log_trace("Seek result: %d\n", result);
     return result;
@@ -167,9 +236,6 @@ int sys_seek(uint32_t fd_num, uint32_t offset, Task* pcb)
 // 初始化VFS
 void init_vfs()
 {
-    for(int i = 0; i < MAX_MOUNT_POINTS; i++) {
-        mount_points[i].used = false;
-    }
     // 注册文件系统相关的系统调用处理函数
     SyscallManager::registerHandler(SYS_OPEN, openHandler);
     SyscallManager::registerHandler(SYS_READ, readHandler);
@@ -182,57 +248,65 @@ void init_vfs()
 }
 
 // 查找挂载点
-static FileSystem* find_fs(const char* path, const char** remaining_path)
+FileSystem* find_fs(const char* path, const char** remaining_path)
 {
     size_t longest_match = 0;
     FileSystem* matched_fs = nullptr;
 
-    for(int i = 0; i < MAX_MOUNT_POINTS; i++) {
-        if(!mount_points[i].used)
-            continue;
-
-        log_debug(
-            "VFSManager::find_fs: checking path %s against %s\n", path, mount_points[i].path);
-
-        size_t mount_len = strlen(mount_points[i].path);
-        log_debug("VFSManager::find_fs: mount_len %d\n", mount_len);
-
-        int ret = strncmp(path, mount_points[i].path, mount_len);
-        if(ret == 0) {
-            //  debug_debug("VFSManager::find_fs: found %x\n", mount_points[i].fs);
-            // debug_debug("VFSManager::find_fs: found %s\n",
-            // mount_points[i].fs->get_name()); debug_debug("VFSManager::find_fs:
-            // found filesystem %s for path %s\n", mount_points[i].fs->get_name(),
-            // path); 找到最长匹配的挂载点，避免匹配到 /usr/bin 时也匹配到 /usr/bin/ls
-            // 这种情况
-            if(mount_len > longest_match) {
-                longest_match = mount_len;
-                //     debug_debug("VFSManager::find_fs: matched_fs %x\n", matched_fs);
-                //    debug_debug("VFSManager::find_fs: matched_fs %x\n", matched_fs);
-                matched_fs = mount_points[i].fs;
-                *remaining_path = path + mount_len;
-            }
-        } else {
-            log_debug("VFSManager::find_fs: ret %d, path %s does not match %s\n", ret, path,
-                mount_points[i].path);
+    rcu_read_lock();
+    MountTable* table = rcu_dereference(mount_table);
+    for(uint32_t i = 0; table && i < table->count; i++) {
+        const MountPoint& mount = table->mounts[i];
+        size_t mount_len = strlen(mount.path);
+        // 找到最长匹配的挂载点，避免匹配到 /usr/bin 时也匹配到 /usr/bin/ls 这种情况
+        if(mount_len > longest_match && strncmp(path, mount.path, mount_len) == 0) {
+            longest_match = mount_len;
+            matched_fs = mount.fs;
+            *remaining_path = path + mount_len;
         }
     }
+    rcu_read_unlock();
 
     log_trace("VFSManager::find_fs: matched_fs %x\n", matched_fs);
     return matched_fs;
 }
 
+static void free_mount_table(rcu_head* head)
+{
+    delete container_of(head, MountTable, rcu);
+}
+
 void VFSManager::register_fs(const char* mount_point, FileSystem* fs)
 {
-    for(int i = 0; i < MAX_MOUNT_POINTS; i++) {
-        if(!mount_points[i].used) {
-            strncpy(mount_points[i].path, mount_point, sizeof(mount_points[i].path) - 1);
-            mount_points[i].fs = fs;
-            mount_points[i].used = true;
-            return;
-        }
+    auto table = new MountTable;
+    if(!table) {
+        log_err("Failed to allocate mount table for %s\n", mount_point);
+        return;
+    }
+    uint32_t flags;
+    mount_lock.acquire_irqsave(flags);
+    MountTable* old = mount_table;
+    uint32_t count = old ? old->count : 0;
+    if(count == MAX_MOUNT_POINTS) {
+        mount_lock.release_irqrestore(flags);
+        delete table;
+        Console::print("No free mount points available\n");
+        return;
+    }
+    if(old) {
+        memcpy(table->mounts, old->mounts, count * sizeof(MountPoint));
+    }
+    MountPoint& mount = table->mounts[count];
+    strncpy(mount.path, mount_point, sizeof(mount.path) - 1);
+    mount.path[sizeof(mount.path) - 1] = '\0';
+    mount.fs = fs;
+    table->count = count + 1;
+    rcu_assign_pointer(mount_table, table);
+    mount_lock.release_irqrestore(flags);
+    // 查找的一方可能还在读旧表
+    if(old) {
+        call_rcu(&old->rcu, free_mount_table);
     }
-    Console::print("No free mount points available\n");
 }
 
 FileDescriptor* VFSManager::open(const char* path)
@@ -1,12 +1,15 @@
 #include <kernel/kernel_memory.h>
 #include <lib/serial.h>
 
+#include "arch/x86/multiboot.h"
 #include "arch/x86/paging.h"
+#include "arch/x86/spinlock.h"
 #include "lib/debug.h"
+#include "lib/string.h"
 
 KernelMemory::KernelMemory()
     : dma_zone(), normal_zone(), high_zone(), page_manager(),
-      vmalloc_tree(VMALLOC_START, VMALLOC_END)
+      vmalloc_tree(KSTACK_END, VMALLOC_END)
 {
     log_debug("KernelMemory::KernelMemory()");
 }
@@ -21,7 +24,7 @@ PADDR KernelMemory::alloc_pages(uint32_t gfp_mask, uint32_t order)
 
     // 根据页面数量选择合适的区域
     uint32_t size = (1 << order) * PAGE_SIZE;
-    Zone* zone = get_zone_for_allocation(size);
+    Zone* zone = get_zone_for_allocation(size, gfp_mask);
     if(!zone) {
         log_debug("get_zone_for_allocation failed for size %d\n", size);
         return 0;
@@ -34,8 +37,8 @@ PADDR KernelMemory::alloc_pages(uint32_t gfp_mask, uint32_t order)
         return 0;
     }
 
-    PADDR phys_addr = pfn * PAGE_SIZE;
-    log_debug("KernelMemory::alloc_pages() addr: 0x%x\n", phys_addr);
+    PADDR phys_addr = (PADDR)pfn * PAGE_SIZE;
+    log_debug("KernelMemory::alloc_pages() pfn: 0x%x\n", pfn);
     return phys_addr;
 }
 
@@ -46,56 +49,72 @@ void KernelMemory::free_pages(PADDR phys_addr, uint32_t order)
         return;
     }
 
+    // 根据PFN确定页面所属的区域
     uint32_t pfn = phys_addr / PAGE_SIZE;
-    Zone* zone = nullptr;
+    zone_for_pfn(pfn)->freePages(pfn, order);
+}
 
-    // 根据PFN确定页面所属的区域
+Zone* KernelMemory::zone_for_pfn(uint32_t pfn)
+{
     if(pfn < DMA_ZONE_END) {
-        zone = &dma_zone;
+        return &dma_zone;
     } else if(pfn < NORMAL_ZONE_END) {
-        zone = &normal_zone;
-    } else {
-        zone = &high_zone;
+        return &normal_zone;
     }
-
-    // 释放物理页面
-    zone->freePages(pfn, order);
+    return &high_zone;
 }
 
 // 释放已分配的页面
 void KernelMemory::decrement_ref_count(PADDR physAddr)
 {
     uint32_t pfn = physAddr / PAGE_SIZE;
-    Zone* zone = nullptr;
-
-    // 根据PFN确定页面所属的区域
-    if(pfn < DMA_ZONE_END) {
-        zone = &dma_zone;
-    } else if(pfn < NORMAL_ZONE_END) {
-        zone = &normal_zone;
-    } else {
-        zone = &high_zone;
-    }
-
-    // 释放物理页面
-    zone->decRefPage(pfn);
+    zone_for_pfn(pfn)->decRefPage(pfn);
 }
 void KernelMemory::increment_ref_count(PADDR physAddr)
 {
     uint32_t pfn = physAddr / PAGE_SIZE;
-    Zone* zone = nullptr;
+    zone_for_pfn(pfn)->increment_ref_count(pfn);
+}
+uint32_t KernelMemory::page_ref_count(PADDR physAddr)
+{
+    uint32_t pfn = physAddr / PAGE_SIZE;
+    return zone_for_pfn(pfn)->refCount(pfn);
+}
 
-    // 根据PFN确定页面所属的区域
-    if(pfn < DMA_ZONE_END) {
-        zone = &dma_zone;
-    } else if(pfn < NORMAL_ZONE_END) {
-        zone = &normal_zone;
-    } else {
-        zone = &high_zone;
+void KernelMemory::setBootInfo(uint32_t magic, uint32_t mbi_phys)
+{
+    nr_mem_ranges = 0;
+    if(magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        serial_puts("KernelMemory: not booted by multiboot loader\n");
+        return;
+    }
+    // 此时还没有开启分页，可以直接访问物理地址
+    auto* mbi = reinterpret_cast<multiboot_info*>(mbi_phys);
+    if(!(mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+        serial_puts("KernelMemory: no memory map\n");
+        return;
     }
 
-    // 释放物理页面
-    zone->increment_ref_count(pfn);
+    uint32_t addr = mbi->mmap_addr;
+    while(addr < mbi->mmap_addr + mbi->mmap_length && nr_mem_ranges < MAX_MEM_RANGES) {
+        auto* entry = reinterpret_cast<multiboot_mmap_entry*>(addr);
+        addr += entry->size + sizeof(entry->size);
+        if(entry->type != MULTIBOOT_MEMORY_AVAILABLE) {
+            continue;
+        }
+        // 只使用完整的页，超出页帧号范围的部分丢弃
+        uint64_t start = (entry->addr + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint64_t end = (entry->addr + entry->len) / PAGE_SIZE;
+        if(end > HIGH_ZONE_END) {
+            end = HIGH_ZONE_END;
+        }
+        if(start >= end) {
+            continue;
+        }
+        mem_ranges[nr_mem_ranges].start_pfn = start;
+        mem_ranges[nr_mem_ranges].end_pfn = end;
+        nr_mem_ranges++;
+    }
 }
 
 // 初始化内核内存管理
@@ -114,16 +133,83 @@ void KernelMemory::init()
     serial_puts("KernelMemory::init() 2\n");
     // 初始化各个内存区域
     // dma_zone.init(ZoneType::ZONE_DMA, DMA_ZONE_START, DMA_ZONE_END);
-    normal_zone.init(ZoneType::ZONE_NORMAL, NORMAL_ZONE_START, NORMAL_ZONE_END);
-    // high_zone.init(ZoneType::ZONE_HIGH, HIGH_ZONE_START, HIGH_ZONE_END);
+    // 内存不足896MB时，普通区域只覆盖实际存在的内存
+    uint32_t normal_end = NORMAL_ZONE_END;
+    if(nr_mem_ranges > 0) {
+        uint32_t max_pfn = 0;
+        for(uint32_t i = 0; i < nr_mem_ranges; i++) {
+            if(mem_ranges[i].start_pfn < NORMAL_ZONE_END && mem_ranges[i].end_pfn > max_pfn) {
+                max_pfn = mem_ranges[i].end_pfn;
+            }
+        }
+        if(max_pfn > NORMAL_ZONE_START && max_pfn < normal_end) {
+            normal_end = max_pfn;
+        }
+    }
+
+    // 高端区域的PageInfo和普通区域自己的元数据一样在启动时从普通区域头部按实际大小划出，
+    // 不再等伙伴系统起来以后分配一个2的幂次的大块：6GB内存时那是8MB的连续块，
+    // 内存再大就分不出来了
+    uint32_t high_end = max_mem_pfn();
+    uint32_t normal_meta = Zone::metaBytes(NORMAL_ZONE_START, normal_end);
+    uint32_t high_meta = 0;
+    if(high_end > HIGH_ZONE_START) {
+        high_meta = Zone::metaBytes(HIGH_ZONE_START, high_end);
+        // 元数据最多占普通区域的一半，超出的高端内存不用
+        uint32_t budget = (normal_end - NORMAL_ZONE_START) / 2 * PAGE_SIZE;
+        if(normal_meta + high_meta > budget) {
+            uint32_t pages = (uint64_t)(high_end - HIGH_ZONE_START) * (budget - normal_meta) /
+                high_meta;
+            log_warn("KernelMemory: highmem truncated, end pfn 0x%x -> 0x%x\n", high_end,
+                HIGH_ZONE_START + pages);
+            high_end = HIGH_ZONE_START + pages;
+            high_meta = Zone::metaBytes(HIGH_ZONE_START, high_end);
+        }
+    }
+    PADDR meta = (PADDR)NORMAL_ZONE_START * PAGE_SIZE;
+    normal_zone.init(ZoneType::ZONE_NORMAL, NORMAL_ZONE_START, normal_end, phys2Virt(meta));
+    normal_zone.addFreeRange(
+        NORMAL_ZONE_START + (normal_meta + high_meta) / PAGE_SIZE, normal_end);
     serial_puts("KernelMemory::init() 3");
 
     slab_allocator.init();
+    init_highmem(high_end, phys2Virt(meta + normal_meta));
+
+    zero_page_phys = alloc_pages(GFP_KERNEL, 0);
+    memset((void*)phys2Virt(zero_page_phys), 0, PAGE_SIZE);
 
     // 初始化VMALLOC区域
     //    vmalloc_tree.init();
 }
 
+uint32_t KernelMemory::max_mem_pfn() const
+{
+    uint32_t max_pfn = 0;
+    for(uint32_t i = 0; i < nr_mem_ranges; i++) {
+        if(mem_ranges[i].end_pfn > max_pfn) {
+            max_pfn = mem_ranges[i].end_pfn;
+        }
+    }
+    return max_pfn;
+}
+
+// 高端内存区域: 896MB以上的内存，PAE下包括4GB以上的内存
+// 这些页面没有直接映射，元数据在启动时从普通区域划出
+void KernelMemory::init_highmem(uint32_t end_pfn, void* meta)
+{
+    if(end_pfn <= HIGH_ZONE_START) {
+        log_info("KernelMemory: no highmem, max_pfn: 0x%x\n", end_pfn);
+        return;
+    }
+
+    high_zone.init(ZoneType::ZONE_HIGH, HIGH_ZONE_START, end_pfn, meta);
+    for(uint32_t i = 0; i < nr_mem_ranges; i++) {
+        high_zone.addFreeRange(mem_ranges[i].start_pfn, mem_ranges[i].end_pfn);
+    }
+    log_info("KernelMemory: highmem pfn [0x%x, 0x%x), free pages: %d\n", HIGH_ZONE_START, end_pfn,
+        high_zone.getFreePages());
+}
+
 // 分配小块连续物理内存（返回虚拟地址）
 VADDR KernelMemory::kmalloc(uint32_t size)
 {
@@ -225,7 +311,7 @@ VADDR KernelMemory::vmalloc(uint32_t size)
         }
 
         // 建立映射
-        uint32_t phys_addr = pfn << 12;
+        PADDR phys_addr = (PADDR)pfn << 12;
         page_manager.mapPage(virt_addr + i * PAGE_SIZE, phys_addr, 3);
     }
 
@@ -260,10 +346,7 @@ void KernelMemory::vfree(VADDR addr)
         page_manager.unmapPage(current_addr);
 
         // 找到对应的区域并释放物理页面
-        Zone* zone = get_zone_for_allocation(PAGE_SIZE);
-        if(zone) {
-            zone->freePages(pfn, 0); // 释放单个页面，order为0
-        }
+        zone_for_pfn(pfn)->freePages(pfn, 0); // 释放单个页面，order为0
 
         current_addr += PAGE_SIZE;
     }
@@ -272,18 +355,47 @@ void KernelMemory::vfree(VADDR addr)
     vmalloc_tree.free(virt_addr);
 }
 
+// KMAP区域的槽位，每个槽位映射一页
+static constexpr uint32_t KMAP_SLOTS = (KMAP_END - KMAP_START) / PAGE_SIZE;
+static uint32_t kmap_bitmap[KMAP_SLOTS / 32];
+static uint32_t kmap_hint = 0;
+static DEFINE_LOCK_CLASS(kmap_lock_class, "kmap");
+static SpinLock kmap_lock(&kmap_lock_class);
+
 // 将物理页面临时映射到内核空间
 VADDR KernelMemory::kmap(PADDR phys_addr)
 {
+    // 直接映射区的页面不需要建立映射
+    if(!is_highmem(phys_addr)) {
+        return phys2Virt(phys_addr);
+    }
+
     // 从KMAP区域分配虚拟地址
-    static uint32_t next_kmap_addr = KMAP_START;
-    uint32_t virt_addr = next_kmap_addr;
-    next_kmap_addr += PAGE_SIZE;
+    uint32_t flags;
+    kmap_lock.acquire_irqsave(flags);
+    uint32_t slot = KMAP_SLOTS;
+    for(uint32_t n = 0; n < KMAP_SLOTS; n++) {
+        uint32_t i = (kmap_hint + n) % KMAP_SLOTS;
+        if(!(kmap_bitmap[i / 32] & (1u << (i % 32)))) {
+            kmap_bitmap[i / 32] |= 1u << (i % 32);
+            kmap_hint = i + 1;
+            slot = i;
+            break;
+        }
+    }
+    kmap_lock.release_irqrestore(flags);
+    if(slot == KMAP_SLOTS) {
+        log_err("kmap: no free slot\n");
+        return nullptr;
+    }
 
-    // 建立临时映射
-    page_manager.mapPage(virt_addr, phys_addr & ~(PAGE_SIZE - 1), 3);
+    // KMAP的页表是所有地址空间共享的，并且在物理上连续
+    auto* ptes = reinterpret_cast<pte_t*>(phys2Virt(K_KMAP_PT_START));
+    uint32_t virt_addr = KMAP_START + slot * PAGE_SIZE;
+    ptes[slot] = (phys_addr & PTE_ADDR_MASK) | PAGE_WRITE | PAGE_PRESENT;
+    asm volatile("invlpg (%0)" : : "r"(virt_addr) : "memory");
 
-    return (void*)(virt_addr | (phys_addr & 0xFFF));
+    return (void*)(virt_addr | (uint32_t)(phys_addr & 0xFFF));
 }
 
 // 解除kmap的映射
@@ -293,9 +405,18 @@ void KernelMemory::kunmap(VADDR addr)
         return;
 
     uint32_t virt_addr = (uint32_t)addr & ~0xFFF;
-    if(virt_addr >= KMAP_START && virt_addr < KMAP_END) {
-        page_manager.unmapPage(virt_addr);
+    if(virt_addr < KMAP_START || virt_addr >= KMAP_END) {
+        return; // 直接映射区的地址
     }
+    uint32_t slot = (virt_addr - KMAP_START) / PAGE_SIZE;
+    auto* ptes = reinterpret_cast<pte_t*>(phys2Virt(K_KMAP_PT_START));
+    ptes[slot] = 0;
+    asm volatile("invlpg (%0)" : : "r"(virt_addr) : "memory");
+
+    uint32_t flags;
+    kmap_lock.acquire_irqsave(flags);
+    kmap_bitmap[slot / 32] &= ~(1u << (slot % 32));
+    kmap_lock.release_irqrestore(flags);
 }
 
 // 获取虚拟地址对应的物理地址
@@ -305,7 +426,7 @@ PADDR KernelMemory::virt2Phys(VADDR virt_addr)
 }
 VADDR KernelMemory::phys2Virt(PADDR phys_addr)
 {
-    return (void*)(phys_addr + KERNEL_DIRECT_MAP_START);
+    return (void*)((uint32_t)phys_addr + KERNEL_DIRECT_MAP_START);
 }
 
 // 获取虚拟地址对应的页框号
@@ -316,8 +437,13 @@ PFN KernelMemory::getPfn(VADDR virt_addr)
 }
 
 // 根据大小选择合适的内存区域
-Zone* KernelMemory::get_zone_for_allocation(uint32_t size)
+Zone* KernelMemory::get_zone_for_allocation(uint32_t size, uint32_t gfp_mask)
 {
+    // 调用者能处理高端内存时优先使用高端区域，把直接映射区留给内核
+    if((gfp_mask & GFP_HIGHMEM) && high_zone.getFreePages() >= size / PAGE_SIZE) {
+        return &high_zone;
+    }
+
     // 对于小于16MB的分配，优先使用DMA区域
     //    if (size <= DMA_ZONE_END * PAGE_SIZE) {
     //        if (dma_zone.getFreePages() * PAGE_SIZE >= size) {
@@ -332,10 +458,5 @@ Zone* KernelMemory::get_zone_for_allocation(uint32_t size)
         log_debug("num free pages: %d\n", normal_zone.getFreePages());
     }
 
-    //    // 对于大块内存，使用高端区域
-    //    if (high_zone.getFreePages() * PAGE_SIZE >= size) {
-    //        return &high_zone;
-    //    }
-
     return nullptr;
 }
\ No newline at end of file
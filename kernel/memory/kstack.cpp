@@ -0,0 +1,148 @@
+#include "kernel/kstack.h"
+#include "arch/x86/percpu.h"
+#include "kernel/kernel.h"
+#include "lib/debug.h"
+
+static inline uint64_t kstack_rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint32_t this_cpu()
+{
+    uint32_t cpu = arch::get_cpu_id();
+    return cpu < MAX_CPUS ? cpu : 0;
+}
+
+bool KernelStackAllocator::populate(uint32_t slot)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    // 槽位的第一页是保护页，不建立映射
+    uint32_t stack = slot_base(slot) + PAGE_SIZE;
+    PADDR pages[STACK_PAGES];
+    for(uint32_t i = 0; i < STACK_PAGES; i++) {
+        pages[i] = kernel_mm.alloc_pages(GFP_HIGHMEM, 0);
+        if(!pages[i]) {
+            log_err("KernelStackAllocator: out of memory, slot:%d\n", slot);
+            for(uint32_t j = 0; j < i; j++) {
+                kernel_mm.free_pages(pages[j], 0);
+            }
+            return false;
+        }
+    }
+    for(uint32_t i = 0; i < STACK_PAGES; i++) {
+        kernel_mm.paging().mapPage(stack + i * PAGE_SIZE, pages[i], PAGE_WRITE | PAGE_NX);
+    }
+    return true;
+}
+
+VADDR KernelStackAllocator::alloc()
+{
+    uint64_t start = kstack_rdtsc();
+    auto& cache = caches[this_cpu()];
+    uint32_t slot = NO_SLOT;
+    uint32_t flags;
+
+    cache.lock.acquire_irqsave(flags);
+    if(cache.count > 0) {
+        slot = cache.slots[--cache.count];
+        cache.hits++;
+    }
+    cache.lock.release_irqrestore(flags);
+
+    if(slot == NO_SLOT) {
+        bool is_fresh = false;
+        lock.acquire_irqsave(flags);
+        if(nr_free_slots > 0) {
+            slot = free_slots[--nr_free_slots];
+            reuse_hits++;
+        } else if(next_fresh < NR_SLOTS) {
+            slot = next_fresh++;
+            is_fresh = true;
+            fresh++;
+            // 记录换成kmalloc时这次分配会不会失败
+            if(!Kernel::instance().kernel_mm().can_alloc_contiguous(2)) {
+                order2_unavailable++;
+            }
+        }
+        lock.release_irqrestore(flags);
+
+        // 建立映射失败的槽位不再使用，KSTACK区域足够大，泄漏一个槽位的虚拟地址可以接受
+        if(is_fresh && !populate(slot)) {
+            slot = NO_SLOT;
+        }
+    }
+
+    if(slot == NO_SLOT) {
+        lock.acquire_irqsave(flags);
+        failures++;
+        lock.release_irqrestore(flags);
+        log_err("KernelStackAllocator: no kernel stack available\n");
+        return nullptr;
+    }
+
+    uint64_t cycles = kstack_rdtsc() - start;
+    cache.lock.acquire_irqsave(flags);
+    cache.allocs++;
+    cache.cycles += cycles;
+    cache.lock.release_irqrestore(flags);
+    return (VADDR)(slot_base(slot) + PAGE_SIZE);
+}
+
+void KernelStackAllocator::free(VADDR stack)
+{
+    uint32_t addr = (uint32_t)stack;
+    if(addr < MemoryConstants::KSTACK_START || addr >= slot_base(NR_SLOTS) ||
+        (addr - MemoryConstants::KSTACK_START) % SLOT_SIZE != PAGE_SIZE) {
+        log_err("KernelStackAllocator: bad stack 0x%x\n", addr);
+        return;
+    }
+    uint32_t slot = (addr - MemoryConstants::KSTACK_START) / SLOT_SIZE;
+
+    uint32_t flags;
+    auto& cache = caches[this_cpu()];
+    cache.lock.acquire_irqsave(flags);
+    if(cache.count < PERCPU_CACHE_SIZE) {
+        cache.slots[cache.count++] = slot;
+        slot = NO_SLOT;
+    }
+    cache.lock.release_irqrestore(flags);
+    if(slot == NO_SLOT) {
+        return;
+    }
+
+    lock.acquire_irqsave(flags);
+    free_slots[nr_free_slots++] = slot;
+    lock.release_irqrestore(flags);
+}
+
+bool KernelStackAllocator::is_guard_page(uint32_t addr)
+{
+    if(addr < MemoryConstants::KSTACK_START || addr >= slot_base(NR_SLOTS)) {
+        return false;
+    }
+    return (addr - MemoryConstants::KSTACK_START) % SLOT_SIZE < PAGE_SIZE;
+}
+
+KernelStackAllocator::Stats KernelStackAllocator::stats()
+{
+    Stats s = {};
+    uint32_t flags;
+    for(uint32_t i = 0; i < MAX_CPUS; i++) {
+        auto& cache = caches[i];
+        cache.lock.acquire_irqsave(flags);
+        s.allocs += cache.allocs;
+        s.percpu_hits += cache.hits;
+        s.alloc_cycles += cache.cycles;
+        cache.lock.release_irqrestore(flags);
+    }
+    lock.acquire_irqsave(flags);
+    s.reuse_hits = reuse_hits;
+    s.fresh = fresh;
+    s.order2_unavailable = order2_unavailable;
+    s.failures = failures;
+    lock.release_irqrestore(flags);
+    return s;
+}
@@ -0,0 +1,70 @@
+#include "kernel/oom.h"
+#include "kernel/kernel.h"
+#include "kernel/process.h"
+#include "kernel/task_group.h"
+#include "lib/debug.h"
+#include "lib/string.h"
+
+volatile uint32_t OomKiller::kills = 0;
+
+// 回调里拷贝出来的候选进程信息，进程表锁释放后Context可能已经被回收
+struct OomVictim {
+    uint32_t pid;
+    uint32_t rss;
+    uint32_t anon;
+    uint32_t file;
+    uint32_t total_vm;
+    char name[PROCNAME_LEN + 1];
+    kernel::TaskGroup* group; // 只在这个组里选，nullptr表示所有进程
+};
+
+static void pick_victim(Context* ctx, void* arg)
+{
+    auto victim = static_cast<OomVictim*>(arg);
+    // 已经被杀死的进程内存正在释放，不要重复选中
+    if(ctx->killed) {
+        return;
+    }
+    auto& mm = ctx->user_mm;
+    if((victim->group && mm.group() != victim->group) || mm.rss_pages() <= victim->rss) {
+        return;
+    }
+    victim->pid = ctx->context_id;
+    victim->rss = mm.rss_pages();
+    victim->anon = mm.rss_anon_pages();
+    victim->file = mm.rss_file_pages();
+    victim->total_vm = mm.total_vm_pages();
+    victim->name[0] = '\0';
+    if(!kernel::list_empty(&ctx->tasks)) {
+        auto task = list_entry(ctx->tasks.next, Task, ctx_node);
+        strncpy(victim->name, task->name, PROCNAME_LEN);
+        victim->name[PROCNAME_LEN] = '\0';
+    }
+}
+
+int OomKiller::out_of_memory(kernel::TaskGroup* group)
+{
+    OomVictim victim = {};
+    victim.group = group;
+    ProcessManager::for_each_context(pick_victim, &victim);
+    if(victim.rss == 0) {
+        log_err("Out of memory and no killable process\n");
+        return -1;
+    }
+
+    if(group) {
+        log_err("Task group %s out of memory: usage:%d pages, limit:%d pages\n", group->name,
+            group->mem_usage, group->mem_limit);
+    } else {
+        auto& kernel_mm = Kernel::instance().kernel_mm();
+        log_err("Out of memory: normal free:%d pages, high free:%d pages\n",
+            kernel_mm.normal_free_pages(), kernel_mm.highmem_free_pages());
+    }
+    log_err("Out of memory: killing process %d (%s) total-vm:%dkB, anon-rss:%dkB, file-rss:%dkB\n",
+        victim.pid, victim.name, victim.total_vm * 4, victim.anon * 4, victim.file * 4);
+    // 失败说明别的CPU刚刚杀死了它，内存同样会被释放
+    if(ProcessManager::kill_process(victim.pid, EXIT_STATUS_KILLED)) {
+        arch::atomic_add(&kills, 1);
+    }
+    return victim.pid;
+}
@@ -7,15 +7,33 @@
 #include <lib/string.h>
 
 #include "kernel/kernel.h"
+#include "kernel/swap.h"
+#include <arch/x86/spinlock.h>
 
 PageManager::PageManager() : curPgdVirt(nullptr) {}
 
+bool PageManager::nx_enabled = false;
+
+#ifdef CONFIG_PAE
+// PDPT只有32字节，CR3要求它位于4GB以下，直接放在内核镜像的bss里
+// 内核镜像是恒等映射的，PDPT的地址就是物理地址
+static constexpr uint32_t PDPT_POOL_SIZE = 1024;
+static PageDirPointerTable pdpt_pool[PDPT_POOL_SIZE];
+static uint32_t pdpt_bitmap[PDPT_POOL_SIZE / 32];
+static SpinLock pdpt_lock;
+#endif
+
+static inline void invlpg(uint32_t virt_addr)
+{
+    asm volatile("invlpg (%0)" : : "r"(virt_addr) : "memory");
+}
+
 void PageManager::init()
 {
     // 初始化页目录
     serial_puts("PageManager: enter init\n");
     PageDirectory* pageDirectory = reinterpret_cast<PageDirectory*>(PAGE_DIRECTORY_ADDR);
-    for(int i = 0; i < 1024; i++) {
+    for(uint32_t i = 0; i < PTRS_PER_PGD; i++) {
         pageDirectory->entries[i] = 0x00000002; // Supervisor, read/write, not present
     }
     serial_puts("PageManager: pageDirectory init\n");
@@ -23,8 +41,16 @@ void PageManager::init()
     mapKernelSpace();
     serial_puts("PageManager: kernel space mapped\n");
 
+#ifdef CONFIG_PAE
+    // PDPT的4项指向4个连续的页目录，PDPTE中只有P位有效，R/W和U/S是保留位
+    auto* pdpt = reinterpret_cast<PageDirPointerTable*>(K_PDPT_ADDR);
+    for(uint32_t i = 0; i < 4; i++) {
+        pdpt->entries[i] = (PAGE_DIRECTORY_ADDR + i * PAGE_SIZE) | PAGE_PRESENT;
+    }
+#endif
+
     // 加载页目录
-    loadPageDirectory(reinterpret_cast<uintptr_t>(PAGE_DIRECTORY_ADDR));
+    loadPageDirectory(kernelCr3());
     serial_puts("PageManager: pageDirectory load\n");
     enablePaging();
     serial_puts("PageManager: enable paging\n");
@@ -32,6 +58,9 @@ void PageManager::init()
     log_debug("PAGE_DIRECTORY_ADDR: %x\n", PAGE_DIRECTORY_ADDR);
     log_debug("KERNEL_DIRECT_MAP_START: %x\n", KERNEL_DIRECT_MAP_START);
     log_debug("PageManager: currentPageDirectory: %x\n", curPgdVirt);
+#ifdef CONFIG_PAE
+    log_info("PageManager: PAE enabled, NX: %d\n", nx_enabled);
+#endif
 }
 
 // 映射内核空间 896MB
@@ -40,30 +69,52 @@ void PageManager::mapKernelSpace()
     // 当前使用物理地址，实模式
     // 映射前4M
     auto* dir = reinterpret_cast<PageDirectory*>(PAGE_DIRECTORY_ADDR);
-    auto* table1 = reinterpret_cast<PageTable*>(K_FIRST_4M_PT);
-    dir->entries[0] = K_FIRST_4M_PT | 7; // user, read/write, present;
-    for(int i = 0; i < 1024; i++) {
-        table1->entries[i] = (i * 4096) | 7; // user can access, read/write, present
+    constexpr uint32_t first4MTables = 0x400000 >> PGD_SHIFT;
+    for(uint32_t j = 0; j < first4MTables; j++) {
+        auto* table = reinterpret_cast<PageTable*>(K_FIRST_4M_PT + j * sizeof(PageTable));
+        for(uint32_t i = 0; i < PTRS_PER_PT; i++) {
+            // user can access, read/write, present
+            table->entries[i] = ((j * PTRS_PER_PT + i) * PAGE_SIZE) | 7;
+        }
+        dir->entries[j] = reinterpret_cast<uintptr_t>(table) | 7; // user, read/write, present;
     }
 
     // map 0xC0000000
-    uint32_t pteStart = 0xC0000000 >> 22;
-    for(int j = 0; j < K_PAGE_TABLE_COUNT; j++) { // each pde
+    uint32_t pteStart = pgd_index(0xC0000000);
+    for(uint32_t j = 0; j < K_PAGE_TABLE_COUNT; j++) { // each pde
         auto* table = reinterpret_cast<PageTable*>(K_PAGE_TABLE_START + j * sizeof(PageTable));
-        for(uint32_t i = 0; i < 1024; i++) {
-            table->entries[i] = (i * 4096 + j * 1024 * 4096) | 3; // Supervisor, read/write, present
+        for(uint32_t i = 0; i < PTRS_PER_PT; i++) {
+            // Supervisor, read/write, present
+            table->entries[i] = ((j * PTRS_PER_PT + i) * PAGE_SIZE) | 3;
         }
         dir->entries[j + pteStart] =
             reinterpret_cast<uintptr_t>(table) | 3; // Supervisor, read/write, present
     }
 
+    // KMAP区域的页表预先建好，之后所有页目录共享这些页表，
+    // 这样在任意地址空间里kmap出来的地址都是可用的
+    uint32_t kmapStart = pgd_index(KMAP_START);
+    for(uint32_t j = 0; j < K_KMAP_PT_COUNT; j++) {
+        auto* table = reinterpret_cast<PageTable*>(K_KMAP_PT_START + j * sizeof(PageTable));
+        memset(table, 0, sizeof(PageTable));
+        dir->entries[j + kmapStart] = reinterpret_cast<uintptr_t>(table) | 3;
+    }
+
+    // VMALLOC区域的页表也预先建好，内核栈放在这里，切换到任何地址空间都要能访问
+    uint32_t vmallocStart = pgd_index(VMALLOC_START);
+    for(uint32_t j = 0; j < K_VMALLOC_PT_COUNT; j++) {
+        auto* table = reinterpret_cast<PageTable*>(K_VMALLOC_PT_START + j * sizeof(PageTable));
+        memset(table, 0, sizeof(PageTable));
+        dir->entries[j + vmallocStart] = reinterpret_cast<uintptr_t>(table) | 3;
+    }
+
     // 映射APIC区域 (0xFEC00000 - 0xFEEFFFFF)
     constexpr uint32_t APIC_START = 0xFEC00000;
     constexpr uint32_t APIC_END = 0xFEEFFFFF;
     
     for (uint32_t addr = APIC_START; addr <= APIC_END; addr += 0x1000) {
-        uint32_t pd_index = addr >> 22;
-        uint32_t pt_index = (addr >> 12) & 0x3FF;
+        uint32_t pd_index = pgd_index(addr);
+        uint32_t pte_index = pt_index(addr);
         
         // 确保页表存在
         if (!(dir->entries[pd_index] & 0x1)) {
@@ -71,8 +122,8 @@ void PageManager::mapKernelSpace()
             dir->entries[pd_index] = reinterpret_cast<uintptr_t>(new_table) | 3;
         }
         
-        auto* table = reinterpret_cast<PageTable*>(dir->entries[pd_index] & 0xFFFFF000);
-        table->entries[pt_index] = addr | 0x13; // Supervisor, read/write, present, cache disabled
+        auto* table = reinterpret_cast<PageTable*>(static_cast<uintptr_t>(pte_paddr(dir->entries[pd_index])));
+        table->entries[pte_index] = addr | 0x13; // Supervisor, read/write, present, cache disabled
     }
 }
 
@@ -83,21 +134,92 @@ void PageManager::loadPageDirectory(uint32_t dir)
 
 void PageManager::enablePaging()
 {
+#ifdef CONFIG_PAE
+    // CR4.PAE(位5)必须在CR0.PG之前打开，每个CPU都要设置一次
+    uint32_t cr4_val;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4_val));
+    cr4_val |= 0x20;
+    asm volatile("mov %0, %%cr4" : : "r"(cr4_val));
+
+    // CPUID 0x80000001 EDX位20表示支持NX，支持时打开EFER.NXE(位11)
+    uint32_t max_ext, eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(max_ext), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000000));
+    if(max_ext >= 0x80000001) {
+        asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001));
+        if(edx & (1 << 20)) {
+            uint32_t lo, hi;
+            asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(0xC0000080));
+            lo |= 1 << 11;
+            asm volatile("wrmsr" : : "a"(lo), "d"(hi), "c"(0xC0000080));
+            nx_enabled = true;
+        }
+    }
+#endif
     uint32_t cr0_val;
     // 获取当前 CR0 寄存器的值
     asm volatile("mov %%cr0, %0" : "=r"(cr0_val));
     cr0_val |= 0x80000000; // 启用分页
+    // CR0.WP(位16)：内核写只读的用户页面也要触发缺页，否则会绕过COW直接写到共享零页上
+    cr0_val |= 0x10000;
     // 将修改后的 CR0 值写回 CR0 寄存器
     asm volatile("mov %0, %%cr0" : : "r"(cr0_val));
 }
 
+uint32_t PageManager::kernelCr3()
+{
+#ifdef CONFIG_PAE
+    return K_PDPT_ADDR;
+#else
+    return PAGE_DIRECTORY_ADDR;
+#endif
+}
+
+uint32_t PageManager::makeCr3(PADDR pgdPhys)
+{
+#ifdef CONFIG_PAE
+    pdpt_lock.acquire();
+    for(uint32_t i = 0; i < PDPT_POOL_SIZE; i++) {
+        if(pdpt_bitmap[i / 32] & (1u << (i % 32))) {
+            continue;
+        }
+        pdpt_bitmap[i / 32] |= 1u << (i % 32);
+        pdpt_lock.release();
+
+        auto* pdpt = &pdpt_pool[i];
+        for(uint32_t j = 0; j < 4; j++) {
+            pdpt->entries[j] = (pgdPhys + j * PAGE_SIZE) | PAGE_PRESENT;
+        }
+        return reinterpret_cast<uint32_t>(pdpt);
+    }
+    pdpt_lock.release();
+    log_err("PageManager: out of PDPT\n");
+    return 0;
+#else
+    return pgdPhys;
+#endif
+}
+
+void PageManager::releaseCr3([[maybe_unused]] uint32_t cr3)
+{
+#ifdef CONFIG_PAE
+    auto* pdpt = reinterpret_cast<PageDirPointerTable*>(cr3);
+    if(pdpt < &pdpt_pool[0] || pdpt >= &pdpt_pool[PDPT_POOL_SIZE]) {
+        return; // 内核PDPT不在池中
+    }
+    uint32_t i = pdpt - &pdpt_pool[0];
+    pdpt_lock.acquire();
+    pdpt_bitmap[i / 32] &= ~(1u << (i % 32));
+    pdpt_lock.release();
+#endif
+}
+
 // 映射虚拟地址到物理地址
-void PageManager::mapPage(uint32_t virt_addr, uint32_t phys_addr, uint32_t flags)
+void PageManager::mapPage(uint32_t virt_addr, PADDR phys_addr, pte_t flags)
 {
     // debug_debug("trying to map virt:%x, phys:%x, flags:%x\n", virt_addr,
     // phys_addr, flags);
-    uint32_t pd_index = virt_addr >> 22;
-    uint32_t pt_index = (virt_addr >> 12) & 0x3FF;
+    uint32_t pd_index = pgd_index(virt_addr);
+    uint32_t pte_index = pt_index(virt_addr);
 
     // 获取页目录项
     if(!curPgdVirt) {
@@ -106,39 +228,45 @@ void PageManager::mapPage(uint32_t virt_addr, uint32_t phys_addr, uint32_t flags
     }
 
     // 检查页表是否存在
-    PageTable* pt;
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    PADDR pt_phys;
     if(!(curPgdVirt->entries[pd_index] & 0x1)) {
         // 创建新页表
         log_debug("creating new page table\n");
-        pt = (PageTable*)Kernel::instance().kernel_mm().alloc_pages(0, 0); // order=0表示分配单个页面
-        // debug_debug("created phys:%x\n", pt);
-        curPgdVirt->entries[pd_index] =
-            reinterpret_cast<uint32_t>(pt) | 3; // Supervisor, read/write, present
+        pt_phys = kernel_mm.alloc_pages(0, 0); // order=0表示分配单个页面
+        if(!pt_phys) {
+            log_err("PageManager: failed to allocate page table\n");
+            return;
+        }
+        memset(kernel_mm.phys2Virt(pt_phys), 0, PAGE_SIZE);
+        curPgdVirt->entries[pd_index] = pt_phys | 3; // Supervisor, read/write, present
     } else {
-        pt = reinterpret_cast<PageTable*>(curPgdVirt->entries[pd_index] & 0xFFFFF000);
+        pt_phys = pte_paddr(curPgdVirt->entries[pd_index]);
         // debug_debug("page table exists, phys: %x\n", pt);
     }
 
     // 设置页表项
-    pt = (PageTable*)Kernel::instance().kernel_mm().phys2Virt((uint32_t)pt);
+    auto* pt = (PageTable*)kernel_mm.phys2Virt(pt_phys);
     // debug_debug("page table virt: %x\n", pt);
-    pt->entries[pt_index] = (phys_addr & 0xFFFFF000) | (flags & 0xFFF) | 0x1; // Present
-    // debug_debug("mapped virt:%x, phys:%x, flags:%x, pte:%x, pd_index:%x,
-    // pt_index:%x\n", virt_addr, phys_addr, flags, pt->entries[pt_index],
-    // pd_index, pt_index);
+    if(!nx_enabled) {
+        flags &= ~PAGE_NX;
+    }
+    pt->entries[pte_index] = (phys_addr & PTE_ADDR_MASK) | (flags & (0xFFF | PAGE_NX)) | 0x1; // Present
+    invlpg(virt_addr);
 }
 
 // 解除虚拟地址映射
 void PageManager::unmapPage(uint32_t virt_addr)
 {
-    uint32_t pd_index = virt_addr >> 22;
-    uint32_t pt_index = (virt_addr >> 12) & 0x3FF;
+    uint32_t pd_index = pgd_index(virt_addr);
 
     if(!curPgdVirt || !(curPgdVirt->entries[pd_index] & 0x1))
         return;
 
-    PageTable* pt = reinterpret_cast<PageTable*>(curPgdVirt->entries[pd_index] & 0xFFFFF000);
-    pt->entries[pt_index] = 0x00000002; // Supervisor, read/write, not present
+    auto* pt = (PageTable*)Kernel::instance().kernel_mm().phys2Virt(
+        pte_paddr(curPgdVirt->entries[pd_index]));
+    pt->entries[pt_index(virt_addr)] = 0x00000002; // Supervisor, read/write, not present
+    invlpg(virt_addr);
 }
 
 // 切换页目录
@@ -151,31 +279,32 @@ void PageManager::switchPageDirectory(PageDirectory* dirVirt, void* dirPhys)
 // 获取页表项标志位
 uint32_t PageManager::getPageFlags(uint32_t virt_addr)
 {
-    uint32_t pd_index = virt_addr >> 22;
-    uint32_t pt_index = (virt_addr >> 12) & 0x3FF;
+    uint32_t pd_index = pgd_index(virt_addr);
 
     if(!curPgdVirt || !(curPgdVirt->entries[pd_index] & 0x1)) {
         return 0; // 页目录项不存在
     }
 
-    PageTable* pt = reinterpret_cast<PageTable*>(curPgdVirt->entries[pd_index] & 0xFFFFF000);
-    return pt->entries[pt_index] & 0xFFF; // 返回标志位
+    auto* pt = (PageTable*)Kernel::instance().kernel_mm().phys2Virt(
+        pte_paddr(curPgdVirt->entries[pd_index]));
+    return pt->entries[pt_index(virt_addr)] & 0xFFF; // 返回标志位
 }
 
 // 设置页表项标志位
 void PageManager::setPageFlags(uint32_t virt_addr, uint32_t flags)
 {
-    uint32_t pd_index = virt_addr >> 22;
-    uint32_t pt_index = (virt_addr >> 12) & 0x3FF;
+    uint32_t pd_index = pgd_index(virt_addr);
 
     if(!curPgdVirt || !(curPgdVirt->entries[pd_index] & 0x1)) {
         return; // 页目录项不存在
     }
 
-    PageTable* pt = reinterpret_cast<PageTable*>(curPgdVirt->entries[pd_index] & 0xFFFFF000);
-    uint32_t entry = pt->entries[pt_index];
+    auto* pt = (PageTable*)Kernel::instance().kernel_mm().phys2Virt(
+        pte_paddr(curPgdVirt->entries[pd_index]));
+    pte_t entry = pt->entries[pt_index(virt_addr)];
     if(entry & 0x1) { // 如果页面存在
-        pt->entries[pt_index] = (entry & 0xFFFFF000) | (flags & 0xFFF);
+        pt->entries[pt_index(virt_addr)] = (entry & ~static_cast<pte_t>(0xFFF)) | (flags & 0xFFF);
+        invlpg(virt_addr);
     }
 }
 
@@ -193,64 +322,85 @@ void PageManager::disablePaging()
 int PageManager::copyMemorySpaceCOW(PageDirectory* src, PageDirectory* dstPgd)
 {
     auto& kernel_mm = Kernel::instance().kernel_mm();
-    for(int i = 0; i < 1024; i++) {
+    for(uint32_t i = 0; i < PTRS_PER_PGD; i++) {
         dstPgd->entries[i] = 0x00000000; // Supervisor, read, not present
     }
     // 前4M空间
-    dstPgd->entries[0] = src->entries[0];
+    for(uint32_t i = 0; i < pgd_index(0x400000); i++) {
+        dstPgd->entries[i] = src->entries[i];
+    }
 
     // 映射0xC0000000后896MB空间, 页表是已经存在的
-    uint32_t kernelPteStart = 0xC0000000 >> 22;
-    for(int j = kernelPteStart; j < kernelPteStart + K_PAGE_TABLE_COUNT; j++) {
+    uint32_t kernelPteStart = pgd_index(0xC0000000);
+    for(uint32_t j = kernelPteStart; j < kernelPteStart + K_PAGE_TABLE_COUNT; j++) {
+        dstPgd->entries[j] = src->entries[j];
+    }
+
+    // KMAP区域的页表是共享的
+    uint32_t kmapPteStart = pgd_index(KMAP_START);
+    for(uint32_t j = kmapPteStart; j < kmapPteStart + K_KMAP_PT_COUNT; j++) {
+        dstPgd->entries[j] = src->entries[j];
+    }
+
+    // VMALLOC区域的页表也是共享的
+    uint32_t vmallocPteStart = pgd_index(VMALLOC_START);
+    for(uint32_t j = vmallocPteStart; j < vmallocPteStart + K_VMALLOC_PT_COUNT; j++) {
         dstPgd->entries[j] = src->entries[j];
     }
 
     // 映射APIC区域 (0xFEC00000 - 0xFEEFFFFF)
     constexpr uint32_t APIC_START = 0xFEC00000;
     constexpr uint32_t APIC_END = 0xFEEFFFFF;
-    uint32_t pd_index = APIC_START >> 22;
-    log_debug("APIC_START pd_index:0x%x\n", pd_index);
-    auto src_pt_paddr = src->entries[pd_index] & 0xFFFFF000;
-    auto dst_pt_paddr = Kernel::instance().kernel_mm().alloc_pages(0, 0); // order=0表示分配单个页面
-    log_debug("src_pt_paddr:0x%x, dst_pt_paddr:0x%x\n", src_pt_paddr, dst_pt_paddr);
-    PageTable* dst_pt = (PageTable*)kernel_mm.phys2Virt(dst_pt_paddr);
-    PageTable* src_pt = (PageTable*)kernel_mm.phys2Virt(src_pt_paddr);
-    memcpy(dst_pt, src_pt, 4096);
-    dstPgd->entries[pd_index] = dst_pt_paddr | 0x3; // Supervisor, read/write, present, cache disabled
+    for(uint32_t pd_index = pgd_index(APIC_START); pd_index <= pgd_index(APIC_END); pd_index++) {
+        log_debug("APIC_START pd_index:0x%x\n", pd_index);
+        auto src_pt_paddr = pte_paddr(src->entries[pd_index]);
+        auto dst_pt_paddr = kernel_mm.alloc_pages(0, 0); // order=0表示分配单个页面
+        log_debug("src_pt_paddr:0x%x, dst_pt_paddr:0x%x\n", (uint32_t)src_pt_paddr,
+            (uint32_t)dst_pt_paddr);
+        PageTable* dst_pt = (PageTable*)kernel_mm.phys2Virt(dst_pt_paddr);
+        PageTable* src_pt = (PageTable*)kernel_mm.phys2Virt(src_pt_paddr);
+        memcpy(dst_pt, src_pt, 4096);
+        dstPgd->entries[pd_index] = dst_pt_paddr | 0x3; // Supervisor, read/write, present, cache disabled
+    }
 
 
     // 复制用户空间页表项并设置COW标志
-    uint32_t userPteStart = USER_START >> 22;
-    uint32_t userPteEnd = USER_END >> 22;
+    uint32_t userPteStart = pgd_index(USER_START);
+    uint32_t userPteEnd = pgd_index(USER_END);
     for(uint32_t pde_idx = userPteStart; pde_idx < userPteEnd; pde_idx++) {
         // 复制所有页目录项（包含present和非present）
         dstPgd->entries[pde_idx] = src->entries[pde_idx];
 
         // 仅处理存在的页表
         if(src->entries[pde_idx] & PAGE_PRESENT) {
-            auto src_pt_paddr = src->entries[pde_idx] & 0xFFFFF000;
+            auto src_pt_paddr = pte_paddr(src->entries[pde_idx]);
             if (src_pt_paddr > 896 * 1024*1024) {
-                log_err("PageManager: src_pt_paddr 0x%x, pde_idx:%d, pde:0x%x \n", src_pt_paddr, pde_idx, src->entries[pde_idx]);
+                log_err("PageManager: src_pt_paddr 0x%x, pde_idx:%d, pde:0x%x \n",
+                    (uint32_t)src_pt_paddr, pde_idx, (uint32_t)src->entries[pde_idx]);
                 continue;
             }
-            auto dst_pt_paddr = Kernel::instance().kernel_mm().alloc_pages(0, 0); // order=0表示分配单个页面
-            log_debug("src_pt_paddr:0x%x, dst_pt_paddr:0x%x\n", src_pt_paddr, dst_pt_paddr);
+            auto dst_pt_paddr = kernel_mm.alloc_pages(0, 0); // order=0表示分配单个页面
             PageTable* dst_pt = (PageTable*)kernel_mm.phys2Virt(dst_pt_paddr);
             PageTable* src_pt = (PageTable*)kernel_mm.phys2Virt(src_pt_paddr);
 
             // 复制所有页表项
             log_debug("copyMemorySpaceCOW: src_pt:%x, dst_pt:%x\n", src_pt, dst_pt);
-            for(uint32_t pte_idx = 0; pte_idx < 1024; pte_idx++) {
-                // 如果是可写页面，设置COW标志
-                if(src_pt->entries[pte_idx] & PAGE_WRITE) {
+            for(uint32_t pte_idx = 0; pte_idx < PTRS_PER_PT; pte_idx++) {
+                // 如果是可写的私有页面，设置COW标志，共享映射两边继续写同一个页面
+                if((src_pt->entries[pte_idx] & PAGE_PRESENT) &&
+                    (src_pt->entries[pte_idx] & PAGE_WRITE) &&
+                    !(src_pt->entries[pte_idx] & PAGE_SHARED)) {
                     // 清除原页面的可写标志
-                    src_pt->entries[pte_idx] &= ~PAGE_WRITE;
+                    src_pt->entries[pte_idx] &= ~static_cast<pte_t>(PAGE_WRITE);
                     // 设置COW标志位（假设PAGE_COW是第9位）
                     src_pt->entries[pte_idx] |= PAGE_COW;
-
-                    // 增加物理页引用计数
-                    uint32_t phys_addr = src_pt->entries[pte_idx] & 0xFFFFF000;
-                    Kernel::instance().kernel_mm().increment_ref_count(phys_addr);
+                }
+                // 子进程也引用了这个物理页，只读页面（如文件映射的页缓存页）同样要计数
+                if(src_pt->entries[pte_idx] & PAGE_PRESENT) {
+                    kernel_mm.increment_ref_count(pte_paddr(src_pt->entries[pte_idx]));
+                } else if(pte_is_swap(src_pt->entries[pte_idx])) {
+                    // 换出的页面两边共享同一个交换槽位
+                    SwapManager::dup_entry(src_pt->entries[pte_idx]);
                 }
                 // 复制修改后的条目到新页表
                 dst_pt->entries[pte_idx] = src_pt->entries[pte_idx];
@@ -265,26 +415,32 @@ int PageManager::copyMemorySpaceCOW(PageDirectory* src, PageDirectory* dstPgd)
 
 void PagingValidate(PageDirectory * pd)
 {
-    for (int i = 0; i < 1024; i++) {
+    for (uint32_t i = 0; i < PTRS_PER_PGD; i++) {
         if (pd->entries[i] & 0x1) {
-            PADDR pt_paddr = pd->entries[i] & 0xFFFFF000;
+            PADDR pt_paddr = pte_paddr(pd->entries[i]);
             if(pt_paddr > 896*1024*1024) {
-                log_err("PageManager: pt_paddr 0x%x, pd_index:%d, pde:0x%x \n", pt_paddr, i, pd->entries[i]);
+                log_err("PageManager: pt_paddr 0x%x, pd_index:%d, pde:0x%x \n", (uint32_t)pt_paddr,
+                    i, (uint32_t)pd->entries[i]);
                 continue;
             }
             PageTable* pt = (PageTable*)Kernel::instance().kernel_mm().phys2Virt(pt_paddr);
             uint32_t pt_virt = (uint32_t)pt;
             if(pt_virt < USER_START && pt_virt > 0x500000) {
-                log_err("PageManager: pt_paddr 0x%x, pd_index:%d, pde:0x%x \n", pt_paddr, i, pd->entries[i]);
+                log_err("PageManager: pt_paddr 0x%x, pd_index:%d, pde:0x%x \n", (uint32_t)pt_paddr,
+                    i, (uint32_t)pd->entries[i]);
                 continue;
             }
-            for (int j = 0; j < 1024; j++) {
+            for (uint32_t j = 0; j < PTRS_PER_PT; j++) {
                 if (pt->entries[j] & 0x1) {
-                    uint32_t phys_addr = pt->entries[j] & 0xFFFFF000;
-                    uint32_t virt_addr = (i << 22) | (j << 12);
-                    if (phys_addr > 896 * 1024*1024 && phys_addr != virt_addr) {
+                    PADDR phys_addr = pte_paddr(pt->entries[j]);
+                    uint32_t virt_addr = (i << PGD_SHIFT) | (j << 12);
+                    // 高端内存页只能属于用户空间或KMAP区域
+                    bool highmem_ok = (virt_addr >= USER_START && virt_addr < USER_END) ||
+                        (virt_addr >= KMAP_START && virt_addr < KMAP_END) ||
+                        (virt_addr >= VMALLOC_START && virt_addr < VMALLOC_END);
+                    if (phys_addr > 896 * 1024*1024 && phys_addr != virt_addr && !highmem_ok) {
                         log_err("PagingValidte error: virt_addr: 0x%x, phys_addr: 0x%x\n", virt_addr,
-                        phys_addr);
+                        (uint32_t)phys_addr);
                     }
 
                 }
@@ -292,7 +448,7 @@ void PagingValidate(PageDirectory * pd)
         }
     }
 }
-void printPTEFlags(uint32_t pte)
+void printPTEFlags(pte_t pte)
 {
     // constexpr uint32_t PAGE_PRESENT = 0x1;        // 页面存在 (位0)
     // constexpr uint32_t PAGE_WRITE = 0x2;          // 可写 (位1)
@@ -322,6 +478,10 @@ void printPTEFlags(uint32_t pte)
     log_debug("dirty : %d\n", dirty);
     log_debug("global : %d\n", global);
     log_debug("cow : %d\n", cow);
+#ifdef CONFIG_PAE
+    bool nx = pte & PAGE_NX;
+    log_debug("nx : %d\n", nx);
+#endif
 }
 void __printPDPTE(VADDR vaddr, PageDirectory* pdVirt)
 {
@@ -329,17 +489,17 @@ void __printPDPTE(VADDR vaddr, PageDirectory* pdVirt)
     auto pdPhys = Kernel::instance().kernel_mm().virt2Phys(pdVirt);
 
     auto fault_addr = (uint32_t)vaddr;
-    auto pd_index = (fault_addr >> 22) & 0x3FF;
-    auto pde = pdVirt->entries[fault_addr >> 22];
-    auto pt_phys = pde & 0xFFFFF000;
+    auto pd_index = pgd_index(fault_addr);
+    auto pde = pdVirt->entries[pd_index];
+    auto pt_phys = pte_paddr(pde);
     auto pt_virt = (PageTable*)Kernel::instance().kernel_mm().phys2Virt(pt_phys);
-    auto pt_index = (fault_addr >> 12) & 0x3FF;
-    auto pte = pt_virt->entries[pt_index];
-    auto phys = pte & 0xFFFFF000;
-    log_debug("PD: 0x%x(phys:0x%x), PD index:%d(0x%x), PDE:0x%x\n", pdVirt, pdPhys, pd_index,
-        pd_index, pde);
-    log_debug("PT: 0x%x(phys:0x%x), PT index:%d(0x%x), PTE:0x%x, phys:0x%x\n", pt_virt, pt_phys,
-        pt_index, pt_index, pte, phys);
+    auto pte_index = pt_index(fault_addr);
+    auto pte = pt_virt->entries[pte_index];
+    auto phys = pte_paddr(pte);
+    log_debug("PD: 0x%x(phys:0x%x), PD index:%d(0x%x), PDE:0x%x\n", pdVirt, (uint32_t)pdPhys,
+        pd_index, pd_index, (uint32_t)pde);
+    log_debug("PT: 0x%x(phys:0x%x), PT index:%d(0x%x), PTE:0x%x, phys:0x%x\n", pt_virt,
+        (uint32_t)pt_phys, pte_index, pte_index, (uint32_t)pte, (uint32_t)phys);
     printPTEFlags(pte);
 }
 
@@ -347,24 +507,24 @@ void printPD(PageDirectory* pdVirt, uint32_t startIndex, uint32_t count)
 {
     for(uint32_t i = startIndex; i < startIndex + count; i++) {
         auto pde = pdVirt->entries[i];
-        log_debug("PDE: 0x%x\n", pde);
+        log_debug("PDE: 0x%x\n", (uint32_t)pde);
     }
 }
 
 void printPDE(PageDirectory* pdVirt, uint32_t index)
 {
     auto pde = pdVirt->entries[index];
-    log_debug("PDE: 0x%x\n", pde);
-    log_debug("  Present:      %d\n",  pde & 0x1);
-    log_debug("  RW:           %d\n", (pde >> 1) & 0x1);
-    log_debug("  User/Super:   %d\n", (pde >> 2) & 0x1);
-    log_debug("  PWT:          %d\n", (pde >> 3) & 0x1);
-    log_debug("  PCD:          %d\n", (pde >> 4) & 0x1);
-    log_debug("  Accessed:     %d\n", (pde >> 5) & 0x1);
-    log_debug("  Dirty:        %d\n", (pde >> 6) & 0x1);
-    log_debug("  Page Size:    %d\n", (pde >> 7) & 0x1);
-    log_debug("  Global:       %d\n", (pde >> 8) & 0x1);
-    log_debug("  Addr:      0x%x\n", (pde >> 12));
+    log_debug("PDE: 0x%x\n", (uint32_t)pde);
+    log_debug("  Present:      %d\n", (uint32_t)(pde & 0x1));
+    log_debug("  RW:           %d\n", (uint32_t)((pde >> 1) & 0x1));
+    log_debug("  User/Super:   %d\n", (uint32_t)((pde >> 2) & 0x1));
+    log_debug("  PWT:          %d\n", (uint32_t)((pde >> 3) & 0x1));
+    log_debug("  PCD:          %d\n", (uint32_t)((pde >> 4) & 0x1));
+    log_debug("  Accessed:     %d\n", (uint32_t)((pde >> 5) & 0x1));
+    log_debug("  Dirty:        %d\n", (uint32_t)((pde >> 6) & 0x1));
+    log_debug("  Page Size:    %d\n", (uint32_t)((pde >> 7) & 0x1));
+    log_debug("  Global:       %d\n", (uint32_t)((pde >> 8) & 0x1));
+    log_debug("  Addr:      0x%x\n", (uint32_t)(pde >> 12));
 }
 
 void printPDPTE(VADDR vaddr)
@@ -0,0 +1,229 @@
+#include "kernel/shm.h"
+#include "arch/x86/fpu.h"
+#include "kernel/kernel.h"
+#include "kernel/process.h"
+#include "kernel/syscall.h"
+#include "kernel/user_memory.h"
+#include "lib/debug.h"
+#include "lib/string.h"
+
+ShmObject ShmManager::objects[MAX_SHM_OBJECTS];
+uint32_t ShmManager::next_gen;
+static DEFINE_LOCK_CLASS(shm_lock_class, "shm");
+SpinLock ShmManager::lock(&shm_lock_class);
+
+ShmObject* ShmManager::lookup(const char* name)
+{
+    for(uint32_t i = 0; i < MAX_SHM_OBJECTS; i++) {
+        if(objects[i].used && objects[i].linked &&
+            strncmp(objects[i].name, name, ShmObject::NAME_LEN) == 0) {
+            return &objects[i];
+        }
+    }
+    return nullptr;
+}
+
+PADDR* ShmManager::alloc_pages(uint32_t nr_pages)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    auto pages = new PADDR[nr_pages];
+    if(!pages) {
+        return nullptr;
+    }
+    // 共享页面内核只在创建时清零，可以放在高端内存
+    for(uint32_t i = 0; i < nr_pages; i++) {
+        pages[i] = kernel_mm.alloc_pages(GFP_HIGHUSER, 0);
+        void* virt = pages[i] ? kernel_mm.kmap(pages[i]) : nullptr;
+        if(!virt) {
+            // 只释放已经分配到的页，kmap失败的这一页也要释放
+            if(pages[i]) {
+                kernel_mm.free_pages(pages[i], 0);
+            }
+            free_pages(pages, i);
+            return nullptr;
+        }
+        arch::clear_page(virt);
+        kernel_mm.kunmap(virt);
+    }
+    return pages;
+}
+
+void ShmManager::free_pages(PADDR* pages, uint32_t nr_pages)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    for(uint32_t i = 0; i < nr_pages; i++) {
+        kernel_mm.free_pages(pages[i], 0);
+    }
+    delete[] pages;
+}
+
+int ShmManager::install(const char* name, PADDR* pages, uint32_t nr_pages)
+{
+    uint32_t id = 0;
+    while(id < MAX_SHM_OBJECTS && objects[id].used) {
+        id++;
+    }
+    if(id == MAX_SHM_OBJECTS) {
+        return -1;
+    }
+
+    auto& obj = objects[id];
+    obj.nr_pages = nr_pages;
+    obj.size = nr_pages * PAGE_SIZE;
+    obj.pages = pages;
+    strncpy(obj.name, name, ShmObject::NAME_LEN - 1);
+    obj.name[ShmObject::NAME_LEN - 1] = '\0';
+    obj.refs = 1; // 名字的引用
+    // 代数从1开始，0留给shm_handles里没有打开的项
+    if(++next_gen == 0) {
+        next_gen = 1;
+    }
+    obj.gen = next_gen;
+    obj.linked = true;
+    obj.used = true;
+    return id;
+}
+
+int ShmManager::open(const char* name, uint32_t size, uint32_t flags, Context& ctx)
+{
+    if(!name || !name[0]) {
+        return -1;
+    }
+    uint32_t irq_flags;
+    lock.acquire_irqsave(irq_flags);
+    auto obj = lookup(name);
+    if(obj) {
+        int id = -1;
+        if(!((flags & SHM_CREAT) && (flags & SHM_EXCL))) {
+            id = obj - objects;
+            ctx.shm_handles[id] = obj->gen;
+        }
+        lock.release_irqrestore(irq_flags);
+        return id;
+    }
+    lock.release_irqrestore(irq_flags);
+    if(!(flags & SHM_CREAT)) {
+        return -1;
+    }
+
+    // size为0或者按页向上取整时溢出
+    uint32_t nr_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if(nr_pages == 0) {
+        log_err("ShmManager: invalid size %u\n", size);
+        return -1;
+    }
+    // 分配和清零物理页不持有lock，装进槽位前再查一次名字，别的进程可能同时创建了同名对象
+    PADDR* pages = alloc_pages(nr_pages);
+    if(!pages) {
+        log_err("ShmManager: out of memory, name:%s, size:%d\n", name, size);
+        return -1;
+    }
+    lock.acquire_irqsave(irq_flags);
+    int id = -1;
+    obj = lookup(name);
+    if(obj) {
+        if(!(flags & SHM_EXCL)) {
+            id = obj - objects;
+            ctx.shm_handles[id] = obj->gen;
+        }
+    } else {
+        id = install(name, pages, nr_pages);
+        if(id >= 0) {
+            ctx.shm_handles[id] = objects[id].gen;
+            pages = nullptr;
+        }
+    }
+    lock.release_irqrestore(irq_flags);
+    if(pages) {
+        if(!obj) {
+            log_err("ShmManager: too many shm objects\n");
+        }
+        free_pages(pages, nr_pages);
+    } else {
+        log_debug("ShmManager: created %s, id:%d, pages:%d\n", name, id, nr_pages);
+    }
+    return id;
+}
+
+void* ShmManager::map(int id, Context& ctx)
+{
+    if(id < 0 || id >= (int)MAX_SHM_OBJECTS) {
+        return nullptr;
+    }
+    // 句柄检查和取引用在lock里完成，之后对象不会被释放，映射不持有lock
+    uint32_t irq_flags;
+    lock.acquire_irqsave(irq_flags);
+    auto& obj = objects[id];
+    if(!obj.used || ctx.shm_handles[id] != obj.gen) {
+        lock.release_irqrestore(irq_flags);
+        log_debug("ShmManager: process %d has not opened shm %d\n", ctx.context_id, id);
+        return nullptr;
+    }
+    obj.refs++;
+    lock.release_irqrestore(irq_flags);
+
+    auto& user_mm = ctx.user_mm;
+    auto start = (uint32_t)user_mm.allocate_area(obj.size, PAGE_WRITE, MEM_TYPE_SHARED);
+    if(!start) {
+        lock.acquire_irqsave(irq_flags);
+        put(obj);
+        lock.release_irqrestore(irq_flags);
+        return nullptr;
+    }
+    auto area = user_mm.find_area(start);
+    area->file = &obj;
+    area->shared = true;
+
+    // 共享页面直接映射，PAGE_SHARED让fork后的进程继续共享而不是COW
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    for(uint32_t i = 0; i < obj.nr_pages; i++) {
+        kernel_mm.increment_ref_count(obj.pages[i]);
+        user_mm.map_pages(start + i * PAGE_SIZE, obj.pages[i], PAGE_SIZE, PAGE_WRITE | PAGE_SHARED);
+    }
+    return (void*)start;
+}
+
+int ShmManager::unmap(void* addr, UserMemory& user_mm)
+{
+    auto area = user_mm.find_area((uint32_t)addr);
+    if(!area || area->type != MEM_TYPE_SHARED || area->start_addr != (uint32_t)addr) {
+        return -1;
+    }
+    auto obj = static_cast<ShmObject*>(area->file);
+    // free_area会释放每个页面上本映射持有的引用，这个映射的refs保证对象还在
+    user_mm.free_area((uint32_t)addr);
+    uint32_t irq_flags;
+    lock.acquire_irqsave(irq_flags);
+    put(*obj);
+    lock.release_irqrestore(irq_flags);
+    return 0;
+}
+
+int ShmManager::unlink(const char* name)
+{
+    uint32_t irq_flags;
+    lock.acquire_irqsave(irq_flags);
+    auto obj = lookup(name);
+    if(!obj) {
+        lock.release_irqrestore(irq_flags);
+        return -1;
+    }
+    obj->linked = false;
+    put(*obj);
+    lock.release_irqrestore(irq_flags);
+    return 0;
+}
+
+void ShmManager::put(ShmObject& obj)
+{
+    if(--obj.refs > 0) {
+        return;
+    }
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    for(uint32_t i = 0; i < obj.nr_pages; i++) {
+        kernel_mm.decrement_ref_count(obj.pages[i]);
+    }
+    log_debug("ShmManager: released %s, pages:%d\n", obj.name, obj.nr_pages);
+    delete[] obj.pages;
+    memset(&obj, 0, sizeof(obj));
+}
@@ -8,7 +8,8 @@
 
 namespace kernel {
 
-static SpinLock slab_global_lock;
+static DEFINE_LOCK_CLASS(slab_lock_class, "slab");
+static SpinLock slab_global_lock(&slab_lock_class);
 
 class Locker
 {
@@ -0,0 +1,607 @@
+#include "kernel/swap.h"
+#include "arch/x86/percpu.h"
+#include "kernel/kernel.h"
+#include "kernel/process.h"
+#include "kernel/task_group.h"
+#include "kernel/user_memory.h"
+#include "lib/debug.h"
+#include "lib/string.h"
+
+using kernel::list_head;
+
+kernel::BlockDevice* SwapManager::device = nullptr;
+static DEFINE_LOCK_CLASS(swap_lock_class, "swap");
+SpinLock SwapManager::lock(&swap_lock_class);
+uint8_t* SwapManager::slot_refs = nullptr;
+uint32_t* SwapManager::io_bitmap = nullptr;
+kernel::WaitQueue SwapManager::io_wq;
+uint32_t SwapManager::nr_slots = 0;
+uint32_t SwapManager::next_slot = 1;
+SwapManager::CacheEntry SwapManager::cache[CACHE_SIZE];
+uint32_t SwapManager::cache_next = 0;
+SwapManager::Stats SwapManager::counters;
+
+// mkswap写在第0块的头部，布局和Linux的swap_header一致，魔数在这一页的最后10个字节
+struct SwapHeader {
+    uint8_t bootbits[1024];
+    uint32_t version;
+    uint32_t last_page;
+    uint32_t nr_badpages;
+    uint8_t uuid[16];
+    char label[16];
+};
+static constexpr char SWAP_MAGIC[] = "SWAPSPACE2";
+static constexpr uint32_t SWAP_MAGIC_LEN = 10;
+
+bool SwapManager::activate(kernel::BlockDevice* dev)
+{
+    if(!dev || active()) {
+        return false;
+    }
+    if(dev->block_size() != PAGE_SIZE) {
+        log_err("SwapManager: block size %d is not page size\n", dev->block_size());
+        return false;
+    }
+    auto buf = new uint8_t[PAGE_SIZE];
+    if(!buf) {
+        return false;
+    }
+    bool ok = dev->read_block(0, buf) &&
+              memcmp(buf + PAGE_SIZE - SWAP_MAGIC_LEN, SWAP_MAGIC, SWAP_MAGIC_LEN) == 0;
+    auto header = reinterpret_cast<SwapHeader*>(buf);
+    uint32_t version = header->version;
+    uint32_t last_page = header->last_page;
+    delete[] buf;
+    if(!ok || version != 1 || last_page == 0) {
+        log_err("SwapManager: no swap signature found\n");
+        return false;
+    }
+
+    // 头部记录的大小不能超过设备容量
+    auto& info = dev->get_info();
+    uint32_t dev_pages = info.total_sectors / (PAGE_SIZE / info.sector_size);
+    if(last_page >= dev_pages) {
+        last_page = dev_pages - 1;
+    }
+    if(last_page > MAX_SLOTS) {
+        log_info("SwapManager: only using %d of %d swap pages\n", MAX_SLOTS, last_page);
+        last_page = MAX_SLOTS;
+    }
+    slot_refs = new uint8_t[last_page + 1];
+    if(!slot_refs) {
+        return false;
+    }
+    memset(slot_refs, 0, last_page + 1);
+    io_bitmap = new uint32_t[last_page / 32 + 1];
+    if(!io_bitmap) {
+        delete[] slot_refs;
+        slot_refs = nullptr;
+        return false;
+    }
+    memset(io_bitmap, 0, (last_page / 32 + 1) * sizeof(uint32_t));
+
+    uint32_t flags;
+    lock.acquire_irqsave(flags);
+    nr_slots = last_page;
+    next_slot = 1;
+    counters.total_slots = nr_slots;
+    device = dev;
+    lock.release_irqrestore(flags);
+    log_info("SwapManager: activated %d KiB swap space\n", nr_slots * 4);
+    return true;
+}
+
+uint32_t SwapManager::alloc_slot()
+{
+    if(counters.used_slots >= nr_slots) {
+        return 0;
+    }
+    // 从上次分配的位置往后找，连续换出的页面落在相邻的槽位上，换入时可以一起预读
+    for(uint32_t i = 0; i < nr_slots; i++) {
+        uint32_t slot = next_slot;
+        next_slot = slot == nr_slots ? 1 : slot + 1;
+        // 已经释放但还在读写的槽位不能重新分配
+        if(!slot_refs[slot] && !io_busy(slot)) {
+            slot_refs[slot] = 1;
+            counters.used_slots++;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+void SwapManager::put_slot(uint32_t slot)
+{
+    if(slot == 0 || slot > nr_slots || !slot_refs[slot]) {
+        log_err("SwapManager: bad swap slot %d\n", slot);
+        return;
+    }
+    if(--slot_refs[slot] == 0) {
+        counters.used_slots--;
+        cache_drop(slot);
+    }
+}
+
+void SwapManager::dup_entry(pte_t pte)
+{
+    uint32_t slot = swap_pte_slot(pte);
+    uint32_t flags;
+    lock.acquire_irqsave(flags);
+    if(slot == 0 || slot > nr_slots || !slot_refs[slot] || slot_refs[slot] == 0xFF) {
+        log_err("SwapManager: cannot duplicate swap slot %d\n", slot);
+    } else {
+        slot_refs[slot]++;
+    }
+    lock.release_irqrestore(flags);
+}
+
+void SwapManager::free_entry(pte_t pte)
+{
+    uint32_t flags;
+    lock.acquire_irqsave(flags);
+    put_slot(swap_pte_slot(pte));
+    lock.release_irqrestore(flags);
+}
+
+bool SwapManager::io_busy(uint32_t slot)
+{
+    return __atomic_load_n(&io_bitmap[slot / 32], __ATOMIC_ACQUIRE) & (1u << (slot % 32));
+}
+
+void SwapManager::start_io(uint32_t slot)
+{
+    __atomic_or_fetch(&io_bitmap[slot / 32], 1u << (slot % 32), __ATOMIC_ACQ_REL);
+}
+
+void SwapManager::end_io(uint32_t slot)
+{
+    // 在io_wq的锁里清掉标记再唤醒，wait_io检查标记和挂上队列不会错过唤醒
+    uint32_t flags;
+    io_wq.lock.acquire_irqsave(flags);
+    __atomic_and_fetch(&io_bitmap[slot / 32], ~(1u << (slot % 32)), __ATOMIC_ACQ_REL);
+    io_wq.wake_all(0);
+    io_wq.lock.release_irqrestore(flags);
+}
+
+void SwapManager::wait_io(uint32_t slot)
+{
+    uint32_t flags;
+    io_wq.lock.acquire_irqsave(flags);
+    while(io_busy(slot)) {
+        // 所有槽位共用一个队列，醒来后重新检查自己的槽位
+        if(kernel::WaitQueue::can_block()) {
+            io_wq.block(flags);
+        } else {
+            io_wq.wait(flags);
+        }
+        io_wq.lock.acquire_irqsave(flags);
+    }
+    io_wq.lock.release_irqrestore(flags);
+}
+
+bool SwapManager::read_slot(uint32_t slot, PADDR page)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    void* virt = kernel_mm.kmap(page);
+    if(!virt) {
+        return false;
+    }
+    bool ok = device->read_block(slot, virt);
+    kernel_mm.kunmap(virt);
+    return ok;
+}
+
+bool SwapManager::write_slot(uint32_t slot, PADDR page)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    void* virt = kernel_mm.kmap(page);
+    if(!virt) {
+        return false;
+    }
+    bool ok = device->write_block(slot, virt);
+    kernel_mm.kunmap(virt);
+    return ok;
+}
+
+PADDR SwapManager::cache_take(uint32_t slot)
+{
+    for(uint32_t i = 0; i < CACHE_SIZE; i++) {
+        if(cache[i].page && cache[i].slot == slot) {
+            PADDR page = cache[i].page;
+            cache[i].page = 0;
+            return page;
+        }
+    }
+    return 0;
+}
+
+bool SwapManager::cache_contains(uint32_t slot)
+{
+    for(uint32_t i = 0; i < CACHE_SIZE; i++) {
+        if(cache[i].page && cache[i].slot == slot) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SwapManager::cache_insert(uint32_t slot, PADDR page)
+{
+    uint32_t idx = cache_next;
+    for(uint32_t i = 0; i < CACHE_SIZE; i++) {
+        if(!cache[i].page) {
+            idx = i;
+            break;
+        }
+    }
+    if(cache[idx].page) {
+        // 缓存满了，替换最早预读进来的页面，槽位上的数据还在，不需要写回
+        Kernel::instance().kernel_mm().free_pages(cache[idx].page, 0);
+        cache_next = (cache_next + 1) % CACHE_SIZE;
+    }
+    cache[idx].slot = slot;
+    cache[idx].page = page;
+}
+
+void SwapManager::cache_drop(uint32_t slot)
+{
+    PADDR page = cache_take(slot);
+    if(page) {
+        Kernel::instance().kernel_mm().free_pages(page, 0);
+    }
+}
+
+uint32_t SwapManager::cache_shrink()
+{
+    uint32_t freed = 0;
+    for(uint32_t i = 0; i < CACHE_SIZE; i++) {
+        if(cache[i].page) {
+            Kernel::instance().kernel_mm().free_pages(cache[i].page, 0);
+            cache[i].page = 0;
+            freed++;
+        }
+    }
+    return freed;
+}
+
+void SwapManager::readahead(uint32_t slot)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    // 内存已经紧张时不预读，免得预读的页面把别的页面挤出去
+    if(kernel_mm.normal_free_pages() + kernel_mm.highmem_free_pages() < READAHEAD_MIN_FREE) {
+        return;
+    }
+    uint32_t first = slot & ~(CLUSTER_SLOTS - 1);
+    for(uint32_t s = first; s < first + CLUSTER_SLOTS; s++) {
+        uint32_t flags;
+        lock.acquire_irqsave(flags);
+        bool skip = s == slot || s == 0 || s > nr_slots || !slot_refs[s] || io_busy(s) ||
+                    cache_contains(s);
+        if(!skip) {
+            start_io(s);
+        }
+        lock.release_irqrestore(flags);
+        if(skip) {
+            continue;
+        }
+        PADDR page = kernel_mm.alloc_pages(GFP_HIGHUSER, 0);
+        bool ok = page && read_slot(s, page);
+        lock.acquire_irqsave(flags);
+        // 读盘期间槽位可能已经被释放
+        if(ok && slot_refs[s]) {
+            cache_insert(s, page);
+            counters.readahead++;
+            page = 0;
+        }
+        lock.release_irqrestore(flags);
+        end_io(s);
+        if(page) {
+            kernel_mm.free_pages(page, 0);
+        }
+        if(!ok) {
+            break;
+        }
+    }
+}
+
+int SwapManager::swap_in(UserMemory& user_mm, uint32_t vaddr)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    uint32_t page_addr = vaddr & ~0xFFF;
+    uint32_t flags;
+    pte_t* pte;
+    pte_t entry;
+    uint32_t slot;
+    lock.acquire_irqsave(flags);
+    while(true) {
+        pte = user_mm.find_pte(page_addr);
+        if(!pte || !pte_is_swap(*pte)) {
+            // 同一进程的其他任务已经换入，或者换出失败恢复了原来的映射
+            lock.release_irqrestore(flags);
+            return E_OK;
+        }
+        entry = *pte;
+        slot = swap_pte_slot(entry);
+        if(!device || slot == 0 || slot > nr_slots || !slot_refs[slot]) {
+            lock.release_irqrestore(flags);
+            log_err("SwapManager: bad swap entry 0x%x at 0x%x\n", (uint32_t)entry, vaddr);
+            return E_PANIC;
+        }
+        // 别的任务正在换入这个槽位，或者换出还没有写完，等它结束再重新检查页表项
+        if(!io_busy(slot)) {
+            break;
+        }
+        lock.release_irqrestore(flags);
+        wait_io(slot);
+        lock.acquire_irqsave(flags);
+    }
+
+    // 确认页面确实要换入以后才记到任务组上
+    if(!kernel::task_group_try_charge(user_mm.group(), 1)) {
+        lock.release_irqrestore(flags);
+        return E_LIMIT;
+    }
+
+    // 槽位只被这一个页表项引用时才能直接拿走缓存页，否则其他引用者还要用它
+    PADDR page = slot_refs[slot] == 1 ? cache_take(slot) : 0;
+    if(page) {
+        counters.readahead_hits++;
+        counters.swap_ins++;
+        put_slot(slot);
+        user_mm.map_pages(page_addr, page, PAGE_SIZE, swap_pte_prot(entry) | PAGE_USER, true);
+        lock.release_irqrestore(flags);
+        return E_OK;
+    }
+
+    // 读盘不持有锁
+    start_io(slot);
+    lock.release_irqrestore(flags);
+    int ret = E_OK;
+    page = kernel_mm.alloc_pages(GFP_HIGHUSER, 0);
+    if(!page) {
+        ret = E_NOMEM;
+    } else if(!read_slot(slot, page)) {
+        log_err("SwapManager: failed to read swap slot %d\n", slot);
+        ret = E_PANIC;
+    }
+
+    // 读盘期间页表项可能已经被解除映射，槽位引用随之放掉，只在页表项没有变化时映射
+    bool mapped = false;
+    lock.acquire_irqsave(flags);
+    pte = user_mm.find_pte(page_addr);
+    if(ret == E_OK && pte && *pte == entry) {
+        counters.swap_ins++;
+        put_slot(slot);
+        user_mm.map_pages(page_addr, page, PAGE_SIZE, swap_pte_prot(entry) | PAGE_USER, true);
+        mapped = true;
+    }
+    lock.release_irqrestore(flags);
+    end_io(slot);
+    if(!mapped) {
+        kernel::task_group_charge_pages(user_mm.group(), -1);
+        if(page) {
+            kernel_mm.free_pages(page, 0);
+        }
+        return ret;
+    }
+    readahead(slot);
+    return E_OK;
+}
+
+// 进程是否有任务正在别的CPU上运行，那个CPU上可能缓存着页表项
+static bool running_elsewhere(Context* ctx)
+{
+    auto& scheduler = Kernel::instance().scheduler();
+    int cpu = arch::get_cpu_id();
+    list_for_each(entry, &ctx->tasks) {
+        int running = scheduler.running_cpu(list_entry(entry, Task, ctx_node));
+        if(running >= 0 && running != cpu) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SwapManager::prepare_evict(Context* ctx, uint32_t vaddr, pte_t* pte, bool current, Evict& ev)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    auto& mm = ctx->user_mm;
+    pte_t entry = *pte;
+    PADDR page = pte_paddr(entry);
+
+    // 只换出进程私有的匿名页：文件页和共享内存有自己的后备，COW页和零页被多个映射共享
+    if(!(entry & PAGE_USER) || (entry & (PAGE_COW | PAGE_SHARED))) {
+        return false;
+    }
+    auto area = mm.find_area(vaddr);
+    if(area && (area->type == MEM_TYPE_MMAP_FILE || area->type == MEM_TYPE_SHARED ||
+                   area->type == MEM_TYPE_DEVICE)) {
+        return false;
+    }
+    if(page == kernel_mm.zero_page() || kernel_mm.page_ref_count(page) != 1) {
+        return false;
+    }
+    uint32_t slot = alloc_slot();
+    if(!slot) {
+        return false;
+    }
+
+    // 先换成交换项再写盘，写盘期间进程访问这一页会在swap_in里等槽位写完
+    *pte = make_swap_pte(slot, entry);
+    if(current) {
+        asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+    }
+    start_io(slot);
+    ProcessManager::mm_grab(ctx);
+    ev = {ctx, vaddr, entry, slot, false, false};
+    return true;
+}
+
+bool SwapManager::finish_evict(Evict& ev, bool commit)
+{
+    auto& mm = ev.ctx->user_mm;
+    PADDR page = pte_paddr(ev.entry);
+    pte_t* pte = mm.find_pte(ev.vaddr);
+    bool mapped = pte && *pte == make_swap_pte(ev.slot, ev.entry);
+    bool freed = true;
+    if(mapped && commit) {
+        counters.swap_outs++;
+    } else if(mapped) {
+        // 恢复原来的映射，页面还没有释放，通过旧TLB项的写入不会丢失
+        *pte = ev.entry;
+        put_slot(ev.slot);
+        freed = false;
+    }
+    // 写盘期间被解除映射的页面也不再被引用，槽位引用已经由free_entry放掉
+    if(freed) {
+        mm.account_rss(ev.vaddr, page, -1);
+        Kernel::instance().kernel_mm().decrement_ref_count(page);
+    }
+    ev.done = true;
+    end_io(ev.slot);
+    return freed && mapped;
+}
+
+uint32_t SwapManager::scan_context(Context* ctx, Evict* batch, uint32_t max, bool current)
+{
+    auto& mm = ctx->user_mm;
+    uint32_t queued = 0;
+    uint32_t scanned = 0;
+    uint32_t walked = 0; // 走过的地址范围，转完一圈就停
+    uint32_t addr = mm.clock_hand;
+    while(walked < USER_END - USER_START && scanned < SCAN_BATCH && queued < max) {
+        if(addr < USER_START || addr >= USER_END) {
+            addr = USER_START;
+        }
+        pte_t* pte = mm.find_pte(addr);
+        if(!pte) {
+            // 整个页表都不存在，直接跳到下一个页目录项
+            uint32_t next = (addr & ~((1u << PGD_SHIFT) - 1)) + (1u << PGD_SHIFT);
+            walked += next - addr;
+            addr = next;
+            continue;
+        }
+        if(*pte & PAGE_PRESENT) {
+            scanned++;
+            if(*pte & PAGE_ACCESSED) {
+                // 最近访问过，清掉访问位再给一次机会，CPU下次填TLB时会重新置位
+                *pte &= ~(pte_t)PAGE_ACCESSED;
+                if(current) {
+                    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+                }
+            } else if(prepare_evict(ctx, addr, pte, current, batch[queued])) {
+                queued++;
+            }
+        }
+        addr += PAGE_SIZE;
+        walked += PAGE_SIZE;
+    }
+    mm.clock_hand = addr;
+    counters.scanned += scanned;
+    return queued;
+}
+
+struct SwapManager::ReclaimScan {
+    uint32_t target;  // 这一轮最多换出的页数，不超过RECLAIM_BATCH
+    uint32_t count;   // batch里的页数
+    uint32_t freed;
+    Context* current;
+    kernel::TaskGroup* group;
+    Evict batch[RECLAIM_BATCH];
+};
+
+void SwapManager::reclaim_context(Context* ctx, void* arg)
+{
+    auto scan = static_cast<ReclaimScan*>(arg);
+    if(scan->count >= scan->target || ctx->killed || ctx == ProcessManager::kernel_context ||
+        (scan->group && ctx->user_mm.group() != scan->group)) {
+        return;
+    }
+    // 别的CPU上的TLB项没法通知刷新，跳过正在别处运行的进程
+    if(running_elsewhere(ctx)) {
+        return;
+    }
+    uint32_t flags;
+    lock.acquire_irqsave(flags);
+    scan->count += scan_context(
+        ctx, scan->batch + scan->count, scan->target - scan->count, ctx == scan->current);
+    lock.release_irqrestore(flags);
+}
+
+void SwapManager::finish_context(Context* ctx, void* arg)
+{
+    auto scan = static_cast<ReclaimScan*>(arg);
+    // 检查之后进程可能刚在别的CPU上开始运行，并在换成交换项之前缓存了页表项，这时恢复映射
+    bool elsewhere = running_elsewhere(ctx);
+    uint32_t flags;
+    lock.acquire_irqsave(flags);
+    for(uint32_t i = 0; i < scan->count; i++) {
+        auto& ev = scan->batch[i];
+        if(ev.ctx == ctx && !ev.done && finish_evict(ev, ev.written && !elsewhere)) {
+            scan->freed++;
+        }
+    }
+    lock.release_irqrestore(flags);
+}
+
+uint32_t SwapManager::write_batch(ReclaimScan& scan)
+{
+    for(uint32_t i = 0; i < scan.count; i++) {
+        scan.batch[i].written = write_slot(scan.batch[i].slot, pte_paddr(scan.batch[i].entry));
+    }
+    // 进程表锁里确认结果，running_elsewhere要遍历进程的任务链表
+    ProcessManager::for_each_context(finish_context, &scan);
+    // 写盘期间离开进程表的进程可能还有任务在运行，不释放页面，恢复映射
+    uint32_t flags;
+    lock.acquire_irqsave(flags);
+    for(uint32_t i = 0; i < scan.count; i++) {
+        if(!scan.batch[i].done) {
+            finish_evict(scan.batch[i], false);
+        }
+    }
+    lock.release_irqrestore(flags);
+    for(uint32_t i = 0; i < scan.count; i++) {
+        ProcessManager::mm_drop(scan.batch[i].ctx);
+    }
+    scan.count = 0;
+    return scan.freed;
+}
+
+uint32_t SwapManager::reclaim(uint32_t target, kernel::TaskGroup* group)
+{
+    if(!active()) {
+        return 0;
+    }
+    auto task = ProcessManager::get_current_task();
+    ReclaimScan scan;
+    scan.count = 0;
+    scan.freed = 0;
+    scan.current = task ? task->context : nullptr;
+    scan.group = group;
+    // 第一轮只清掉访问位的页面要到下一轮才能换出。
+    // 每轮在锁里选出页面，不持有锁写盘，写完再回到锁里确认
+    for(uint32_t pass = 0; pass < 3 && scan.freed < target; pass++) {
+        uint32_t left = target - scan.freed;
+        scan.target = left < RECLAIM_BATCH ? left : RECLAIM_BATCH;
+        ProcessManager::for_each_context(reclaim_context, &scan);
+        write_batch(scan);
+    }
+    // 交换缓存里的页面不记在任何组上，收缩它不会降低组的用量
+    if(scan.freed < target && !group) {
+        uint32_t flags;
+        lock.acquire_irqsave(flags);
+        scan.freed += cache_shrink();
+        lock.release_irqrestore(flags);
+    }
+    log_debug("SwapManager: reclaimed %d pages, target:%d\n", scan.freed, target);
+    return scan.freed;
+}
+
+SwapManager::Stats SwapManager::stats()
+{
+    uint32_t flags;
+    lock.acquire_irqsave(flags);
+    Stats s = counters;
+    lock.release_irqrestore(flags);
+    return s;
+}
@@ -1,19 +1,30 @@
 #include <arch/x86/paging.h>
+#include <kernel/fs/PageCache.h>
 #include <kernel/kernel.h>
+#include <kernel/shm.h>
+#include <kernel/swap.h>
+#include <kernel/task_group.h>
 #include <kernel/user_memory.h>
+#include <kernel/vfs.h>
 #include <lib/debug.h>
 #include <lib/string.h>
 
 // 初始化内存管理器
-void UserMemory::init(PADDR page_dir_phys, VADDR page_dir, uint32_t (*alloc_page)(), void (*free_page)(uint32_t),
-    void* (*phys_to_virt)(uint32_t))
+void UserMemory::init(PADDR page_dir_phys, VADDR page_dir, PADDR (*alloc_page)(), void (*free_page)(PADDR),
+    void* (*phys_to_virt)(PADDR))
 {
     pgd = page_dir;
     pgd_phys = page_dir_phys;
+    // 内核页目录使用启动时建好的CR3
+    cr3 = page_dir_phys == PAGE_DIRECTORY_ADDR ? PageManager::kernelCr3()
+                                               : PageManager::makeCr3(page_dir_phys);
     log_debug("pgd:0x%x\n", pgd);
     num_areas = 0;
     total_vm = 0;
     locked_vm = 0;
+    rss_anon = 0;
+    rss_file = 0;
+    clock_hand = USER_START;
     allocate_physical_page = alloc_page;
     free_physical_page = free_page;
     this->phys_to_virt = phys_to_virt;
@@ -41,6 +52,9 @@ void UserMemory::clone(UserMemory& src)
     end_stack = src.end_stack;
     total_vm = src.total_vm;
     locked_vm = src.locked_vm;
+    // 页表按COW复制，两边映射同样的页面
+    rss_anon = src.rss_anon;
+    rss_file = src.rss_file;
 }
 
 // 分配一个新的内存区域
@@ -100,6 +114,9 @@ void* UserMemory::allocate_area(uint32_t size, uint32_t flags, uint32_t type)
     areas[num_areas].end_addr = end;
     areas[num_areas].flags = flags;
     areas[num_areas].type = type;
+    areas[num_areas].file = nullptr;
+    areas[num_areas].file_offset = 0;
+    areas[num_areas].shared = false;
     num_areas++;
 
     log_debug("allocated area, start:0x%x, end:0x%x, size:0x%x\n", start, end, size);
@@ -114,11 +131,11 @@ void* UserMemory::allocate_area(uint32_t size, uint32_t flags, uint32_t type)
     log_debug("total_vm: %d\n", total_vm);
     for(uint32_t i = 0; i < num_pages; i++) {
         uint32_t vaddr = start + (i << 12);
-        uint32_t pde_idx = vaddr >> 22;
-        uint32_t pte_idx = (vaddr >> 12) & 0x3FF;
+        uint32_t pde_idx = pgd_index(vaddr);
+        uint32_t pte_idx = pt_index(vaddr);
 
         // 获取页目录项
-        uint32_t* pde = (uint32_t*)(pgd) + pde_idx;
+        pte_t* pde = (pte_t*)(pgd) + pde_idx;
         if(vaddr == 0x40000000) {
             log_debug("pde_idx: %d\n", pde_idx);
             printPDPTE((void*)vaddr);
@@ -128,24 +145,27 @@ void* UserMemory::allocate_area(uint32_t size, uint32_t flags, uint32_t type)
         // 如果页表不存在，创建新的页表
         if(!(*pde & PAGE_PRESENT)) {
             log_debug("allocating pt\n");
-            uint32_t page_table = allocate_physical_page();
+            PADDR page_table = allocate_physical_page();
             auto virt = phys_to_virt(page_table);
             *pde = page_table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
-            log_debug("pdg:%x, pde:%x, *pde:%x, page_table: %x\n", pgd, pde, *pde, page_table);
+            log_debug("pdg:%x, pde:%x, *pde:%x, page_table: %x\n", pgd, pde, (uint32_t)*pde,
+                (uint32_t)page_table);
             memset((void*)virt, 0, 0x1000);
         }
 
         // 获取页表物理地址并转换为虚拟地址
-        uint32_t page_table = *pde & 0xFFFFF000;
-        uint32_t* page_table_virt = (uint32_t*)phys_to_virt(page_table);
-        uint32_t* pte = &page_table_virt[pte_idx];
+        PADDR page_table = pte_paddr(*pde);
+        pte_t* page_table_virt = (pte_t*)phys_to_virt(page_table);
+        pte_t* pte = &page_table_virt[pte_idx];
         // 页表项已经是虚拟地址，不需要再次转换
-        uint32_t* pte0 = pte;
+        pte_t* pte0 = pte;
 
         if(type == MEM_TYPE_STACK) {
-            auto phys = (uint32_t)Kernel::instance().kernel_mm().alloc_pages(0, 0); // order=0表示分配单个页面
+            // 栈页面内核只通过用户虚拟地址访问，可以放在高端内存
+            auto phys = Kernel::instance().kernel_mm().alloc_pages(GFP_HIGHUSER, 0); // order=0表示分配单个页面
             // debug_debug("stack virt:0x%x, phys:0x%x\n", vaddr, phys);
             *pte0 = (phys | flags | PAGE_USER | PAGE_WRITE | PAGE_PRESENT);
+            account_rss(vaddr, phys, 1);
             //__printPDPTE( (void*)vaddr, (PageDirectory*)pgd);
         } else {
             // 设置页表项为不存在，但保留权限标志，这样在page
@@ -157,18 +177,56 @@ void* UserMemory::allocate_area(uint32_t size, uint32_t flags, uint32_t type)
     return (void*)start;
 }
 
+void* UserMemory::allocate_file_area(
+    uint32_t size, uint32_t flags, void* file, uint32_t offset, bool shared)
+{
+    if(!file || (offset & (PAGE_SIZE - 1))) {
+        return nullptr;
+    }
+    auto start = allocate_area(size, flags, MEM_TYPE_MMAP_FILE);
+    if(!start) {
+        return nullptr;
+    }
+    // allocate_area总是把新区域放在数组末尾
+    auto& area = areas[num_areas - 1];
+    area.file = file;
+    area.file_offset = offset;
+    area.shared = shared;
+    // 映射持有文件的一个引用，关掉fd以后缺页还要从文件读
+    kernel::get_file(static_cast<kernel::FileDescriptor*>(file));
+    return start;
+}
+
+MemoryArea* UserMemory::find_area(uint32_t addr)
+{
+    for(uint32_t i = 0; i < num_areas; i++) {
+        if(addr >= areas[i].start_addr && addr < areas[i].end_addr) {
+            return &areas[i];
+        }
+    }
+    return nullptr;
+}
+
 // 释放指定地址范围的内存区域
 void UserMemory::free_area(uint32_t start)
 {
 
-    uint32_t size = 0;
     // 查找并移除匹配的内存区域
     for(uint32_t i = 0; i < num_areas; i++) {
         if(areas[i].start_addr == start) {
             // 更新总虚拟内存大小
-            size = areas[i].end_addr - areas[i].start_addr;
+            uint32_t size = areas[i].end_addr - areas[i].start_addr;
             total_vm -= (size + 0xFFF) >> 12;
 
+            // 先解除该区域的页面映射，驻留页统计需要知道区域类型
+            if(areas[i].type == MEM_TYPE_MMAP_FILE && areas[i].shared) {
+                release_shared_writers(areas[i]);
+            }
+            unmap_pages(start, size);
+            if(areas[i].type == MEM_TYPE_MMAP_FILE) {
+                kernel::fdput(static_cast<kernel::FileDescriptor*>(areas[i].file));
+            }
+
             // 移动后续区域
             for(uint32_t j = i; j < num_areas - 1; j++) {
                 areas[j] = areas[j + 1];
@@ -177,9 +235,94 @@ void UserMemory::free_area(uint32_t start)
             break;
         }
     }
+}
+
+// 页缓存写回以后页就是干净的，之后经过可写页表项的写入只留在页表项的脏位上，
+// 解除映射时才交给页缓存的延迟写回
+void UserMemory::release_shared_writers(const MemoryArea& area)
+{
+    auto file = static_cast<kernel::FileDescriptor*>(area.file);
+    for(uint32_t vaddr = area.start_addr; vaddr < area.end_addr; vaddr += PAGE_SIZE) {
+        pte_t* pte = find_pte(vaddr);
+        if(!pte || (*pte & (PAGE_PRESENT | PAGE_WRITE)) != (PAGE_PRESENT | PAGE_WRITE)) {
+            continue;
+        }
+        size_t offset = area.file_offset + (vaddr - area.start_addr);
+        Page* page = file->get_mmap_page(offset);
+        if(page && page->phys == pte_paddr(*pte) && page->shared_writers) {
+            __atomic_sub_fetch(&page->shared_writers, 1, __ATOMIC_RELAXED);
+            if(*pte & PAGE_DIRTY) {
+                file->mark_mmap_dirty(offset);
+            }
+        }
+    }
+}
+
+// 和unmap_pages一样只刷新本CPU的TLB
+void UserMemory::collect_dirty(const MemoryArea& area, uint32_t start, uint32_t end)
+{
+    auto file = static_cast<kernel::FileDescriptor*>(area.file);
+    for(uint32_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+        pte_t* pte = find_pte(vaddr);
+        if(!pte || (*pte & (PAGE_PRESENT | PAGE_WRITE | PAGE_DIRTY)) !=
+                (PAGE_PRESENT | PAGE_WRITE | PAGE_DIRTY)) {
+            continue;
+        }
+        // 脏位在低32位，原子地清掉，不丢掉别的CPU同时置上的访问位
+        __atomic_and_fetch((uint32_t*)pte, ~PAGE_DIRTY, __ATOMIC_SEQ_CST);
+        asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+        file->mark_mmap_dirty(area.file_offset + (vaddr - area.start_addr));
+    }
+}
+
+void UserMemory::release_all()
+{
+    // 共享内存映射要通过ShmManager解除，才能释放对象上的引用
+    while(num_areas > 0) {
+        auto& area = areas[num_areas - 1];
+        if(area.type != MEM_TYPE_SHARED || !area.file ||
+            ShmManager::unmap((void*)area.start_addr, *this) < 0) {
+            free_area(area.start_addr);
+        }
+    }
 
-    // 解除该区域的页面映射
-    unmap_pages(start, size);
+    // 区域之外的用户映射(例如brk扩展的堆)也一起解除，然后释放用户页表
+    for(uint32_t pde_idx = pgd_index(USER_START); pde_idx < pgd_index(USER_END); pde_idx++) {
+        pte_t* pde = (pte_t*)(pgd) + pde_idx;
+        if(!(*pde & PAGE_PRESENT)) {
+            continue;
+        }
+        unmap_pages(pde_idx << PGD_SHIFT, PTRS_PER_PT * PAGE_SIZE);
+        PADDR page_table = pte_paddr(*pde);
+        *pde = 0;
+        free_physical_page(page_table);
+    }
+}
+
+void UserMemory::account_rss(uint32_t vaddr, PADDR paddr, int delta, bool charge)
+{
+    if(vaddr < USER_START || vaddr >= USER_END ||
+        paddr == Kernel::instance().kernel_mm().zero_page()) {
+        return;
+    }
+    auto area = find_area(vaddr);
+    bool file = area && (area->type == MEM_TYPE_MMAP_FILE || area->type == MEM_TYPE_SHARED);
+    arch::atomic_add(file ? &rss_file : &rss_anon, (uint32_t)delta);
+    if(charge) {
+        kernel::task_group_charge_pages(mem_group, delta);
+    }
+}
+
+void UserMemory::set_group(kernel::TaskGroup* group)
+{
+    kernel::TaskGroup* old = mem_group;
+    if(old == group) {
+        return;
+    }
+    mem_group = group;
+    int pages = (int)rss_pages();
+    kernel::task_group_charge_pages(old, -pages);
+    kernel::task_group_charge_pages(group, pages);
 }
 
 // 扩展或收缩堆区
@@ -198,13 +341,20 @@ uint32_t UserMemory::brk(uint32_t new_brk)
     int32_t new_pages = (new_brk - start_heap + 0xFFF) >> 12;
 
     if(new_pages > old_pages) {
-        // 需要扩展堆
-        for(uint32_t addr = end_heap; addr < new_brk; addr += 0x1000) {
+        // 堆页面立即分配，先把新增的页数记到任务组上，超出内存上限时不扩展
+        uint32_t charged = new_pages - old_pages;
+        if(!kernel::task_group_try_charge(mem_group, charged)) {
+            return end_heap;
+        }
+        // 需要扩展堆，从原来最后一个页面之后开始，和记账的页数一致
+        for(int32_t i = old_pages; i < new_pages; i++) {
             // 分配物理页面并建立映射
-            uint32_t phys_page = allocate_physical_page();
-            if(!map_pages(addr, phys_page, 0x1000, PAGE_USER | PAGE_WRITE)) {
+            PADDR phys_page = allocate_physical_page();
+            if(!map_pages(start_heap + (i << 12), phys_page, 0x1000, PAGE_USER | PAGE_WRITE, true)) {
+                kernel::task_group_charge_pages(mem_group, -(int)charged);
                 return end_heap;
             }
+            charged--;
         }
     } else if(new_pages < old_pages) {
         // 需要收缩堆
@@ -216,38 +366,47 @@ uint32_t UserMemory::brk(uint32_t new_brk)
 }
 
 // 映射物理页面到虚拟地址空间
-bool UserMemory::map_pages(uint32_t virt_addr, uint32_t phys_addr, uint32_t size, uint32_t flags)
+bool UserMemory::map_pages(
+    uint32_t virt_addr, PADDR phys_addr, uint32_t size, pte_t flags, bool charged)
 {
     uint32_t num_pages = (size + 0xFFF) >> 12;
+    if(!PageManager::nxEnabled()) {
+        flags &= ~PAGE_NX;
+    }
 
     for(uint32_t i = 0; i < num_pages; i++) {
         uint32_t vaddr = virt_addr + (i << 12);
-        uint32_t paddr = phys_addr + (i << 12);
+        PADDR paddr = phys_addr + (i << 12);
 
         // 获取页目录项和页表项的索引
-        uint32_t pde_idx = vaddr >> 22;
-        uint32_t pte_idx = (vaddr >> 12) & 0x3FF;
+        uint32_t pde_idx = pgd_index(vaddr);
+        uint32_t pte_idx = pt_index(vaddr);
 
         // 获取页目录项
-        uint32_t* pde = (uint32_t*)(pgd + (pde_idx << 2));
+        pte_t* pde = (pte_t*)(pgd) + pde_idx;
 
         // 如果页表不存在，创建新的页表
         if(!(*pde & PAGE_PRESENT)) {
-            uint32_t page_table = allocate_physical_page();
+            PADDR page_table = allocate_physical_page();
             auto virt = phys_to_virt(page_table);
             *pde = page_table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
             memset((void*)virt, 0, 0x1000);
         }
 
         // 获取页表物理地址并转换为虚拟地址
-        uint32_t page_table = *pde & 0xFFFFF000;
-        uint32_t* page_table_virt = (uint32_t*)phys_to_virt(page_table);
-        uint32_t* pte = &page_table_virt[pte_idx];
+        PADDR page_table = pte_paddr(*pde);
+        pte_t* page_table_virt = (pte_t*)phys_to_virt(page_table);
+        pte_t* pte = &page_table_virt[pte_idx];
         // 页表项已经是虚拟地址，不需要再次转换
-        uint32_t* pte0 = pte;
+        pte_t* pte0 = pte;
 
+        // 替换已有映射时(例如COW)先减掉旧页面
+        if(*pte0 & PAGE_PRESENT) {
+            account_rss(vaddr, pte_paddr(*pte0), -1);
+        }
         // 建立页表项映射，确保用户态权限
         *pte0 = paddr | (flags | PAGE_USER) | PAGE_PRESENT;
+        account_rss(vaddr, paddr, 1, !charged);
     }
 
     return true;
@@ -262,29 +421,44 @@ void UserMemory::unmap_pages(uint32_t virt_addr, uint32_t size)
         uint32_t vaddr = virt_addr + (i << 12);
 
         // 获取页目录项和页表项的索引
-        uint32_t pde_idx = vaddr >> 22;
-        uint32_t pte_idx = (vaddr >> 12) & 0x3FF;
+        uint32_t pde_idx = pgd_index(vaddr);
+        uint32_t pte_idx = pt_index(vaddr);
 
         // 获取页目录项
-        uint32_t* pde = (uint32_t*)(pgd + (pde_idx << 2));
+        pte_t* pde = (pte_t*)(pgd) + pde_idx;
 
         if(*pde & PAGE_PRESENT) {
             // 获取页表物理地址并转换为虚拟地址
-            uint32_t page_table = *pde & 0xFFFFF000;
-            uint32_t* page_table_virt = (uint32_t*)phys_to_virt(page_table);
-            uint32_t* pte = &page_table_virt[pte_idx];
-            uint32_t* pte0 = pte;
+            PADDR page_table = pte_paddr(*pde);
+            pte_t* page_table_virt = (pte_t*)phys_to_virt(page_table);
+            pte_t* pte = &page_table_virt[pte_idx];
+            pte_t* pte0 = pte;
 
-            // 清除页表项
+            // 清除页表项，页面可能被fork后的进程或页缓存共享，只释放本映射的引用
             if(*pte0 & PAGE_PRESENT) {
-                uint32_t phys_page = *pte0 & 0xFFFFF000;
-                free_physical_page(phys_page);
+                PADDR phys_page = pte_paddr(*pte0);
+                account_rss(vaddr, phys_page, -1);
+                Kernel::instance().kernel_mm().decrement_ref_count(phys_page);
+                *pte0 = 0;
+                asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+            } else if(pte_is_swap(*pte0)) {
+                SwapManager::free_entry(*pte0);
                 *pte0 = 0;
             }
         }
     }
 }
 
+pte_t* UserMemory::find_pte(uint32_t vaddr)
+{
+    pte_t* pde = (pte_t*)(pgd) + pgd_index(vaddr);
+    if(!(*pde & PAGE_PRESENT)) {
+        return nullptr;
+    }
+    pte_t* page_table_virt = (pte_t*)phys_to_virt(pte_paddr(*pde));
+    return &page_table_virt[pt_index(vaddr)];
+}
+
 // 查找最大的连续空闲区域
 uint32_t UserMemory::find_largest_free_area()
 {
@@ -332,9 +506,14 @@ bool UserMemory::copyFrom(const UserMemory& src)
             continue;
         }
         memcpy(&areas[i], &src.areas[i], sizeof(MemoryArea));
+        if(areas[i].type == MEM_TYPE_MMAP_FILE) {
+            kernel::get_file(static_cast<kernel::FileDescriptor*>(areas[i].file));
+        }
     }
     total_vm = src.total_vm;
     locked_vm = src.locked_vm;
+    rss_anon = src.rss_anon;
+    rss_file = src.rss_file;
     return true;
 }
 void UserMemory::print()
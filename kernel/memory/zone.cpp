@@ -5,18 +5,17 @@
 #include "kernel/kernel_memory.h"
 #include "lib/debug.h"
 
-Zone::Zone()
+Zone::Zone() : type(ZoneType::ZONE_NORMAL), zone_start_pfn(0), zone_end_pfn(0), size(0)
 {
     // 初始化水位标记
 }
 
-void Zone::init(ZoneType type, uint32_t start_pfn, uint32_t end_pfn)
+void Zone::init(ZoneType type, uint32_t start_pfn, uint32_t end_pfn, void* meta)
 {
     this->type = type;
     zone_start_pfn = start_pfn;
     zone_end_pfn = end_pfn;
     size = end_pfn - start_pfn;
-    nr_free_pages = end_pfn - start_pfn;
     // 初始化区域的其他资源
     // 这里可以添加额外的初始化逻辑
     watermark[static_cast<int>(WatermarkLevel::WMARK_MIN)] = size / 16; // 6.25%
@@ -24,23 +23,30 @@ void Zone::init(ZoneType type, uint32_t start_pfn, uint32_t end_pfn)
     watermark[static_cast<int>(WatermarkLevel::WMARK_HIGH)] = size / 4; // 25%
 
     // 初始化伙伴系统分配器
-    buddy_allocator.init(zone_start_pfn * 4096, size * 4096);
+    buddy_allocator.init(zone_start_pfn, size, meta);
+}
+
+void Zone::addFreeRange(uint32_t start_pfn, uint32_t end_pfn)
+{
+    if(start_pfn >= zone_end_pfn || end_pfn <= zone_start_pfn) {
+        return;
+    }
+    buddy_allocator.add_free_range(start_pfn, end_pfn);
+}
+
+uint32_t Zone::metaBytes(uint32_t start_pfn, uint32_t end_pfn)
+{
+    return BuddyAllocator::meta_bytes(end_pfn - start_pfn);
 }
 
 uint32_t Zone::allocPages(uint32_t gfp_mask, uint32_t order)
 {
     uint32_t count = 1 << order;
-    if(count > nr_free_pages) {
+    if(count > getFreePages()) {
         return 0; // 返回0表示分配失败
     }
 
-    uint32_t allocated_addr = buddy_allocator.allocate_pages(gfp_mask, order);
-    if(allocated_addr == 0) {
-        return 0;
-    }
-
-    nr_free_pages -= count;
-    return allocated_addr / 4096; // 转换为页帧号
+    return buddy_allocator.allocate_pages(gfp_mask, order);
 }
 
 void Zone::freePages(uint32_t pfn, uint32_t order)
@@ -51,8 +57,7 @@ void Zone::freePages(uint32_t pfn, uint32_t order)
         return;
     }
 
-    buddy_allocator.free_pages(pfn * 4096, order);
-    nr_free_pages += count;
+    buddy_allocator.free_pages(pfn, order);
 }
 
 void Zone::decRefPage(uint32_t pfn)
@@ -60,7 +65,7 @@ void Zone::decRefPage(uint32_t pfn)
     if(pfn < zone_start_pfn || pfn >= zone_end_pfn) {
         return;
     }
-    buddy_allocator.decrement_ref_count(pfn * 4096);
+    buddy_allocator.decrement_ref_count(pfn);
 }
 
 void Zone::increment_ref_count(uint32_t pfn)
@@ -68,14 +73,14 @@ void Zone::increment_ref_count(uint32_t pfn)
     if(pfn < zone_start_pfn || pfn >= zone_end_pfn) {
         return;
     }
-    buddy_allocator.increment_ref_count(pfn * 4096);
+    buddy_allocator.increment_ref_count(pfn);
 }
 
 
 
 uint32_t Zone::getFreePages() const
 {
-    return nr_free_pages;
+    return buddy_allocator.free_page_count();
 }
 
 void Zone::setWatermark(WatermarkLevel level, uint32_t value)
@@ -93,7 +98,7 @@ uint32_t Zone::getWatermark(WatermarkLevel level) const
 
 bool Zone::isWatermarkReached(WatermarkLevel level) const
 {
-    return nr_free_pages <= watermark[static_cast<int>(level)];
+    return getFreePages() <= watermark[static_cast<int>(level)];
 }
 
 bool Zone::migratePagesTo(Zone* target, uint32_t count)
@@ -103,7 +108,7 @@ bool Zone::migratePagesTo(Zone* target, uint32_t count)
         return false;
     }
 
-    if(!target || count > nr_free_pages || count > target->size - target->nr_free_pages) {
+    if(!target || count > getFreePages() || count > target->size - target->getFreePages()) {
         return false;
     }
 
@@ -0,0 +1,61 @@
+#include "kernel/kthread.h"
+
+#include <kernel/kernel.h>
+#include <kernel/process.h>
+#include <lib/debug.h>
+
+namespace kernel {
+
+// 所有内核线程的入口，线程函数和参数在Task里
+static void kthread_entry()
+{
+    Task* self = ProcessManager::get_current_task();
+    kthread_exit(self->thread_fn(self->thread_arg));
+}
+
+Task* kthread_create(kthread_fn_t fn, void* arg, const char* name)
+{
+    Task* task = ProcessManager::kernel_task(
+        ProcessManager::kernel_context, name, (uint32_t)kthread_entry, 0, nullptr);
+    if(!task->stacks.kernel_stack) {
+        log_err("kthread_create: no kernel stack for %s\n", name);
+        return nullptr;
+    }
+    task->thread_fn = fn;
+    task->thread_arg = arg;
+    return task;
+}
+
+void kthread_bind(Task* task, uint32_t cpu)
+{
+    task->affinity = 1u << cpu;
+}
+
+void kthread_start(Task* task)
+{
+    // 运行队列的锁不关中断，本CPU的中断里也会加这个锁
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    Kernel::instance().scheduler().enqueue_task(task, arch::get_cpu_id(), ENQUEUE_NEW);
+    asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+Task* kthread_run(kthread_fn_t fn, void* arg, const char* name)
+{
+    Task* task = kthread_create(fn, arg, name);
+    if(task) {
+        kthread_start(task);
+    }
+    return task;
+}
+
+void kthread_exit(int status)
+{
+    asm volatile("cli");
+    Task* self = ProcessManager::get_current_task();
+    self->exit_status = status;
+    self->state = EXITED;
+    ProcessManager::exit_current();
+}
+
+} // namespace kernel
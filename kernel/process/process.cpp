@@ -5,13 +5,17 @@
 #include <lib/console.h>
 
 #include "arch/x86/gdt.h"
+#include "arch/x86/percpu.h"
 #include "kernel/process.h"
 #include <cstdint>
 #include <kernel/kernel.h>
+#include <kernel/rcu.h>
 #include <kernel/scheduler.h>
 #include <lib/debug.h>
 #include <lib/string.h>
 
+using kernel::list_head;
+
 uint32_t PidManager::pid_bitmap[(PidManager::MAX_PID + 31) / 32];
 
 int32_t PidManager::alloc()
@@ -22,7 +26,8 @@ int32_t PidManager::alloc()
                 uint32_t mask = 1 << j;
                 if(!(pid_bitmap[i] & mask)) {
                     pid_bitmap[i] |= mask;
-                    return i * 32 + j;
+                    // 0号保留，和free里的pid--对应
+                    return i * 32 + j + 1;
                 }
             }
         }
@@ -65,11 +70,22 @@ Context* ProcessManager::create_context(const char* name)
 
     auto context = new Context();
     context->context_id = pid;
-
+    register_context(context);
 
     return context;
 }
 
+static void sleep_timer_fn(kernel::timer_list* timer)
+{
+    ProcessManager::wake_up(container_of(timer, Task, sleep_timer));
+}
+
+static enum kernel::hrtimer_restart sleep_hrtimer_fn(kernel::hrtimer* timer)
+{
+    ProcessManager::wake_up(container_of(timer, Task, sleep_hrtimer));
+    return kernel::HRTIMER_NORESTART;
+}
+
 // 初始化进程详细信息
 Task* ProcessManager::kernel_task(
     Context* context, const char* name, uint32_t entry, uint32_t argc, char* argv[])
@@ -83,10 +99,13 @@ Task* ProcessManager::kernel_task(
     task->context = context;
 
     task->state = PROCESS_READY;
-    task->priority = 0;
-    task->time_slice = DEFAULT_TIME_SLICE;
+    task->priority = kernel::DEFAULT_PRIO;
+    task->se.set_prio(task->priority);
     task->total_time = 0; // 新进程从0开始计时
     task->exit_status = 0;
+    kernel::timer_setup(&task->sleep_timer, sleep_timer_fn);
+    kernel::hrtimer_init(&task->sleep_hrtimer, sleep_hrtimer_fn);
+    kernel::INIT_LIST_HEAD(&task->group_node);
 
     // 清理用户栈
     task->stacks.user_stack = 0;
@@ -106,10 +125,15 @@ Task* ProcessManager::kernel_task(
     task->regs.esp = task->stacks.esp0;
     task->regs.ebp = task->stacks.ebp0;
 
-    task->regs.cr3 = 0x400000;
+    task->regs.cr3 = PageManager::kernelCr3();
 
     task->alloc_stack(kernel_mm);
 
+    uint32_t flags;
+    context_lock.acquire_irqsave(flags);
+    kernel::list_add_tail(&task->ctx_node, &context->tasks);
+    context_lock.release_irqrestore(flags);
+
     // 复制进程名称
     for(int i = 0; i < PROCNAME_LEN && name[i]; i++) {
         task->name[i] = name[i];
@@ -121,12 +145,10 @@ Task* ProcessManager::kernel_task(
     // appendPCB((PCB*)pPcb);
     return task;
 }
-int Context::allocate_fd()
+Context::Context()
 {
-    auto ret = next_fd;
-    log_debug("allocate_fd: %x\n", ret);
-    next_fd++;
-    return ret;
+    kernel::INIT_LIST_HEAD(&tasks);
+    kernel::INIT_LIST_HEAD(&node);
 }
 
 kernel::ConsoleFS ProcessManager::console_fs;
@@ -165,6 +187,14 @@ void Context::print()
 void Context::cloneFiles(Context* source)
 {
     memcpy(fd_table, source->fd_table, sizeof(fd_table));
+    // 两个进程的fd表各持有一个引用
+    for(auto file : fd_table) {
+        if(file) {
+            kernel::get_file(file);
+        }
+    }
+    // 共享内存句柄不持有引用，直接复制
+    memcpy(shm_handles, source->shm_handles, sizeof(shm_handles));
 }
 
 
@@ -181,26 +211,26 @@ void Context::cloneMemorySpace(Context* source)
 
     // 使用COW方式复制内存空间
     auto parent_pgd = source->user_mm.getPageDirectory();
-    auto paddr = kernel_mm.alloc_pages(0, 0); // gfp_mask = 0, order = 0 (1 page)
-    log_debug("alloc page at 0x%x\n", paddr);
+    auto paddr = kernel_mm.alloc_pages(0, PGD_ORDER); // PAE下页目录占4页
+    log_debug("alloc page at 0x%x\n", (uint32_t)paddr);
     auto child_pgd = kernel_mm.phys2Virt(paddr);
     log_debug("child_pgd: 0x%x\n", child_pgd);
     PagingValidate((PageDirectory*)parent_pgd);
     log_info("Copying memory space\n");
     kernel_mm.paging().copyMemorySpaceCOW((PageDirectory*)parent_pgd, (PageDirectory*)child_pgd);
-    log_debug("Copying page at 0x%x\n", paddr);
+    log_debug("Copying page at 0x%x\n", (uint32_t)paddr);
     user_mm.init(
         paddr, child_pgd,
         []() {
             auto page = Kernel::instance().kernel_mm().alloc_pages(
                 0, 0); // gfp_mask = 0, order = 0 (1 page)
-            log_debug("ProcessManager: Allocated Page at %x\n", page);
+            log_debug("ProcessManager: Allocated Page at %x\n", (uint32_t)page);
             return page;
         },
-        [](uint32_t physAddr) {
+        [](PADDR physAddr) {
             Kernel::instance().kernel_mm().free_pages(physAddr, 0);
         }, // order=0表示释放单个页面
-        [](uint32_t physAddr) {
+        [](PADDR physAddr) {
             return (void*)Kernel::instance().kernel_mm().phys2Virt(physAddr);
         });
 }
@@ -209,7 +239,8 @@ void Context::cloneMemorySpace(Context* source)
 void Task::print()
 {
     log_info("Process: %s (PID: %d), pcb_addr:0x%x\n", name, task_id, this);
-    log_info("  State: %d, Priority: %d, Time: %d/%d\n", state, priority, total_time, time_slice);
+    log_info("  State: %d, Priority: %d, Time: %d, vruntime: %u\n", state, priority, total_time,
+        (uint32_t)se.vruntime);
 
     regs.print();
     stacks.print();
@@ -218,12 +249,29 @@ void Task::print()
 void Task::alloc_stack(KernelMemory& kernel_mm)
 {
     stacks.ss0 = KERNEL_DS;
-    auto kernel_stack = kernel_mm.kmalloc(KERNEL_STACK_SIZE);
+    // 重复调用时先释放旧栈，它会进入本CPU的缓存，紧接着就被取回来
+    free_stack(kernel_mm);
+    auto kernel_stack = kernel_mm.kstacks().alloc();
+    if(!kernel_stack) {
+        log_err("Task: failed to allocate kernel stack, tid:%d\n", task_id);
+        return;
+    }
     stacks.kernel_stack = kernel_stack;
     stacks.esp0 = (uint32_t)kernel_stack + KERNEL_STACK_SIZE - 16;
     stacks.ebp0 = stacks.esp0;
 }
 
+void Task::free_stack(KernelMemory& kernel_mm)
+{
+    if(!stacks.kernel_stack) {
+        return;
+    }
+    kernel_mm.kstacks().free(stacks.kernel_stack);
+    stacks.kernel_stack = nullptr;
+    stacks.esp0 = 0;
+    stacks.ebp0 = 0;
+}
+
 int Task::allocUserStack()
 {
     auto& mm = context->user_mm;
@@ -323,128 +371,198 @@ int ProcessManager::fork()
     return 0;
 }
 
-// 切换到下一个进程
+// 切换过程中的上一个任务，切换完成后在新任务的栈上由finish_switch读取
+DEFINE_PER_CPU(Task*, switch_prev);
+// CR3里装着的用户地址空间，内核任务运行时保持不变
+DEFINE_PER_CPU(Context*, active_mm);
+DEFINE_PER_CPU(ProcessManager::SwitchStats, switch_stats_percpu);
+
+// 切换到下一个进程，调用方已关中断
 bool ProcessManager::schedule()
 {
+    auto cpu = arch::get_cpu_id();
     auto current = get_current_task();
-    if(current && --current->time_slice > 0) {
-        //debug_debug("time_slice %d\n", current->time_slice);
+    auto& scheduler = Kernel::instance().scheduler();
+    bool exiting = current && current->state == EXITED;
+    // 睡眠和退出的任务不能继续运行，不管有没有重新调度标记都要切走
+    bool blocked = exiting || (current && current->state == PROCESS_SLEEPING);
+    // 时钟中断或唤醒设置了重新调度标记才切换；RCU读侧临界区里不抢占，等退出以后的下一次检查
+    if(current && !blocked && (kernel::rcu_read_lock_held() || !scheduler.need_resched())) {
         return false;
     }
-    auto next = Kernel::instance().scheduler().pick_next_task();
+    auto next = scheduler.pick_next_task();
+    // 在运行队列里等待时被杀死的任务，没有在任何CPU上运行，直接回收
+    while(next && next != current && next->state == EXITED) {
+        // 可能刚在别的CPU上被杀死、切走，等它离开自己的内核栈
+        while(__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+            asm volatile("pause");
+        }
+        reap(next);
+        next = scheduler.pick_next_task();
+    }
     if(!next || next == current) {
         return false;
     }
-    auto cpu = arch::apic_get_id();
+    // 运行队列已经空了，当前任务还能在这个CPU上运行就继续运行，不切到idle；
+    // 任务组被限流的任务切到idle，由put_prev_task挂到组上
+    if(!blocked && next == scheduler.get_idle_task()
+        && (!current || (scheduler.cpu_allowed(current, cpu) && !scheduler.task_throttled(current)))) {
+        return false;
+    }
     // log_debug("got next task: %d(0x%x, pre_cpu:%d), cpu: %d\n", next->task_id, next, next->cpu, cpu);
-    // debug_debug("schedule: current: %d, next:%d(0x%x)\n", current->task_id, next->task_id, next);
-    current->time_slice = DEFAULT_TIME_SLICE;
-    Kernel::instance().scheduler().enqueue_task(current);
-    Kernel::instance().scheduler().set_current_task(next);
+    if(exiting) {
+        // 被杀死时正在这个CPU上运行的进程，用户内存留到现在释放，此时CR3还是它的
+        if(current->context->killed) {
+            uint32_t flags;
+            context_lock.acquire_irqsave(flags);
+            current->context->user_mm.release_all();
+            context_lock.release_irqrestore(flags);
+        }
+        zombies[cpu] = current;
+    }
+    scheduler.put_prev_task(current);
+    // next可能是别的CPU刚换下来放回队列的任务，等那个CPU离开它的内核栈
+    while(__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+    next->on_cpu = true;
+    arch::fpu_switch(current, next);
+    scheduler.set_current_task(next);
+    switch_mm(current, next);
+    GDT::updateTSS(cpu, next->stacks.esp0, KERNEL_DS);
+    if(next->cpu != (int)cpu) {
+        log_trace("switching task: prev: %d, next:%d, prev cpu:%d, cur cpu:%d\n",
+            current ? current->task_id : 0, next->task_id, next->cpu, cpu);
+    }
+    next->cpu = cpu;
+    if(!next->kernel_esp) {
+        prepare_stack(next);
+    }
     debug.is_task_switch = true;
     debug.cur_task = next;
     debug.prev_task = current;
+    this_cpu_write(switch_prev, current);
+    kernel::rcu_note_context_switch();
+    uint32_t boot_esp;
+    // 只换内核栈，current再被选中时从这里返回，可能已经在另一个CPU上
+    switch_to(current ? &current->kernel_esp : &boot_esp, next->kernel_esp);
+    finish_switch();
     return true;
 }
 
-// 保存当前进程的寄存器状态（由中断处理程序调用）
-void ProcessManager::save_context(uint32_t int_num, uint32_t* esp)
-{
-    // if (current_pid == 0) return;
-
-    Task* current = Kernel::instance().scheduler().get_current_task();
-    auto& regs = current->regs;
-    // 从中断栈中获取寄存器状态
-    regs.eax = esp[7]; // pushad的顺序：eax,ecx,edx,ebx,esp,ebp,esi,edi
-    regs.ecx = esp[6];
-    regs.edx = esp[5];
-    regs.ebx = esp[4];
-    regs.esp = esp[3];
-    regs.ebp = esp[2];
-    regs.esi = esp[1];
-    regs.edi = esp[0];
-
-    // 获取eflags和eip（从中断栈中）
-    regs.eflags = esp[14]; // 中断栈：gs,fs,es,ds,pushad,vector,error,eip,cs,eflags
-    regs.cs = esp[13];
-    regs.eip = esp[12];
-
-    // 保存段寄存器
-    regs.ds = esp[8];
-    regs.es = esp[9];
-    regs.fs = esp[10];
-    regs.gs = esp[11];
-    if((regs.cs != 0x08 && regs.cs != 0x1b) || regs.ds == 0) {
-        log_debug("cs 0x%x, ds 0x%x, int 0x%x\n", regs.cs, regs.ds, int_num);
-        current->print();
-        current->debug_status |= DEBUG_STATUS_HALT;
-    }
-    // debug_debug("save context\n");
-    // current->print();
-
-    // debug_debug("saved context\n");
-    // current->print();
-}
-
-// 恢复新进程的寄存器状态（由中断处理程序调用）
-void ProcessManager::restore_context(uint32_t int_num, uint32_t* esp)
-{
-    //中断返回的可以是用户态，也可能是内核态
-    // 内核态的典型场景是内核在执行idle任务。
-
-    Task* next = get_current_task();
-    auto& regs = next->regs;
-
-    // 恢复通用寄存器
-    esp[7] = regs.eax;
-    esp[6] = regs.ecx;
-    esp[5] = regs.edx;
-    esp[4] = regs.ebx;
-    esp[3] = regs.esp;
-    esp[2] = regs.ebp;
-    esp[1] = regs.esi;
-    esp[0] = regs.edi;
-
-    // 恢复eflags和eip
-    esp[14] = regs.eflags;
-    esp[13] = regs.cs;
-    esp[12] = regs.eip;
-
-    if(regs.cs != 0x08 && regs.cs != 0x1b) {
-        log_debug("cs error 0x%x, int_num 0x%x\n", regs.cs, int_num);
-        next->print();
-        if(next->debug_status & DEBUG_STATUS_HALT) {
-            while(true) {
-                asm volatile("hlt");
-            }
-        }
+void ProcessManager::finish_switch()
+{
+    auto cpu = arch::get_cpu_id();
+    Task* prev = this_cpu_read(switch_prev);
+    this_cpu_write(switch_prev, nullptr);
+    // 从这里开始别的CPU可以切换到prev，唤醒方也可以把它放回运行队列
+    if(prev) {
+        __atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
+    }
+    // 上一次在这个CPU上退出的任务，已经不在它的内核栈上了
+    if(zombies[cpu]) {
+        reap(zombies[cpu]);
+        zombies[cpu] = nullptr;
     }
-    next->debug_status = 0;
+    // 被抢占的实时任务已经离开内核栈，可以推给别的CPU了
+    Kernel::instance().scheduler().post_switch();
+}
 
-    // 恢复段寄存器
-    if(regs.ds ==0) {
-        log_debug("ds error 0x%x, int_num 0x%x\n", regs.ds, int_num);
-        next->print();
+void ProcessManager::yield()
+{
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    Kernel::instance().scheduler().yield();
+    schedule();
+    asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+void ProcessManager::prepare_stack(Task* task)
+{
+    auto& regs = task->regs;
+    auto sp = (uint32_t*)task->stacks.esp0;
+    // 和interrupt.asm里SAVE_REGS_FOR_CONTEXT_SWITCH保存的帧一样，从高地址往低地址压
+    if(regs.cs & 3) {
+        *--sp = regs.ss;
+        *--sp = regs.esp;
     }
-    esp[8] = regs.ds;
-    esp[9] = regs.es;
-    esp[10] = regs.fs;
-    esp[11] = regs.gs;
-    auto cpu = arch::apic_get_id();
-    GDT::updateTSS(cpu, next->stacks.esp0, KERNEL_DS);
-    GDT::updateTSSCR3(cpu, next->regs.cr3);
+    *--sp = regs.eflags;
+    *--sp = regs.cs;
+    *--sp = regs.eip;
+    *--sp = regs.gs;
+    *--sp = regs.fs;
+    *--sp = regs.es;
+    *--sp = regs.ds;
+    // pushad的顺序：eax,ecx,edx,ebx,esp,ebp,esi,edi
+    *--sp = regs.eax;
+    *--sp = regs.ecx;
+    *--sp = regs.edx;
+    *--sp = regs.ebx;
+    *--sp = 0;
+    *--sp = regs.ebp;
+    *--sp = regs.esi;
+    *--sp = regs.edi;
+    // switch_to返回的地址和它弹出的ebp,ebx,esi,edi
+    *--sp = (uint32_t)ret_from_fork;
+    for(int i = 0; i < 4; i++) {
+        *--sp = 0;
+    }
+    task->kernel_esp = (uint32_t)sp;
+}
+
+void ProcessManager::switch_mm(Task* prev, Task* next)
+{
+    auto stats = this_cpu_ptr(switch_stats_percpu);
+    Context* ctx = next->context;
+    if(ctx == kernel_context) {
+        // 内核任务只访问内核空间，每个页目录的内核部分都一样，继续用上一个任务的页目录。
+        // 上一个进程的页目录由active_mm的引用保证不会被释放
+        stats->lazy_tlb++;
+        return;
+    }
+    if(prev && prev->context == ctx) {
+        stats->cr3_skips++;
+        return;
+    }
+    // 从内核任务切回来时CR3里可能还是别的进程的，也要重新装入：
+    // 换出页面只刷新本CPU的TLB，不在运行的地址空间不能留着过时的TLB项
+    Context* old = this_cpu_read(active_mm);
+    if(old != ctx) {
+        mm_grab(ctx);
+        this_cpu_write(active_mm, ctx);
+    }
+    asm volatile("mov %0, %%cr3" : : "r"(next->regs.cr3) : "memory");
+    stats->cr3_loads++;
+    if(old && old != ctx) {
+        mm_drop(old);
+    }
+}
 
-    if(debug.is_task_switch && debug.cur_task->cpu != cpu) {
-        log_trace("switching task: prev: %d, next:%d\n", debug.prev_task->task_id,
-            next->task_id);
-        log_trace("prev cpu:%d, cur cpu:%d\n", next->cpu, cpu);
-        debug.is_task_switch = false;
-        // next->print();
+void ProcessManager::mm_drop(Context* ctx)
+{
+    if(__atomic_sub_fetch(&ctx->mm_refs, 1, __ATOMIC_SEQ_CST) == 0) {
+        free_mm(ctx);
     }
-    next->cpu = cpu;
-    // update cr3
-    asm volatile("mov %%eax, %%cr3\n\t" ::"a"(next->regs.cr3));
 }
+
+void ProcessManager::free_mm(Context* ctx)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    // 放掉fd表每一项的引用，和其他进程共享的文件由放掉最后一个引用的一方关闭
+    for(uint32_t fd_num = 0; fd_num < MAX_PROCESS_FDS; fd_num++) {
+        kernel::fd_close(ctx, fd_num);
+    }
+    PageManager::releaseCr3(ctx->user_mm.getCr3());
+    kernel_mm.free_pages(ctx->user_mm.getPageDirectoryPhysical(), PGD_ORDER);
+    pid_manager.free(ctx->context_id);
+    delete ctx;
+}
+
+void ProcessManager::switch_stats(uint32_t cpu, SwitchStats& stats)
+{
+    stats = per_cpu(switch_stats_percpu, cpu);
+}
+
 Task* ProcessManager::get_current_task()
 {
     return Kernel::instance().scheduler().get_current_task();
@@ -469,7 +587,7 @@ void ProcessManager::switch_to_user_mode(uint32_t entry_point, Task* task)
     __printPDPTE((void*)entry_point, (PageDirectory*)context->user_mm.getPageDirectory());
     log_debug("user stack: 0x%x\n", user_stack);
     __printPDPTE((void*)user_stack, (PageDirectory*)context->user_mm.getPageDirectory());
-    auto cpu = arch::apic_get_id();
+    auto cpu = arch::get_cpu_id();
     GDT::updateTSS(cpu, task->stacks.esp0, KERNEL_DS);
     GDT::updateTSSCR3(cpu, task->regs.cr3);
 
@@ -498,18 +616,181 @@ void ProcessManager::switch_to_user_mode(uint32_t entry_point, Task* task)
 
 // 静态成员初始化
 Context* ProcessManager::kernel_context = nullptr;
+kernel::list_head ProcessManager::context_list = {
+    &ProcessManager::context_list, &ProcessManager::context_list};
+static DEFINE_LOCK_CLASS(process_lock_class, "process");
+SpinLock ProcessManager::context_lock(&process_lock_class);
+Task* ProcessManager::zombies[MAX_CPUS];
+
+void ProcessManager::register_context(Context* ctx)
+{
+    uint32_t flags;
+    context_lock.acquire_irqsave(flags);
+    kernel::list_add_tail(&ctx->node, &context_list);
+    context_lock.release_irqrestore(flags);
+}
+
+void ProcessManager::for_each_context(void (*fn)(Context* ctx, void* arg), void* arg)
+{
+    uint32_t flags;
+    context_lock.acquire_irqsave(flags);
+    list_for_each(entry, &context_list) {
+        fn(list_entry(entry, Context, node), arg);
+    }
+    context_lock.release_irqrestore(flags);
+}
+
+bool ProcessManager::kill_process(uint32_t pid, uint32_t status)
+{
+    auto& scheduler = Kernel::instance().scheduler();
+    int cpu = arch::get_cpu_id();
+    uint32_t flags;
+    context_lock.acquire_irqsave(flags);
+    Context* ctx = nullptr;
+    list_for_each(entry, &context_list) {
+        auto c = list_entry(entry, Context, node);
+        if(c->context_id == pid) {
+            ctx = c;
+            break;
+        }
+    }
+    if(!ctx || ctx->killed) {
+        context_lock.release_irqrestore(flags);
+        return false;
+    }
+
+    __atomic_store_n(&ctx->killed, true, __ATOMIC_SEQ_CST);
+    bool running_elsewhere = false;
+    list_for_each(entry, &ctx->tasks) {
+        auto task = list_entry(entry, Task, ctx_node);
+        task->exit_status = status;
+        // 睡眠的任务让唤醒定时器马上到期，阻塞在等待队列上的任务从队列上摘下来唤醒，
+        // 由唤醒路径看到killed后标记退出并放回运行队列回收。
+        // 等待项只会被摘下一次，不会和唤醒方同时把任务放回队列
+        if(__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) == PROCESS_SLEEPING) {
+            if(kernel::WaitQueue::cancel(&task->wait_entry)) {
+                wake_up(task);
+            }
+            if(kernel::timer_pending(&task->sleep_timer)) {
+                kernel::mod_timer(&task->sleep_timer, kernel::jiffies());
+            }
+            if(kernel::hrtimer_active(&task->sleep_hrtimer)) {
+                kernel::hrtimer_start(&task->sleep_hrtimer, 0, kernel::HRTIMER_MODE_REL);
+            }
+        }
+        // 和唤醒路径竞争：唤醒先把状态改成READY时这里再改成退出
+        ProcessState state = PROCESS_READY;
+        while(!__atomic_compare_exchange_n(
+            &task->state, &state, EXITED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            if(state == PROCESS_SLEEPING || state == EXITED) {
+                break;
+            }
+        }
+        int running = scheduler.running_cpu(task);
+        if(running >= 0 && running != cpu) {
+            running_elsewhere = true;
+        }
+    }
+    // 其他CPU上还可能有这个地址空间的TLB项，交给那个CPU在切走时释放
+    if(!running_elsewhere) {
+        ctx->user_mm.release_all();
+    }
+    context_lock.release_irqrestore(flags);
+    log_info("killed process %d, status:%d, memory released:%d\n", pid, status, !running_elsewhere);
+    return true;
+}
+
+void ProcessManager::exit_current()
+{
+    // schedule()看到任务已经退出，不会再把它放回运行队列，切走以后不会再回来，循环只是防御
+    while(true) {
+        asm volatile("cli");
+        schedule();
+        asm volatile("sti; hlt");
+    }
+}
+
+void ProcessManager::reap(Task* task)
+{
+    auto& kernel_mm = Kernel::instance().kernel_mm();
+    auto ctx = task->context;
+    uint32_t flags;
+    context_lock.acquire_irqsave(flags);
+    kernel::list_del_init(&task->ctx_node);
+    bool last = ctx && ctx->killed && kernel::list_empty(&ctx->tasks);
+    if(last) {
+        kernel::list_del_init(&ctx->node);
+        ctx->user_mm.release_all();
+    }
+    context_lock.release_irqrestore(flags);
+
+    log_debug("reaping task %d\n", task->task_id);
+    kernel::task_group_exit(task);
+    kernel::del_timer_sync(&task->sleep_timer);
+    kernel::hrtimer_cancel(&task->sleep_hrtimer);
+    task->free_stack(kernel_mm);
+    tid_manager.free(task->task_id);
+    delete task;
+    if(last) {
+        // 还装在某个CPU的CR3里时(切到了内核任务)，由那个CPU换CR3时释放
+        mm_drop(ctx);
+    }
+}
+
+// 把运行中的当前任务标记为睡眠，已经被杀死时返回false
+bool ProcessManager::prepare_sleep(Task* task)
+{
+    ProcessState state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE);
+    if(state == EXITED || state == PROCESS_SLEEPING) {
+        return false;
+    }
+    return __atomic_compare_exchange_n(
+        &task->state, &state, PROCESS_SLEEPING, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
 
 void ProcessManager::sleep_current_process(uint32_t ticks)
 {
     Task* task = get_current_task();
-    if(!task)
+    if(!task || !ticks)
         return;
 
-    task->state = PROCESS_SLEEPING; // 需要确保枚举值已定义
-    task->sleep_ticks = ticks;      // 需要在PCB结构中添加该字段
+    // 调用方已关中断，定时器在本CPU上，切走之前不会到期
+    if(prepare_sleep(task)) {
+        kernel::mod_timer(&task->sleep_timer, kernel::jiffies() + ticks);
+    }
+    schedule();
+}
 
-    // 触发调度让出CPU
+void ProcessManager::sleep_current_ns(uint64_t ns)
+{
+    Task* task = get_current_task();
+    if(!task || !ns)
+        return;
+
+    if(prepare_sleep(task)) {
+        kernel::hrtimer_start(&task->sleep_hrtimer, ns, kernel::HRTIMER_MODE_REL);
+    }
     schedule();
 }
 
+bool ProcessManager::wake_up(Task* task)
+{
+    ProcessState state = PROCESS_SLEEPING;
+    if(!__atomic_compare_exchange_n(
+           &task->state, &state, PROCESS_READY, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return false;
+    }
+    auto& scheduler = Kernel::instance().scheduler();
+    // 进程在睡眠时被杀死，放回运行队列，被选中时回收
+    if(task->context && __atomic_load_n(&task->context->killed, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&task->state, EXITED, __ATOMIC_RELEASE);
+    }
+    // 其他CPU上的定时器可能在任务切走之前到期，等它离开自己的内核栈再放回队列
+    while(__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+    scheduler.enqueue_task(task, task->se.cpu, kernel::ENQUEUE_WAKEUP);
+    return true;
+}
+
 ProcessManager::Debug ProcessManager::debug;
\ No newline at end of file
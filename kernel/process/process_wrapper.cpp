@@ -1,10 +1,15 @@
 #include "kernel/process.h"
 
-extern "C" void restore_context_wrapper(uint32_t int_num, uint32_t* esp)
+// 新任务第一次运行，从ret_from_fork调用
+extern "C" void schedule_tail()
 {
-    ProcessManager::restore_context(int_num, esp);
+    ProcessManager::finish_switch();
 }
-extern "C" void save_context_wrapper(uint32_t int_num, uint32_t* esp)
+
+// 中断和系统调用处理完以后调用，中断已关。
+// 时钟中断或唤醒设置了重新调度标记、当前任务在系统调用里退出时切走，
+// 切回来时从这里返回，接着用当前任务内核栈上的帧中断返回
+extern "C" void interrupt_exit_schedule()
 {
-    ProcessManager::save_context(int_num, esp);
-}
\ No newline at end of file
+    ProcessManager::schedule();
+}
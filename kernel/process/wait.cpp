@@ -0,0 +1,145 @@
+#include "kernel/wait.h"
+
+#include <arch/x86/interrupt.h>
+#include <kernel/process.h>
+#include <kernel/rcu.h>
+#include <kernel/smp_scheduler.h>
+#include <kernel/timer.h>
+
+namespace kernel {
+
+WaitQueue::WaitQueue()
+{
+    INIT_LIST_HEAD(&waiters);
+}
+
+WaitEntry* WaitQueue::first() const
+{
+    return empty() ? nullptr : list_entry(waiters.next, WaitEntry, node);
+}
+
+void WaitQueue::add(WaitEntry* entry)
+{
+    // 全局对象没有执行构造函数
+    if(!waiters.next) {
+        INIT_LIST_HEAD(&waiters);
+    }
+    entry->wq = this;
+    entry->done = false;
+    list_add_tail(&entry->node, &waiters);
+}
+
+void WaitQueue::remove(WaitEntry* entry)
+{
+    list_del_init(&entry->node);
+    entry->wq = nullptr;
+}
+
+void WaitQueue::wake(WaitEntry* entry, int result)
+{
+    remove(entry);
+    entry->result = result;
+    if(!entry->blocking) {
+        // 自旋的等待方看到done就返回，等待项在它的栈上，之后不能再访问
+        __atomic_store_n(&entry->done, true, __ATOMIC_RELEASE);
+        return;
+    }
+    Task* task = entry->task;
+    entry->done = true;
+    ProcessManager::wake_up(task);
+}
+
+uint32_t WaitQueue::wake_all(int result)
+{
+    uint32_t count = 0;
+    WaitEntry* entry;
+    while((entry = first())) {
+        wake(entry, result);
+        count++;
+    }
+    return count;
+}
+
+int WaitQueue::wait(uint32_t flags, uint32_t timeout)
+{
+    WaitEntry entry;
+    entry.task = ProcessManager::get_current_task();
+    entry.blocking = false;
+    entry.result = 0;
+    add(&entry);
+    lock.release_irqrestore(flags);
+
+    uint32_t start = jiffies();
+    while(!__atomic_load_n(&entry.done, __ATOMIC_ACQUIRE)) {
+        if(timeout != WAIT_FOREVER && jiffies() - start >= timeout) {
+            lock.acquire_irqsave(flags);
+            // 加锁之前可能刚好被唤醒，那样结果已经交过来了
+            bool timed_out = !entry.done;
+            if(timed_out) {
+                remove(&entry);
+            }
+            lock.release_irqrestore(flags);
+            if(timed_out) {
+                return WAIT_TIMEOUT;
+            }
+            break;
+        }
+        asm volatile("pause");
+    }
+    return entry.result;
+}
+
+int WaitQueue::block(uint32_t flags)
+{
+    Task* task = ProcessManager::get_current_task();
+    // 先标记睡眠再挂上队列，唤醒方看到等待项时任务一定已经是睡眠状态
+    if(!task || !ProcessManager::prepare_sleep(task)) {
+        lock.release_irqrestore(flags);
+        return WAIT_KILLED;
+    }
+    WaitEntry* entry = &task->wait_entry;
+    entry->task = task;
+    entry->blocking = true;
+    entry->result = 0;
+    add(entry);
+    // 杀死进程时只取消已经挂上队列的等待项，挂上之前被杀死的要在这里发现
+    if(task->context && __atomic_load_n(&task->context->killed, __ATOMIC_SEQ_CST)) {
+        remove(entry);
+        __atomic_store_n(&task->state, EXITED, __ATOMIC_RELEASE);
+        lock.release_irqrestore(flags);
+        return WAIT_KILLED;
+    }
+    // 系统调用入口已关中断，释放锁以后到切走之前不会被本CPU上的中断打断，
+    // 其他CPU上的唤醒方会等任务离开CPU再把它放回运行队列
+    lock.release_irqrestore(flags);
+    ProcessManager::schedule();
+    // 唤醒方交出结果以后才把任务放回运行队列
+    return entry->result;
+}
+
+bool WaitQueue::can_block()
+{
+    Task* task = ProcessManager::get_current_task();
+    return task && task != this_cpu_read(idle_task) && !in_interrupt() && !rcu_read_lock_held();
+}
+
+bool WaitQueue::cancel(WaitEntry* entry)
+{
+    uint32_t flags;
+    while(true) {
+        WaitQueue* wq = __atomic_load_n(&entry->wq, __ATOMIC_ACQUIRE);
+        if(!wq) {
+            return false;
+        }
+        wq->lock.acquire_irqsave(flags);
+        // 条件变量会把等待项移到互斥锁的队列上，加锁后再确认一次
+        if(entry->wq == wq) {
+            wq->remove(entry);
+            wq->lock.release_irqrestore(flags);
+            return true;
+        }
+        wq->lock.release_irqrestore(flags);
+    }
+}
+
+} // namespace kernel
@@ -0,0 +1,60 @@
+#include "kernel/sched_bandwidth.h"
+
+namespace kernel {
+
+void CpuBandwidth::init()
+{
+    quota_ns = 0;
+    period_ns = BW_DEFAULT_PERIOD_NS;
+    runtime_used = 0;
+    throttled = false;
+    usage_ns = 0;
+    nr_periods = 0;
+    nr_throttled = 0;
+}
+
+bool CpuBandwidth::set(uint64_t quota_ns, uint64_t period_ns)
+{
+    if(period_ns == 0) {
+        period_ns = BW_DEFAULT_PERIOD_NS;
+    }
+    if(period_ns < BW_MIN_PERIOD_NS || period_ns > BW_MAX_PERIOD_NS ||
+        (quota_ns && quota_ns < BW_MIN_QUOTA_NS)) {
+        return false;
+    }
+    this->quota_ns = quota_ns;
+    this->period_ns = period_ns;
+    runtime_used = 0;
+    throttled = false;
+    return true;
+}
+
+bool CpuBandwidth::charge(uint64_t ns)
+{
+    usage_ns += ns;
+    if(!limited()) {
+        return false;
+    }
+    runtime_used += ns;
+    if(throttled || runtime_used < quota_ns) {
+        return false;
+    }
+    throttled = true;
+    nr_throttled++;
+    return true;
+}
+
+bool CpuBandwidth::refill()
+{
+    nr_periods++;
+    // 超出的时间记到下一个周期，长期来看份额准确；最多扣一个配额，不会连续饿死
+    uint64_t over = runtime_used > quota_ns ? runtime_used - quota_ns : 0;
+    runtime_used = over < quota_ns ? over : quota_ns;
+    if(!throttled || (limited() && runtime_used >= quota_ns)) {
+        return false;
+    }
+    throttled = false;
+    return true;
+}
+
+} // namespace kernel
@@ -0,0 +1,349 @@
+#include "kernel/sched_fair.h"
+
+namespace kernel {
+
+const uint32_t sched_prio_to_weight[NICE_WIDTH] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+
+const uint32_t sched_prio_to_wmult[NICE_WIDTH] = {
+    /* -20 */ 48388, 59856, 76040, 92818, 118348,
+    /* -15 */ 147320, 184698, 229616, 287308, 360437,
+    /* -10 */ 449829, 563644, 704093, 875809, 1099582,
+    /*  -5 */ 1376151, 1717300, 2157191, 2708050, 3363326,
+    /*   0 */ 4194304, 5237765, 6557202, 8165337, 10153587,
+    /*   5 */ 12820798, 15790321, 19976592, 24970740, 31350126,
+    /*  10 */ 39045157, 49367440, 61356676, 76695844, 95443717,
+    /*  15 */ 119304647, 148102320, 186737708, 238609294, 286331153,
+};
+
+// vruntime会回绕，比较时看差值的符号
+static inline bool vruntime_before(uint64_t a, uint64_t b) { return (int64_t)(a - b) < 0; }
+static inline uint64_t max_vruntime(uint64_t a, uint64_t b) { return vruntime_before(a, b) ? b : a; }
+static inline uint64_t min_vruntime_of(uint64_t a, uint64_t b) { return vruntime_before(a, b) ? a : b; }
+
+// a * mul >> shift，a拆成高低32位分别乘，不需要128位乘法
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift)
+{
+    uint32_t lo = (uint32_t)a;
+    uint32_t hi = (uint32_t)(a >> 32);
+    uint64_t ret = ((uint64_t)lo * mul) >> shift;
+    if(hi) {
+        ret += ((uint64_t)hi * mul) << (32 - shift);
+    }
+    return ret;
+}
+
+uint64_t calc_delta_fair(uint64_t delta, const SchedEntity* se)
+{
+    if(se->weight == NICE_0_LOAD) {
+        return delta;
+    }
+    // delta * NICE_0_LOAD / weight = delta * NICE_0_LOAD * inv_weight >> 32，
+    // 乘数超过32位时和移位量一起缩小，内核里没有64位除法
+    uint64_t fact = (uint64_t)NICE_0_LOAD * se->inv_weight;
+    uint32_t shift = 32;
+    while(fact >> 32) {
+        fact >>= 1;
+        shift--;
+    }
+    return mul_u64_u32_shr(delta, (uint32_t)fact, shift);
+}
+
+void SchedEntity::set_prio(uint32_t prio)
+{
+    if(prio >= NICE_WIDTH) {
+        prio = DEFAULT_PRIO;
+    }
+    weight = sched_prio_to_weight[prio];
+    inv_weight = sched_prio_to_wmult[prio];
+}
+
+void CfsRunQueue::init(uint32_t cpu)
+{
+    this->cpu = cpu;
+    curr = nullptr;
+    nr_running = 0;
+    load_weight = 0;
+    min_vruntime = 0;
+    tick_cycles = 0;
+    last_tick = 0;
+    resched = false;
+    RB_INIT_ROOT(&timeline);
+}
+
+uint64_t CfsRunQueue::units_to_cycles(uint32_t units) const
+{
+    return ((uint64_t)tick_cycles * units) >> SCHED_FIXEDPOINT_SHIFT;
+}
+
+uint64_t CfsRunQueue::sched_slice(const SchedEntity* se) const
+{
+    uint32_t nr = nr_running;
+    uint32_t load = load_weight;
+    if(curr) {
+        nr++;
+        load += curr->weight;
+    }
+    // 还没入队的新实体也算进去
+    if(!se->on_rq && se != curr) {
+        nr++;
+        load += se->weight;
+    }
+    uint32_t period = SCHED_LATENCY;
+    if(nr > SCHED_NR_LATENCY) {
+        period = nr * SCHED_MIN_GRANULARITY;
+    }
+    // 先算权重占比再乘周期，全部是32位除法
+    uint32_t share = (se->weight << SCHED_FIXEDPOINT_SHIFT) / load;
+    uint32_t units = (uint32_t)(((uint64_t)period * share) >> SCHED_FIXEDPOINT_SHIFT);
+    return units_to_cycles(units);
+}
+
+void CfsRunQueue::update_min_vruntime()
+{
+    SchedEntity* left = pick_first();
+    if(!curr && !left) {
+        return;
+    }
+    uint64_t vruntime;
+    if(curr && left) {
+        vruntime = min_vruntime_of(curr->vruntime, left->vruntime);
+    } else {
+        vruntime = curr ? curr->vruntime : left->vruntime;
+    }
+    min_vruntime = max_vruntime(min_vruntime, vruntime);
+}
+
+void CfsRunQueue::update_curr(uint64_t now)
+{
+    if(!curr) {
+        return;
+    }
+    int64_t delta = (int64_t)(now - curr->exec_start);
+    if(delta <= 0) {
+        return;
+    }
+    curr->exec_start = now;
+    curr->sum_exec += delta;
+    curr->vruntime += calc_delta_fair(delta, curr);
+    update_min_vruntime();
+}
+
+void CfsRunQueue::place_entity(SchedEntity* se, uint32_t flags)
+{
+    uint64_t vruntime = min_vruntime;
+    if(flags & ENQUEUE_NEW) {
+        // 新任务排在一个时间片之后，不断创建任务不能挤占已有任务
+        se->vruntime = vruntime + calc_delta_fair(sched_slice(se), se);
+        return;
+    }
+    // 迁移过来的实体保持和原队列min_vruntime的相对位置
+    if(flags & ENQUEUE_MIGRATED) {
+        se->vruntime += vruntime;
+    }
+    if(!(flags & ENQUEUE_WAKEUP)) {
+        return;
+    }
+    // 唤醒的任务最多补偿半个调度周期，睡得再久也不能长时间独占CPU
+    vruntime -= units_to_cycles(SCHED_LATENCY) >> 1;
+    se->vruntime = max_vruntime(se->vruntime, vruntime);
+}
+
+void CfsRunQueue::check_preempt_wakeup(SchedEntity* se)
+{
+    if(!curr) {
+        resched = true;
+        return;
+    }
+    // 唤醒的任务落后当前任务超过唤醒粒度才抢占，避免频繁切换
+    int64_t vdiff = (int64_t)(curr->vruntime - se->vruntime);
+    if(vdiff > (int64_t)calc_delta_fair(units_to_cycles(SCHED_WAKEUP_GRANULARITY), se)) {
+        resched = true;
+    }
+}
+
+void CfsRunQueue::enqueue(SchedEntity* se, uint32_t flags)
+{
+    if(flags) {
+        place_entity(se, flags);
+    }
+
+    struct rb_node** link = &timeline.root.node;
+    struct rb_node* parent = nullptr;
+    bool leftmost = true;
+    while(*link) {
+        parent = *link;
+        auto entry = rb_entry(parent, SchedEntity, run_node);
+        // vruntime相同的实体按入队顺序排在后面
+        if(vruntime_before(se->vruntime, entry->vruntime)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    rb_link_node(&se->run_node, parent, link);
+    rb_insert_color_cached(&se->run_node, &timeline, leftmost);
+    se->on_rq = true;
+    se->cpu = cpu;
+    nr_running++;
+    load_weight += se->weight;
+
+    if(flags) {
+        check_preempt_wakeup(se);
+    }
+}
+
+void CfsRunQueue::dequeue(SchedEntity* se)
+{
+    rb_erase_cached(&se->run_node, &timeline);
+    se->on_rq = false;
+    nr_running--;
+    load_weight -= se->weight;
+    update_min_vruntime();
+}
+
+SchedEntity* CfsRunQueue::pick_first() const
+{
+    struct rb_node* left = rb_first_cached(&timeline);
+    return left ? rb_entry(left, SchedEntity, run_node) : nullptr;
+}
+
+void CfsRunQueue::set_next(SchedEntity* se, uint64_t now)
+{
+    curr = se;
+    resched = false;
+    if(se) {
+        se->exec_start = now;
+        se->prev_sum_exec = se->sum_exec;
+    }
+}
+
+void CfsRunQueue::put_prev(uint64_t now, bool runnable)
+{
+    update_curr(now);
+    SchedEntity* prev = curr;
+    curr = nullptr;
+    if(prev && runnable) {
+        enqueue(prev, 0);
+    }
+}
+
+bool CfsRunQueue::check_preempt_tick()
+{
+    if(!curr) {
+        return nr_running > 0;
+    }
+    if(nr_running == 0) {
+        return false;
+    }
+    // 只能在tick上切换，时间片剩下不到半个tick就在这个tick切换，不再多跑一整个tick
+    uint64_t ran = curr->sum_exec - curr->prev_sum_exec + (tick_cycles >> 1);
+    uint64_t ideal = sched_slice(curr);
+    if(ran >= ideal) {
+        return true;
+    }
+    if(ran < units_to_cycles(SCHED_MIN_GRANULARITY)) {
+        return false;
+    }
+    // 当前任务的vruntime领先最左边的任务超过一个时间片，也让出CPU
+    int64_t delta = (int64_t)(curr->vruntime - pick_first()->vruntime);
+    return delta > (int64_t)ideal;
+}
+
+bool CfsRunQueue::tick(uint64_t now)
+{
+    if(last_tick) {
+        uint64_t delta = now - last_tick;
+        uint32_t cycles = delta > 0xFFFFFFFFull ? 0xFFFFFFFF : (uint32_t)delta;
+        if(tick_cycles == 0) {
+            tick_cycles = cycles;
+        } else {
+            // 关中断太久会丢tick，单次采样最多按两个tick算
+            if(cycles > tick_cycles * 2) {
+                cycles = tick_cycles * 2;
+            }
+            tick_cycles = tick_cycles - (tick_cycles >> 3) + (cycles >> 3);
+        }
+    }
+    last_tick = now;
+
+    update_curr(now);
+    if(check_preempt_tick()) {
+        resched = true;
+    }
+    return resched;
+}
+
+void CfsRunQueue::yield(uint64_t now)
+{
+    struct rb_node* last = rb_last(&timeline.root);
+    if(!curr || !last) {
+        return;
+    }
+    update_curr(now);
+    SchedEntity* se = rb_entry(last, SchedEntity, run_node);
+    if((int64_t)(curr->vruntime - se->vruntime) <= 0) {
+        curr->vruntime = se->vruntime + 1;
+    }
+    resched = true;
+}
+
+bool CfsRunQueue::test_and_clear_resched()
+{
+    bool ret = resched;
+    resched = false;
+    return ret;
+}
+
+uint32_t CfsRunQueue::calc_imbalance(const CfsRunQueue& busiest) const
+{
+    uint32_t src = busiest.nr_total();
+    uint32_t dst = nr_total();
+    // 差1的时候搬一个只是把不平衡换了个方向
+    if(busiest.nr_running == 0 || src <= dst + 1) {
+        return 0;
+    }
+    uint32_t imbalance = (src - dst) / 2;
+    return imbalance < busiest.nr_running ? imbalance : busiest.nr_running;
+}
+
+uint32_t CfsRunQueue::pull_from(CfsRunQueue& src, uint32_t max, uint64_t now, bool check_hot,
+    migrate_filter_t filter, void* arg, uint32_t* hot_skipped)
+{
+    uint64_t hot_cycles = src.units_to_cycles(SCHED_MIGRATION_COST);
+    uint32_t moved = 0;
+    uint32_t hot = 0;
+    struct rb_node* node = rb_first_cached(&src.timeline);
+    while(node && moved < max) {
+        struct rb_node* next = rb_next(node);
+        auto se = rb_entry(node, SchedEntity, run_node);
+        node = next;
+        if(filter && !filter(se, arg)) {
+            continue;
+        }
+        // exec_start是实体上次停止运行的时间，从没运行过的实体是0
+        if(check_hot && se->exec_start && (int64_t)(now - se->exec_start) < (int64_t)hot_cycles) {
+            hot++;
+            continue;
+        }
+        src.dequeue(se);
+        se->vruntime -= src.min_vruntime;
+        enqueue(se, ENQUEUE_MIGRATED);
+        moved++;
+    }
+    if(hot_skipped) {
+        *hot_skipped = hot;
+    }
+    return moved;
+}
+
+} // namespace kernel
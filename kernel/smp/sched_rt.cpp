@@ -0,0 +1,161 @@
+#include "kernel/sched_rt.h"
+
+namespace kernel {
+
+void RtRunQueue::init(uint32_t cpu)
+{
+    this->cpu = cpu;
+    curr = nullptr;
+    nr_running = 0;
+    resched = false;
+    requeue_tail = false;
+    for(uint32_t i = 0; i < BITMAP_WORDS; i++) {
+        bitmap[i] = 0;
+    }
+    for(uint32_t i = 0; i < MAX_RT_PRIO; i++) {
+        INIT_LIST_HEAD(&queue[i]);
+    }
+}
+
+bool RtRunQueue::has_waiting(uint32_t prio) const
+{
+    return bitmap[prio / 32] & (1u << (prio % 32));
+}
+
+uint32_t RtRunQueue::highest_prio() const
+{
+    // 从高位往低位找第一个非空的字，字里最高的1就是最高优先级
+    for(int i = BITMAP_WORDS - 1; i >= 0; i--) {
+        if(bitmap[i]) {
+            return i * 32 + 31 - __builtin_clz(bitmap[i]);
+        }
+    }
+    return 0;
+}
+
+RtEntity* RtRunQueue::pick_first() const
+{
+    uint32_t prio = highest_prio();
+    if(!prio) {
+        return nullptr;
+    }
+    return list_entry(queue[prio].next, RtEntity, run_list);
+}
+
+void RtRunQueue::enqueue(RtEntity* rt, bool head)
+{
+    uint32_t prio = rt->prio;
+    if(head) {
+        list_add(&rt->run_list, &queue[prio]);
+    } else {
+        list_add_tail(&rt->run_list, &queue[prio]);
+    }
+    bitmap[prio / 32] |= 1u << (prio % 32);
+    rt->on_rq = true;
+    rt->cpu = cpu;
+    nr_running++;
+
+    // 正在运行的是普通任务或idle时总是抢占
+    if(!curr || prio > curr->prio) {
+        resched = true;
+    }
+}
+
+void RtRunQueue::dequeue(RtEntity* rt)
+{
+    list_del_init(&rt->run_list);
+    if(list_empty(&queue[rt->prio])) {
+        bitmap[rt->prio / 32] &= ~(1u << (rt->prio % 32));
+    }
+    rt->on_rq = false;
+    nr_running--;
+}
+
+void RtRunQueue::set_next(RtEntity* rt)
+{
+    curr = rt;
+    resched = false;
+    requeue_tail = false;
+}
+
+void RtRunQueue::put_prev(bool runnable)
+{
+    RtEntity* prev = curr;
+    bool tail = requeue_tail;
+    curr = nullptr;
+    requeue_tail = false;
+    if(prev && runnable) {
+        enqueue(prev, !tail);
+    }
+}
+
+bool RtRunQueue::tick()
+{
+    if(!curr || curr->policy != SCHED_RR) {
+        return resched;
+    }
+    if(--curr->time_slice) {
+        return resched;
+    }
+    curr->time_slice = RR_TIMESLICE;
+    // 同优先级没有别的任务时继续运行，新的时间片从现在开始
+    if(has_waiting(curr->prio)) {
+        requeue_tail = true;
+        resched = true;
+    }
+    return resched;
+}
+
+void RtRunQueue::yield()
+{
+    if(!curr || !has_waiting(curr->prio)) {
+        return;
+    }
+    requeue_tail = true;
+    resched = true;
+}
+
+bool RtRunQueue::curr_keeps_cpu() const
+{
+    uint32_t prio = highest_prio();
+    return curr->prio > prio || (curr->prio == prio && !requeue_tail);
+}
+
+bool RtRunQueue::test_and_clear_resched()
+{
+    bool ret = resched;
+    resched = false;
+    return ret;
+}
+
+RtEntity* RtRunQueue::find_first(rt_filter_t filter, void* arg) const
+{
+    for(int w = BITMAP_WORDS - 1; w >= 0; w--) {
+        uint32_t bits = bitmap[w];
+        while(bits) {
+            uint32_t bit = 31 - __builtin_clz(bits);
+            bits &= ~(1u << bit);
+            const struct list_head* head = &queue[w * 32 + bit];
+            for(struct list_head* pos = head->next; pos != head; pos = pos->next) {
+                RtEntity* rt = list_entry(pos, RtEntity, run_list);
+                if(!filter || filter(rt, arg)) {
+                    return rt;
+                }
+            }
+        }
+    }
+    return nullptr;
+}
+
+RtEntity* RtRunQueue::pull_from(RtRunQueue& src, uint32_t min_prio, rt_filter_t filter, void* arg)
+{
+    RtEntity* rt = src.find_first(filter, arg);
+    if(!rt || rt->prio <= min_prio) {
+        return nullptr;
+    }
+    src.dequeue(rt);
+    enqueue(rt);
+    return rt;
+}
+
+} // namespace kernel
@@ -1,5 +1,7 @@
 #include <arch/x86/apic.h>
 #include <arch/x86/percpu.h>
+#include <arch/x86/tsc.h>
+#include <kernel/boot_options.h>
 #include <kernel/kernel.h>
 #include <kernel/process.h>
 #include <kernel/smp_scheduler.h>
@@ -10,104 +12,621 @@ void print_pointer(void *ptr) {
 }
 extern "C" Task* create_idle_task(Context *context, uint32_t lapic_id);
 namespace kernel {
-// 用PerCPU模板定义每CPU运行队列
+
+DEFINE_PER_CPU(Task*, current_task);
+DEFINE_PER_CPU(Task*, idle_task);
+
+static DEFINE_LOCK_CLASS(runqueue_lock_class, "runqueue");
 
 void RunQueue::print_list()
 {
-    log_debug("RunQueue 0x%x, task_count:%d\n", this, nr_running);
+    log_debug("RunQueue 0x%x, task_count:%d, min_vruntime:%u\n", this, nr_running,
+        (uint32_t)cfs.min_vruntime);
     int i = 0;
-    list_for_each(entry, &runnable_list) {
-        Task* task = list_entry(entry, Task, sched_list);
-        log_debug("Task(nr:%d) ID: %d\n", i, task->task_id);
+    for (auto node = rb_first_cached(&cfs.timeline); node; node = rb_next(node)) {
+        Task* task = container_of(rb_entry(node, SchedEntity, run_node), Task, se);
+        log_debug("Task(nr:%d) ID: %d, nice:%d, vruntime:%u\n", i, task->task_id,
+            prio_to_nice(task->priority), (uint32_t)task->se.vruntime);
         i++;
     }
 }
 
-
+// 调度时钟，用TSC周期计时
+static inline uint64_t sched_clock()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
 
 void SMP_Scheduler::init() {
     // scheduler_runqueue.init_all(new RunQueue());
+    uint32_t cpu_count = arch::apic_get_cpu_count();
+    online_mask = cpu_count >= 32 ? 0xFFFFFFFF : (1u << cpu_count) - 1;
+    uint32_t isolated = BootOptions::isolated_cpus() & online_mask;
+    housekeeping_mask = online_mask & ~isolated;
+    if (!housekeeping_mask) {
+        log_err("isolcpus=0x%x isolates every CPU, ignored\n", isolated);
+        housekeeping_mask = online_mask;
+    } else if (isolated) {
+        log_info("CPUs 0x%x isolated, general tasks run on 0x%x\n", isolated, housekeeping_mask);
+    }
+    resched_ipi_enabled = !BootOptions::is_off("resched_ipi");
 
-    for (unsigned int cpu = 0; cpu < arch::apic_get_cpu_count(); cpu++) {
+    for (unsigned int cpu = 0; cpu < cpu_count; cpu++) {
         scheduler_runqueue.set(cpu, new RunQueue());
         RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu);
         log_debug("Initializing SMP scheduler for CPU %d, rq: 0x%x\n", cpu, rq);
-        rq->lock = SPINLOCK_INIT;
+        rq->lock = SpinLock(&runqueue_lock_class);
+        rq->cpu = cpu;
         rq->nr_running = 0;
-        INIT_LIST_HEAD(&rq->runnable_list);
+        rq->cfs.init(cpu);
+        rq->rt.init(cpu);
+        rq->curr_prio = CPUPRIO_IDLE;
+        // 各CPU错开做周期性均衡，不会同时去锁同一个最忙的队列
+        rq->balance_ticks = BALANCE_INTERVAL + cpu;
         if(cpu !=0 ) {
             auto task = create_idle_task(ProcessManager::kernel_context, cpu);
-            idle_task.set(cpu, task);
-            current_task.set(cpu, task);
+            per_cpu(idle_task, cpu) = task;
+            per_cpu(current_task, cpu) = task;
         }
     }
 }
 
+// 没有睡眠、没有退出，切走以后还要放回运行队列
+static bool task_runnable(Task* p) {
+    return p->state != EXITED && p->state != PROCESS_SLEEPING;
+}
+
 Task* SMP_Scheduler::pick_next_task() {
     RunQueue* rq = scheduler_runqueue.operator->();
-    if (rq->nr_running != 0) {
-        // debug_debug("Picking next task on CPU %d, rq: 0x%x, task_count:%d\n", arch::apic_get_id(), rq, rq->nr_running);
+    Task* curr = get_current_task();
+    // rt.curr只有本CPU修改，不加锁读
+    bool curr_rt = curr && rq->rt.curr == &curr->rt && rt_policy(curr->rt.policy)
+        && task_runnable(curr) && cpu_allowed(curr, rq->cpu);
+    if (!rq->rt.nr_running && (rt_overload_mask & ~(1u << rq->cpu))) {
+        pull_rt(rq, curr_rt ? curr->rt.prio : 0);
     }
-    // rq->print_list();
     spin_lock(&rq->lock);
-    if (list_empty(&rq->runnable_list)) {
+    if (curr_rt && rq->rt.curr_keeps_cpu()) {
+        spin_unlock(&rq->lock);
+        return curr;
+    }
+    RtEntity* rt = rq->rt.pick_first();
+    if (rt) {
+        rq->rt.dequeue(rt);
+        update_rt_overload(rq);
+        spin_unlock(&rq->lock);
+        return container_of(rt, Task, rt);
+    }
+    SchedEntity* se = pick_fair(rq);
+    if (!se) {
         spin_unlock(&rq->lock);
         return load_balance();
     }
-    Task* next = list_entry(rq->runnable_list.next, Task, sched_list);
-    list_del_init(&next->sched_list);
-    rq->nr_running--;
     spin_unlock(&rq->lock);
-    // debug_debug("Picked task %d(0x%x) on CPU %d, rq: 0x%x\n", next->task_id, next, arch::apic_get_id(), rq);
-    auto cpu = arch::apic_get_id();
+    Task* next = container_of(se, Task, se);
+    auto cpu = arch::get_cpu_id();
     if (cpu != next->cpu) {
         log_debug("stolen from cpu %d to cpu %d, rq:0x%x\n", next->cpu, cpu, rq);
     }
 
     return next;
 }
-void SMP_Scheduler::enqueue_task(Task* p, int cpu_id)
+
+SchedEntity* SMP_Scheduler::pick_fair(RunQueue* rq) {
+    SchedEntity* se;
+    while ((se = rq->cfs.pick_first())) {
+        rq->cfs.dequeue(se);
+        Task* p = container_of(se, Task, se);
+        TaskGroup* tg = p->group;
+        if (!task_group_throttled(tg)) {
+            break;
+        }
+        // 排队期间所在的组被限流了，挂到组上等下一个周期
+        se->vruntime -= rq->cfs.min_vruntime;
+        if (!task_group_throttle_task(tg, p)) {
+            se->vruntime += rq->cfs.min_vruntime;
+            break;
+        }
+    }
+    rq->nr_running = rq->cfs.nr_running;
+    return se;
+}
+
+bool SMP_Scheduler::charge_group(Task* p) {
+    uint64_t delta = p->se.sum_exec - p->group_charged;
+    p->group_charged = p->se.sum_exec;
+    TaskGroup* tg = p->group;
+    if (!tg) {
+        return false;
+    }
+    return delta ? task_group_charge(tg, arch::tsc_cycles_to_ns(delta)) : task_group_throttled(tg);
+}
+
+void SMP_Scheduler::enqueue_task(Task* p, int cpu_id, uint32_t flags)
 {
+    if (rt_policy(p->rt.policy)) {
+        cpu_id = select_rt_cpu(p, cpu_id);
+        RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu_id);
+        spin_lock(&rq->lock);
+        p->se.cpu = cpu_id;
+        rq->rt.enqueue(&p->rt);
+        update_rt_overload(rq);
+        bool kick = rq->rt.resched && (uint32_t)cpu_id != arch::get_cpu_id();
+        spin_unlock(&rq->lock);
+        if (kick) {
+            resched_cpu(cpu_id);
+        }
+        return;
+    }
+    cpu_id = select_cpu(p, cpu_id);
     RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu_id);
-    // debug_debug("Enqueueing task %d(0x%x) on CPU %d, rq: 0x%x\n", p->task_id, p, cpu_id, rq);
     spin_lock(&rq->lock);
-    list_add_tail(&p->sched_list, &rq->runnable_list);
-    rq->nr_running++;
+    // 唤醒抢占要和当前任务最新的vruntime比较，只能结算本CPU的当前任务
+    if ((uint32_t)cpu_id == arch::get_cpu_id()) {
+        rq->cfs.update_curr(sched_clock());
+    }
+    rq->cfs.enqueue(&p->se, flags);
+    rq->nr_running = rq->cfs.nr_running;
+    // 放到其他CPU上并且要抢占(包括那个CPU空闲)时通知它，不用等它的下一个tick
+    bool kick = rq_resched(rq) && (uint32_t)cpu_id != arch::get_cpu_id();
     spin_unlock(&rq->lock);
+    if (kick) {
+        resched_cpu(cpu_id);
+    }
 }
 
-void SMP_Scheduler::enqueue_task(Task* p) {
+void SMP_Scheduler::put_prev_task(Task* prev) {
     RunQueue* rq = scheduler_runqueue.operator->();
-    // debug_debug("Enqueueing task %d on CPU %d, rq: 0x%x\n", p->task_id, arch::apic_get_id(), rq);
+    // 退出和睡眠的任务不放回队列，睡眠的任务由唤醒放回
+    bool runnable = prev != get_idle_task() && prev->state != EXITED && prev->state != PROCESS_SLEEPING;
+    // 运行期间亲和性被改掉了，不再放回本CPU的队列
+    bool migrate = runnable && !cpu_allowed(prev, rq->cpu);
+    bool to_rt = rt_policy(prev->rt.policy);
     spin_lock(&rq->lock);
-    list_add_tail(&p->sched_list, &rq->runnable_list);
-    rq->nr_running++;
+    // 按运行时所在的调度类放回，运行期间策略被改掉时换到新的调度类
+    bool was_rt = rq->rt.curr && rq->rt.curr == &prev->rt;
+    // 结算到现在为止的运行时间，任务组被限流时不放回队列
+    bool throttle = false;
+    if (!was_rt && rq->cfs.curr == &prev->se) {
+        rq->cfs.update_curr(sched_clock());
+        throttle = charge_group(prev) && runnable && !migrate && !to_rt;
+    }
+    bool stay = runnable && !migrate && was_rt == to_rt && !throttle;
+    if (was_rt) {
+        rq->rt.put_prev(stay);
+    } else {
+        rq->cfs.put_prev(sched_clock(), stay);
+    }
+    if (throttle) {
+        TaskGroup* tg = prev->group;
+        prev->se.vruntime -= rq->cfs.min_vruntime;
+        // 组刚刚解除限流，或者任务刚被移出这个组，照常放回队列
+        if (!tg || !task_group_throttle_task(tg, prev)) {
+            rq->cfs.enqueue(&prev->se, ENQUEUE_MIGRATED);
+        }
+    }
+    if (runnable && !migrate && !stay && !throttle) {
+        if (to_rt) {
+            rq->rt.enqueue(&prev->rt);
+        } else {
+            rq->cfs.enqueue(&prev->se, ENQUEUE_WAKEUP);
+        }
+    }
+    if (migrate && !to_rt) {
+        prev->se.vruntime -= rq->cfs.min_vruntime;
+    }
+    rq->nr_running = rq->cfs.nr_running;
+    update_rt_overload(rq);
     spin_unlock(&rq->lock);
+    if (migrate) {
+        enqueue_task(prev, rq->cpu, ENQUEUE_MIGRATED);
+    }
 }
 
-Task* SMP_Scheduler::load_balance() {
+void SMP_Scheduler::scheduler_tick() {
     RunQueue* rq = scheduler_runqueue.operator->();
     spin_lock(&rq->lock);
-    if (!list_empty(&rq->runnable_list)) {
-        auto* stolen = list_entry(rq->runnable_list.next, Task, sched_list);
-        list_del_init(&stolen->sched_list);
-        rq->nr_running--;
-        spin_unlock(&rq->lock);
-        log_debug("stealing task %d(0x%x) from CPU %d\n", stolen->task_id, stolen, arch::apic_get_id());
-        return stolen;
+    rq->cfs.tick(sched_clock());
+    // 任务组用完了配额(可能是组里别的CPU上的任务用完的)，换下当前任务
+    if (rq->cfs.curr && charge_group(container_of(rq->cfs.curr, Task, se))) {
+        rq->cfs.resched = true;
+    }
+    rq->rt.tick();
+    bool idle = !rq->cfs.curr && !rq->rt.curr;
+    if (idle) {
+        rq->stats.idle_ticks++;
+    } else {
+        rq->stats.busy_ticks++;
+    }
+    // 空闲CPU每个tick都尝试拉任务，忙碌CPU隔BALANCE_INTERVAL个tick检查一次
+    bool due = idle || --rq->balance_ticks == 0;
+    if (due) {
+        rq->balance_ticks = BALANCE_INTERVAL;
+    }
+    spin_unlock(&rq->lock);
+    if (due) {
+        balance(rq, idle);
+    }
+}
+
+bool SMP_Scheduler::need_resched() {
+    RunQueue* rq = scheduler_runqueue.operator->();
+    spin_lock(&rq->lock);
+    // 运行实时任务时公平调度类的标记没有意义，一起清掉
+    bool rt = rq->rt.test_and_clear_resched();
+    bool fair = rq->cfs.test_and_clear_resched();
+    bool ret = rt || (fair && !rq->rt.curr);
+    spin_unlock(&rq->lock);
+    return ret;
+}
+
+void SMP_Scheduler::yield() {
+    RunQueue* rq = scheduler_runqueue.operator->();
+    spin_lock(&rq->lock);
+    if (rq->rt.curr) {
+        rq->rt.yield();
+    } else {
+        rq->cfs.yield(sched_clock());
+    }
+    spin_unlock(&rq->lock);
+}
+
+void SMP_Scheduler::resched_cpu(uint32_t cpu) {
+    if (cpu == arch::get_cpu_id() || !resched_ipi_enabled) {
+        return;
+    }
+    RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu);
+    // 目标CPU处理IPI时一次看到所有的重新调度标记，在路上的IPI足够了
+    if (__atomic_exchange_n(&rq->ipi_pending, true, __ATOMIC_ACQ_REL)) {
+        __atomic_fetch_add(&rq->stats.ipis_coalesced, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    arch::apic_send_ipi(IPI_RESCHEDULE_VECTOR, cpu);
+}
+
+void SMP_Scheduler::resched_ipi() {
+    RunQueue* rq = scheduler_runqueue.operator->();
+    // 先清pending再检查重新调度标记，之后设置的标记会再发一个IPI
+    __atomic_store_n(&rq->ipi_pending, false, __ATOMIC_SEQ_CST);
+    rq->stats.resched_ipis++;
+}
+
+bool SMP_Scheduler::nohz_idle_enter() {
+    RunQueue* rq = scheduler_runqueue.operator->();
+    spin_lock(&rq->lock);
+    bool ret = !rq->cfs.curr && !rq->rt.curr && rq->cfs.nr_running == 0 && rq->rt.nr_running == 0
+        && !rq_resched(rq);
+    spin_unlock(&rq->lock);
+    return ret;
+}
+
+void SMP_Scheduler::nohz_idle_exit() {
+    RunQueue* rq = scheduler_runqueue.operator->();
+    spin_lock(&rq->lock);
+    rq->cfs.last_tick = 0;
+    spin_unlock(&rq->lock);
+}
+
+int SMP_Scheduler::set_current_nice(int nice) {
+    if (nice < MIN_NICE) {
+        nice = MIN_NICE;
+    } else if (nice > MAX_NICE) {
+        nice = MAX_NICE;
+    }
+    RunQueue* rq = scheduler_runqueue.operator->();
+    Task* current = get_current_task();
+    uint32_t flags;
+    rq->lock.acquire_irqsave(flags);
+    // 当前任务不在红黑树里，先按旧权重结算，再换权重
+    rq->cfs.update_curr(sched_clock());
+    current->priority = nice_to_prio(nice);
+    current->se.set_prio(current->priority);
+    rq->lock.release_irqrestore(flags);
+    return nice;
+}
+
+bool SMP_Scheduler::set_scheduler(Task* p, uint32_t policy, uint32_t prio) {
+    bool valid = rt_policy(policy) ? prio >= 1 && prio < MAX_RT_PRIO : policy == SCHED_NORMAL && prio == 0;
+    if (!p || !valid) {
+        return false;
+    }
+    // 任务可能正在被迁移，锁住以后再确认它还在这个CPU上
+    RunQueue* rq;
+    uint32_t flags;
+    while (true) {
+        rq = scheduler_runqueue.get_for_cpu(p->se.cpu);
+        if (!rq) {
+            p->rt.policy = policy;
+            p->rt.prio = prio;
+            return true;
+        }
+        rq->lock.acquire_irqsave(flags);
+        if (rq->cpu == p->se.cpu) {
+            break;
+        }
+        rq->lock.release_irqrestore(flags);
+    }
+    bool queued_rt = p->rt.on_rq && p->rt.cpu == rq->cpu;
+    bool queued_fair = p->se.on_rq && p->se.cpu == rq->cpu;
+    bool running = rq->rt.curr == &p->rt || rq->cfs.curr == &p->se;
+    if (queued_rt) {
+        rq->rt.dequeue(&p->rt);
+    } else if (queued_fair) {
+        rq->cfs.dequeue(&p->se);
+    }
+    p->rt.policy = policy;
+    p->rt.prio = prio;
+    p->rt.time_slice = RR_TIMESLICE;
+    if (queued_rt || queued_fair) {
+        if (rt_policy(policy)) {
+            rq->rt.enqueue(&p->rt);
+        } else {
+            // 从实时类回来的任务按唤醒放置，vruntime不会落后太多
+            rq->cfs.enqueue(&p->se, queued_rt ? ENQUEUE_WAKEUP : 0);
+        }
+        rq->nr_running = rq->cfs.nr_running;
+        update_rt_overload(rq);
+    } else if (running) {
+        // 在下一次切换时放进新的调度类，见put_prev_task
+        rq->rt.resched = true;
+    }
+    bool kick = rq_resched(rq) && rq->cpu != arch::get_cpu_id();
+    uint32_t cpu = rq->cpu;
+    rq->lock.release_irqrestore(flags);
+    if (kick) {
+        resched_cpu(cpu);
+    }
+    return true;
+}
+
+struct MigrateTarget {
+    SMP_Scheduler* scheduler;
+    uint32_t cpu;
+};
+
+// 任务的亲和性允许在目标CPU上运行
+static bool can_run_on(SchedEntity* se, void* arg) {
+    auto target = static_cast<MigrateTarget*>(arg);
+    Task* p = container_of(se, Task, se);
+    // 刚被放回队列、还没离开原来CPU的内核栈的任务不拉，两个CPU互相拉对方换下的任务时会互相等
+    return !__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE)
+        && target->scheduler->cpu_allowed(p, target->cpu);
+}
+
+// 还没离开原来CPU的内核栈的实时任务不能迁移
+static bool rt_not_running(RtEntity* rt, void*) {
+    return !__atomic_load_n(&container_of(rt, Task, rt)->on_cpu, __ATOMIC_ACQUIRE);
+}
+
+// 实时任务的版本，同样跳过还没离开原来CPU的内核栈的任务
+static bool can_run_rt_on(RtEntity* rt, void* arg) {
+    auto target = static_cast<MigrateTarget*>(arg);
+    Task* p = container_of(rt, Task, rt);
+    return !__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE)
+        && target->scheduler->cpu_allowed(p, target->cpu);
+}
+
+uint32_t SMP_Scheduler::rq_prio(RunQueue* rq) {
+    uint32_t prio = rq->curr_prio;
+    uint32_t waiting = rq->rt.highest_prio();
+    if (waiting && rt_to_cpuprio(waiting) > prio) {
+        prio = rt_to_cpuprio(waiting);
+    }
+    return prio;
+}
+
+uint32_t SMP_Scheduler::select_rt_cpu(Task* p, uint32_t preferred) {
+    uint32_t allowed = allowed_cpus(p);
+    uint32_t prio = rt_to_cpuprio(p->rt.prio);
+    if (preferred < MAX_CPUS && (allowed & (1u << preferred))
+        && rq_prio(scheduler_runqueue.get_for_cpu(preferred)) < prio) {
+        return preferred;
+    }
+    // 选正在运行的任务优先级最低的CPU，空闲的CPU最好
+    uint32_t best = MAX_CPUS;
+    uint32_t best_prio = prio;
+    for (unsigned int cpu = 0; cpu < arch::apic_get_cpu_count(); cpu++) {
+        RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu);
+        if (!rq || !(allowed & (1u << cpu))) {
+            continue;
+        }
+        uint32_t cpu_prio = rq_prio(rq);
+        if (cpu_prio < best_prio) {
+            best_prio = cpu_prio;
+            best = cpu;
+        }
+    }
+    // 都在运行更高优先级的任务，按普通任务的方式选，在队列里等
+    return best < MAX_CPUS ? best : select_cpu(p, preferred);
+}
+
+void SMP_Scheduler::update_rt_overload(RunQueue* rq) {
+    uint32_t bit = 1u << rq->cpu;
+    if (rq->rt.nr_running) {
+        __atomic_fetch_or(&rt_overload_mask, bit, __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_and(&rt_overload_mask, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+bool SMP_Scheduler::pull_rt(RunQueue* rq, uint32_t floor) {
+    uint32_t mask = __atomic_load_n(&rt_overload_mask, __ATOMIC_ACQUIRE) & ~(1u << rq->cpu);
+    bool pulled = false;
+    MigrateTarget target = {this, rq->cpu};
+    for (uint32_t cpu = 0; mask; cpu++, mask >>= 1) {
+        RunQueue* src = scheduler_runqueue.get_for_cpu(cpu);
+        // 不加锁先看一眼，没有比floor高的就不去锁别的CPU
+        if (!(mask & 1) || !src || src->rt.highest_prio() <= floor) {
+            continue;
+        }
+        double_lock(rq, src);
+        uint32_t min_prio = rq->rt.highest_prio() > floor ? rq->rt.highest_prio() : floor;
+        RtEntity* rt = rq->rt.pull_from(src->rt, min_prio, can_run_rt_on, &target);
+        if (rt) {
+            container_of(rt, Task, rt)->se.cpu = rq->cpu;
+            update_rt_overload(rq);
+            update_rt_overload(src);
+            rq->stats.rt_pulls++;
+            floor = rt->prio;
+            pulled = true;
+        }
+        double_unlock(rq, src);
+    }
+    return pulled;
+}
+
+void SMP_Scheduler::push_rt(RunQueue* rq) {
+    spin_lock(&rq->lock);
+    // 等待的任务里优先级最高的一个，放开锁以后任务可能被选中运行甚至退出，只记下优先级和亲和性
+    RtEntity* rt = rq->rt.find_first(rt_not_running, nullptr);
+    uint32_t prio = rt ? rt_to_cpuprio(rt->prio) : 0;
+    uint32_t allowed = rt ? allowed_cpus(container_of(rt, Task, rt)) & ~(1u << rq->cpu) : 0;
+    spin_unlock(&rq->lock);
+    if (!allowed) {
+        return;
+    }
+    RunQueue* best = nullptr;
+    uint32_t best_prio = prio;
+    for (unsigned int cpu = 0; cpu < arch::apic_get_cpu_count(); cpu++) {
+        RunQueue* target = scheduler_runqueue.get_for_cpu(cpu);
+        if (target && (allowed & (1u << cpu)) && rq_prio(target) < best_prio) {
+            best_prio = rq_prio(target);
+            best = target;
+        }
+    }
+    if (!best) {
+        return;
+    }
+    double_lock(rq, best);
+    // 放开锁期间队列和目标CPU都可能变了，重新找能在目标CPU上运行的任务
+    bool kick = false;
+    MigrateTarget target = {this, best->cpu};
+    rt = rq->rt.find_first(can_run_rt_on, &target);
+    if (rt && rq_prio(best) < rt_to_cpuprio(rt->prio)) {
+        rq->rt.dequeue(rt);
+        best->rt.enqueue(rt);
+        container_of(rt, Task, rt)->se.cpu = best->cpu;
+        update_rt_overload(rq);
+        update_rt_overload(best);
+        rq->stats.rt_pushes++;
+        kick = best->rt.resched;
+    }
+    double_unlock(rq, best);
+    if (kick) {
+        resched_cpu(best->cpu);
+    }
+}
+
+void SMP_Scheduler::post_switch() {
+    RunQueue* rq = scheduler_runqueue.operator->();
+    // 本CPU运行的是普通任务时，等待的实时任务马上会在本CPU上运行，不用推
+    if (rq->rt.curr && rq->rt.nr_running) {
+        push_rt(rq);
+    }
+}
+
+uint32_t SMP_Scheduler::allowed_cpus(Task* p) {
+    uint32_t mask = (p->affinity ? p->affinity : housekeeping_mask) & online_mask;
+    return mask ? mask : housekeeping_mask;
+}
+
+uint32_t SMP_Scheduler::select_cpu(Task* p, uint32_t preferred) {
+    uint32_t allowed = allowed_cpus(p);
+    if (preferred < MAX_CPUS && (allowed & (1u << preferred))) {
+        return preferred;
+    }
+    // 不加锁读任务数，选错了也只是不够均衡，之后的负载均衡会纠正
+    uint32_t best = preferred;
+    uint32_t min_tasks = 0xFFFFFFFF;
+    for (unsigned int cpu = 0; cpu < arch::apic_get_cpu_count(); cpu++) {
+        RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu);
+        if (!rq || !(allowed & (1u << cpu))) {
+            continue;
+        }
+        if (rq->cfs.nr_total() < min_tasks) {
+            min_tasks = rq->cfs.nr_total();
+            best = cpu;
+        }
+    }
+    return best;
+}
+
+void SMP_Scheduler::double_lock(RunQueue* a, RunQueue* b) {
+    // 所有CPU都按cpu号从小到大加锁，两个CPU互相拉任务时不会死锁
+    if (a->cpu < b->cpu) {
+        spin_lock(&a->lock);
+        spin_lock(&b->lock);
+    } else {
+        spin_lock(&b->lock);
+        spin_lock(&a->lock);
+    }
+}
+
+void SMP_Scheduler::double_unlock(RunQueue* a, RunQueue* b) {
+    spin_unlock(&a->lock);
+    spin_unlock(&b->lock);
+}
+
+bool SMP_Scheduler::balance(RunQueue* rq, bool idle) {
+    uint32_t busiest_cpu = find_busiest_cpu();
+    if (busiest_cpu == rq->cpu) {
+        return false;
+    }
+    RunQueue* busiest = scheduler_runqueue.get_for_cpu(busiest_cpu);
+    // 不加锁先看一眼，大多数时候不需要迁移，不去碰别的CPU的锁
+    if (rq->cfs.calc_imbalance(busiest->cfs) == 0) {
+        return false;
+    }
+
+    double_lock(rq, busiest);
+    uint32_t moved = 0;
+    uint32_t imbalance = rq->cfs.calc_imbalance(busiest->cfs);
+    if (imbalance) {
+        uint32_t hot = 0;
+        bool check_hot = rq->balance_failed < BALANCE_FAILED_MAX;
+        MigrateTarget target = {this, rq->cpu};
+        moved = rq->cfs.pull_from(busiest->cfs, imbalance, sched_clock(), check_hot, can_run_on,
+            &target, &hot);
+        rq->nr_running = rq->cfs.nr_running;
+        busiest->nr_running = busiest->cfs.nr_running;
+        if (moved) {
+            rq->balance_failed = 0;
+        } else if (hot) {
+            rq->balance_failed++;
+        }
+        rq->stats.hot_skipped += hot;
+        rq->stats.migrations_in += moved;
+        busiest->stats.migrations_out += moved;
+        if (idle) {
+            rq->stats.idle_pulls += moved;
+        } else {
+            rq->stats.periodic_pulls += moved;
+        }
     }
+    double_unlock(rq, busiest);
+    return moved > 0;
+}
+
+Task* SMP_Scheduler::load_balance() {
+    RunQueue* rq = scheduler_runqueue.operator->();
+    if (!balance(rq, true)) {
+        return get_idle_task();
+    }
+    spin_lock(&rq->lock);
+    SchedEntity* se = pick_fair(rq);
     spin_unlock(&rq->lock);
-    auto idle = get_idle_task();
-    // debug_debug("No tasks to run, returning idle task %d\n", idle->task_id);
-    return idle;
+    return se ? container_of(se, Task, se) : get_idle_task();
 }
 
 uint32_t SMP_Scheduler::find_busiest_cpu() {
+    // 只读nr_running不加锁，结果只是个参考，迁移前会在锁里重新检查
+    uint32_t busiest_cpu = arch::get_cpu_id();
     uint32_t max_tasks = 0;
-    uint32_t busiest_cpu = 0;
-    for (unsigned int cpu = 0; cpu < MAX_CPUS; ++cpu) {
+    for (unsigned int cpu = 0; cpu < arch::apic_get_cpu_count(); ++cpu) {
         RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu);
-        if (rq->nr_running > max_tasks) {
+        if (rq && rq->nr_running > max_tasks) {
             max_tasks = rq->nr_running;
             busiest_cpu = cpu;
         }
@@ -115,37 +634,92 @@ uint32_t SMP_Scheduler::find_busiest_cpu() {
     return busiest_cpu;
 }
 
-void SMP_Scheduler::set_affinity(Task* p, uint32_t cpu_mask) {
-    if (!p) return;
-    uint32_t max_cpus = MAX_CPUS;
-    uint32_t valid_mask = (1 << max_cpus) - 1;
-    cpu_mask &= valid_mask;
-    if (cpu_mask == 0) {
-        cpu_mask = valid_mask;
+bool SMP_Scheduler::cpu_stats(uint32_t cpu, RunQueue::Stats& stats, uint32_t& nr_running) {
+    if (cpu >= arch::apic_get_cpu_count()) {
+        return false;
     }
-    p->affinity = cpu_mask;
-    log_debug("Set process %d affinity to 0x%x\n", p->task_id, cpu_mask);
+    RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu);
+    uint32_t flags;
+    rq->lock.acquire_irqsave(flags);
+    stats = rq->stats;
+    nr_running = rq->nr_running + rq->rt.nr_running;
+    rq->lock.release_irqrestore(flags);
+    return true;
+}
+
+bool SMP_Scheduler::set_affinity(Task* p, uint32_t cpu_mask) {
+    if (!p || (cpu_mask && !(cpu_mask & online_mask))) {
+        return false;
+    }
+    p->affinity = cpu_mask & online_mask;
+    log_debug("Set process %d affinity to 0x%x\n", p->task_id, p->affinity);
+
+    // 任务在排队或运行的CPU不再允许时，把它挪走
+    uint32_t cpu = p->se.cpu;
+    RunQueue* rq = scheduler_runqueue.get_for_cpu(cpu);
+    if (!rq || cpu_allowed(p, cpu)) {
+        return true;
+    }
+    bool moved = false;
+    bool kick = false;
+    uint32_t flags;
+    rq->lock.acquire_irqsave(flags);
+    if (p->rt.on_rq && p->rt.cpu == cpu) {
+        rq->rt.dequeue(&p->rt);
+        update_rt_overload(rq);
+        moved = true;
+    } else if (p->se.on_rq && p->se.cpu == cpu) {
+        rq->cfs.dequeue(&p->se);
+        rq->nr_running = rq->cfs.nr_running;
+        p->se.vruntime -= rq->cfs.min_vruntime;
+        moved = true;
+    } else if (rq->cfs.curr == &p->se || rq->rt.curr == &p->rt) {
+        // 正在运行，由那个CPU在下一次切换时迁移，见put_prev_task
+        rq->cfs.resched = true;
+        rq->rt.resched = true;
+        kick = true;
+    }
+    rq->lock.release_irqrestore(flags);
+    if (moved) {
+        enqueue_task(p, cpu, ENQUEUE_MIGRATED);
+    } else if (kick) {
+        resched_cpu(cpu);
+    }
+    return true;
 }
 
 RunQueue* SMP_Scheduler::get_current_runqueue() {
     return scheduler_runqueue.operator->();
 }
-Task *SMP_Scheduler::get_idle_task()
-{
-    return idle_task.operator->();
-}
 void SMP_Scheduler::set_idle_task(Task *task)
 {
-    idle_task.set(task);
+    this_cpu_write(idle_task, task);
 }
 
-Task *SMP_Scheduler::get_current_task()
+int SMP_Scheduler::running_cpu(Task *task)
 {
-    return current_task.operator->();
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (__atomic_load_n(&per_cpu(current_task, cpu), __ATOMIC_ACQUIRE) == task) {
+            return cpu;
+        }
+    }
+    return -1;
 }
 void SMP_Scheduler::set_current_task(Task *task)
 {
-    current_task.set(task);
+    Task* prev = get_current_task();
+    this_cpu_write(current_task, task);
+    RunQueue* rq = scheduler_runqueue.operator->();
+    spin_lock(&rq->lock);
+    if (prev != task) {
+        rq->stats.nr_switches++;
+    }
+    bool idle = task == get_idle_task();
+    bool rt = !idle && rt_policy(task->rt.policy);
+    rq->rt.set_next(rt ? &task->rt : nullptr);
+    rq->cfs.set_next(idle || rt ? nullptr : &task->se, sched_clock());
+    rq->curr_prio = idle ? CPUPRIO_IDLE : rt ? rt_to_cpuprio(task->rt.prio) : CPUPRIO_NORMAL;
+    spin_unlock(&rq->lock);
 }
 
 } // namespace kernel
\ No newline at end of file
@@ -0,0 +1,243 @@
+#include "kernel/task_group.h"
+
+#include <arch/x86/atomic.h>
+#include <kernel/kernel.h>
+#include <kernel/process.h>
+#include <lib/debug.h>
+#include <lib/string.h>
+
+namespace kernel {
+
+// 全局对象不执行构造函数，全零的组就是没有使用的组，第0项留给根组不使用
+static TaskGroup groups[MAX_TASK_GROUPS];
+static SpinLock groups_lock; // 保护组的创建
+static DEFINE_LOCK_CLASS(task_group_lock_class, "task_group");
+
+// 调用方持有tg->lock，组解除限流，挂在组上的任务移到tasks里
+static void unthrottle_locked(TaskGroup* tg, struct list_head* tasks)
+{
+    tg->throttled_ns += ktime_get() - tg->throttled_at;
+    while(!list_empty(&tg->throttled_tasks)) {
+        struct list_head* node = tg->throttled_tasks.next;
+        list_del_init(node);
+        list_add_tail(node, tasks);
+    }
+}
+
+// 被限流的任务放回运行队列，调用方已关中断，不持有任何锁
+static void requeue_tasks(struct list_head* tasks)
+{
+    auto& scheduler = Kernel::instance().scheduler();
+    while(!list_empty(tasks)) {
+        Task* p = list_entry(tasks->next, Task, group_node);
+        list_del_init(&p->group_node);
+        // 挂起时vruntime换成了相对值，按迁移放回，在新的位置上保持原来的先后
+        scheduler.enqueue_task(p, p->se.cpu, ENQUEUE_MIGRATED);
+    }
+}
+
+static enum hrtimer_restart period_timer_fn(hrtimer* timer)
+{
+    auto tg = container_of(timer, TaskGroup, period_timer);
+    struct list_head tasks;
+    INIT_LIST_HEAD(&tasks);
+    uint32_t flags;
+    tg->lock.acquire_irqsave(flags);
+    if(tg->bandwidth.refill()) {
+        unthrottle_locked(tg, &tasks);
+    }
+    bool limited = tg->bandwidth.limited();
+    uint64_t period = tg->bandwidth.period_ns;
+    tg->lock.release();
+    requeue_tasks(&tasks);
+    asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+    if(!limited) {
+        return HRTIMER_NORESTART;
+    }
+    hrtimer_forward_ns(timer, period);
+    return HRTIMER_RESTART;
+}
+
+int task_group_create(const char* name)
+{
+    if(!name || !name[0]) {
+        return -1;
+    }
+    char buf[TASK_GROUP_NAME_LEN + 1];
+    strncpy(buf, name, TASK_GROUP_NAME_LEN);
+    buf[TASK_GROUP_NAME_LEN] = '\0';
+
+    uint32_t flags;
+    groups_lock.acquire_irqsave(flags);
+    int id = -1;
+    uint32_t free_id = 0;
+    for(uint32_t i = 1; i < MAX_TASK_GROUPS; i++) {
+        if(groups[i].id != i) {
+            free_id = free_id ? free_id : i;
+        } else if(strcmp(groups[i].name, buf) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if(id < 0 && free_id) {
+        TaskGroup* tg = &groups[free_id];
+        tg->lock = SpinLock(&task_group_lock_class);
+        strncpy(tg->name, buf, TASK_GROUP_NAME_LEN + 1);
+        tg->bandwidth.init();
+        tg->throttled_at = 0;
+        tg->throttled_ns = 0;
+        INIT_LIST_HEAD(&tg->throttled_tasks);
+        hrtimer_init(&tg->period_timer, period_timer_fn);
+        tg->nr_tasks = 0;
+        tg->mem_usage = 0;
+        tg->mem_limit = 0;
+        tg->mem_max_usage = 0;
+        tg->mem_failcnt = 0;
+        // id最后写，task_group_get看到id以后组已经初始化完
+        __atomic_store_n(&tg->id, free_id, __ATOMIC_RELEASE);
+        id = free_id;
+        log_info("task group %d (%s) created\n", id, tg->name);
+    }
+    groups_lock.release_irqrestore(flags);
+    return id;
+}
+
+TaskGroup* task_group_get(uint32_t id)
+{
+    if(id == 0 || id >= MAX_TASK_GROUPS || __atomic_load_n(&groups[id].id, __ATOMIC_ACQUIRE) != id) {
+        return nullptr;
+    }
+    return &groups[id];
+}
+
+bool task_group_set_limits(TaskGroup* tg, uint64_t quota_ns, uint64_t period_ns,
+    uint32_t mem_limit_pages)
+{
+    struct list_head tasks;
+    INIT_LIST_HEAD(&tasks);
+    uint32_t flags;
+    tg->lock.acquire_irqsave(flags);
+    bool was_throttled = tg->bandwidth.throttled;
+    if(!tg->bandwidth.set(quota_ns, period_ns)) {
+        tg->lock.release_irqrestore(flags);
+        return false;
+    }
+    // 新的配额从现在开始算，之前被限流的任务都放回去
+    if(was_throttled) {
+        unthrottle_locked(tg, &tasks);
+    }
+    tg->mem_limit = mem_limit_pages;
+    uint64_t period = tg->bandwidth.limited() ? tg->bandwidth.period_ns : 0;
+    // 放回运行队列要加运行队列的锁，不能在组的锁里面
+    tg->lock.release();
+    requeue_tasks(&tasks);
+    asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+
+    if(period) {
+        hrtimer_start(&tg->period_timer, period, HRTIMER_MODE_REL);
+    } else {
+        hrtimer_cancel(&tg->period_timer);
+    }
+    log_info("task group %d (%s): quota %dus, period %dus, memory limit %d pages\n", tg->id,
+        tg->name, (uint32_t)(quota_ns / 1000), (uint32_t)(tg->bandwidth.period_ns / 1000),
+        mem_limit_pages);
+    return true;
+}
+
+void task_group_attach(Task* p, TaskGroup* tg)
+{
+    uint32_t irq;
+    asm volatile("pushfl; popl %0; cli" : "=r"(irq) : : "memory");
+    TaskGroup* old = p->group;
+    if(old == tg) {
+        asm volatile("pushl %0; popfl" : : "r"(irq) : "memory", "cc");
+        return;
+    }
+    bool parked = false;
+    if(old) {
+        old->lock.acquire();
+        if(!list_empty(&p->group_node)) {
+            list_del_init(&p->group_node);
+            parked = true;
+        }
+        old->lock.release();
+        __atomic_sub_fetch(&old->nr_tasks, 1, __ATOMIC_RELAXED);
+    }
+    p->group = tg;
+    if(tg) {
+        __atomic_add_fetch(&tg->nr_tasks, 1, __ATOMIC_RELAXED);
+    }
+    // 在旧组上等下一个周期的任务不再受旧组限制，立即放回运行队列
+    if(parked) {
+        Kernel::instance().scheduler().enqueue_task(p, p->se.cpu, ENQUEUE_MIGRATED);
+    }
+    asm volatile("pushl %0; popfl" : : "r"(irq) : "memory", "cc");
+
+    // 内核线程共用kernel_context，没有自己的地址空间
+    if(p->context && p->context != ProcessManager::kernel_context) {
+        p->context->user_mm.set_group(tg);
+    }
+}
+
+void task_group_exit(Task* p)
+{
+    if(p->group) {
+        __atomic_sub_fetch(&p->group->nr_tasks, 1, __ATOMIC_RELAXED);
+        p->group = nullptr;
+    }
+}
+
+bool task_group_charge(TaskGroup* tg, uint64_t ns)
+{
+    tg->lock.acquire();
+    if(tg->bandwidth.charge(ns)) {
+        tg->throttled_at = ktime_get();
+    }
+    bool throttled = tg->bandwidth.throttled;
+    tg->lock.release();
+    return throttled;
+}
+
+bool task_group_throttle_task(TaskGroup* tg, Task* p)
+{
+    tg->lock.acquire();
+    bool throttled = tg->bandwidth.throttled;
+    if(throttled) {
+        list_add_tail(&p->group_node, &tg->throttled_tasks);
+    }
+    tg->lock.release();
+    return throttled;
+}
+
+void task_group_charge_pages(TaskGroup* tg, int delta)
+{
+    if(!tg) {
+        return;
+    }
+    uint32_t usage = arch::atomic_add(&tg->mem_usage, (uint32_t)delta) + delta;
+    // 峰值只是统计，不加锁
+    if(delta > 0 && usage > tg->mem_max_usage) {
+        tg->mem_max_usage = usage;
+    }
+}
+
+bool task_group_try_charge(TaskGroup* tg, uint32_t pages)
+{
+    if(!tg) {
+        return true;
+    }
+    // 检查和记账用一次cmpxchg完成，多个CPU同时缺页时不会一起越过上限
+    uint32_t usage = arch::atomic_load(&tg->mem_usage, arch::relaxed);
+    do {
+        if(tg->mem_limit && usage + pages > tg->mem_limit) {
+            arch::atomic_add(&tg->mem_failcnt, 1);
+            return false;
+        }
+    } while(!arch::atomic_compare_exchange(&tg->mem_usage, &usage, usage + pages));
+    if(usage + pages > tg->mem_max_usage) {
+        tg->mem_max_usage = usage + pages;
+    }
+    return true;
+}
+
+} // namespace kernel
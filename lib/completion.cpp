@@ -0,0 +1,64 @@
+#include <lib/completion.h>
+
+namespace kernel {
+
+bool Completion::try_consume()
+{
+    if(done == 0) {
+        return false;
+    }
+    if(done != COMPLETE_ALL) {
+        done--;
+    }
+    return true;
+}
+
+bool Completion::wait(uint32_t timeout)
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    if(try_consume()) {
+        wq.lock.release_irqrestore(flags);
+        return true;
+    }
+    if(timeout == 0) {
+        wq.lock.release_irqrestore(flags);
+        return false;
+    }
+    return wq.wait(flags, timeout) == 0;
+}
+
+bool Completion::wait_block()
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    if(try_consume()) {
+        wq.lock.release_irqrestore(flags);
+        return true;
+    }
+    return wq.block(flags) == 0;
+}
+
+void Completion::complete()
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    WaitEntry* waiter = wq.first();
+    if(waiter) {
+        wq.wake(waiter, 0);
+    } else if(done != COMPLETE_ALL) {
+        done++;
+    }
+    wq.lock.release_irqrestore(flags);
+}
+
+void Completion::complete_all()
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    done = COMPLETE_ALL;
+    wq.wake_all(0);
+    wq.lock.release_irqrestore(flags);
+}
+
+} // namespace kernel
@@ -0,0 +1,41 @@
+#include <lib/condvar.h>
+
+namespace kernel {
+
+bool CondVar::wait(Mutex& mutex, uint32_t timeout)
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    // 持有队列锁释放互斥锁，signal要等挂上队列以后才能拿到队列锁
+    mutex.unlock();
+    bool signaled;
+    if(timeout == WAIT_FOREVER && WaitQueue::can_block()) {
+        // 和Mutex::lock一样能睡眠时阻塞；已经被杀死的任务不睡眠，返回false
+        signaled = wq.block(flags) != WAIT_KILLED;
+    } else {
+        signaled = wq.wait(flags, timeout) == 0;
+    }
+    mutex.lock();
+    return signaled;
+}
+
+void CondVar::signal()
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    WaitEntry* waiter = wq.first();
+    if(waiter) {
+        wq.wake(waiter, 0);
+    }
+    wq.lock.release_irqrestore(flags);
+}
+
+void CondVar::broadcast()
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    wq.wake_all(0);
+    wq.lock.release_irqrestore(flags);
+}
+
+} // namespace kernel
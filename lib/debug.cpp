@@ -4,6 +4,21 @@
 #include "lib/string.h"
 
 LogLevel current_log_level = LOG_DEBUG;
+volatile uint32_t log_generation = 1;
+
+// 按源文件路径设置的日志级别，name为空串表示没有使用
+struct LogLevelRule {
+    char name[LOG_RULE_NAME_MAX];
+    LogLevel level;
+};
+static LogLevelRule log_rules[LOG_RULES_MAX];
+// 修改规则前后各加1，奇数表示正在修改。读的一方可能在中断里，不等待，读到修改中的规则时不缓存结果
+static volatile uint32_t log_rules_seq;
+// 修改规则的一方在系统调用或者启动时，中断已关
+static SpinLock log_rules_lock;
+
+static const char* const log_level_names[] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug", "trace"};
 
 const char* get_filename_from_path(const char* path)
 {
@@ -11,6 +26,146 @@ const char* get_filename_from_path(const char* path)
     return (last_slash != nullptr) ? (last_slash + 1) : path;
 }
 
+// 规则已经改完，之前缓存的结果都过时
+static void log_levels_changed()
+{
+    __atomic_add_fetch(&log_generation, 1, __ATOMIC_RELEASE);
+}
+
+uint32_t log_site_update(LogSite* site, LogLevel level)
+{
+    uint32_t generation = __atomic_load_n(&log_generation, __ATOMIC_ACQUIRE);
+    uint32_t seq = __atomic_load_n(&log_rules_seq, __ATOMIC_ACQUIRE);
+    LogLevel limit = current_log_level;
+    bool stable = !(seq & 1);
+    if(stable) {
+        for(const LogLevelRule& rule : log_rules) {
+            if(rule.name[0] && strstr(site->file, rule.name)) {
+                limit = rule.level;
+                break;
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        stable = __atomic_load_n(&log_rules_seq, __ATOMIC_RELAXED) == seq;
+    }
+    if(!stable) {
+        limit = current_log_level;
+    }
+    uint32_t state = (generation << 1) | (level <= limit ? 1 : 0);
+    if(stable) {
+        site->state = state;
+    }
+    return state;
+}
+
+void set_log_level(LogLevel level)
+{
+    current_log_level = level;
+    log_levels_changed();
+}
+
+static LogLevelRule* find_log_rule(const char* name)
+{
+    for(LogLevelRule& rule : log_rules) {
+        if(rule.name[0] && !strcmp(rule.name, name)) {
+            return &rule;
+        }
+    }
+    return nullptr;
+}
+
+bool set_log_level(const char* name, int level)
+{
+    if(!name[0] || strlen(name) >= LOG_RULE_NAME_MAX || level > LOG_TRACE) {
+        return false;
+    }
+    log_rules_lock.acquire();
+    LogLevelRule* rule = find_log_rule(name);
+    bool ok = rule || level < 0;
+    if(!rule && level >= 0) {
+        for(LogLevelRule& free_rule : log_rules) {
+            if(!free_rule.name[0]) {
+                rule = &free_rule;
+                ok = true;
+                break;
+            }
+        }
+    }
+    if(rule) {
+        __atomic_store_n(&log_rules_seq, log_rules_seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if(level < 0) {
+            rule->name[0] = '\0';
+        } else {
+            strcpy(rule->name, name);
+            rule->level = (LogLevel)level;
+        }
+        __atomic_store_n(&log_rules_seq, log_rules_seq + 1, __ATOMIC_RELEASE);
+    }
+    log_rules_lock.release();
+    log_levels_changed();
+    return ok;
+}
+
+LogLevel get_log_level(const char* name)
+{
+    LogLevelRule* rule = find_log_rule(name);
+    return rule ? rule->level : current_log_level;
+}
+
+int parse_log_level(const char* str, uint32_t len)
+{
+    if(len == 1 && str[0] >= '0' && str[0] <= '0' + LOG_TRACE) {
+        return str[0] - '0';
+    }
+    for(int level = LOG_EMERG; level <= LOG_TRACE; level++) {
+        const char* name = log_level_names[level];
+        if(strlen(name) == len && !strncmp(name, str, len)) {
+            return level;
+        }
+    }
+    if(len == 4 && !strncmp(str, "warn", 4)) {
+        return LOG_WARNING;
+    }
+    return -1;
+}
+
+bool parse_log_levels(const char* config, uint32_t len)
+{
+    const char* end = config + len;
+    while(config < end) {
+        const char* item_end = config;
+        const char* colon = nullptr;
+        while(item_end < end && *item_end != ',') {
+            if(*item_end == ':') {
+                colon = item_end;
+            }
+            item_end++;
+        }
+        if(!colon) {
+            int level = parse_log_level(config, item_end - config);
+            if(level < 0) {
+                return false;
+            }
+            set_log_level((LogLevel)level);
+        } else {
+            char name[LOG_RULE_NAME_MAX];
+            uint32_t name_len = colon - config;
+            int level = parse_log_level(colon + 1, item_end - colon - 1);
+            if(name_len == 0 || name_len >= sizeof(name) || level < 0) {
+                return false;
+            }
+            memcpy(name, config, name_len);
+            name[name_len] = '\0';
+            if(!set_log_level(name, level)) {
+                return false;
+            }
+        }
+        config = item_end + 1;
+    }
+    return true;
+}
+
 // 初始化串口
 static bool serial_initialized = false;
 static void ensure_serial_initialized() {
@@ -31,6 +186,8 @@ LogOutputInterface log_output_handler = {
     }
 };
 
+LogRecordHandler log_record_handler = nullptr;
+
 // 移除颜色保存/恢复相关代码
 
 void set_log_output_handler(const LogOutputInterface& new_handler) {
@@ -47,8 +204,85 @@ struct FormatFlags {
     char type = 0;
 };
 
+// 格式化参数的来源：可变参数。整数和指针都按一个字取，和原来的va_arg(args, long)一样
+struct VaArgs {
+    va_list args;
+
+    explicit VaArgs(va_list src) { va_copy(args, src); }
+    ~VaArgs() { va_end(args); }
+
+    unsigned long word() { return va_arg(args, unsigned long); }
+    const char* str() { return va_arg(args, const char*); }
+};
+
+// 格式化参数的来源：pack_args打包好的参数，读完或者打包时截断的部分返回0和空串
+struct PackedArgs {
+    const char* p;
+    const char* end;
+
+    unsigned long word()
+    {
+        unsigned long value = 0;
+        if(p + sizeof(value) <= end) {
+            memcpy(&value, p, sizeof(value));
+            p += sizeof(value);
+        } else {
+            p = end;
+        }
+        return value;
+    }
+
+    const char* str()
+    {
+        if(p >= end) {
+            return "";
+        }
+        const char* s = p;
+        p += strlen(s) + 1;
+        return s;
+    }
+};
+
+// 从可变参数取出来，原样写进缓冲区，写不下的参数丢掉
+struct ArgPacker {
+    VaArgs& src;
+    char* p;
+    char* end;
+
+    unsigned long word()
+    {
+        unsigned long value = src.word();
+        if(p + sizeof(value) <= end) {
+            memcpy(p, &value, sizeof(value));
+            p += sizeof(value);
+        } else {
+            p = end;
+        }
+        return value;
+    }
+
+    // 字符串连同结尾的0复制进来，放不下时截断
+    const char* str()
+    {
+        const char* s = src.str();
+        if(!s) {
+            s = "(null)";
+        }
+        if(p >= end) {
+            return s;
+        }
+        char* dst = p;
+        while(*s && p < end - 1) {
+            *p++ = *s++;
+        }
+        *p++ = '\0';
+        return dst;
+    }
+};
+
 // 解析格式说明符
-const char* parse_format_flags(const char* format, FormatFlags& flags, va_list& args)
+template <typename Args>
+static const char* parse_format_flags(const char* format, FormatFlags& flags, Args& args)
 {
     // 解析标志位
     while (*format) {
@@ -76,7 +310,7 @@ const char* parse_format_flags(const char* format, FormatFlags& flags, va_list&
         for(flags.width = 0; *format >= '0' && *format <= '9'; format++)
             flags.width = flags.width * 10 + (*format - '0');
     } else if(*format == '*') {
-        flags.width = va_arg(args, int);
+        flags.width = (int)args.word();
         format++;
     }
 
@@ -88,7 +322,7 @@ const char* parse_format_flags(const char* format, FormatFlags& flags, va_list&
             for(flags.precision = 0; *format >= '0' && *format <= '9'; format++)
                 flags.precision = flags.precision * 10 + (*format - '0');
         } else if(*format == '*') {
-            flags.precision = va_arg(args, int);
+            flags.precision = (int)args.word();
             format++;
         }
     }
@@ -419,8 +653,9 @@ char* format_pointer(char* p, const char* end, void* ptr)
     return p;
 }
 
-// 主格式化函数
-int format_string_v(char* buffer, size_t size, const char* format, va_list args)
+// 主格式化函数，参数从args取
+template <typename Args>
+static int format_args(char* buffer, size_t size, const char* format, Args& args)
 {
     char* p = buffer;
     const char* end = buffer + size;
@@ -435,31 +670,34 @@ int format_string_v(char* buffer, size_t size, const char* format, va_list args)
         FormatFlags flags;
         format++; // 跳过%
         format = parse_format_flags(format, flags, args);
+        if(!*format) {
+            break;
+        }
 
         // 根据类型调用相应的格式化函数
         switch(flags.type) {
             case 'd':
             case 'i':
-                p = format_integer(p, end, va_arg(args, long), flags);
+                p = format_integer(p, end, (long)args.word(), flags);
                 break;
             case 'u':
-                p = format_unsigned(p, end, va_arg(args, unsigned long), flags);
+                p = format_unsigned(p, end, args.word(), flags);
                 break;
             case 'x':
             case 'X':
-                p = format_hex(p, end, va_arg(args, unsigned long), flags);
+                p = format_hex(p, end, args.word(), flags);
                 break;
             case 'o':
-                p = format_octal(p, end, va_arg(args, unsigned long), flags);
+                p = format_octal(p, end, args.word(), flags);
                 break;
             case 's':
-                p = format_string(p, end, va_arg(args, const char*), flags);
+                p = format_string(p, end, args.str(), flags);
                 break;
             case 'c':
-                p = format_char(p, end, va_arg(args, int), flags);
+                p = format_char(p, end, (int)args.word(), flags);
                 break;
             case 'p':
-                p = format_pointer(p, end, va_arg(args, void*));
+                p = format_pointer(p, end, (void*)args.word());
                 break;
             case '%':
                 if(p < end) {
@@ -483,6 +721,62 @@ int format_string_v(char* buffer, size_t size, const char* format, va_list args)
 
     return p - buffer;
 }
+
+int format_string_v(char* buffer, size_t size, const char* format, va_list args)
+{
+    VaArgs va(args);
+    return format_args(buffer, size, format, va);
+}
+
+size_t pack_args(void* buf, size_t size, const char* format, va_list args)
+{
+    VaArgs va(args);
+    ArgPacker packer = {va, (char*)buf, (char*)buf + size};
+    // 和format_args按同样的顺序取参数
+    for(; *format; format++) {
+        if(*format != '%') {
+            continue;
+        }
+        FormatFlags flags;
+        format = parse_format_flags(format + 1, flags, packer);
+        if(!*format) {
+            break;
+        }
+        switch(flags.type) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+            case 'p':
+                packer.word();
+                break;
+            case 's':
+                packer.str();
+                break;
+            default:
+                break;
+        }
+    }
+    return packer.p - (char*)buf;
+}
+
+int format_string_packed(
+    char* buffer, size_t size, const char* format, const void* packed, size_t packed_size)
+{
+    PackedArgs args = {(const char*)packed, (const char*)packed + packed_size};
+    return format_args(buffer, size, format, args);
+}
+
+int format_log_prefix(char* buffer, size_t size, LogLevel level, uint32_t cpu, int tid,
+    const char* file, int line, const char* func)
+{
+    return format_string(buffer, size, "%s[CPU:%d TID:%d] (%s:%d %s): ",
+        log_level_prefix[level], cpu, tid, get_filename_from_path(file), line, func);
+}
+
 int format_string(char* buffer, size_t size, const char* format, ...)
 {
     va_list args;
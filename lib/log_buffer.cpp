@@ -1,5 +1,5 @@
 #include <arch/x86/smp.h>
-#include <cstring>
+#include <arch/x86/tsc.h>
 #include <kernel/kernel.h>
 #include <kernel/process.h>
 #include <lib/debug.h>
@@ -7,169 +7,202 @@
 #include <lib/serial.h>
 
 // 串口和控制台设备的互斥锁
-SpinLock serial_lock;
-SpinLock console_lock;
+static DEFINE_LOCK_CLASS(serial_lock_class, "serial");
+static DEFINE_LOCK_CLASS(console_lock_class, "console");
+SpinLock serial_lock(&serial_lock_class);
+SpinLock console_lock(&console_lock_class);
+
+// 全零就是没有分配的空环
+DEFINE_PER_CPU(LogRing, log_ring);
 
 // 初始化单例指针
 LogBuffer* LogBuffer::instance = nullptr;
 
-// LogBuffer构造函数
-LogBuffer::LogBuffer() : head(0), tail(0), consumer_running(false)
+// 单例放在静态存储里，第一次打日志时可能还没有堆
+alignas(LogBuffer) static char log_buffer_storage[sizeof(LogBuffer)];
+
+// LogBuffer构造函数，记下原来直接写串口的输出处理器
+LogBuffer::LogBuffer() : consumer_running(false), draining(false), direct_output(log_output_handler)
 {
-    // 构造函数初始化成员变量
+    kernel::init_work(&drain_work, LogBuffer::drain);
 }
 
 // 获取单例实例
 LogBuffer& LogBuffer::get_instance()
 {
     if(instance == nullptr) {
-        instance = new LogBuffer();
+        instance = new(log_buffer_storage) LogBuffer();
     }
     return *instance;
 }
 
-// 初始化日志缓冲队列
-void LogBuffer::init()
-{
-    head = 0;
-    tail = 0;
-    consumer_running = false;
-
-    // 注册日志输出处理器
-    LogOutputInterface log_handler = {[](LogLevel level, const char* message) {
-        // 将日志消息添加到缓冲区
-        LogBuffer::get_instance().enqueue(level, message);
-    }};
-
-    set_log_output_handler(log_handler);
-}
-
-// 添加日志消息到队列
-bool LogBuffer::enqueue(uint32_t level, const char* message)
+// 写进本CPU的日志环。关中断保证同一时间本CPU上只有一个写的一方，不加锁
+bool LogBuffer::record(
+    LogLevel level, const char* file, int line, const char* func, const char* format, va_list args)
 {
-    if(!message) {
-        return false;
-    }
-
-    // 获取锁
     uint32_t flags;
-    buffer_lock.acquire_irqsave(flags);
-
-    // 检查队列是否已满
-    if(is_full()) {
-        buffer_lock.release_irqrestore(flags);
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    LogRing* ring = this_cpu_ptr(log_ring);
+    if(!ring->data) {
+        asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
         return false;
     }
 
-    // 填充消息结构
-    buffer[tail].cpu_id = arch::smp_get_current_cpu();
-    buffer[tail].timestamp = Kernel::instance().get_ticks();
-    buffer[tail].level = level;
-
-    // 复制消息内容，确保不会溢出
-    strncpy(buffer[tail].message, message, MAX_LOG_MESSAGE_SIZE - 1);
-    buffer[tail].message[MAX_LOG_MESSAGE_SIZE - 1] = '\0';
-
-    // 更新尾指针
-    tail = (tail + 1) % LOG_BUFFER_SIZE;
-
-    // 释放锁
-    buffer_lock.release_irqrestore(flags);
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t offset = tail & (LOG_RING_SIZE - 1);
+    uint32_t room = LOG_RING_SIZE - offset;
+    // 记录在环里连续存放，环尾剩下的地方放不下最长的记录时填充掉，从环头开始写
+    uint32_t pad = room < MAX_LOG_RECORD_SIZE ? room : 0;
+    if(tail + pad + MAX_LOG_RECORD_SIZE - head > LOG_RING_SIZE) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        ring->dropped_total++;
+        asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+        return true;
+    }
+    if(pad) {
+        // 填充记录可能只有8个字节，只写size和level
+        LogRecord* rec = (LogRecord*)(ring->data + offset);
+        rec->size = pad;
+        rec->level = LOG_RECORD_PAD;
+        tail += pad;
+        offset = 0;
+    }
 
+    LogRecord* rec = (LogRecord*)(ring->data + offset);
+    rec->args_size = pack_args(rec + 1, MAX_LOG_RECORD_SIZE - sizeof(LogRecord), format, args);
+    rec->size = (sizeof(LogRecord) + rec->args_size + 7) & ~7u;
+    rec->level = level;
+    rec->cpu = arch::get_cpu_id();
+    rec->line = line;
+    Task* current = ProcessManager::get_current_task();
+    rec->tid = current ? current->task_id : 0;
+    rec->tsc = arch::rdtsc();
+    rec->format = format;
+    rec->file = file;
+    rec->func = func;
+    ring->recorded++;
+    // 记录写完以后才让消费者看到
+    __atomic_store_n(&ring->tail, tail + rec->size, __ATOMIC_RELEASE);
+    asm volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
     return true;
 }
 
-// 从队列中取出日志消息
-bool LogBuffer::dequeue(LogMessage& message)
+// 日志环里最早的一条记录，跳过填充，没有时返回nullptr
+static LogRecord* ring_peek(LogRing* ring)
 {
-    // 获取锁
-    uint32_t flags;
-    buffer_lock.acquire_irqsave(flags);
-
-    // 检查队列是否为空
-    if(is_empty()) {
-        buffer_lock.release_irqrestore(flags);
-        return false;
+    while(true) {
+        uint32_t head = ring->head;
+        if(head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+            return nullptr;
+        }
+        LogRecord* rec = (LogRecord*)(ring->data + (head & (LOG_RING_SIZE - 1)));
+        if(rec->level != LOG_RECORD_PAD) {
+            return rec;
+        }
+        __atomic_store_n(&ring->head, head + rec->size, __ATOMIC_RELEASE);
     }
-
-    // 复制消息
-    message = buffer[head];
-
-    // 更新头指针
-    head = (head + 1) % LOG_BUFFER_SIZE;
-
-    // 释放锁
-    buffer_lock.release_irqrestore(flags);
-
-    return true;
 }
 
-// 检查队列是否为空
-bool LogBuffer::is_empty() { return head == tail; }
-
-// 检查队列是否已满
-bool LogBuffer::is_full() { return ((tail + 1) % LOG_BUFFER_SIZE) == head; }
-
-// 获取队列中的消息数量
-uint32_t LogBuffer::get_message_count()
+// 格式化一条记录，写到串口
+void LogBuffer::output(const LogRecord* rec)
 {
-    uint32_t flags;
-    buffer_lock.acquire_irqsave(flags);
+    char message[512];
+    int len = format_log_prefix(message, sizeof(message), (LogLevel)rec->level, rec->cpu, rec->tid,
+        rec->file, rec->line, rec->func);
+    format_string_packed(
+        message + len, sizeof(message) - len, rec->format, rec + 1, rec->args_size);
+    direct_output.print((LogLevel)rec->level, message);
+}
 
-    uint32_t count;
-    if(tail >= head) {
-        count = tail - head;
-    } else {
-        count = LOG_BUFFER_SIZE - head + tail;
+void LogBuffer::flush()
+{
+    if(__atomic_exchange_n(&draining, true, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    uint32_t cpu_count = arch::smp_get_cpu_count();
+    while(true) {
+        // 各CPU的环里最早的记录中取TSC最小的，多个CPU的日志按时间交错输出
+        LogRing* oldest = nullptr;
+        LogRecord* first = nullptr;
+        for(uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+            LogRing* ring = &per_cpu(log_ring, cpu);
+            if(!ring->data) {
+                continue;
+            }
+            LogRecord* rec = ring_peek(ring);
+            if(rec && (!first || (int64_t)(rec->tsc - first->tsc) < 0)) {
+                oldest = ring;
+                first = rec;
+            }
+        }
+        if(!first) {
+            break;
+        }
+        output(first);
+        // 输出完才把位置还给写的一方
+        __atomic_store_n(&oldest->head, oldest->head + first->size, __ATOMIC_RELEASE);
     }
 
-    buffer_lock.release_irqrestore(flags);
-    return count;
+    for(uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        LogRing* ring = &per_cpu(log_ring, cpu);
+        uint32_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if(dropped) {
+            char message[80];
+            format_string(message, sizeof(message), "log: %u records dropped on cpu %u\n",
+                dropped, cpu);
+            direct_output.print(LOG_WARNING, message);
+        }
+    }
+    __atomic_store_n(&draining, false, __ATOMIC_RELEASE);
 }
 
-// 启动日志消费线程
+// 启动日志消费者，给每个CPU分配日志环
 void LogBuffer::start_consumer()
 {
-    if(!consumer_running) {
-        consumer_running = true;
-
-        // 创建内核线程作为日志消费者
-        ProcessManager::kernel_task((Context*)ProcessManager::kernel_context, "log_consumer",
-            (uint32_t)LogBuffer::consumer_thread, 0, nullptr);
+    if(consumer_running) {
+        return;
+    }
+    for(uint32_t cpu = 0; cpu < arch::smp_get_cpu_count(); cpu++) {
+        char* data = new char[LOG_RING_SIZE];
+        if(!data) {
+            log_err("log: no memory for the ring of cpu %d\n", cpu);
+            continue;
+        }
+        LogRing* ring = &per_cpu(log_ring, cpu);
+        ring->head = 0;
+        ring->tail = 0;
+        __atomic_store_n(&ring->data, data, __ATOMIC_RELEASE);
     }
+    consumer_running = true;
+    log_record_handler = LogBuffer::record;
 }
 
-// 日志消费线程函数
-void LogBuffer::consumer_thread()
+// 时钟中断里调用。打日志的路径上不排队，调用方可能持有运行队列或者等待队列的锁
+void LogBuffer::tick()
 {
-    LogBuffer& log_buffer = LogBuffer::get_instance();
-    LogMessage message;
-
-    while(log_buffer.consumer_running) {
-        // 尝试从队列中取出消息
-        if(log_buffer.dequeue(message)) {
-            // 获取锁以确保输出不会交错
-            uint32_t flags;
-            serial_lock.acquire_irqsave(flags);
-
-            // 根据日志级别选择颜色
-            if(message.level <= LOG_ERR) {
-                // 错误级别消息同时输出到控制台
-                console_lock.acquire();
-                Console::print(message.message);
-                console_lock.release();
-            }
+    LogBuffer* log_buffer = instance;
+    if(!log_buffer || !log_buffer->consumer_running) {
+        return;
+    }
+    LogRing* ring = this_cpu_ptr(log_ring);
+    if(ring->head != ring->tail || ring->dropped) {
+        kernel::queue_work(&log_buffer->drain_work);
+    }
+}
 
-            // 输出到串口
-            serial_puts(message.message);
+// 在kworker里把日志环里的记录写出去
+void LogBuffer::drain(kernel::work_struct* work)
+{
+    container_of(work, LogBuffer, drain_work)->flush();
+}
 
-            // 释放锁
-            serial_lock.release_irqrestore(flags);
-        } else {
-            // 队列为空，让出CPU
-            // 在实际系统中，这里可以使用一个条件变量或信号量来等待
-            // 简单起见，我们只是让出CPU时间片
-            asm volatile("pause");
-        }
+void LogBuffer::get_stats(LogBufferStats& stats)
+{
+    stats.recorded = 0;
+    stats.dropped = 0;
+    for(uint32_t cpu = 0; cpu < arch::smp_get_cpu_count(); cpu++) {
+        stats.recorded += per_cpu(log_ring, cpu).recorded;
+        stats.dropped += per_cpu(log_ring, cpu).dropped_total;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,233 @@
+#include "kernel/rbtree.h"
+
+namespace kernel {
+
+// 空叶子(nullptr)按黑色处理
+static inline bool is_red(const struct rb_node *node) {
+    return node && node->red;
+}
+
+// 把parent指向old的孩子指针换成node，parent为空时node成为根
+static void change_child(struct rb_node *parent, struct rb_node *old, struct rb_node *node,
+    struct rb_root *root) {
+    if (!parent) {
+        root->node = node;
+    } else if (parent->left == old) {
+        parent->left = node;
+    } else {
+        parent->right = node;
+    }
+}
+
+static void rotate_left(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *right = node->right;
+    node->right = right->left;
+    if (right->left) {
+        right->left->parent = node;
+    }
+    right->parent = node->parent;
+    change_child(node->parent, node, right, root);
+    right->left = node;
+    node->parent = right;
+}
+
+static void rotate_right(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *left = node->left;
+    node->left = left->right;
+    if (left->right) {
+        left->right->parent = node;
+    }
+    left->parent = node->parent;
+    change_child(node->parent, node, left, root);
+    left->right = node;
+    node->parent = left;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+    node->red = true;
+    struct rb_node *parent;
+    // 父节点是红色时违反性质，父节点不是根，所以祖父节点一定存在
+    while ((parent = node->parent) && parent->red) {
+        struct rb_node *gparent = parent->parent;
+        if (parent == gparent->left) {
+            struct rb_node *uncle = gparent->right;
+            if (is_red(uncle)) {
+                // 叔叔也是红色：父亲和叔叔变黑，祖父变红，从祖父继续向上
+                parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right) {
+                rotate_left(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            rotate_right(gparent, root);
+        } else {
+            struct rb_node *uncle = gparent->left;
+            if (is_red(uncle)) {
+                parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left) {
+                rotate_right(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            rotate_left(gparent, root);
+        }
+    }
+    root->node->red = false;
+}
+
+// 删除黑色节点后，node所在的子树少了一个黑节点，node可能是空叶子，所以单独传入parent
+static void erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root) {
+    while (node != root->node && !is_red(node)) {
+        if (node == parent->left) {
+            struct rb_node *sibling = parent->right;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                rotate_left(parent, root);
+                sibling = parent->right;
+            }
+            if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!is_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                rotate_right(sibling, root);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            rotate_left(parent, root);
+            node = root->node;
+        } else {
+            struct rb_node *sibling = parent->left;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                rotate_right(parent, root);
+                sibling = parent->left;
+            }
+            if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!is_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                rotate_left(sibling, root);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            rotate_right(parent, root);
+            node = root->node;
+        }
+    }
+    if (node) {
+        node->red = false;
+    }
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *child;
+    struct rb_node *parent;
+    bool removed_red;
+
+    if (!node->left || !node->right) {
+        // 最多一个孩子，直接用孩子顶替
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+        if (child) {
+            child->parent = parent;
+        }
+        change_child(parent, node, child, root);
+    } else {
+        // 两个孩子：用后继节点顶替，实际被摘掉的是后继原来的位置
+        struct rb_node *successor = node->right;
+        while (successor->left) {
+            successor = successor->left;
+        }
+        removed_red = successor->red;
+        child = successor->right;
+        if (successor->parent == node) {
+            parent = successor;
+        } else {
+            parent = successor->parent;
+            parent->left = child;
+            if (child) {
+                child->parent = parent;
+            }
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+        successor->left = node->left;
+        node->left->parent = successor;
+        successor->parent = node->parent;
+        successor->red = node->red;
+        change_child(node->parent, node, successor, root);
+    }
+
+    if (!removed_red) {
+        erase_color(child, parent, root);
+    }
+}
+
+struct rb_node *rb_first(const struct rb_root *root) {
+    struct rb_node *node = root->node;
+    if (!node) {
+        return nullptr;
+    }
+    while (node->left) {
+        node = node->left;
+    }
+    return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+    struct rb_node *node = root->node;
+    if (!node) {
+        return nullptr;
+    }
+    while (node->right) {
+        node = node->right;
+    }
+    return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return const_cast<struct rb_node *>(node);
+    }
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+} // namespace kernel
@@ -0,0 +1,46 @@
+#include <lib/semaphore.h>
+
+namespace kernel {
+
+bool Semaphore::down(uint32_t timeout)
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    if(count > 0) {
+        count--;
+        wq.lock.release_irqrestore(flags);
+        return true;
+    }
+    if(timeout == 0) {
+        wq.lock.release_irqrestore(flags);
+        return false;
+    }
+    return wq.wait(flags, timeout) == 0;
+}
+
+bool Semaphore::down_block()
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    if(count > 0) {
+        count--;
+        wq.lock.release_irqrestore(flags);
+        return true;
+    }
+    return wq.block(flags) == 0;
+}
+
+void Semaphore::up()
+{
+    uint32_t flags;
+    wq.lock.acquire_irqsave(flags);
+    WaitEntry* waiter = wq.first();
+    if(waiter) {
+        wq.wake(waiter, 0);
+    } else {
+        count++;
+    }
+    wq.lock.release_irqrestore(flags);
+}
+
+} // namespace kernel
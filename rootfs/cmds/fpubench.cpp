@@ -0,0 +1,89 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/time.h"
+#include "utils.h"
+
+// 测量只用整数寄存器的任务和使用SSE的任务在任务切换上的开销差别。
+// 每一轮先做一点计算，然后短暂睡眠，切到idle再切回来，一轮是两次任务切换：
+//   int: 只用整数寄存器，换出时不用保存FPU状态，换入时只置上CR0.TS
+//   sse: 睡眠前把轮数写进xmm0，醒来后读回来检查，每次换出都要FXSAVE。
+//        idle不用FPU，切回来时寄存器里还是它的状态，不会触发#NM
+// 绑定在CPU 0上，报告每轮的耗时和CPU 0上FPU统计的增量
+
+static constexpr uint32_t DEFAULT_ROUNDS = 1000;
+static constexpr uint32_t SLEEP_NS = 20000;
+
+enum Mode { MODE_INT, MODE_SSE, MODE_COUNT };
+static const char* mode_names[] = {"int", "sse"};
+
+static void int_work(uint32_t round)
+{
+    volatile uint32_t sum = round;
+    for(uint32_t i = 0; i < 16; i++) {
+        sum = sum * 33 + i;
+    }
+}
+
+// 返回xmm0在睡眠前后是否一致
+static bool sse_round(uint32_t round)
+{
+    timespec ts = {0, SLEEP_NS};
+    uint32_t out;
+    asm volatile("movd %0, %%xmm0\n\t"
+                 "pshufd $0, %%xmm0, %%xmm0\n\t"
+                 "paddd %%xmm0, %%xmm1"
+        :
+        : "r"(round));
+    syscall_nanosleep(&ts, nullptr);
+    asm volatile("movd %%xmm0, %0" : "=r"(out));
+    return out == round;
+}
+
+static bool fpu_stat(SchedStat& stat)
+{
+    return syscall_schedstat(0, &stat) == 0;
+}
+
+void cmd_fpubench(int argc, char* argv[])
+{
+    uint32_t rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    if(rounds == 0) {
+        printf("usage: fpubench [rounds]\n");
+        return;
+    }
+    uint32_t old_mask = 0;
+    syscall_sched_getaffinity(0, &old_mask);
+    syscall_sched_setaffinity(0, 1u << 0);
+    timespec ts = {0, SLEEP_NS};
+    // 让亲和性生效，之后一直在CPU 0上
+    syscall_nanosleep(&ts, nullptr);
+
+    printf("  MODE ROUNDS  NS/ROUND  TRAPS  SAVES   LAZY ERRORS\n");
+    for(int mode = 0; mode < MODE_COUNT; mode++) {
+        SchedStat before, after;
+        timespec start, end;
+        uint32_t errors = 0;
+        if(!fpu_stat(before) || syscall_clock_gettime(CLOCK_MONOTONIC, &start) < 0) {
+            printf("fpubench: schedstat or clock_gettime failed\n");
+            break;
+        }
+        for(uint32_t i = 0; i < rounds; i++) {
+            if(mode == MODE_SSE) {
+                errors += !sse_round(i);
+            } else {
+                int_work(i);
+                syscall_nanosleep(&ts, nullptr);
+            }
+        }
+        syscall_clock_gettime(CLOCK_MONOTONIC, &end);
+        fpu_stat(after);
+        uint32_t us = (uint32_t)(end.tv_sec - start.tv_sec) * 1000000 + (uint32_t)(end.tv_nsec - start.tv_nsec) / 1000;
+        uint32_t ns = rounds <= 4000 ? us * 1000 / rounds : us / (rounds / 1000);
+        printf("%6s %6u %9u %6u %6u %6u %6u\n", mode_names[mode], rounds, ns,
+            after.fpu_traps - before.fpu_traps, after.fpu_saves - before.fpu_saves,
+            after.fpu_lazy_hits - before.fpu_lazy_hits, errors);
+    }
+    syscall_sched_setaffinity(0, old_mask);
+}
+
+REGISTER_COMMAND("fpubench", cmd_fpubench, "Measure context-switch cost with and without FPU state");
@@ -0,0 +1,34 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/string.h"
+#include "utils.h"
+
+// 查看锁统计，内核编译时要打开USE_LOCKSTAT
+//   lockstat         列出每个锁类的加锁次数、等待次数、等待周期数的分布和最长等待、持有周期数
+//   lockstat reset   清零
+
+void cmd_lockstat(int argc, char* argv[])
+{
+    if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+        if(syscall_lockstat(LOCKSTAT_RESET, nullptr) < 0) {
+            printf("lockstat: not enabled, rebuild the kernel with USE_LOCKSTAT=ON\n");
+        }
+        return;
+    }
+    LockStat stat;
+    if(syscall_lockstat(0, &stat) < 0) {
+        printf("lockstat: not enabled, rebuild the kernel with USE_LOCKSTAT=ON\n");
+        return;
+    }
+    printf("   ACQUIRED  CONTENDED   <256    <1K    <4K   <16K   <64K  <256K    <1M   >=1M"
+           "  MAX_WAIT  MAX_HOLD NAME\n");
+    for(uint32_t i = 0; syscall_lockstat(i, &stat) == 0; i++) {
+        printf("%11u %10u", stat.acquisitions, stat.contended);
+        for(uint32_t count : stat.wait_hist) {
+            printf(" %6u", count);
+        }
+        printf(" %9u %9u %s\n", stat.max_wait_cycles, stat.max_hold_cycles, stat.name);
+    }
+}
+
+REGISTER_COMMAND("lockstat", cmd_lockstat, "Show per lock class spinlock statistics");
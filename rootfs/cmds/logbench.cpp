@@ -0,0 +1,32 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "utils.h"
+
+// 测量一次log_debug的开销。
+// 内核打rounds条调试日志，日志只写进本CPU的日志环(格式串指针和打包的参数)，
+// 格式化和写串口推迟到kworker；再把同样的日志同步格式化rounds次，
+// 这是原来每次打日志时调用方要做的事。用logbuf=off启动时两者都是同步的
+
+static constexpr uint32_t DEFAULT_ROUNDS = 512;
+
+void cmd_logbench(int argc, char* argv[])
+{
+    uint32_t rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    if(rounds == 0) {
+        printf("usage: logbench [rounds]\n");
+        return;
+    }
+    LogBench result;
+    if(syscall_logbench(rounds, &result) < 0) {
+        printf("logbench: failed\n");
+        return;
+    }
+    // record是推迟格式化的log_debug，sync是logbuf=off时同步输出的log_debug
+    printf("  PATH CYCLES/OP NS/OP\n");
+    printf("%6s %9u %5u\n", result.deferred ? "record" : "sync", result.record_cycles,
+        result.record_ns);
+    printf("%6s %9u %5u\n", "format", result.format_cycles, result.format_ns);
+    printf("recorded %u, dropped %u\n", result.recorded, result.dropped);
+}
+
+REGISTER_COMMAND("logbench", cmd_logbench, "Measure the cost of a log_debug call");
@@ -0,0 +1,66 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/string.h"
+#include "utils.h"
+
+// 读取和设置日志级别
+//   loglevel                 打印全局级别
+//   loglevel LEVEL           设置全局级别
+//   loglevel NAME            打印源文件路径包含NAME的日志的级别
+//   loglevel NAME LEVEL      单独设置这些日志的级别，例如loglevel ext2 debug
+//   loglevel NAME off        删除NAME的设置，改回全局级别
+// LEVEL是级别的名字或者0~8。比编译时的级别(cmake -DLOG_LEVEL)详细的日志已经去掉，设置了也不输出
+
+static const char* const level_names[] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug", "trace"};
+static constexpr int LEVEL_COUNT = sizeof(level_names) / sizeof(level_names[0]);
+
+static int parse_level(const char* str)
+{
+    if(str[0] >= '0' && str[0] <= '0' + LEVEL_COUNT - 1 && !str[1]) {
+        return str[0] - '0';
+    }
+    for(int level = 0; level < LEVEL_COUNT; level++) {
+        if(!strcmp(str, level_names[level])) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+static void print_level(const char* name)
+{
+    int level = syscall_loglevel(name, LOGLEVEL_GET);
+    if(level < 0 || level >= LEVEL_COUNT) {
+        printf("loglevel: failed\n");
+        return;
+    }
+    printf("%s: %s\n", name ? name : "global", level_names[level]);
+}
+
+void cmd_loglevel(int argc, char* argv[])
+{
+    if(argc == 1) {
+        print_level(nullptr);
+        return;
+    }
+    if(argc == 2) {
+        int level = parse_level(argv[1]);
+        if(level < 0) {
+            print_level(argv[1]);
+        } else if(syscall_loglevel(nullptr, level) < 0) {
+            printf("loglevel: failed\n");
+        }
+        return;
+    }
+    int level = strcmp(argv[2], "off") ? parse_level(argv[2]) : LOGLEVEL_RESET;
+    if(level == -1) {
+        printf("usage: loglevel [NAME] [emerg|alert|crit|err|warning|notice|info|debug|trace|off]\n");
+        return;
+    }
+    if(syscall_loglevel(argv[1], level) < 0) {
+        printf("loglevel: failed, name too long or too many names?\n");
+    }
+}
+
+REGISTER_COMMAND("loglevel", cmd_loglevel, "Show or set the global and per-file log levels");
@@ -0,0 +1,27 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "utils.h"
+
+void cmd_meminfo(int argc, char* argv[])
+{
+    MemInfo info;
+    if(syscall_meminfo(&info) < 0) {
+        printf("meminfo: failed\n");
+        return;
+    }
+    printf("normal free: %u KiB\n", info.normal_free_pages * 4);
+    printf("high free:   %u KiB\n", info.high_free_pages * 4);
+    // 映射零页但一直没被写的次数，就是共享零页省下的页面分配
+    printf("zero page: %u read faults, %u copied on write, %u allocations saved\n",
+        info.zero_page_maps, info.zero_page_cows, info.zero_page_maps - info.zero_page_cows);
+    // 内核栈不再需要order-2连续块，order2_unavailable是kmalloc方式下会失败的创建次数
+    printf("kernel stacks: %u allocated, %u reused, %u cycles avg, %u order-2 failures avoided\n",
+        info.kstack_allocs, info.kstack_cached, info.kstack_avg_cycles,
+        info.kstack_order2_unavailable);
+    printf("oom kills: %u\n", info.oom_kills);
+    printf("swap: %u KiB total, %u KiB used, %u out, %u in, %u read ahead (%u hits)\n",
+        info.swap_total * 4, info.swap_used * 4, info.swap_outs, info.swap_ins,
+        info.swap_readahead, info.swap_readahead_hits);
+}
+
+REGISTER_COMMAND("meminfo", cmd_meminfo, "Show memory statistics");
@@ -0,0 +1,104 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "kernel/vfs.h"
+#include "utils.h"
+
+// read()和mmap()顺序读取同一个文件的吞吐量对比
+// 默认读取测试盘上的/bench.dat（tools/create_disk.sh生成的50MiB文件）
+
+static inline uint64_t bench_rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// 以2^20个周期为单位，避免用户态做64位除法
+static uint32_t to_mcycles(uint64_t cycles) { return (uint32_t)(cycles >> 20); }
+
+static uint32_t checksum(const uint32_t* data, uint32_t words, uint32_t sum)
+{
+    for(uint32_t i = 0; i < words; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+static void print_result(const char* name, uint32_t size, uint64_t cycles, uint32_t sum)
+{
+    uint32_t mcycles = to_mcycles(cycles);
+    // KiB/Mcycle，和CPU频率无关，便于两种方式直接比较
+    uint32_t rate = mcycles ? (size >> 10) / mcycles : 0;
+    printf("%s: %u KiB, %u Mcycles, %u KiB/Mcycle, checksum 0x%x\n", name, size >> 10, mcycles,
+        rate, sum);
+}
+
+static char read_buf[64 * 1024];
+
+static bool bench_read(const char* path, uint32_t size)
+{
+    int fd = syscall_open(path);
+    if(fd < 0) {
+        printf("mmapbench: cannot open '%s'\n", path);
+        return false;
+    }
+    uint32_t sum = 0;
+    uint32_t total = 0;
+    uint64_t start = bench_rdtsc();
+    while(total < size) {
+        int n = syscall_read(fd, read_buf, sizeof(read_buf));
+        if(n <= 0) {
+            break;
+        }
+        sum = checksum((const uint32_t*)read_buf, n / 4, sum);
+        total += n;
+    }
+    uint64_t cycles = bench_rdtsc() - start;
+    syscall_close(fd);
+    print_result("read", total, cycles, sum);
+    return true;
+}
+
+static bool bench_mmap(const char* path, uint32_t size)
+{
+    int fd = syscall_open(path);
+    if(fd < 0) {
+        printf("mmapbench: cannot open '%s'\n", path);
+        return false;
+    }
+    uint64_t start = bench_rdtsc();
+    void* addr = syscall_mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(addr == (void*)MAP_FAILED || addr == nullptr) {
+        printf("mmapbench: mmap failed\n");
+        syscall_close(fd);
+        return false;
+    }
+    uint32_t sum = checksum((const uint32_t*)addr, size / 4, 0);
+    uint64_t cycles = bench_rdtsc() - start;
+    syscall_close(fd);
+    print_result("mmap", size, cycles, sum);
+    return true;
+}
+
+void cmd_mmapbench(int argc, char* argv[])
+{
+    const char* path = argc > 1 ? argv[1] : "/bench.dat";
+
+    kernel::FileAttribute attr;
+    if(syscall_stat(path, &attr) < 0 || attr.type != kernel::FT_REG) {
+        printf("mmapbench: '%s' is not a regular file\n", path);
+        return;
+    }
+    // 两种方式都只统计整字，结尾不足4字节的部分忽略
+    uint32_t size = attr.size & ~3u;
+    printf("mmapbench: %s, %u bytes\n", path, size);
+
+    // 第一遍read把文件读进页缓存，第二遍read和mmap都在缓存命中的情况下比较
+    if(!bench_read(path, size)) {
+        return;
+    }
+    bench_read(path, size);
+    bench_mmap(path, size);
+}
+
+REGISTER_COMMAND("mmapbench", cmd_mmapbench, "Compare read() and mmap() throughput on a file");
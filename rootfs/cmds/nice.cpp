@@ -0,0 +1,13 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "utils.h"
+
+// 调整shell自己的nice值，之后在shell里运行的命令都按新的权重调度
+// 不带参数时只打印当前的nice值
+void cmd_nice(int argc, char* argv[])
+{
+    int inc = argc > 1 ? atoi(argv[1]) : 0;
+    printf("nice: %d\n", syscall_nice(inc));
+}
+
+REGISTER_COMMAND("nice", cmd_nice, "Adjust the shell's nice value");
@@ -0,0 +1,70 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "kernel/vfs.h"
+#include "utils.h"
+
+// 测量系统调用和缺页的开销，对比不同的编译时日志级别(cmake -DLOG_LEVEL=INFO和默认的TRACE)。
+// getpid的路径上没有日志；stat和缺页处理的路径上有log_debug，
+// 编译进去时每次都要检查这些调用点，级别允许时还要记录参数
+
+static constexpr uint32_t DEFAULT_ROUNDS = 10000;
+static constexpr uint32_t FAULT_PAGES = 256;
+
+static inline uint64_t bench_rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// 用户态没有64位除法，总周期数先缩小到32位
+static uint32_t per_op(uint64_t cycles, uint32_t count)
+{
+    while(cycles >> 32) {
+        cycles >>= 1;
+        count >>= 1;
+    }
+    return count ? (uint32_t)cycles / count : 0;
+}
+
+void cmd_pathbench(int argc, char* argv[])
+{
+    uint32_t rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    if(rounds == 0) {
+        printf("usage: pathbench [rounds]\n");
+        return;
+    }
+
+    uint64_t start = bench_rdtsc();
+    for(uint32_t i = 0; i < rounds; i++) {
+        syscall_getpid();
+    }
+    uint32_t getpid_cycles = per_op(bench_rdtsc() - start, rounds);
+
+    kernel::FileAttribute attr;
+    start = bench_rdtsc();
+    for(uint32_t i = 0; i < rounds; i++) {
+        syscall_stat("/", &attr);
+    }
+    uint32_t stat_cycles = per_op(bench_rdtsc() - start, rounds);
+
+    // 匿名映射第一次写每一页都缺页
+    char* area = (char*)syscall_mmap(nullptr, FAULT_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(area == (char*)MAP_FAILED || area == nullptr) {
+        printf("pathbench: mmap failed\n");
+        return;
+    }
+    start = bench_rdtsc();
+    for(uint32_t i = 0; i < FAULT_PAGES; i++) {
+        area[i * PAGE_SIZE] = 1;
+    }
+    uint32_t fault_cycles = per_op(bench_rdtsc() - start, FAULT_PAGES);
+
+    printf("  PATH CYCLES/OP\n");
+    printf("getpid %9u\n", getpid_cycles);
+    printf("  stat %9u\n", stat_cycles);
+    printf(" fault %9u\n", fault_cycles);
+}
+
+REGISTER_COMMAND("pathbench", cmd_pathbench, "Measure syscall and page fault costs");
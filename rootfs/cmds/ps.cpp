@@ -0,0 +1,16 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "utils.h"
+
+// 列出进程表中的进程和它们的内存占用，单位KiB
+void cmd_ps(int argc, char* argv[])
+{
+    printf("  PID      VSZ      RSS     ANON     FILE NAME\n");
+    ProcStat stat;
+    for(uint32_t i = 0; syscall_procstat(i, &stat) == 0; i++) {
+        printf("%5u %8u %8u %8u %8u %s\n", stat.pid, stat.total_vm * 4,
+            (stat.rss_anon + stat.rss_file) * 4, stat.rss_anon * 4, stat.rss_file * 4, stat.name);
+    }
+}
+
+REGISTER_COMMAND("ps", cmd_ps, "List processes and their memory usage");
@@ -0,0 +1,48 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "utils.h"
+
+// 比较RCU和加锁的查找在多个CPU上的扩展性。
+// 内核在CPU 0到cpus-1上各放一个内核任务，反复做open和read开头的查找：按路径找挂载点，
+// 在fd表里取一个文件的引用再放掉。每种方式先在1个CPU上跑，再在cpus个CPU上跑，
+// 打印每个CPU平均每次查找的开销。RCU的查找不写共享的缓存行，CPU多了开销不变；
+// 读写锁的读锁要改同一个计数，自旋锁还要互相等待，CPU越多越慢。
+// 最后两列是测试期间结束的宽限期数和测试后synchronize_rcu的平均延迟
+
+static constexpr uint32_t DEFAULT_CPUS = 4;
+static constexpr uint32_t DEFAULT_ROUNDS = 100000;
+
+struct Mode {
+    const char* name;
+    uint32_t mode;
+};
+static const Mode modes[] = {
+    {"rcu", RCUBENCH_RCU},
+    {"rwlock", RCUBENCH_RWLOCK},
+    {"spinlock", RCUBENCH_SPINLOCK},
+};
+
+void cmd_rcubench(int argc, char* argv[])
+{
+    uint32_t cpus = argc > 1 ? atoi(argv[1]) : DEFAULT_CPUS;
+    uint32_t rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    if(cpus == 0 || rounds == 0) {
+        printf("usage: rcubench [cpus] [rounds]\n");
+        return;
+    }
+    printf("    MODE CPUS     TOTAL CYCLES/OP NS/OP  GPS SYNC(us)\n");
+    for(const Mode& mode : modes) {
+        uint32_t runs[] = {1, cpus};
+        for(uint32_t n : runs) {
+            RcuBench result;
+            if(syscall_rcubench(mode.mode, n, rounds, &result) < 0) {
+                printf("rcubench: failed, too many CPUs or another run in progress?\n");
+                return;
+            }
+            printf("%8s %4u %9u %9u %5u %4u %8u\n", mode.name, n, result.total, result.cycles,
+                result.ns, result.gp_completed, result.sync_us);
+        }
+    }
+}
+
+REGISTER_COMMAND("rcubench", cmd_rcubench, "Compare RCU and locked mount/fd lookups on several CPUs");
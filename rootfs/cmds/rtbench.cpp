@@ -0,0 +1,86 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/time.h"
+#include "utils.h"
+
+// 测量CPU满载时实时任务的唤醒延迟。
+// 绑定在CPU 0上，用cpuhog在CPU 0上启动几个空转的普通内核任务，
+// 分别以SCHED_NORMAL和SCHED_FIFO反复睡眠1ms，打印比请求多睡的时间(唤醒到运行的延迟)。
+// 普通任务醒来后要和空转任务按vruntime竞争CPU，实时任务醒来立即抢占它们
+
+static constexpr uint32_t DEFAULT_ROUNDS = 100;
+static constexpr uint32_t DEFAULT_HOGS = 3;
+static constexpr uint32_t SLEEP_NS = 1000000;
+static constexpr uint32_t HOG_MS = 60000; // 上限，测完一种策略就让它们退出
+static constexpr uint32_t RT_PRIO = 50;
+
+struct Mode {
+    const char* name;
+    uint32_t policy;
+    uint32_t prio;
+};
+static const Mode modes[] = {
+    {"normal", kernel::SCHED_NORMAL, 0},
+    {"fifo", kernel::SCHED_FIFO, RT_PRIO},
+};
+
+static int32_t elapsed_ns(const timespec& start, const timespec& end)
+{
+    return (int32_t)(end.tv_sec - start.tv_sec) * 1000000000 + (int32_t)(end.tv_nsec - start.tv_nsec);
+}
+
+void cmd_rtbench(int argc, char* argv[])
+{
+    uint32_t rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    uint32_t hogs = argc > 2 ? atoi(argv[2]) : DEFAULT_HOGS;
+    if(rounds == 0) {
+        printf("usage: rtbench [rounds] [hogs]\n");
+        return;
+    }
+    uint32_t old_mask = 0;
+    syscall_sched_getaffinity(0, &old_mask);
+    syscall_sched_setaffinity(0, 1u << 0);
+    timespec req = {0, SLEEP_NS};
+    // 让亲和性生效，之后一直在CPU 0上
+    syscall_nanosleep(&req, nullptr);
+
+    printf("  MODE HOGS    MIN(us)    AVG(us)    MAX(us) PUSHES  PULLS\n");
+    for(const Mode& mode : modes) {
+        if(syscall_sched_setscheduler(0, mode.policy, mode.prio) < 0) {
+            printf("rtbench: sched_setscheduler(%s) failed\n", mode.name);
+            break;
+        }
+        if(hogs && syscall_cpuhog(0, hogs, HOG_MS) != (int)hogs) {
+            printf("rtbench: failed to start %u hogs\n", hogs);
+            syscall_cpuhog(0, 0, 0);
+            break;
+        }
+        SchedStat before, after;
+        syscall_schedstat(0, &before);
+        int32_t min = 0x7FFFFFFF;
+        int32_t max = 0;
+        int32_t sum = 0;
+        for(uint32_t i = 0; i < rounds; i++) {
+            timespec start, end;
+            syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+            syscall_nanosleep(&req, nullptr);
+            syscall_clock_gettime(CLOCK_MONOTONIC, &end);
+            int32_t late = elapsed_ns(start, end) - (int32_t)SLEEP_NS;
+            if(late < min) {
+                min = late;
+            }
+            if(late > max) {
+                max = late;
+            }
+            sum += late / 1000;
+        }
+        syscall_schedstat(0, &after);
+        syscall_cpuhog(0, 0, 0);
+        printf("%6s %4u %10d %10d %10d %6u %6u\n", mode.name, hogs, min / 1000, sum / (int32_t)rounds,
+            max / 1000, after.rt_pushes - before.rt_pushes, after.rt_pulls - before.rt_pulls);
+    }
+    syscall_sched_setscheduler(0, kernel::SCHED_NORMAL, 0);
+    syscall_sched_setaffinity(0, old_mask);
+}
+
+REGISTER_COMMAND("rtbench", cmd_rtbench, "Measure SCHED_FIFO wakeup latency under CPU load");
@@ -0,0 +1,23 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "utils.h"
+
+// 打印每个CPU的调度统计：切换次数、迁移次数和忙碌比例(BUSY，百分比)，
+// 收到的时钟中断数(IRQS)和idle时停掉tick省掉的中断数(NOHZ)，
+// 以及收到的重新调度IPI数(IPI)和因为已有IPI在路上没有重复发送的次数(COALESCED)
+void cmd_schedstat(int argc, char* argv[])
+{
+    printf("CPU  RUN   SWITCH  MIG_IN MIG_OUT IDLE_PULL PERIODIC  HOT_SKIP    BUSY      IRQS      NOHZ     IPI COALESCED\n");
+    SchedStat stat;
+    for(uint32_t cpu = 0; syscall_schedstat(cpu, &stat) == 0; cpu++) {
+        uint32_t irqs = stat.idle_ticks + stat.busy_ticks;
+        uint32_t ticks = irqs + stat.nohz_ticks;
+        uint32_t busy = ticks ? stat.busy_ticks * 100 / ticks : 0;
+        printf("%3u %4u %8u %7u %7u %9u %8u %9u %7u %9u %9u %7u %9u\n", cpu, stat.nr_running,
+            stat.nr_switches, stat.migrations_in, stat.migrations_out, stat.idle_pulls,
+            stat.periodic_pulls, stat.hot_skipped, busy, irqs, stat.nohz_ticks, stat.resched_ipis,
+            stat.ipis_coalesced);
+    }
+}
+
+REGISTER_COMMAND("schedstat", cmd_schedstat, "Show per-CPU scheduler statistics");
@@ -0,0 +1,135 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/string.h"
+#include "utils.h"
+
+// 共享内存和文件两种方式做乒乓消息交换的吞吐量对比
+// fork还没有实现，生产者和消费者在同一个进程里交替执行，
+// 共享内存方式下两端各自映射同一个对象，经过不同的虚拟地址访问同一组物理页
+
+static constexpr uint32_t MSG_SIZE = 4096;
+static constexpr uint32_t ROUNDS = 1024;
+
+struct PingPong {
+    volatile uint32_t seq; // 生产者写入的消息序号
+    volatile uint32_t ack; // 消费者确认的消息序号
+    uint8_t data[MSG_SIZE];
+};
+
+static inline uint64_t bench_rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint32_t checksum(const uint8_t* data, uint32_t size)
+{
+    uint32_t sum = 0;
+    for(uint32_t i = 0; i < size; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+static void print_result(const char* name, uint64_t cycles, uint32_t sum, bool ok)
+{
+    uint32_t kcycles = (uint32_t)(cycles >> 10);
+    uint32_t total_kib = MSG_SIZE / 1024 * ROUNDS;
+    // KiB/Mcycle，和CPU频率无关
+    uint32_t rate = (kcycles >> 10) ? total_kib / (kcycles >> 10) : 0;
+    printf("%s: %u rounds x %u bytes, %u Kcycles/round, %u KiB/Mcycle, checksum 0x%x%s\n", name,
+        ROUNDS, MSG_SIZE, kcycles / ROUNDS, rate, sum, ok ? "" : " (MISMATCH)");
+}
+
+static void bench_shm()
+{
+    const char* name = "shmbench";
+    int id = syscall_shm_open(name, sizeof(PingPong), SHM_CREAT | SHM_EXCL);
+    if(id < 0) {
+        printf("shmbench: shm_open failed\n");
+        return;
+    }
+    auto producer = (PingPong*)syscall_shm_map(id);
+    auto consumer = (PingPong*)syscall_shm_map(id);
+    if(producer == (PingPong*)MAP_FAILED || consumer == (PingPong*)MAP_FAILED) {
+        printf("shmbench: shm_map failed\n");
+        syscall_shm_unlink(name);
+        return;
+    }
+
+    uint32_t sum = 0;
+    bool ok = true;
+    uint64_t start = bench_rdtsc();
+    for(uint32_t i = 1; i <= ROUNDS; i++) {
+        memset(producer->data, (int)i, MSG_SIZE);
+        producer->seq = i;
+
+        if(consumer->seq != i) {
+            ok = false;
+        }
+        sum += checksum(consumer->data, MSG_SIZE);
+        consumer->ack = i;
+
+        if(producer->ack != i) {
+            ok = false;
+        }
+    }
+    uint64_t cycles = bench_rdtsc() - start;
+    print_result("shm", cycles, sum, ok);
+
+    // unlink之后对象还在，最后一个映射解除时才释放物理页
+    syscall_shm_unlink(name);
+    syscall_shm_unmap(producer);
+    syscall_shm_unmap(consumer);
+}
+
+static uint8_t msg_buf[MSG_SIZE];
+
+static void bench_file(const char* path)
+{
+    int fd = syscall_open(path);
+    if(fd < 0) {
+        printf("shmbench: cannot open '%s'\n", path);
+        return;
+    }
+
+    uint32_t sum = 0;
+    bool ok = true;
+    uint64_t start = bench_rdtsc();
+    for(uint32_t i = 1; i <= ROUNDS; i++) {
+        // 生产者写消息，消费者读出来
+        memset(msg_buf, (int)i, MSG_SIZE);
+        syscall_seek(fd, 0);
+        syscall_write(fd, msg_buf, MSG_SIZE);
+        syscall_seek(fd, 0);
+        if(syscall_read(fd, msg_buf, MSG_SIZE) != (int)MSG_SIZE) {
+            ok = false;
+        }
+        sum += checksum(msg_buf, MSG_SIZE);
+
+        // 消费者写确认，生产者读确认
+        uint32_t ack = i;
+        syscall_seek(fd, MSG_SIZE);
+        syscall_write(fd, &ack, sizeof(ack));
+        syscall_seek(fd, MSG_SIZE);
+        ack = 0;
+        syscall_read(fd, &ack, sizeof(ack));
+        if(ack != i) {
+            ok = false;
+        }
+    }
+    uint64_t cycles = bench_rdtsc() - start;
+    syscall_close(fd);
+    print_result("file", cycles, sum, ok);
+}
+
+void cmd_shmbench(int argc, char* argv[])
+{
+    // 文件方式会覆盖文件开头的MSG_SIZE + 4字节
+    const char* path = argc > 1 ? argv[1] : "/bench.dat";
+    bench_shm();
+    bench_file(path);
+}
+
+REGISTER_COMMAND("shmbench", cmd_shmbench, "Compare shared memory and file ping-pong throughput");
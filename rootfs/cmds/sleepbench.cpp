@@ -0,0 +1,56 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/time.h"
+#include "utils.h"
+
+// 测量nanosleep的精度：每个时长睡若干次，用单调时钟量实际睡了多久，
+// 打印比请求多睡的时间(唤醒延迟)的最小、平均、最大值。
+// 高精度定时器按一次性中断唤醒，延迟应该远小于一个tick(10ms)；
+// 加启动参数highres=off对比按tick唤醒的延迟
+
+static constexpr uint32_t DEFAULT_ROUNDS = 20;
+static const uint32_t durations_us[] = {50, 200, 1000, 5000, 20000};
+
+// 两次时钟之间的纳秒数，测量的时长都在2秒以内，32位够用
+static int32_t elapsed_ns(const timespec& start, const timespec& end)
+{
+    return (int32_t)(end.tv_sec - start.tv_sec) * 1000000000 + (int32_t)(end.tv_nsec - start.tv_nsec);
+}
+
+void cmd_sleepbench(int argc, char* argv[])
+{
+    uint32_t rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    timespec start, end;
+    if(rounds == 0 || syscall_clock_gettime(CLOCK_MONOTONIC, &start) < 0) {
+        printf("usage: sleepbench [rounds]\n");
+        return;
+    }
+
+    printf(" SLEEP(us)    MIN(us)    AVG(us)    MAX(us)\n");
+    for(uint32_t d = 0; d < sizeof(durations_us) / sizeof(durations_us[0]); d++) {
+        timespec req = {0, (long)durations_us[d] * 1000};
+        int32_t min = 0x7FFFFFFF;
+        int32_t max = 0;
+        int32_t sum = 0;
+        for(uint32_t i = 0; i < rounds; i++) {
+            syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+            if(syscall_nanosleep(&req, nullptr) < 0) {
+                printf("sleepbench: nanosleep failed\n");
+                return;
+            }
+            syscall_clock_gettime(CLOCK_MONOTONIC, &end);
+            // 比请求多睡的时间
+            int32_t late = elapsed_ns(start, end) - (int32_t)req.tv_nsec;
+            if(late < min) {
+                min = late;
+            }
+            if(late > max) {
+                max = late;
+            }
+            sum += late / 1000;
+        }
+        printf("%10u %10d %10d %10d\n", durations_us[d], min / 1000, sum / (int32_t)rounds, max / 1000);
+    }
+}
+
+REGISTER_COMMAND("sleepbench", cmd_sleepbench, "Measure nanosleep wakeup latency");
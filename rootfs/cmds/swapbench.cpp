@@ -0,0 +1,82 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "utils.h"
+
+// 分配一块比物理内存大的匿名内存，按页写入再反复顺序读回校验，
+// 验证换出换入的正确性，并统计每一轮的耗时和换入换出次数
+// 运行前需要挂上交换设备，例如 SWAP_IMAGE=swap.img QEMU_MEM=64M ./run.sh
+// 还没有munmap，映射留到进程退出，重复运行会继续占用交换空间
+
+static constexpr uint32_t PAGE = 4096;
+static constexpr uint32_t READ_ROUNDS = 2;
+
+static inline uint64_t bench_rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// 每页的内容由页号决定，读回时可以校验
+static inline uint32_t page_pattern(uint32_t page) { return page * 2654435761u; }
+
+static void print_round(const char* name, uint32_t pages, uint64_t cycles, uint32_t errors,
+    const MemInfo& before, const MemInfo& after)
+{
+    // 以2^20个周期为单位，避免用户态做64位除法
+    uint32_t mcycles = (uint32_t)(cycles >> 20);
+    printf("%s: %u pages, %u Mcycles, %u swapped out, %u swapped in, %u read-ahead hits, %u errors\n",
+        name, pages, mcycles, after.swap_outs - before.swap_outs, after.swap_ins - before.swap_ins,
+        after.swap_readahead_hits - before.swap_readahead_hits, errors);
+}
+
+void cmd_swapbench(int argc, char* argv[])
+{
+    uint32_t mib = argc > 1 ? atoi(argv[1]) : 96;
+    uint32_t pages = mib * 256;
+    MemInfo before, after;
+    if(mib == 0 || syscall_meminfo(&before) < 0) {
+        printf("usage: swapbench [MiB]\n");
+        return;
+    }
+    if(before.swap_total == 0) {
+        printf("swapbench: no swap device, working set must fit in RAM\n");
+    }
+
+    auto base = (uint8_t*)syscall_mmap(nullptr, pages * PAGE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == (uint8_t*)MAP_FAILED || !base) {
+        printf("swapbench: mmap %u MiB failed\n", mib);
+        return;
+    }
+
+    // 写入：每页首尾各写一个字，整页都会被分配
+    uint64_t start = bench_rdtsc();
+    for(uint32_t i = 0; i < pages; i++) {
+        auto words = (volatile uint32_t*)(base + i * PAGE);
+        words[0] = page_pattern(i);
+        words[PAGE / 4 - 1] = ~page_pattern(i);
+    }
+    uint64_t cycles = bench_rdtsc() - start;
+    syscall_meminfo(&after);
+    print_round("write", pages, cycles, 0, before, after);
+
+    // 顺序读回：前面的页面已经被换出，读的时候换入，相邻槽位被预读
+    for(uint32_t round = 0; round < READ_ROUNDS; round++) {
+        before = after;
+        uint32_t errors = 0;
+        start = bench_rdtsc();
+        for(uint32_t i = 0; i < pages; i++) {
+            auto words = (volatile uint32_t*)(base + i * PAGE);
+            if(words[0] != page_pattern(i) || words[PAGE / 4 - 1] != ~page_pattern(i)) {
+                errors++;
+            }
+        }
+        cycles = bench_rdtsc() - start;
+        syscall_meminfo(&after);
+        print_round("read", pages, cycles, errors, before, after);
+    }
+    printf("swap used: %u KiB of %u KiB\n", after.swap_used * 4, after.swap_total * 4);
+}
+
+REGISTER_COMMAND("swapbench", cmd_swapbench, "Touch more anonymous memory than RAM to exercise swap");
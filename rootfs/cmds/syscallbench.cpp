@@ -0,0 +1,29 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/time.h"
+#include "utils.h"
+
+// 测量系统调用往返的耗时：连续调用getpid，用单调时钟量总时间。
+// 每次进出内核都要保存恢复上下文、找当前任务，这些路径上的CPU号和当前任务都从per-CPU段读取
+
+static constexpr uint32_t DEFAULT_ROUNDS = 100000;
+
+void cmd_syscallbench(int argc, char* argv[])
+{
+    uint32_t rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    timespec start, end;
+    if(rounds == 0 || syscall_clock_gettime(CLOCK_MONOTONIC, &start) < 0) {
+        printf("usage: syscallbench [rounds]\n");
+        return;
+    }
+    for(uint32_t i = 0; i < rounds; i++) {
+        syscall_getpid();
+    }
+    syscall_clock_gettime(CLOCK_MONOTONIC, &end);
+    uint32_t us = (uint32_t)(end.tv_sec - start.tv_sec) * 1000000 + (uint32_t)(end.tv_nsec - start.tv_nsec) / 1000;
+    // 先乘1000再除，次数多时用微秒算，避免溢出
+    uint32_t ns = rounds <= 4000 ? us * 1000 / rounds : us / (rounds / 1000);
+    printf("%u getpid calls in %u us, %u ns per call\n", rounds, us, ns);
+}
+
+REGISTER_COMMAND("syscallbench", cmd_syscallbench, "Measure syscall round-trip time");
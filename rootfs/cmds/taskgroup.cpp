@@ -0,0 +1,60 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/string.h"
+#include "utils.h"
+
+// 管理任务组
+//   taskgroup                               列出所有任务组
+//   taskgroup create NAME                   创建任务组，打印组号
+//   taskgroup set ID QUOTA_US [PERIOD_US] [MEM_KB]  设置CPU配额和内存上限，0表示不限制
+//   taskgroup attach ID [PID]               把任务移到组里，PID省略时是shell自己，ID为0移回根组
+
+static constexpr uint32_t MAX_GROUPS = 8; // 和内核的MAX_TASK_GROUPS一致
+
+static void print_groups()
+{
+    printf(" ID QUOTA(us) PERIOD(us) USAGE(ms) THROTTLED(ms) NR_THR TASKS"
+           " MEM(KB) LIMIT(KB) MAX(KB) FAILCNT NAME\n");
+    for(uint32_t id = 1; id < MAX_GROUPS; id++) {
+        TaskGroupStat stat;
+        if(syscall_taskgroup_stat(id, &stat) < 0) {
+            continue;
+        }
+        printf("%3u %9u %10u %9u %13u %6u %5u %7u %9u %7u %7u %s\n", id, stat.quota_us,
+            stat.period_us, stat.usage_ms, stat.throttled_ms, stat.nr_throttled, stat.nr_tasks,
+            stat.mem_usage_pages * 4, stat.mem_limit_pages * 4, stat.mem_max_pages * 4,
+            stat.mem_failcnt, stat.name);
+    }
+}
+
+void cmd_taskgroup(int argc, char* argv[])
+{
+    if(argc < 2) {
+        print_groups();
+        return;
+    }
+    if(strcmp(argv[1], "create") == 0 && argc > 2) {
+        int id = syscall_taskgroup_create(argv[2]);
+        if(id < 0) {
+            printf("taskgroup: failed to create %s\n", argv[2]);
+            return;
+        }
+        printf("%d\n", id);
+    } else if(strcmp(argv[1], "set") == 0 && argc > 3) {
+        uint32_t period = argc > 4 ? atoi(argv[4]) : 0;
+        uint32_t mem_kb = argc > 5 ? atoi(argv[5]) : 0;
+        if(syscall_taskgroup_set(atoi(argv[2]), atoi(argv[3]), period, mem_kb) < 0) {
+            printf("taskgroup: invalid group or limits\n");
+        }
+    } else if(strcmp(argv[1], "attach") == 0 && argc > 2) {
+        uint32_t pid = argc > 3 ? atoi(argv[3]) : 0;
+        if(syscall_taskgroup_attach(atoi(argv[2]), pid) < 0) {
+            printf("taskgroup: no such group or task\n");
+        }
+    } else {
+        printf("usage: taskgroup [create NAME | set ID QUOTA_US [PERIOD_US] [MEM_KB] | "
+               "attach ID [PID]]\n");
+    }
+}
+
+REGISTER_COMMAND("taskgroup", cmd_taskgroup, "Create task groups and set CPU/memory limits");
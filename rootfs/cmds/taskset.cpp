@@ -0,0 +1,56 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "utils.h"
+
+// 解析十进制或0x开头的十六进制掩码，格式不对时返回false
+static bool parse_mask(const char* s, uint32_t* mask)
+{
+    uint32_t base = 10;
+    if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    }
+    if(!*s) {
+        return false;
+    }
+    uint32_t value = 0;
+    for(; *s; s++) {
+        uint32_t digit;
+        if(*s >= '0' && *s <= '9') {
+            digit = *s - '0';
+        } else if(base == 16 && *s >= 'a' && *s <= 'f') {
+            digit = *s - 'a' + 10;
+        } else if(base == 16 && *s >= 'A' && *s <= 'F') {
+            digit = *s - 'A' + 10;
+        } else {
+            return false;
+        }
+        value = value * base + digit;
+    }
+    *mask = value;
+    return true;
+}
+
+// 查看或设置shell的CPU亲和性，之后在shell里运行的命令只在这些CPU上运行
+// 掩码为0表示不限制，只避开isolcpus隔离的CPU
+void cmd_taskset(int argc, char* argv[])
+{
+    uint32_t mask;
+    if(argc > 1) {
+        if(!parse_mask(argv[1], &mask)) {
+            printf("taskset: invalid mask %s\n", argv[1]);
+            return;
+        }
+        if(syscall_sched_setaffinity(0, mask) < 0) {
+            printf("taskset: no online CPU in mask 0x%x\n", mask);
+            return;
+        }
+    }
+    if(syscall_sched_getaffinity(0, &mask) < 0) {
+        printf("taskset: failed to get affinity\n");
+        return;
+    }
+    printf("affinity: 0x%x\n", mask);
+}
+
+REGISTER_COMMAND("taskset", cmd_taskset, "Show or set the shell's CPU affinity mask");
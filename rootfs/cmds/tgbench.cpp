@@ -0,0 +1,74 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/time.h"
+#include "utils.h"
+
+// 用两组CPU空转任务测试任务组的CPU带宽控制。
+// 在CPU 0上启动A组1个、B组3个空转任务，先不限制，再给两组相同的配额各跑一段时间，
+// 打印每组用掉的CPU时间占总时长的比例。
+// 不限制时公平调度按任务分CPU，B组得到大约3/4；有配额时每组不超过配额/周期，两组相同
+
+static constexpr uint32_t DEFAULT_MS = 1000;
+static constexpr uint32_t DEFAULT_HOGS_A = 1;
+static constexpr uint32_t DEFAULT_HOGS_B = 3;
+static constexpr uint32_t QUOTA_US = 40000;
+static constexpr uint32_t PERIOD_US = 100000;
+
+struct Phase {
+    const char* name;
+    uint32_t quota_us; // 0表示不限制
+};
+static const Phase phases[] = {
+    {"unlimited", 0},
+    {"quota", QUOTA_US},
+};
+
+void cmd_tgbench(int argc, char* argv[])
+{
+    uint32_t ms = argc > 1 ? atoi(argv[1]) : DEFAULT_MS;
+    uint32_t hogs_a = argc > 2 ? atoi(argv[2]) : DEFAULT_HOGS_A;
+    uint32_t hogs_b = argc > 3 ? atoi(argv[3]) : DEFAULT_HOGS_B;
+    if(ms == 0 || hogs_a == 0 || hogs_b == 0) {
+        printf("usage: tgbench [ms] [hogs_a] [hogs_b]\n");
+        return;
+    }
+    int a = syscall_taskgroup_create("bench-a");
+    int b = syscall_taskgroup_create("bench-b");
+    if(a < 0 || b < 0) {
+        printf("tgbench: failed to create task groups\n");
+        return;
+    }
+
+    printf("    PHASE QUOTA(us) A_HOGS A_MS A_PCT A_THR B_HOGS B_MS B_PCT B_THR\n");
+    for(const Phase& phase : phases) {
+        if(syscall_taskgroup_set(a, phase.quota_us, PERIOD_US, 0) < 0 ||
+            syscall_taskgroup_set(b, phase.quota_us, PERIOD_US, 0) < 0) {
+            printf("tgbench: failed to set quota\n");
+            break;
+        }
+        TaskGroupStat a0, b0, a1, b1;
+        syscall_taskgroup_stat(a, &a0);
+        syscall_taskgroup_stat(b, &b0);
+        if(syscall_cpuhog(0, hogs_a, ms, a) != (int)hogs_a ||
+            syscall_cpuhog(0, hogs_b, ms, b) != (int)hogs_b) {
+            printf("tgbench: failed to start hogs\n");
+            syscall_cpuhog(0, 0, 0);
+            break;
+        }
+        timespec req = {(long)(ms / 1000), (long)(ms % 1000) * 1000000};
+        syscall_nanosleep(&req, nullptr);
+        syscall_taskgroup_stat(a, &a1);
+        syscall_taskgroup_stat(b, &b1);
+        syscall_cpuhog(0, 0, 0);
+
+        uint32_t a_ms = a1.usage_ms - a0.usage_ms;
+        uint32_t b_ms = b1.usage_ms - b0.usage_ms;
+        printf("%9s %9u %6u %4u %4u%% %5u %6u %4u %4u%% %5u\n", phase.name, phase.quota_us, hogs_a,
+            a_ms, a_ms * 100 / ms, a1.nr_throttled - a0.nr_throttled, hogs_b, b_ms, b_ms * 100 / ms,
+            b1.nr_throttled - b0.nr_throttled);
+    }
+    syscall_taskgroup_set(a, 0, 0, 0);
+    syscall_taskgroup_set(b, 0, 0, 0);
+}
+
+REGISTER_COMMAND("tgbench", cmd_tgbench, "Compare CPU shares of two task groups with and without quota");
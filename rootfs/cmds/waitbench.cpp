@@ -0,0 +1,103 @@
+#include "commands.h"
+#include "kernel/syscall_user.h"
+#include "lib/time.h"
+#include "utils.h"
+
+// 测量等待方从资源被释放到重新运行的延迟(交接延迟)。
+// 只有一个用户进程，释放方由内核里的高精度定时器回调扮演，它在到期时释放一个信号量：
+//   wakeup: 阻塞在等待队列上，释放方直接把计数交给等待方并唤醒它
+//   poll:   模拟原来互斥锁的做法，拿不到就睡一个tick再试
+//   mutex:  释放方是持有基准互斥锁的内核线程，等待方在Mutex::lock里阻塞，测量互斥锁的交接
+//   remote: 释放方在CPU 1，等待方阻塞在CPU 0，唤醒跨CPU，靠重新调度IPI通知CPU 0，
+//           只有一个CPU时跳过。加启动参数resched_ipi=off对比等到CPU 0自己的tick才发现的延迟
+// 延迟 = 等待方从系统调用返回时的时钟 - 释放时的时钟
+
+static constexpr uint32_t DEFAULT_ROUNDS = 20;
+static constexpr uint32_t RELEASE_DELAY_US = 2000;
+
+enum Mode { MODE_WAKEUP, MODE_POLL, MODE_MUTEX, MODE_REMOTE, MODE_COUNT };
+static const char* mode_names[] = {"wakeup", "poll", "mutex", "remote"};
+
+static int32_t elapsed_ns(const timespec& start, const timespec& end)
+{
+    return (int32_t)(end.tv_sec - start.tv_sec) * 1000000000 + (int32_t)(end.tv_nsec - start.tv_nsec);
+}
+
+// 等一次释放，返回交接延迟(纳秒)，失败返回-1
+static int32_t handoff_once(Mode mode)
+{
+    if(mode == MODE_REMOTE) {
+        // 睡一下让亲和性生效，醒来时已经在CPU 1上，定时器启动在当前CPU上
+        timespec migrate = {0, 100000};
+        syscall_sched_setaffinity(0, 1u << 1);
+        syscall_nanosleep(&migrate, nullptr);
+    }
+    if(mode == MODE_MUTEX) {
+        if(syscall_waitbench(WAITBENCH_MUTEX, RELEASE_DELAY_US) < 0) {
+            return -1;
+        }
+    } else if(syscall_waitbench(WAITBENCH_ARM, RELEASE_DELAY_US) < 0) {
+        return -1;
+    }
+    if(mode == MODE_REMOTE) {
+        // 阻塞以后CPU 1不能再运行它，唤醒时放到CPU 0
+        syscall_sched_setaffinity(0, 1u << 0);
+    }
+    // mutex模式的系统调用返回时已经拿到并释放了互斥锁
+    if(mode == MODE_POLL) {
+        // 一个tick
+        timespec tick = {0, 10000000};
+        while(syscall_waitbench(WAITBENCH_TRYDOWN, 0) < 0) {
+            syscall_nanosleep(&tick, nullptr);
+        }
+    } else if(mode != MODE_MUTEX && syscall_waitbench(WAITBENCH_DOWN, 0) < 0) {
+        return -1;
+    }
+    timespec up, now;
+    syscall_clock_gettime(CLOCK_MONOTONIC, &now);
+    if(syscall_waitbench(WAITBENCH_RESULT, (uint32_t)&up) < 0) {
+        return -1;
+    }
+    return elapsed_ns(up, now);
+}
+
+void cmd_waitbench(int argc, char* argv[])
+{
+    uint32_t rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    if(rounds == 0) {
+        printf("usage: waitbench [rounds]\n");
+        return;
+    }
+
+    SchedStat stat;
+    bool smp = syscall_schedstat(1, &stat) == 0;
+
+    printf("   MODE    MIN(us)    AVG(us)    MAX(us)\n");
+    for(int mode = 0; mode < MODE_COUNT; mode++) {
+        if(mode == MODE_REMOTE && !smp) {
+            continue;
+        }
+        int32_t min = 0x7FFFFFFF;
+        int32_t max = 0;
+        int32_t sum = 0;
+        for(uint32_t i = 0; i < rounds; i++) {
+            int32_t ns = handoff_once((Mode)mode);
+            if(ns < 0) {
+                printf("waitbench: syscall failed\n");
+                syscall_sched_setaffinity(0, 0);
+                return;
+            }
+            if(ns < min) {
+                min = ns;
+            }
+            if(ns > max) {
+                max = ns;
+            }
+            sum += ns / 1000;
+        }
+        printf("%7s %10d %10d %10d\n", mode_names[mode], min / 1000, sum / (int32_t)rounds, max / 1000);
+    }
+    syscall_sched_setaffinity(0, 0);
+}
+
+REGISTER_COMMAND("waitbench", cmd_waitbench, "Measure wait queue handoff latency");
@@ -80,6 +80,28 @@ int main() {
     register_command({"rm", cmd_rm, "Remove file"});
     register_command({"pwd", cmd_pwd, "Concatenate and print files"});
     EXTERN_REGISTER(xxd, "print in hex format");
+    EXTERN_REGISTER(mmapbench, "compare read and mmap throughput");
+    EXTERN_REGISTER(shmbench, "compare shm and file ping-pong");
+    EXTERN_REGISTER(meminfo, "show memory statistics");
+    EXTERN_REGISTER(ps, "list processes and their memory usage");
+    EXTERN_REGISTER(swapbench, "touch more anonymous memory than RAM to exercise swap");
+    EXTERN_REGISTER(nice, "adjust the shell's nice value");
+    EXTERN_REGISTER(schedstat, "show per-CPU scheduler statistics");
+    EXTERN_REGISTER(taskset, "show or set the shell's CPU affinity");
+    EXTERN_REGISTER(sleepbench, "measure nanosleep wakeup latency");
+    EXTERN_REGISTER(waitbench, "measure wait queue handoff latency");
+    EXTERN_REGISTER(syscallbench, "measure syscall round-trip time");
+    EXTERN_REGISTER(fpubench, "measure context-switch cost with and without FPU state");
+    EXTERN_REGISTER(switchbench, "measure kernel-to-kernel context switch cost");
+    EXTERN_REGISTER(rtbench, "measure SCHED_FIFO wakeup latency under CPU load");
+    EXTERN_REGISTER(taskgroup, "create task groups and set CPU/memory limits");
+    EXTERN_REGISTER(tgbench, "compare CPU shares of two task groups with and without quota");
+    EXTERN_REGISTER(lockstat, "show per lock class spinlock statistics");
+    EXTERN_REGISTER(lockbench, "compare test-and-set and ticket spinlocks under contention");
+    EXTERN_REGISTER(rcubench, "compare RCU and locked mount/fd lookups on several CPUs");
+    EXTERN_REGISTER(logbench, "measure the cost of a log_debug call");
+    EXTERN_REGISTER(loglevel, "show or set the global and per-file log levels");
+    EXTERN_REGISTER(pathbench, "measure syscall and page fault costs");
     EXTERN_REGISTER(help, "print help message");
 
 
@@ -167,7 +167,8 @@ void scanf(const char* format, ...)
 
 void my_sleep(unsigned int ms)
 {
-    struct timespec req = {0, (long)ms * 1000000}; // 将毫秒转换为纳秒
+    // 纳秒部分不能超过1秒
+    struct timespec req = {(long)(ms / 1000), (long)(ms % 1000) * 1000000};
     struct timespec rem;
     syscall_nanosleep(&req, &rem);
 }
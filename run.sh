@@ -41,10 +41,20 @@ echo "启动CustomKernel..."
 # 启用多个日志类别以记录尽可能多的信息
 # 注意：QEMU 默认日志不包含时间戳，可以通过外部工具（如 ts 或 logger）添加时间戳
 # 来源信息（如 CPU ID）可能在某些日志类别中包含
+# 内存大小可以用QEMU_MEM指定，PAE内核(-DUSE_PAE=ON)可以用 QEMU_MEM=6G 验证4GB以上的内存
+# NX需要CPU支持，可以用 QEMU_CPU=max 打开
+# 交换设备用SWAP_IMAGE指定(tools/create_swap.sh生成)，挂在从盘上，
+# 例如 SWAP_IMAGE=swap.img QEMU_MEM=64M ./run.sh 后运行 swapbench 验证换出换入
+swap_opts=""
+if [ -n "$SWAP_IMAGE" ]; then
+    swap_opts="-hdb $SWAP_IMAGE"
+fi
 qemu-system-i386 \
     -cdrom $iso_file \
     -hda $disk_image \
-    -m 1G \
+    $swap_opts \
+    -m ${QEMU_MEM:-1G} \
+    -cpu ${QEMU_CPU:-qemu32} \
     -serial stdio  \
     -smp cores=4 \
     -s 2>&1 | tee qemu.log
@@ -95,11 +95,94 @@ TEST_CASE(hexdump_formatting) {
     ASSERT_STR_EQ("00000000", buffer);
 }
 
+static size_t pack(char* buf, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t len = pack_args(buf, size, format, args);
+    va_end(args);
+    return len;
+}
+
+TEST_CASE(packed_formatting) {
+    char packed[128];
+    char buffer[100];
+    char str[] = "hello";
+
+    // 打包以后再格式化，结果和直接格式化相同
+    size_t len = pack(packed, sizeof(packed), "%s %u %08x %c %*d %%", str, 42, 0x1234, 'z', 4, 7);
+    // 字符串在打包时已经复制
+    str[0] = 'j';
+    format_string_packed(buffer, sizeof(buffer), "%s %u %08x %c %*d %%", packed, len);
+    ASSERT_STR_EQ("hello 42 00001234 z    7 %", buffer);
+
+    // 放不下时字符串截断，后面的参数丢掉
+    len = pack(packed, sizeof(unsigned long) + 4, "%d %s %d", 1, "truncated", 2);
+    ASSERT_EQ(sizeof(unsigned long) + 4, len);
+    format_string_packed(buffer, sizeof(buffer), "%d %s %d", packed, len);
+    ASSERT_STR_EQ("1 tru 0", buffer);
+}
+
+TEST_CASE(per_file_log_levels) {
+    // 每个LogSite是一个固定级别的调用点
+    LogSite ext2_info = {"kernel/fs/ext2.cpp", 0};
+    LogSite ext2_debug = {"kernel/fs/ext2.cpp", 0};
+    LogSite paging_debug = {"kernel/memory/paging.cpp", 0};
+    LogSite paging_trace = {"kernel/memory/paging.cpp", 0};
+    LogSite main_info = {"kernel/core/main.cpp", 0};
+
+    set_log_level(LOG_INFO);
+    ASSERT_EQ(true, log_site_enabled(&ext2_info, LOG_INFO));
+    ASSERT_EQ(false, log_site_enabled(&ext2_debug, LOG_DEBUG));
+
+    // 单独打开ext2的调试日志，其他文件不变
+    ASSERT_EQ(true, set_log_level("ext2", LOG_DEBUG));
+    ASSERT_EQ(true, log_site_enabled(&ext2_debug, LOG_DEBUG));
+    ASSERT_EQ(false, log_site_enabled(&paging_debug, LOG_DEBUG));
+    ASSERT_EQ((int)LOG_DEBUG, (int)get_log_level("ext2"));
+    ASSERT_EQ((int)LOG_INFO, (int)get_log_level("paging"));
+
+    // 启动参数：全局级别和按文件的级别
+    const char config[] = "warning,paging:trace";
+    ASSERT_EQ(true, parse_log_levels(config, sizeof(config) - 1));
+    ASSERT_EQ(false, log_site_enabled(&main_info, LOG_INFO));
+    ASSERT_EQ(true, log_site_enabled(&ext2_debug, LOG_DEBUG));
+    ASSERT_EQ(true, log_site_enabled(&paging_trace, LOG_TRACE));
+    const char bad[] = "ext2:loud";
+    ASSERT_EQ(false, parse_log_levels(bad, sizeof(bad) - 1));
+    ASSERT_EQ(false, set_log_level("a_name_that_is_too_long", LOG_DEBUG));
+
+    // 删除规则以后改回全局级别
+    ASSERT_EQ(true, set_log_level("ext2", -1));
+    ASSERT_EQ(false, log_site_enabled(&ext2_debug, LOG_DEBUG));
+    set_log_level("paging", -1);
+    set_log_level(LOG_DEBUG);
+}
+
+TEST_CASE(log_prefix_level) {
+    char buffer[128];
+    char expected[128];
+
+    // 前缀是这条日志的级别，和全局级别无关
+    set_log_level(LOG_ERR);
+    format_log_prefix(buffer, sizeof(buffer), LOG_WARNING, 1, 7, "kernel/fs/ext2.cpp", 42, "read");
+    format_string(expected, sizeof(expected), "%s[CPU:1 TID:7] (ext2.cpp:42 read): ",
+        log_level_prefix[LOG_WARNING]);
+    ASSERT_STR_EQ(expected, buffer);
+
+    // TRACE是最后一个级别
+    format_log_prefix(buffer, sizeof(buffer), LOG_TRACE, 0, 1, "kernel/fs/ext2.cpp", 7, "iget");
+    ASSERT_STR_EQ("<8>[CPU:0 TID:1] (ext2.cpp:7 iget): ", buffer);
+    set_log_level(LOG_DEBUG);
+}
+
 int main() {
     RUN_TEST(basic_hex_formatting);
     RUN_TEST(advanced_hex_formatting);
     RUN_TEST(edge_cases);
     RUN_TEST(hexdump_formatting);
+    RUN_TEST(packed_formatting);
+    RUN_TEST(per_file_log_levels);
+    RUN_TEST(log_prefix_level);
     
     print_test_results();
     return g_test_stats.failed_tests;
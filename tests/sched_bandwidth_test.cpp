@@ -0,0 +1,134 @@
+#include "lib/test_framework.h"
+#include "kernel/sched_bandwidth.h"
+
+using namespace kernel;
+
+static constexpr uint64_t MS = 1000000ULL;
+
+TEST_CASE(set_limits) {
+    CpuBandwidth bw;
+    bw.init();
+    ASSERT_EQ(false, bw.limited());
+    ASSERT_EQ(true, bw.period_ns == BW_DEFAULT_PERIOD_NS);
+
+    // 周期和配额超出范围时不修改
+    ASSERT_EQ(false, bw.set(10 * MS, MS / 2));
+    ASSERT_EQ(false, bw.set(10 * MS, 2000 * MS));
+    ASSERT_EQ(false, bw.set(MS / 2, 100 * MS));
+    ASSERT_EQ(false, bw.limited());
+
+    ASSERT_EQ(true, bw.set(20 * MS, 50 * MS));
+    ASSERT_EQ(true, bw.limited());
+    ASSERT_EQ(true, bw.period_ns == 50 * MS);
+    // 周期为0用默认值，配额为0不限制
+    ASSERT_EQ(true, bw.set(0, 0));
+    ASSERT_EQ(false, bw.limited());
+    ASSERT_EQ(true, bw.period_ns == BW_DEFAULT_PERIOD_NS);
+}
+
+TEST_CASE(charge_throttles) {
+    CpuBandwidth bw;
+    bw.init();
+    bw.set(10 * MS, 100 * MS);
+    ASSERT_EQ(false, bw.charge(4 * MS));
+    ASSERT_EQ(false, bw.throttled);
+    // 用完配额的那一次返回true，之后不再返回
+    ASSERT_EQ(true, bw.charge(6 * MS));
+    ASSERT_EQ(true, bw.throttled);
+    ASSERT_EQ(false, bw.charge(MS));
+    ASSERT_EQ(1, (int)bw.nr_throttled);
+    ASSERT_EQ(true, bw.usage_ns == 11 * MS);
+
+    // 修改配额解除限流，本周期重新计算
+    ASSERT_EQ(true, bw.set(20 * MS, 100 * MS));
+    ASSERT_EQ(false, bw.throttled);
+    ASSERT_EQ(true, bw.runtime_used == 0);
+}
+
+TEST_CASE(refill_carries_overrun) {
+    CpuBandwidth bw;
+    bw.init();
+    bw.set(10 * MS, 100 * MS);
+    bw.charge(13 * MS);
+    ASSERT_EQ(true, bw.throttled);
+    // 超出的3ms从下一个周期扣
+    ASSERT_EQ(true, bw.refill());
+    ASSERT_EQ(false, bw.throttled);
+    ASSERT_EQ(true, bw.runtime_used == 3 * MS);
+    ASSERT_EQ(true, bw.charge(7 * MS));
+
+    // 超出很多时最多扣一个配额：下一个周期整个被限流，再下一个周期恢复
+    bw.charge(30 * MS);
+    ASSERT_EQ(false, bw.refill());
+    ASSERT_EQ(true, bw.throttled);
+    ASSERT_EQ(true, bw.refill());
+    ASSERT_EQ(false, bw.throttled);
+    ASSERT_EQ(true, bw.runtime_used == 0);
+    ASSERT_EQ(3, (int)bw.nr_periods);
+}
+
+TEST_CASE(unlimited_only_counts) {
+    CpuBandwidth bw;
+    bw.init();
+    ASSERT_EQ(false, bw.charge(1000 * MS));
+    ASSERT_EQ(false, bw.throttled);
+    ASSERT_EQ(true, bw.runtime_used == 0);
+    ASSERT_EQ(true, bw.usage_ns == 1000 * MS);
+    ASSERT_EQ(false, bw.refill());
+}
+
+// 一个CPU上A组1个任务、B组3个任务，按tick轮转运行没有被限流的任务，返回两组的运行时间
+static void simulate(uint64_t quota, uint32_t periods, uint64_t* a_ns, uint64_t* b_ns) {
+    static constexpr uint64_t TICK = 10 * MS;
+    static constexpr uint32_t TICKS_PER_PERIOD = 10;
+    CpuBandwidth a, b;
+    a.init();
+    b.init();
+    a.set(quota, TICKS_PER_PERIOD * TICK);
+    b.set(quota, TICKS_PER_PERIOD * TICK);
+    CpuBandwidth* tasks[] = {&a, &b, &b, &b};
+    uint32_t next = 0;
+    for (uint32_t t = 0; t < periods * TICKS_PER_PERIOD; t++) {
+        for (uint32_t i = 0; i < 4; i++) {
+            CpuBandwidth* group = tasks[(next + i) % 4];
+            if (!group->throttled) {
+                group->charge(TICK);
+                next = (next + i + 1) % 4;
+                break;
+            }
+        }
+        if ((t + 1) % TICKS_PER_PERIOD == 0) {
+            a.refill();
+            b.refill();
+        }
+    }
+    *a_ns = a.usage_ns;
+    *b_ns = b.usage_ns;
+}
+
+TEST_CASE(two_group_fairness) {
+    uint64_t a_ns, b_ns;
+    // 不限制时按任务平分，B组3个任务得到3/4
+    simulate(0, 100, &a_ns, &b_ns);
+    ASSERT_EQ(true, b_ns == 3 * a_ns);
+    ASSERT_EQ(true, a_ns + b_ns == 10000 * MS);
+
+    // 相同的配额下两组得到相同的CPU时间，都是配额/周期
+    simulate(40 * MS, 100, &a_ns, &b_ns);
+    ASSERT_EQ(true, a_ns == b_ns);
+    ASSERT_EQ(true, a_ns == 4000 * MS);
+}
+
+int main() {
+    printf("Running sched_bandwidth tests...\n");
+
+    RUN_TEST(set_limits);
+    RUN_TEST(charge_throttles);
+    RUN_TEST(refill_carries_overrun);
+    RUN_TEST(unlimited_only_counts);
+    RUN_TEST(two_group_fairness);
+
+    print_test_results();
+
+    return g_test_stats.failed_tests > 0 ? 1 : 0;
+}
@@ -0,0 +1,586 @@
+#include "lib/test_framework.h"
+#include "kernel/rbtree.h"
+#include "kernel/sched_fair.h"
+
+using namespace kernel;
+
+// 简单的线性同余随机数，保证每次运行结果相同
+static uint32_t rand_state = 12345;
+static uint32_t next_rand() {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+struct Item {
+    rb_node node;
+    uint32_t key;
+    bool in_tree;
+};
+
+static void insert_item(rb_root_cached* root, Item* item) {
+    rb_node** link = &root->root.node;
+    rb_node* parent = nullptr;
+    bool leftmost = true;
+    while (*link) {
+        parent = *link;
+        if (item->key < rb_entry(parent, Item, node)->key) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    rb_link_node(&item->node, parent, link);
+    rb_insert_color_cached(&item->node, root, leftmost);
+    item->in_tree = true;
+}
+
+// 检查红黑性质，返回黑高，违反时返回-1
+static int check_subtree(const rb_node* node, const rb_node* parent) {
+    if (!node) {
+        return 1;
+    }
+    if (node->parent != parent) {
+        return -1;
+    }
+    if (node->red && ((node->left && node->left->red) || (node->right && node->right->red))) {
+        return -1;
+    }
+    int left = check_subtree(node->left, node);
+    int right = check_subtree(node->right, node);
+    if (left < 0 || left != right) {
+        return -1;
+    }
+    return left + (node->red ? 0 : 1);
+}
+
+static bool check_tree(const rb_root_cached* root, uint32_t expected_count) {
+    if (root->root.node && root->root.node->red) {
+        return false;
+    }
+    if (check_subtree(root->root.node, nullptr) < 0) {
+        return false;
+    }
+    if (root->leftmost != rb_first(&root->root)) {
+        return false;
+    }
+    uint32_t count = 0;
+    uint32_t last = 0;
+    for (rb_node* node = rb_first(&root->root); node; node = rb_next(node)) {
+        uint32_t key = rb_entry(node, Item, node)->key;
+        if (count > 0 && key < last) {
+            return false;
+        }
+        last = key;
+        count++;
+    }
+    return count == expected_count;
+}
+
+TEST_CASE(rbtree_insert_erase) {
+    static Item items[2000];
+    rb_root_cached root;
+    RB_INIT_ROOT(&root);
+
+    for (uint32_t i = 0; i < 2000; i++) {
+        items[i].key = next_rand() % 500; // 有重复的键
+        insert_item(&root, &items[i]);
+    }
+    ASSERT_EQ(true, check_tree(&root, 2000));
+
+    // 随机删除一半，再插回一部分
+    uint32_t count = 2000;
+    for (uint32_t i = 0; i < 1000; i++) {
+        Item* item = &items[next_rand() % 2000];
+        if (item->in_tree) {
+            rb_erase_cached(&item->node, &root);
+            item->in_tree = false;
+            count--;
+        }
+    }
+    ASSERT_EQ(true, check_tree(&root, count));
+    for (uint32_t i = 0; i < 2000; i += 3) {
+        if (!items[i].in_tree) {
+            items[i].key = next_rand() % 500;
+            insert_item(&root, &items[i]);
+            count++;
+        }
+    }
+    ASSERT_EQ(true, check_tree(&root, count));
+
+    // 每次删最左节点，相当于调度器不断取vruntime最小的任务
+    uint32_t last = 0;
+    bool sorted = true;
+    while (root.leftmost) {
+        Item* item = rb_entry(root.leftmost, Item, node);
+        sorted = sorted && item->key >= last;
+        last = item->key;
+        rb_erase_cached(&item->node, &root);
+        count--;
+    }
+    ASSERT_EQ(true, sorted);
+    ASSERT_EQ(0, (int)count);
+    ASSERT_EQ(true, root.root.node == nullptr);
+}
+
+TEST_CASE(weight_tables) {
+    for (uint32_t prio = 0; prio < NICE_WIDTH; prio++) {
+        // weight * wmult应该在2^32附近
+        uint64_t product = (uint64_t)sched_prio_to_weight[prio] * sched_prio_to_wmult[prio];
+        uint64_t diff = product > (1ull << 32) ? product - (1ull << 32) : (1ull << 32) - product;
+        ASSERT_EQ(true, diff < sched_prio_to_weight[prio]);
+    }
+    ASSERT_EQ(1024, (int)sched_prio_to_weight[DEFAULT_PRIO]);
+    ASSERT_EQ(0, prio_to_nice(DEFAULT_PRIO));
+    ASSERT_EQ(39, (int)nice_to_prio(MAX_NICE));
+}
+
+TEST_CASE(calc_delta) {
+    SchedEntity se = {};
+    se.set_prio(DEFAULT_PRIO);
+    ASSERT_EQ(true, calc_delta_fair(1000000, &se) == 1000000);
+
+    // nice 5的vruntime增长速度是nice 0的1024/335倍
+    se.set_prio(nice_to_prio(5));
+    uint64_t expected = 1000000ull * 1024 / 335;
+    uint64_t got = calc_delta_fair(1000000, &se);
+    ASSERT_EQ(true, got > expected - expected / 1000 && got < expected + expected / 1000);
+
+    // 超过32位的delta，高位部分也要算对
+    se.set_prio(nice_to_prio(-10));
+    expected = 0x300000000ull * 1024 / 9548;
+    got = calc_delta_fair(0x300000000ull, &se);
+    ASSERT_EQ(true, got > expected - expected / 1000 && got < expected + expected / 1000);
+}
+
+// 单CPU调度模拟
+// 时钟单位是微秒，时钟中断10ms一次，和内核一样只在tick上抢占，
+// 任务主动睡眠时立即切换到下一个任务
+static constexpr uint64_t TICK = 10000;
+static constexpr uint64_t STEP = 100;
+
+struct SimTask {
+    SchedEntity se;
+    int nice;
+    uint32_t burst;   // 交互任务每次唤醒运行的时间，0表示一直运行的批处理任务
+    uint32_t sleep;   // 交互任务每次睡眠的平均时间，实际在它上下半个tick内随机
+    uint32_t left;    // 这次唤醒还要运行的时间
+    bool sleeping;
+    uint64_t wake_at;
+    uint64_t woke;    // 最近一次唤醒的时间，还没开始运行时有效
+    bool waiting;
+    uint64_t ran;
+    uint32_t wakeups;
+    uint64_t latency_sum;
+    uint64_t latency_max;
+};
+
+// 调度策略，模拟器只通过这个接口和策略交互
+struct Policy {
+    virtual void add(SimTask* task, uint64_t now) = 0;
+    virtual void wake(SimTask* task, uint64_t now) = 0;
+    // 时钟中断，返回是否需要切换
+    virtual bool tick(uint64_t now) = 0;
+    // 切换到下一个任务，prev_runnable表示当前任务是否放回队列，没有其他任务时返回nullptr
+    virtual SimTask* switch_next(uint64_t now, bool prev_runnable) = 0;
+    virtual ~Policy() {}
+};
+
+struct FairPolicy : Policy {
+    CfsRunQueue cfs;
+    FairPolicy() { cfs.init(); }
+    void add(SimTask* task, uint64_t) override {
+        task->se.set_prio(nice_to_prio(task->nice));
+        cfs.enqueue(&task->se, ENQUEUE_NEW);
+    }
+    void wake(SimTask* task, uint64_t now) override {
+        cfs.update_curr(now);
+        cfs.enqueue(&task->se, ENQUEUE_WAKEUP);
+    }
+    bool tick(uint64_t now) override {
+        cfs.tick(now);
+        return cfs.test_and_clear_resched();
+    }
+    SimTask* switch_next(uint64_t now, bool prev_runnable) override {
+        SchedEntity* next = cfs.pick_first();
+        if (!next) {
+            if (!prev_runnable) {
+                cfs.put_prev(now, false);
+            }
+            return nullptr;
+        }
+        cfs.dequeue(next);
+        cfs.put_prev(now, prev_runnable);
+        cfs.set_next(next, now);
+        return container_of(next, SimTask, se);
+    }
+};
+
+// 原来的调度方式：FIFO链表，固定100个tick的时间片
+struct FifoPolicy : Policy {
+    SimTask* queue[16];
+    uint32_t head = 0, count = 0;
+    SimTask* curr = nullptr;
+    uint32_t slice = 0;
+    void push(SimTask* task) { queue[(head + count++) % 16] = task; }
+    void add(SimTask* task, uint64_t) override { push(task); }
+    void wake(SimTask* task, uint64_t) override { push(task); }
+    bool tick(uint64_t) override { return !curr ? count > 0 : ++slice >= 100; }
+    SimTask* switch_next(uint64_t, bool prev_runnable) override {
+        if (count == 0) {
+            if (!prev_runnable) {
+                curr = nullptr;
+            }
+            return nullptr;
+        }
+        SimTask* next = queue[head];
+        head = (head + 1) % 16;
+        count--;
+        if (curr && prev_runnable) {
+            push(curr);
+        }
+        curr = next;
+        slice = 0;
+        return next;
+    }
+};
+
+static void simulate(Policy& policy, SimTask* tasks, uint32_t nr, uint64_t duration) {
+    for (uint32_t i = 0; i < nr; i++) {
+        tasks[i].left = tasks[i].burst;
+        policy.add(&tasks[i], 0);
+    }
+    SimTask* running = nullptr;
+    for (uint64_t now = 0; now < duration; now += STEP) {
+        for (uint32_t i = 0; i < nr; i++) {
+            SimTask* task = &tasks[i];
+            if (task->sleeping && task->wake_at <= now) {
+                task->sleeping = false;
+                task->left = task->burst;
+                task->woke = now;
+                task->waiting = true;
+                policy.wake(task, now);
+            }
+        }
+
+        SimTask* next = nullptr;
+        if (now % TICK == 0 && policy.tick(now)) {
+            next = policy.switch_next(now, running != nullptr);
+        }
+        if (next) {
+            running = next;
+            if (running->waiting) {
+                uint64_t latency = now - running->woke;
+                running->waiting = false;
+                running->wakeups++;
+                running->latency_sum += latency;
+                if (latency > running->latency_max) {
+                    running->latency_max = latency;
+                }
+            }
+        }
+        if (!running) {
+            continue;
+        }
+
+        running->ran += STEP;
+        if (running->burst && (running->left -= STEP) == 0) {
+            // 交互任务这次的工作做完，睡眠并立即切换
+            running->sleeping = true;
+            running->wake_at = now + STEP + running->sleep - TICK / 2 + next_rand() % (TICK / STEP) * STEP;
+            running = policy.switch_next(now + STEP, false);
+            if (running && running->waiting) {
+                uint64_t latency = now + STEP - running->woke;
+                running->waiting = false;
+                running->wakeups++;
+                running->latency_sum += latency;
+                if (latency > running->latency_max) {
+                    running->latency_max = latency;
+                }
+            }
+        }
+    }
+}
+
+// 4个批处理任务(其中一个nice 5)和一个交互任务：每次运行1ms，平均睡眠20ms
+static void init_mixed(SimTask* tasks) {
+    for (uint32_t i = 0; i < 5; i++) {
+        tasks[i] = {};
+    }
+    tasks[3].nice = 5;
+    tasks[4].burst = 1000;
+    tasks[4].sleep = 20000;
+}
+
+static void print_result(const char* name, SimTask* tasks, uint64_t duration) {
+    SimTask& shell = tasks[4];
+    uint32_t avg = shell.wakeups ? (uint32_t)(shell.latency_sum / shell.wakeups) : 0;
+    printf("%s: interactive wakeups %u, avg latency %u us, max latency %u us, cpu %u.%u%%\n",
+        name, shell.wakeups, avg, (uint32_t)shell.latency_max,
+        (uint32_t)(shell.ran * 100 / duration), (uint32_t)(shell.ran * 1000 / duration % 10));
+    for (uint32_t i = 0; i < 4; i++) {
+        printf("%s: batch %u nice %d cpu %u.%u%%\n", name, i, tasks[i].nice,
+            (uint32_t)(tasks[i].ran * 100 / duration), (uint32_t)(tasks[i].ran * 1000 / duration % 10));
+    }
+}
+
+TEST_CASE(mixed_latency_benchmark) {
+    constexpr uint64_t duration = 20 * 1000000; // 20秒
+    SimTask fifo_tasks[5], fair_tasks[5];
+    init_mixed(fifo_tasks);
+    init_mixed(fair_tasks);
+    FifoPolicy fifo;
+    FairPolicy fair;
+    simulate(fifo, fifo_tasks, 5, duration);
+    simulate(fair, fair_tasks, 5, duration);
+    print_result("fifo", fifo_tasks, duration);
+    print_result("fair", fair_tasks, duration);
+
+    // 交互任务唤醒后最多等到下一个tick就能运行，平均半个tick
+    ASSERT_EQ(true, fair_tasks[4].latency_max <= TICK);
+    ASSERT_EQ(true, fair_tasks[4].latency_sum / fair_tasks[4].wakeups < TICK * 2 / 3);
+    ASSERT_EQ(true, fair_tasks[4].latency_max * 100 < fifo_tasks[4].latency_max);
+    // 每次唤醒都能很快处理完，不会像FIFO那样排在几个整秒的时间片后面
+    ASSERT_EQ(true, fair_tasks[4].wakeups > fifo_tasks[4].wakeups * 100);
+
+    // 批处理任务按权重分CPU，nice 0之间相同，nice 0和nice 5之间约为1024:335
+    uint64_t nice0 = fair_tasks[0].ran;
+    for (uint32_t i = 1; i < 3; i++) {
+        uint64_t diff = fair_tasks[i].ran > nice0 ? fair_tasks[i].ran - nice0 : nice0 - fair_tasks[i].ran;
+        ASSERT_EQ(true, diff * 20 < nice0);
+    }
+    uint64_t ratio = nice0 * 100 / fair_tasks[3].ran;
+    ASSERT_EQ(true, ratio > 290 && ratio < 320);
+}
+
+TEST_CASE(dynamic_slice) {
+    // 可运行任务少时平分调度周期，多了以后每个任务至少一个tick
+    SimTask tasks[8] = {};
+    FairPolicy fair;
+    fair.cfs.tick(TICK);
+    fair.cfs.tick(2 * TICK);
+    fair.add(&tasks[0], 0);
+    fair.add(&tasks[1], 0);
+    ASSERT_EQ(true, fair.cfs.sched_slice(&tasks[0].se) == 2 * TICK);
+    for (uint32_t i = 2; i < 8; i++) {
+        fair.add(&tasks[i], 0);
+    }
+    ASSERT_EQ(true, fair.cfs.sched_slice(&tasks[0].se) == TICK);
+}
+
+TEST_CASE(yield_alternates) {
+    // 两个任务轮流让出CPU，每次都切到另一个；只剩一个任务时让出不会切换
+    SimTask tasks[2] = {};
+    FairPolicy fair;
+    fair.add(&tasks[0], 0);
+    fair.add(&tasks[1], 0);
+    SimTask* curr = fair.switch_next(0, false);
+    uint64_t now = 0;
+    for (uint32_t i = 0; i < 10; i++) {
+        now += 100;
+        fair.cfs.yield(now);
+        ASSERT_EQ(true, fair.cfs.test_and_clear_resched());
+        SimTask* next = fair.switch_next(now, true);
+        ASSERT_EQ(true, next != curr);
+        curr = next;
+    }
+    // 当前任务退出，另一个任务单独运行
+    fair.cfs.put_prev(now, false);
+    SchedEntity* last = fair.cfs.pick_first();
+    fair.cfs.dequeue(last);
+    fair.cfs.set_next(last, now);
+    fair.cfs.yield(now + 100);
+    ASSERT_EQ(false, fair.cfs.test_and_clear_resched());
+}
+
+static bool deny_odd(SchedEntity* se, void* arg) {
+    return (container_of(se, SimTask, se) - static_cast<SimTask*>(arg)) % 2 == 0;
+}
+
+TEST_CASE(pull_hot_and_filtered) {
+    SimTask tasks[4] = {};
+    FairPolicy src, dst;
+    src.cfs.tick(TICK);
+    src.cfs.tick(2 * TICK);
+    for (uint32_t i = 0; i < 4; i++) {
+        src.add(&tasks[i], 0);
+    }
+    // tasks[0]刚在源CPU上运行过，缓存还热
+    tasks[0].se.exec_start = 3 * TICK;
+    uint32_t hot = 0;
+    uint32_t moved = dst.cfs.pull_from(src.cfs, 4, 3 * TICK + 100, true, deny_odd, tasks, &hot);
+    ASSERT_EQ(1, (int)moved);
+    ASSERT_EQ(1, (int)hot);
+    ASSERT_EQ(true, tasks[2].se.on_rq && dst.cfs.pick_first() == &tasks[2].se);
+    // 不检查缓存热度时热任务也可以迁移，vruntime按min_vruntime平移
+    moved = dst.cfs.pull_from(src.cfs, 4, 3 * TICK + 100, false, deny_odd, tasks, &hot);
+    ASSERT_EQ(1, (int)moved);
+    ASSERT_EQ(2, (int)src.cfs.nr_running);
+    ASSERT_EQ(2, (int)dst.cfs.nr_running);
+    ASSERT_EQ(true, dst.cfs.resched);
+}
+
+// 多CPU负载均衡模拟，和SMP_Scheduler一样：空闲CPU每个tick都尝试拉任务，
+// 忙碌CPU每10个tick检查一次，连续两次因为缓存热没拉到任务后不再检查热度
+// 亲和性变化时迁移的实体保持和队列min_vruntime的相对位置，并记录新的CPU
+TEST_CASE(migrate_keeps_relative_vruntime) {
+    CfsRunQueue src, dst;
+    src.init(0);
+    dst.init(1);
+    SchedEntity a = {}, b = {};
+    a.set_prio(DEFAULT_PRIO);
+    b.set_prio(DEFAULT_PRIO);
+    src.min_vruntime = 5000;
+    dst.min_vruntime = 100000;
+    a.vruntime = 5300;
+    src.enqueue(&a, 0);
+    ASSERT_EQ(0, (int)a.cpu);
+    src.dequeue(&a);
+    a.vruntime -= src.min_vruntime;
+    dst.enqueue(&a, ENQUEUE_MIGRATED);
+    ASSERT_EQ(1, (int)a.cpu);
+    ASSERT_EQ(100300, (int)a.vruntime);
+    // 迁移时不按唤醒补偿，远落后于min_vruntime的实体也不会被拉回
+    b.vruntime = (uint64_t)-20000;
+    dst.enqueue(&b, ENQUEUE_MIGRATED);
+    ASSERT_EQ(80000, (int)b.vruntime);
+    ASSERT_EQ(true, dst.pick_first() == &b);
+}
+
+static constexpr uint32_t SIM_CPUS = 4;
+
+struct SimCpu {
+    FairPolicy policy;
+    SimTask* running;
+    uint32_t balance_ticks;
+    uint32_t balance_failed;
+    uint32_t migrations;
+    uint32_t hot_skipped;
+    uint64_t busy;
+};
+
+static void sim_balance(SimCpu* cpus, uint32_t self, uint64_t now) {
+    uint32_t busiest = self;
+    uint32_t max = 0;
+    for (uint32_t i = 0; i < SIM_CPUS; i++) {
+        if (cpus[i].policy.cfs.nr_running > max) {
+            max = cpus[i].policy.cfs.nr_running;
+            busiest = i;
+        }
+    }
+    SimCpu& cpu = cpus[self];
+    if (busiest == self) {
+        return;
+    }
+    uint32_t imbalance = cpu.policy.cfs.calc_imbalance(cpus[busiest].policy.cfs);
+    if (!imbalance) {
+        return;
+    }
+    uint32_t hot = 0;
+    uint32_t moved = cpu.policy.cfs.pull_from(cpus[busiest].policy.cfs, imbalance, now,
+        cpu.balance_failed < 2, nullptr, nullptr, &hot);
+    cpu.balance_failed = moved ? 0 : (hot ? cpu.balance_failed + 1 : cpu.balance_failed);
+    cpu.migrations += moved;
+    cpu.hot_skipped += hot;
+}
+
+// 返回所有CPU都忙起来的时间，从没有全忙过返回duration
+static uint64_t simulate_smp(SimCpu* cpus, SimTask* tasks, uint32_t nr, uint64_t duration, bool balance) {
+    for (uint32_t i = 0; i < SIM_CPUS; i++) {
+        cpus[i].balance_ticks = 10 + i;
+    }
+    // 所有任务都创建在CPU 0上
+    for (uint32_t i = 0; i < nr; i++) {
+        cpus[0].policy.add(&tasks[i], 0);
+    }
+    uint64_t all_busy = duration;
+    for (uint64_t now = TICK; now < duration; now += STEP) {
+        bool busy = true;
+        for (uint32_t i = 0; i < SIM_CPUS; i++) {
+            SimCpu& cpu = cpus[i];
+            if (now % TICK == 0) {
+                cpu.policy.cfs.tick(now);
+                bool idle = !cpu.running;
+                if (balance && (idle || --cpu.balance_ticks == 0)) {
+                    cpu.balance_ticks = 10;
+                    sim_balance(cpus, i, now);
+                }
+                if (cpu.policy.cfs.test_and_clear_resched()) {
+                    SimTask* next = cpu.policy.switch_next(now, cpu.running != nullptr);
+                    if (next) {
+                        cpu.running = next;
+                    }
+                }
+            }
+            if (cpu.running) {
+                cpu.running->ran += STEP;
+                cpu.busy += STEP;
+            } else {
+                busy = false;
+            }
+        }
+        if (busy && all_busy == duration) {
+            all_busy = now;
+        }
+    }
+    return all_busy;
+}
+
+TEST_CASE(balance_benchmark) {
+    constexpr uint32_t nr = 8;
+    constexpr uint64_t duration = 5 * 1000000;
+    for (int balance = 0; balance < 2; balance++) {
+        SimTask tasks[nr] = {};
+        static SimCpu cpus[SIM_CPUS];
+        for (uint32_t i = 0; i < SIM_CPUS; i++) {
+            cpus[i] = {};
+            cpus[i].policy.cfs.init();
+        }
+        uint64_t all_busy = simulate_smp(cpus, tasks, nr, duration, balance);
+        const char* name = balance ? "balance" : "no-balance";
+        uint64_t min_ran = duration, max_ran = 0;
+        for (uint32_t i = 0; i < nr; i++) {
+            min_ran = tasks[i].ran < min_ran ? tasks[i].ran : min_ran;
+            max_ran = tasks[i].ran > max_ran ? tasks[i].ran : max_ran;
+        }
+        printf("%s: %u tasks on cpu 0, all cpus busy after %u ms, task cpu share %u%%..%u%%\n",
+            name, nr, (uint32_t)(all_busy / 1000), (uint32_t)(min_ran * 100 / duration),
+            (uint32_t)(max_ran * 100 / duration));
+        uint32_t migrations = 0;
+        for (uint32_t i = 0; i < SIM_CPUS; i++) {
+            printf("%s: cpu %u busy %u%%, migrations in %u, hot skipped %u\n", name, i,
+                (uint32_t)(cpus[i].busy * 100 / duration), cpus[i].migrations, cpus[i].hot_skipped);
+            migrations += cpus[i].migrations;
+        }
+        if (balance) {
+            // 一个tick内其他CPU都拉到了任务，之后保持每个CPU两个任务，不来回迁移
+            ASSERT_EQ(true, all_busy <= 2 * TICK);
+            ASSERT_EQ(true, migrations <= nr);
+            for (uint32_t i = 0; i < SIM_CPUS; i++) {
+                ASSERT_EQ(true, cpus[i].busy * 100 / duration >= 99);
+            }
+            ASSERT_EQ(true, min_ran * 100 / duration >= 45 && max_ran * 100 / duration <= 55);
+        } else {
+            ASSERT_EQ(true, all_busy == duration);
+            ASSERT_EQ(0, (int)migrations);
+        }
+    }
+}
+
+int main() {
+    printf("Running sched_fair tests...\n");
+
+    RUN_TEST(rbtree_insert_erase);
+    RUN_TEST(weight_tables);
+    RUN_TEST(calc_delta);
+    RUN_TEST(dynamic_slice);
+    RUN_TEST(yield_alternates);
+    RUN_TEST(mixed_latency_benchmark);
+    RUN_TEST(pull_hot_and_filtered);
+    RUN_TEST(migrate_keeps_relative_vruntime);
+    RUN_TEST(balance_benchmark);
+
+    print_test_results();
+
+    return g_test_stats.failed_tests > 0 ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+#include "lib/test_framework.h"
+#include "kernel/sched_rt.h"
+
+using namespace kernel;
+
+static RtEntity* make(RtEntity* rt, uint32_t policy, uint32_t prio) {
+    rt->policy = policy;
+    rt->prio = prio;
+    rt->time_slice = RR_TIMESLICE;
+    rt->on_rq = false;
+    INIT_LIST_HEAD(&rt->run_list);
+    return rt;
+}
+
+// 取出所有等待的实体，返回取出的个数
+static uint32_t drain(RtRunQueue& rq, RtEntity** order, uint32_t max) {
+    uint32_t n = 0;
+    while (RtEntity* rt = rq.pick_first()) {
+        rq.dequeue(rt);
+        if (n < max) {
+            order[n] = rt;
+        }
+        n++;
+    }
+    return n;
+}
+
+TEST_CASE(priority_order) {
+    static RtRunQueue rq;
+    rq.init();
+    // 跨过位图的几个字
+    static const uint32_t prios[] = {5, 99, 33, 64, 1, 32, 31, 63};
+    RtEntity rts[8];
+    for (uint32_t i = 0; i < 8; i++) {
+        rq.enqueue(make(&rts[i], SCHED_FIFO, prios[i]));
+    }
+    ASSERT_EQ(8, (int)rq.nr_running);
+    ASSERT_EQ(99, (int)rq.highest_prio());
+
+    RtEntity* order[8];
+    ASSERT_EQ(8, (int)drain(rq, order, 8));
+    static const uint32_t expected[] = {99, 64, 63, 33, 32, 31, 5, 1};
+    for (uint32_t i = 0; i < 8; i++) {
+        ASSERT_EQ((int)expected[i], (int)order[i]->prio);
+        ASSERT_EQ(false, order[i]->on_rq);
+    }
+    ASSERT_EQ(0, (int)rq.highest_prio());
+    ASSERT_EQ(true, rq.pick_first() == nullptr);
+}
+
+TEST_CASE(fifo_within_prio) {
+    static RtRunQueue rq;
+    rq.init();
+    RtEntity a, b, c, d;
+    rq.enqueue(make(&a, SCHED_FIFO, 10));
+    rq.enqueue(make(&b, SCHED_FIFO, 10));
+    rq.enqueue(make(&c, SCHED_FIFO, 10));
+    // 放到队首的排在最前面
+    rq.enqueue(make(&d, SCHED_FIFO, 10), true);
+    RtEntity* order[4];
+    ASSERT_EQ(4, (int)drain(rq, order, 4));
+    ASSERT_EQ(true, order[0] == &d && order[1] == &a && order[2] == &b && order[3] == &c);
+
+    // 中间删掉一个，链表和位图保持一致
+    rq.enqueue(&a);
+    rq.enqueue(&b);
+    rq.dequeue(&a);
+    ASSERT_EQ(10, (int)rq.highest_prio());
+    rq.dequeue(&b);
+    ASSERT_EQ(0, (int)rq.highest_prio());
+}
+
+TEST_CASE(wakeup_preempt) {
+    static RtRunQueue rq;
+    rq.init();
+    RtEntity curr, low, high, other;
+    // 正在运行普通任务或idle时总是抢占
+    rq.enqueue(make(&low, SCHED_FIFO, 1));
+    ASSERT_EQ(true, rq.test_and_clear_resched());
+
+    rq.dequeue(&low);
+    rq.set_next(make(&curr, SCHED_FIFO, 50));
+    rq.enqueue(make(&low, SCHED_FIFO, 40));
+    ASSERT_EQ(false, rq.resched);
+    // 同优先级不抢占
+    rq.enqueue(make(&other, SCHED_RR, 50));
+    ASSERT_EQ(false, rq.resched);
+    ASSERT_EQ(true, rq.curr_keeps_cpu());
+    rq.enqueue(make(&high, SCHED_FIFO, 60));
+    ASSERT_EQ(true, rq.resched);
+    ASSERT_EQ(false, rq.curr_keeps_cpu());
+
+    // 被抢占的实体回到同优先级的队首，高优先级运行完以后先于other运行
+    rq.put_prev(true);
+    ASSERT_EQ(true, rq.pick_first() == &high);
+    rq.dequeue(&high);
+    rq.set_next(&high);
+    rq.put_prev(false);
+    ASSERT_EQ(true, rq.pick_first() == &curr);
+}
+
+TEST_CASE(round_robin) {
+    static RtRunQueue rq;
+    rq.init();
+    RtEntity a, b;
+    make(&a, SCHED_RR, 20);
+    make(&b, SCHED_RR, 20);
+
+    // 同优先级只有自己时用完时间片继续运行
+    rq.set_next(&a);
+    for (uint32_t i = 0; i < RR_TIMESLICE * 3; i++) {
+        ASSERT_EQ(false, rq.tick());
+    }
+    ASSERT_EQ(true, rq.curr_keeps_cpu());
+
+    // 有同优先级的等待者时，用完时间片轮到它，自己排到队尾
+    rq.enqueue(&b);
+    ASSERT_EQ(false, rq.resched);
+    uint32_t ticks = 0;
+    while (!rq.tick()) {
+        ticks++;
+    }
+    ASSERT_EQ(true, ticks < RR_TIMESLICE);
+    ASSERT_EQ(false, rq.curr_keeps_cpu());
+    ASSERT_EQ(RR_TIMESLICE, a.time_slice);
+    rq.put_prev(true);
+    ASSERT_EQ(true, rq.pick_first() == &b);
+
+    // 轮流运行，每个都拿到完整的时间片
+    uint32_t ran[2] = {0, 0};
+    RtEntity* curr = nullptr;
+    for (uint32_t t = 0; t < RR_TIMESLICE * 10; t++) {
+        if (!curr || rq.test_and_clear_resched()) {
+            if (curr) {
+                rq.put_prev(true);
+            }
+            curr = rq.pick_first();
+            rq.dequeue(curr);
+            rq.set_next(curr);
+        }
+        ran[curr == &a ? 0 : 1]++;
+        rq.tick();
+    }
+    ASSERT_EQ((int)(RR_TIMESLICE * 5), (int)ran[0]);
+    ASSERT_EQ((int)(RR_TIMESLICE * 5), (int)ran[1]);
+}
+
+TEST_CASE(fifo_never_rotates) {
+    static RtRunQueue rq;
+    rq.init();
+    RtEntity a, b;
+    rq.set_next(make(&a, SCHED_FIFO, 20));
+    rq.enqueue(make(&b, SCHED_FIFO, 20));
+    for (uint32_t i = 0; i < RR_TIMESLICE * 5; i++) {
+        ASSERT_EQ(false, rq.tick());
+    }
+    ASSERT_EQ(true, rq.curr_keeps_cpu());
+
+    // 主动让出时排到同优先级的队尾
+    rq.yield();
+    ASSERT_EQ(true, rq.resched);
+    ASSERT_EQ(false, rq.curr_keeps_cpu());
+    rq.put_prev(true);
+    ASSERT_EQ(true, rq.pick_first() == &b);
+
+    // 没有同优先级的等待者时让出不起作用
+    rq.dequeue(&b);
+    rq.set_next(&b);
+    rq.dequeue(&a);
+    rq.test_and_clear_resched();
+    rq.yield();
+    ASSERT_EQ(false, rq.resched);
+}
+
+static bool allow_odd_prio(RtEntity* rt, void*) {
+    return rt->prio % 2 == 1;
+}
+
+TEST_CASE(pull_filtered) {
+    static RtRunQueue src;
+    static RtRunQueue dst;
+    src.init(0);
+    dst.init(1);
+    RtEntity a, b, c;
+    src.set_next(make(&a, SCHED_FIFO, 90));
+    src.enqueue(make(&b, SCHED_FIFO, 80));
+    src.enqueue(make(&c, SCHED_FIFO, 71));
+
+    // 80被过滤掉，拉到优先级次高的71
+    RtEntity* pulled = dst.pull_from(src, 0, allow_odd_prio, nullptr);
+    ASSERT_EQ(true, pulled == &c);
+    ASSERT_EQ(1, (int)c.cpu);
+    ASSERT_EQ(1, (int)src.nr_running);
+    ASSERT_EQ(1, (int)dst.nr_running);
+    ASSERT_EQ(true, dst.resched);
+
+    // 不比min_prio高的不拉
+    dst.dequeue(&c);
+    dst.set_next(&c);
+    ASSERT_EQ(true, dst.pull_from(src, 80, nullptr, nullptr) == nullptr);
+    pulled = dst.pull_from(src, 71, nullptr, nullptr);
+    ASSERT_EQ(true, pulled == &b);
+    ASSERT_EQ(0, (int)src.nr_running);
+    ASSERT_EQ(0, (int)src.highest_prio());
+}
+
+int main() {
+    printf("Running sched_rt tests...\n");
+
+    RUN_TEST(priority_order);
+    RUN_TEST(fifo_within_prio);
+    RUN_TEST(wakeup_preempt);
+    RUN_TEST(round_robin);
+    RUN_TEST(fifo_never_rotates);
+    RUN_TEST(pull_filtered);
+
+    print_test_results();
+
+    return g_test_stats.failed_tests > 0 ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+#include "lib/test_framework.h"
+#include "kernel/timer.h"
+
+using namespace kernel;
+
+// 简单的线性同余随机数，保证每次运行结果相同
+static uint32_t rand_state = 54321;
+static uint32_t next_rand() {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static uint32_t fired_count;
+static bool fired_on_time;
+static uint32_t wheel_now;
+
+static void record_fire(timer_list* timer) {
+    fired_count++;
+    if (timer->expires != wheel_now) {
+        fired_on_time = false;
+    }
+}
+
+// 随机到期时间分布在第一层和后面各层，每个定时器都要正好在到期的那个tick被摘下来
+TEST_CASE(wheel_expiry_exact) {
+    static timer_list timers[3000];
+    static TimerWheel wheel;
+    // 从接近回绕的位置开始，覆盖jiffies回绕
+    uint32_t start = 0xFFFFF000u;
+    wheel.init(start);
+    const uint32_t level_bits[] = {8, 14, 20, 22};
+    uint32_t last = start;
+    for (uint32_t i = 0; i < 3000; i++) {
+        INIT_LIST_HEAD(&timers[i].entry);
+        timers[i].function = record_fire;
+        timers[i].expires = start + next_rand() % (1u << level_bits[i % 4]);
+        if ((int32_t)(timers[i].expires - last) > 0) {
+            last = timers[i].expires;
+        }
+        wheel.add(&timers[i]);
+    }
+
+    fired_count = 0;
+    fired_on_time = true;
+    list_head expired;
+    INIT_LIST_HEAD(&expired);
+    for (wheel_now = start; wheel_now != last + 1; wheel_now++) {
+        wheel.advance(wheel_now, &expired);
+        while (!list_empty(&expired)) {
+            auto timer = list_entry(expired.next, timer_list, entry);
+            list_del_init(&timer->entry);
+            timer->function(timer);
+        }
+    }
+    ASSERT_EQ(3000u, fired_count);
+    ASSERT_EQ(true, fired_on_time);
+    ASSERT_EQ(last + 1, wheel.clk);
+}
+
+// 停掉tick以后一次补上很多个tick，到期的定时器一个都不能漏，也不能提前
+TEST_CASE(wheel_catch_up) {
+    static timer_list timers[2000];
+    static TimerWheel wheel;
+    wheel.init(1);
+    for (uint32_t i = 0; i < 2000; i++) {
+        INIT_LIST_HEAD(&timers[i].entry);
+        timers[i].expires = 1 + next_rand() % (1u << 16);
+        wheel.add(&timers[i]);
+    }
+
+    uint32_t now = 0;
+    uint32_t fired = 0;
+    bool in_window = true;
+    list_head expired;
+    INIT_LIST_HEAD(&expired);
+    while (fired < 2000 && now < (1u << 17)) {
+        uint32_t prev = now;
+        now += 1 + next_rand() % 40;
+        wheel.advance(now, &expired);
+        while (!list_empty(&expired)) {
+            auto timer = list_entry(expired.next, timer_list, entry);
+            list_del_init(&timer->entry);
+            if (timer->expires <= prev || timer->expires > now) {
+                in_window = false;
+            }
+            fired++;
+        }
+    }
+    ASSERT_EQ(2000u, fired);
+    ASSERT_EQ(true, in_window);
+}
+
+TEST_CASE(wheel_del_and_next_expiry) {
+    static timer_list timers[4];
+    static TimerWheel wheel;
+    wheel.init(100);
+    // 空的时间轮最多看到limit
+    ASSERT_EQ(110u, wheel.next_expiry(10));
+
+    const uint32_t expires[] = {105, 103, 400, 99};
+    for (uint32_t i = 0; i < 4; i++) {
+        INIT_LIST_HEAD(&timers[i].entry);
+        timers[i].expires = expires[i];
+        wheel.add(&timers[i]);
+    }
+    // 已经过期的定时器在下一次转动时到期
+    ASSERT_EQ(100u, wheel.next_expiry(10));
+    wheel.del(&timers[3]);
+    ASSERT_EQ(true, list_empty(&timers[3].entry));
+    ASSERT_EQ(103u, wheel.next_expiry(10));
+    wheel.del(&timers[1]);
+    ASSERT_EQ(105u, wheel.next_expiry(10));
+    ASSERT_EQ(104u, wheel.next_expiry(4));
+    wheel.del(&timers[0]);
+    // 后面的层在第一层转完一圈之前不检查，返回cascade的时间
+    ASSERT_EQ(256u, wheel.next_expiry(1000));
+
+    list_head expired;
+    INIT_LIST_HEAD(&expired);
+    wheel.advance(399, &expired);
+    ASSERT_EQ(true, list_empty(&expired));
+    wheel.advance(400, &expired);
+    ASSERT_EQ(true, expired.next == &timers[2].entry);
+}
+
+// hrtimer按到期时间的差值排序，TSC回绕时顺序也不变
+TEST_CASE(hrtimer_queue_order) {
+    static hrtimer timers[1000];
+    HrtimerQueue queue;
+    queue.init();
+    uint64_t base = 0xFFFFFFFFFFF00000ull;
+    uint64_t first = ~0ull;
+    bool first_ok = true;
+    for (uint32_t i = 0; i < 1000; i++) {
+        timers[i].expires = base + (next_rand() % 0x200000);
+        bool leftmost = queue.enqueue(&timers[i]);
+        // 返回值表示是否成为最早的定时器，时钟事件据此决定要不要重新编程
+        bool expect = i == 0 || (int64_t)(timers[i].expires - first) < 0;
+        if (leftmost != expect) {
+            first_ok = false;
+        }
+        if (expect) {
+            first = timers[i].expires;
+        }
+    }
+    ASSERT_EQ(true, first_ok);
+
+    // 随机取消一部分
+    uint32_t count = 1000;
+    for (uint32_t i = 0; i < 1000; i += 7) {
+        queue.remove(&timers[i]);
+        count--;
+    }
+    ASSERT_EQ(false, timers[7].queued);
+
+    bool sorted = true;
+    uint64_t last = base;
+    uint32_t popped = 0;
+    hrtimer* timer;
+    while ((timer = queue.first())) {
+        if ((int64_t)(timer->expires - last) < 0) {
+            sorted = false;
+        }
+        last = timer->expires;
+        queue.remove(timer);
+        popped++;
+    }
+    ASSERT_EQ(true, sorted);
+    ASSERT_EQ(count, popped);
+}
+
+int main() {
+    printf("Running timer tests...\n");
+
+    RUN_TEST(wheel_expiry_exact);
+    RUN_TEST(wheel_catch_up);
+    RUN_TEST(wheel_del_and_next_expiry);
+    RUN_TEST(hrtimer_queue_order);
+
+    print_test_results();
+
+    return g_test_stats.failed_tests > 0 ? 1 : 0;
+}
@@ -14,8 +14,8 @@ disk_size=100M
 # 创建空的磁盘镜像文件
 dd if=/dev/zero of=$disk_image bs=1M count=100
 
-# 格式化为ext2文件系统
-mkfs.ext2 $disk_image
+# 格式化为ext2文件系统，块大小和页一样是4KiB，文件mmap要求一个块正好是一页
+mkfs.ext2 -b 4096 $disk_image
 
 # 创建临时挂载点
 tmp_mount=$(mktemp -d)
@@ -31,6 +31,9 @@ else
     echo "错误：rootfs/binary目录不存在"
 fi
 
+# mmapbench使用的50MiB测试文件
+sudo dd if=/dev/urandom of=$tmp_mount/bench.dat bs=1M count=50
+
 # 卸载磁盘镜像
 sudo umount $tmp_mount
 
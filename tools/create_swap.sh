@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# 创建交换设备镜像，运行时作为第二块IDE硬盘(从盘)挂到QEMU上
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <swap_image_file> [size_MiB]"
+    exit 1
+fi
+
+swap_image=$1
+swap_size=${2:-128}
+
+dd if=/dev/zero of=$swap_image bs=1M count=$swap_size
+
+# 内核按Linux的SWAPSPACE2格式识别交换设备，页大小固定为4096
+mkswap -p 4096 $swap_image
+
+echo "交换镜像创建完成：$swap_image (${swap_size}MiB)"